@@ -2,11 +2,88 @@
 
 layout(binding = 1) uniform sampler2D texSampler;
 
+struct Light {
+    // xyz world position, w radius
+    vec4 position;
+    // rgb premultiplied by the intensity
+    vec4 color;
+    // xyz direction, w cosine of the outer cone, -1 for point lights
+    vec4 spot;
+};
+
+layout(std430, binding = 3) readonly buffer Lights {
+    Light lights[];
+};
+
+// written by ClusteredLighting::update, one {offset, count} pair into LightIndices per cluster
+layout(std430, binding = 4) readonly buffer Clusters {
+    // w is the light count
+    uvec4 grid;
+    // near, far, slice scale, slice bias
+    vec4 depth;
+    vec4 viewport;
+    uvec2 clusters[];
+};
+
+layout(std430, binding = 5) readonly buffer LightIndices {
+    uint lightIndices[];
+};
+
+layout(constant_id = 0) const bool kUseTexture = true;
+// 0 unlit, 1 clustered, 2 every light for every fragment
+layout(constant_id = 1) const int kLightingMode = 0;
+
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragWorldPosition;
 
 layout(location = 0) out vec4 outColor;
 
+const float kAmbient = 0.15;
+
+vec3 shadeLight(uint index, vec3 position, vec3 normal) {
+    Light light = lights[index];
+    vec3 toLight = light.position.xyz - position;
+    float dist = length(toLight);
+    float ratio = dist / light.position.w;
+    if (ratio >= 1.0) {
+        return vec3(0.0);
+    }
+    vec3 l = toLight / dist;
+    float falloff = 1.0 - ratio * ratio;
+    float attenuation = falloff * falloff;
+    if (light.spot.w > -1.0) {
+        float cosAngle = dot(-l, light.spot.xyz);
+        attenuation *= smoothstep(light.spot.w, mix(light.spot.w, 1.0, 0.5), cosAngle);
+    }
+    return light.color.rgb * attenuation * abs(dot(normal, l));
+}
+
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
+    vec4 albedo = kUseTexture ? texture(texSampler, fragTexCoord) : vec4(fragColor, 1.0);
+    if (kLightingMode == 0) {
+        outColor = albedo;
+        return;
+    }
+
+    // flat normal of the triangle, lit from both sides
+    vec3 normal = normalize(cross(dFdx(fragWorldPosition), dFdy(fragWorldPosition)));
+    vec3 lighting = vec3(kAmbient);
+    if (kLightingMode == 1) {
+        float near = depth.x;
+        float far = depth.y;
+        float viewDepth = near * far / (far - gl_FragCoord.z * (far - near));
+        uvec3 cell = uvec3(gl_FragCoord.xy * vec2(grid.xy) / viewport.xy,
+            uint(max(floor(log(viewDepth) * depth.z + depth.w), 0.0)));
+        cell = min(cell, grid.xyz - 1u);
+        uvec2 range = clusters[(cell.z * grid.y + cell.y) * grid.x + cell.x];
+        for (uint i = 0u; i < range.y; i++) {
+            lighting += shadeLight(lightIndices[range.x + i], fragWorldPosition, normal);
+        }
+    } else {
+        for (uint i = 0u; i < grid.w; i++) {
+            lighting += shadeLight(i, fragWorldPosition, normal);
+        }
+    }
+    outColor = vec4(albedo.rgb * lighting, albedo.a);
 }
@@ -6,16 +6,37 @@ layout(binding = 0) uniform MVPUniformMatrix {
     mat4 proj;
 } ubo;
 
+struct SceneObject {
+    mat4 model;
+    vec4 boundsMin;
+    vec4 boundsMax;
+};
+
+// one entry per instance, indirect draws pick theirs through firstInstance
+layout(std430, binding = 2) readonly buffer Objects {
+    SceneObject objects[];
+};
+
+// positions stored as normalized integers are scaled back into model space
+layout(constant_id = 0) const bool kQuantizedPosition = false;
+layout(constant_id = 1) const float kPositionScale = 1.0;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragWorldPosition;
+
+// the depth pre-pass and the shading pass have to produce bit identical depth
+invariant gl_Position;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    vec3 position = kQuantizedPosition ? inPosition * kPositionScale : inPosition;
+    vec4 world = ubo.model * objects[gl_InstanceIndex].model * vec4(position, 1.0);
+    gl_Position = ubo.proj * ubo.view * world;
+    fragWorldPosition = world.xyz;
     fragColor = inColor;
     fragTexCoord = inTexCoord;
 }
-
@@ -9,25 +9,29 @@
 #include <format>
 #include <vector>
 #include <string_view>
+#include <chrono>
 #include <vulkan/vulkan.hpp>
 #include "Application.hpp"
 #include "Log.hpp"
 #include "Utils.hpp"
 #include "ErrorCode.hpp"
 #include "VulkanInstance.hpp"
+#include "JobSystem.hpp"
+#include "Benchmark.hpp"
+#include "Trace.hpp"
 #define GLFM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 using namespace Utils;
 using namespace Vulkan;
 
-static constexpr const unsigned int WIN_HEIGHT = 600;
-static constexpr const unsigned int WIN_WIDTH = 800;
+// background pipeline compiles post no events, an idle on-demand loop checks on them this often
+static constexpr const double kStreamingPollSeconds = 0.05;
 
 std::error_code Application::initWindow() {
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-    pwin = glfwCreateWindow(WIN_WIDTH, WIN_HEIGHT, "Hello Vulkan", nullptr, nullptr);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+    pwin = glfwCreateWindow(options.width, options.height, "Hello Vulkan", nullptr, nullptr);
     if (!pwin) {
         LOGE("can not create a new window");
         return MakeGenerateError(AppStatus::FAIL);
@@ -35,14 +39,28 @@ std::error_code Application::initWindow() {
     return {};
 }
 
-std::error_code Application::init() {
-    if (auto ret = initWindow(); ret) {
+std::error_code Application::init(const RenderOptions &opts) {
+    options = opts;
+    if (!options.tracePath.empty()) {
+        trace::SetThreadName("main");
+        trace::Start(options.tracePath);
+    }
+    if (options.headless) {
+        LOGI("Running headless at {}x{} for {} frames", options.width, options.height, options.frames);
+    } else if (auto ret = initWindow(); ret) {
         LOGE("inintialize the vulkan instance failed");
         return ret;
     }
 
+    jobs = std::make_shared<JobSystem>();
+    jobs->initialize(options.jobThreads, options.pinJobThreads);
+    if (pwin && options.onDemand) {
+        // main thread work queued by the workers wakes the event wait of an idle loop
+        jobs->setMainThreadWake([]() { glfwPostEmptyEvent(); });
+    }
+
     instance = std::make_shared<VulkanInstance>();
-    if (auto ret = instance->initialize(pwin, WIN_WIDTH, WIN_HEIGHT); ret) {
+    if (auto ret = instance->initialize(pwin, options.width, options.height, options, jobs.get()); ret) {
         LOGE("inintialize the vulkan instance failed");
         return ret;
     }
@@ -51,18 +69,107 @@ std::error_code Application::init() {
 }
 
 std::error_code Application::run() {
-    while (!glfwWindowShouldClose(pwin)) {
-        glfwPollEvents();
-        instance->draw();
+    const bool benchmark = !options.benchmarkPath.empty();
+    const uint32_t warmup = benchmark ? options.warmupFrames : 0;
+    BenchmarkRecorder recorder{};
+    uint64_t gpuSamples = 0;
+    // utilisation of the whole run, printed for continuous and on-demand runs alike to compare them
+    uint64_t idleWaits = 0;
+    double gpuBusyMs = 0.0;
+    const auto cpuStart = System::ProcessCpuSeconds();
+    const auto start = std::chrono::steady_clock::now();
+    uint32_t frame = 0;
+    try {
+        // idle waits of the on-demand loop are not frames, the count goes up at the end of a drawn one
+        while (options.frames == 0 || frame < warmup + options.frames) {
+            if ((pwin && glfwWindowShouldClose(pwin)) || instance->finished()) {
+                break;
+            }
+            if (options.onDemand && !instance->needsRedraw()) {
+                // the last frame is still current: sleep until input, a resize or main thread work arrives
+                TRACE_ZONE("wait for events");
+                if (instance->streaming()) {
+                    glfwWaitEventsTimeout(kStreamingPollSeconds);
+                } else {
+                    glfwWaitEvents();
+                }
+                if (jobs->pumpMainThread() > 0) {
+                    // streamed work finished on the main thread, its results have to be shown
+                    instance->invalidate();
+                }
+                idleWaits++;
+                continue;
+            }
+
+            // poll after the frame start was paced so the frame renders the freshest input
+            instance->beginFrame();
+            if (pwin) {
+                glfwPollEvents();
+            }
+            // GLFW calls queued by the workers run here, on the thread that owns the window
+            jobs->pumpMainThread();
+            instance->draw();
+
+            // GPU times arrive a few frames late, they are collected whenever a new one was measured
+            const auto &pacing = instance->pacingStats();
+            if (benchmark && frame >= warmup) {
+                if (instance->frameTimings().complete) {
+                    recorder.addFrame(instance->frameTimings());
+                }
+                if (pacing.gpuSamples != gpuSamples) {
+                    recorder.add("gpu_frame_ms", pacing.lastGpuMs);
+                }
+            }
+            if (pacing.gpuSamples != gpuSamples) {
+                gpuBusyMs += pacing.lastGpuMs;
+            }
+            gpuSamples = pacing.gpuSamples;
+            frame++;
+        }
+        instance->wait();
+    } catch (const std::exception &err) {
+        LOGE("rendering failed after {} frames: {}", frame, err.what());
+        return MakeGenerateError(AppStatus::FAIL);
+    }
+
+    const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOGI("Rendered {} frames in {:.3f} ms ({:.1f} fps)", frame, ms, ms > 0.0 ? frame * 1000.0 / ms : 0.0);
+    if (ms > 0.0) {
+        // GPU time of the frames whose timestamps were read back, the last few are missing
+        const auto cpuMs = (System::ProcessCpuSeconds() - cpuStart) * 1000.0;
+        LOGI("{} loop: CPU {:.1f}% of one core, GPU busy {:.1f}%, {} idle waits",
+            options.onDemand ? "On-demand" : "Continuous", 100.0 * cpuMs / ms, 100.0 * gpuBusyMs / ms, idleWaits);
+    }
+    if (!benchmark) {
+        return {};
     }
 
+    if (!recorder.writeJson(options.benchmarkPath, warmup, frame > warmup ? frame - warmup : 0)) {
+        return MakeGenerateError(AppStatus::FAIL);
+    }
+    LOGI("Benchmark results written into {}", options.benchmarkPath);
+    if (!options.baselinePath.empty() && !CompareBenchmarkBaseline(recorder.summarize(), options.baselinePath, options.regressionThreshold)) {
+        return MakeGenerateError(AppStatus::FAIL);
+    }
     return {};
 }
 
 std::error_code Application::destroy() {
-    instance->destroy();
-    instance = nullptr;
-    glfwDestroyWindow(pwin);
-    glfwTerminate();
+    if (instance) {
+        instance->destroy();
+        instance = nullptr;
+    }
+    // after the instance, which may still wait on jobs while it is destroyed
+    if (jobs) {
+        jobs->destroy();
+        jobs = nullptr;
+    }
+    if (pwin) {
+        glfwDestroyWindow(pwin);
+        glfwTerminate();
+        pwin = nullptr;
+    }
+    // after the instance so the GPU scopes of the last frames are in
+    trace::Stop();
     return {};
 }
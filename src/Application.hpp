@@ -1,13 +1,15 @@
 #pragma once
 #include <memory>
 #include <system_error>
+#include "RenderOptions.hpp"
 
 struct GLFWwindow;
 
 class VulkanInstance;
+class JobSystem;
 class Application {
 public:
-	std::error_code init();
+	std::error_code init(const RenderOptions &options = {});
 	std::error_code run();
 	std::error_code destroy();
 	
@@ -17,4 +19,6 @@ private:
 private:
 	GLFWwindow* pwin{};
 	std::shared_ptr<VulkanInstance> instance{};
+	std::shared_ptr<JobSystem> jobs{};
+	RenderOptions options{};
 };
\ No newline at end of file
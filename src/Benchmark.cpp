@@ -0,0 +1,121 @@
+#include "Benchmark.hpp"
+#include "HeapStats.hpp"
+#include "Log.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <regex>
+#include <tuple>
+
+// differences below this are timer noise, never reported as regressions
+static constexpr const double kRegressionFloorMs = 0.05;
+
+static double Percentile(const std::vector<double> &sorted, const double p){
+    if(sorted.empty()){
+        return 0.0;
+    }
+    // nearest rank
+    const auto rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+void BenchmarkRecorder::add(const std::string &metric, const double ms){
+    _samples[metric].push_back(ms);
+}
+
+void BenchmarkRecorder::addFrame(const FrameTimings &timings){
+    add("cpu_acquire_ms", timings.acquireMs);
+    add("cpu_ubo_ms", timings.uboMs);
+    add("cpu_record_ms", timings.recordMs);
+    add("cpu_submit_ms", timings.submitMs);
+    add("cpu_present_ms", timings.presentMs);
+    add("cpu_frame_ms", timings.acquireMs + timings.uboMs + timings.recordMs + timings.submitMs + timings.presentMs);
+    if(heap::CountingEnabled()){
+        add("heap_allocs", static_cast<double>(timings.heapAllocations));
+    }
+}
+
+std::map<std::string, MetricSummary> BenchmarkRecorder::summarize() const {
+    std::map<std::string, MetricSummary> result{};
+    for(auto &[name, samples] : _samples){
+        auto sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        MetricSummary summary{};
+        summary.p50 = Percentile(sorted, 50.0);
+        summary.p95 = Percentile(sorted, 95.0);
+        summary.p99 = Percentile(sorted, 99.0);
+        summary.max = sorted.empty() ? 0.0 : sorted.back();
+        summary.samples = sorted.size();
+        result.emplace(name, summary);
+    }
+    return result;
+}
+
+bool BenchmarkRecorder::writeJson(const std::string &path, const uint32_t warmupFrames, const uint32_t frames) const {
+    std::ofstream file(path, std::ios::trunc);
+    if(!file.is_open()){
+        LOGE("Failed to open {} to write the benchmark results", path);
+        return false;
+    }
+
+    file << "{\n";
+    file << std::format("    \"warmup_frames\": {},\n", warmupFrames);
+    file << std::format("    \"frames\": {},\n", frames);
+    file << "    \"metrics\": {\n";
+    const auto summaries = summarize();
+    size_t i = 0;
+    for(auto &[name, s] : summaries){
+        file << std::format("        \"{}\": {{ \"p50\": {:.4f}, \"p95\": {:.4f}, \"p99\": {:.4f}, \"max\": {:.4f}, \"samples\": {} }}{}\n",
+            name, s.p50, s.p95, s.p99, s.max, s.samples, ++i == summaries.size() ? "" : ",");
+        LOGI("{:<16} p50 {:8.4f} ms  p95 {:8.4f} ms  p99 {:8.4f} ms  max {:8.4f} ms", name, s.p50, s.p95, s.p99, s.max);
+    }
+    file << "    }\n";
+    file << "}\n";
+    return file.good();
+}
+
+bool CompareBenchmarkBaseline(const std::map<std::string, MetricSummary> &current, const std::string &baselinePath, const double thresholdPercent){
+    if(!std::filesystem::exists(baselinePath)){
+        LOGE("Benchmark baseline {} does not exist", baselinePath);
+        return false;
+    }
+
+    // the baseline is the output of a previous run, so the format is the one writeJson produces
+    const auto data = Utils::FileSystem::ReadFile(baselinePath);
+    const std::string text(data.begin(), data.end());
+    static const std::regex kMetric(R"re("(\w+)"\s*:\s*\{\s*"p50"\s*:\s*([-+.eE0-9]+)\s*,\s*"p95"\s*:\s*([-+.eE0-9]+)\s*,\s*"p99"\s*:\s*([-+.eE0-9]+))re");
+
+    bool passed = true;
+    uint32_t compared = 0;
+    for(auto it = std::sregex_iterator(text.begin(), text.end(), kMetric);it != std::sregex_iterator();++it){
+        const auto &match = *it;
+        const auto found = current.find(match[1].str());
+        if(found == current.end()){
+            continue;
+        }
+
+        const auto &now = found->second;
+        const std::tuple<const char*, double, double> checks[] = {
+            {"p50", std::stod(match[2].str()), now.p50},
+            {"p95", std::stod(match[3].str()), now.p95},
+            {"p99", std::stod(match[4].str()), now.p99},
+        };
+        for(auto &[label, before, after] : checks){
+            const auto delta = after - before;
+            if(delta > kRegressionFloorMs && delta > before * thresholdPercent / 100.0){
+                LOGE("Regression in {} {}: {:.4f} ms -> {:.4f} ms (+{:.1f}%)", match[1].str(), label, before, after, before > 0.0 ? delta / before * 100.0 : 0.0);
+                passed = false;
+            }
+        }
+        compared++;
+    }
+
+    if(compared == 0){
+        LOGE("Benchmark baseline {} has no metric in common with this run", baselinePath);
+        return false;
+    }
+    LOGI("Compared {} metrics against {} with a {:.1f}% threshold: {}", compared, baselinePath, thresholdPercent, passed ? "passed" : "regressed");
+    return passed;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+// CPU time of the phases of one frame, filled by VulkanInstance::draw().
+struct FrameTimings{
+    double acquireMs{};
+    double uboMs{};
+    double recordMs{};
+    double submitMs{};
+    double presentMs{};
+    // operator new calls of the render thread, from the frame slot wait to the submit
+    uint64_t heapAllocations{};
+    // false when the frame was dropped, e.g. the swapchain was out of date
+    bool complete{false};
+};
+
+struct MetricSummary{
+    double p50{};
+    double p95{};
+    double p99{};
+    double max{};
+    size_t samples{};
+};
+
+// Collects per-frame samples of named metrics and reduces them to percentiles.
+class BenchmarkRecorder{
+public:
+    void add(const std::string &metric, const double ms);
+    void addFrame(const FrameTimings &timings);
+
+    std::map<std::string, MetricSummary> summarize() const;
+    bool writeJson(const std::string &path, const uint32_t warmupFrames, const uint32_t frames) const;
+
+private:
+    std::map<std::string, std::vector<double>> _samples{};
+};
+
+// Compares p50/p95/p99 against a baseline written by a previous run, returns false when any
+// metric got slower by more than thresholdPercent.
+bool CompareBenchmarkBaseline(const std::map<std::string, MetricSummary> &current, const std::string &baselinePath, const double thresholdPercent);
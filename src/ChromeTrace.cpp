@@ -0,0 +1,55 @@
+#include "ChromeTrace.hpp"
+#include "Log.hpp"
+
+static std::string EscapeJson(const std::string &text){
+    std::string result{};
+    result.reserve(text.size());
+    for(const auto c : text){
+        if(c == '"' || c == '\\'){
+            result.push_back('\\');
+        }
+        result.push_back(static_cast<unsigned char>(c) < 0x20 ? ' ' : c);
+    }
+    return result;
+}
+
+bool ChromeTrace::open(const std::string &path){
+    _file.open(path, std::ios::trunc);
+    if(!_file.is_open()){
+        LOGE("Failed to open {} to write the trace", path);
+        return false;
+    }
+
+    _path = path;
+    _events = 0;
+    _file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    _file << std::format("{{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": {}, \"args\": {{\"name\": \"CPU\"}}}},\n", kCpuProcess);
+    _file << std::format("{{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": {}, \"args\": {{\"name\": \"GPU\"}}}}", kGpuProcess);
+    return true;
+}
+
+void ChromeTrace::writeEvent(const std::string &event){
+    _file << ",\n" << event;
+}
+
+void ChromeTrace::writeZone(const char *name, const uint32_t pid, const uint32_t tid, const double beginUs, const double durationUs){
+    writeEvent(std::format("{{\"name\": \"{}\", \"ph\": \"X\", \"pid\": {}, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}}}",
+        EscapeJson(name), pid, tid, beginUs, durationUs));
+    _events++;
+}
+
+void ChromeTrace::writeThreadName(const uint32_t pid, const uint32_t tid, const std::string &name){
+    writeEvent(std::format("{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": {}, \"tid\": {}, \"args\": {{\"name\": \"{}\"}}}}", pid, tid, EscapeJson(name)));
+}
+
+bool ChromeTrace::close(){
+    if(!_file.is_open()){
+        return false;
+    }
+
+    _file << "\n]}\n";
+    const auto good = _file.good();
+    _file.close();
+    LOGI("Wrote {} trace events to {}", _events, _path);
+    return good;
+}
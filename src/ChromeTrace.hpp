@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// Streams complete events ("ph":"X") in the Chrome trace event format, loadable in
+// chrome://tracing or Perfetto. Not thread safe, the trace flusher is the only writer.
+class ChromeTrace{
+public:
+    static constexpr const uint32_t kCpuProcess = 0;
+    static constexpr const uint32_t kGpuProcess = 1;
+
+    bool open(const std::string &path);
+    void writeZone(const char *name, const uint32_t pid, const uint32_t tid, const double beginUs, const double durationUs);
+    void writeThreadName(const uint32_t pid, const uint32_t tid, const std::string &name);
+    // Terminates the JSON, returns false when any write failed.
+    bool close();
+
+    bool isOpen() const { return _file.is_open(); }
+    uint64_t size() const { return _events; }
+
+private:
+    void writeEvent(const std::string &event);
+
+    std::ofstream _file{};
+    std::string _path{};
+    uint64_t _events{};
+};
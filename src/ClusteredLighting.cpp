@@ -0,0 +1,356 @@
+#include "ClusteredLighting.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CLUSTER_SSE 1
+#else
+#define CLUSTER_SSE 0
+#endif
+
+static constexpr const uint32_t kLightSeed = 1234;
+static constexpr const float kOrbitSpeed = 0.3f;
+// lights overlapping an average point of the scene, keeps the shading cost per cluster stable
+static constexpr const float kLightOverlap = 8.0f;
+static constexpr const float kSpotCosOuter = 0.85f;
+// below this bounding the lights is cheaper than handing it to the workers
+static constexpr const uint32_t kParallelLights = 2048;
+static constexpr const uint32_t kBatchesPerJob = 128;
+
+// matches the header of the Clusters buffer in shader.frag, the {offset, count} pairs follow it
+struct ClusterHeader{
+    // cluster grid size, w light count
+    glm::uvec4 grid{};
+    // near, far, slice scale, slice bias: slice = floor(log(viewDepth) * scale + bias)
+    glm::vec4 depth{};
+    // rendered size in pixels
+    glm::vec4 viewport{};
+};
+
+ClusteredLighting::Buffer ClusteredLighting::createBuffer(const vk::DeviceSize size){
+    Buffer result{};
+    vk::BufferCreateInfo info{};
+    info.size = size;
+    info.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+    info.sharingMode = vk::SharingMode::eExclusive;
+    result.buffer = _device.createBuffer(info);
+
+    const auto requirements = _device.getBufferMemoryRequirements(result.buffer);
+    vk::MemoryAllocateInfo allocInfo{};
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = Utils::Vulkan::FindMemoryType(_phyDevice, requirements.memoryTypeBits,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    result.memory = _device.allocateMemory(allocInfo);
+    _device.bindBufferMemory(result.buffer, result.memory, 0);
+    result.mapped = _device.mapMemory(result.memory, 0, size);
+    return result;
+}
+
+void ClusteredLighting::destroyBuffer(Buffer &buffer){
+    _device.destroyBuffer(buffer.buffer);
+    _device.freeMemory(buffer.memory);
+    buffer = {};
+}
+
+void ClusteredLighting::initialize(const vk::Device &device, const vk::PhysicalDevice &phyDevice, const uint32_t slotCount, const uint32_t maxLights,
+    const glm::vec3 &sceneMin, const glm::vec3 &sceneMax, JobSystem *jobs){
+    _device = device;
+    _phyDevice = phyDevice;
+    _jobs = jobs;
+    // the buffers are bound even when nothing is lit, so they are never empty
+    _maxLights = std::max(maxLights, 1u);
+    _sceneMin = sceneMin;
+    _sceneMax = sceneMax;
+    _slots.resize(slotCount);
+    for(auto &slot : _slots){
+        slot.lights = createBuffer(_maxLights * sizeof(GpuLight));
+        slot.clusters = createBuffer(sizeof(ClusterHeader) + kClusterCount * sizeof(glm::uvec2));
+        slot.indices = createBuffer(kMaxLightIndices * sizeof(uint32_t));
+        std::memset(slot.clusters.mapped, 0, sizeof(ClusterHeader) + kClusterCount * sizeof(glm::uvec2));
+    }
+    _clusterCounts.resize(kClusterCount);
+    _clusterEnds.resize(kClusterCount);
+    setLightCount(0);
+}
+
+void ClusteredLighting::destroy(){
+    if(!_device){
+        return;
+    }
+
+    for(auto &slot : _slots){
+        destroyBuffer(slot.lights);
+        destroyBuffer(slot.clusters);
+        destroyBuffer(slot.indices);
+    }
+    _slots.clear();
+    _device = nullptr;
+}
+
+void ClusteredLighting::setLightCount(const uint32_t count){
+    _count = std::min(count, _maxLights);
+    _stats = {};
+    _stats.lights = _count;
+
+    std::mt19937 rng(kLightSeed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const auto extent = _sceneMax - _sceneMin;
+    const auto lo = _sceneMin - extent * 0.1f;
+    const auto hi = _sceneMax + extent * 0.1f;
+    const auto volume = (hi.x - lo.x) * (hi.y - lo.y) * (hi.z - lo.z);
+    // every light covers kLightOverlap / count of the volume
+    const auto radius = std::cbrt(kLightOverlap * volume / (std::max(_count, 1u) * 4.18879f));
+
+    const auto padded = (_count + 3) & ~3u;
+    _baseX.assign(padded, 0.0f);
+    _baseY.assign(padded, 0.0f);
+    _baseZ.assign(padded, 0.0f);
+    // a negative radius gives an empty depth range
+    _radius.assign(padded, -1.0f);
+    _base.resize(_count);
+    _ranges.resize(padded);
+    for(uint32_t i = 0;i < _count;i ++){
+        const glm::vec3 position = glm::mix(lo, hi, glm::vec3(unit(rng), unit(rng), unit(rng)));
+        const auto hue = unit(rng);
+        const auto color = 0.5f + 0.5f * glm::cos(6.28318f * (hue + glm::vec3(0.0f, 0.33f, 0.67f)));
+        _baseX[i] = position.x;
+        _baseY[i] = position.y;
+        _baseZ[i] = position.z;
+        _radius[i] = radius * (0.75f + 0.5f * unit(rng));
+
+        auto &light = _base[i];
+        light.position = glm::vec4(position, _radius[i]);
+        light.color = glm::vec4(color, 1.0f);
+        light.spot = glm::vec4(0.0f, 0.0f, -1.0f, -1.0f);
+        if(i % 4 == 3){
+            // spot lights point roughly down, binned like point lights of the same radius
+            light.spot = glm::vec4(glm::normalize(glm::vec3(unit(rng) - 0.5f, unit(rng) - 0.5f, -1.0f)), kSpotCosOuter);
+        }
+    }
+}
+
+#if CLUSTER_SSE
+static inline __m128 Select(const __m128 mask, const __m128 a, const __m128 b){
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// NDC range of [lo, hi] divided by a depth in [dmin, dmax], the extremes lie on the box corners
+static inline void ProjectRange(const __m128 lo, const __m128 hi, const __m128 dmin, const __m128 dmax, const __m128 scale, __m128 &ndcLo, __m128 &ndcHi){
+    const auto zero = _mm_setzero_ps();
+    ndcLo = _mm_mul_ps(scale, Select(_mm_cmplt_ps(lo, zero), _mm_div_ps(lo, dmin), _mm_div_ps(lo, dmax)));
+    ndcHi = _mm_mul_ps(scale, Select(_mm_cmpgt_ps(hi, zero), _mm_div_ps(hi, dmin), _mm_div_ps(hi, dmax)));
+}
+
+static inline __m128i ToTile(const __m128 ndc, const float tiles){
+    const auto half = _mm_set1_ps(0.5f);
+    const auto t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(ndc, half), half), _mm_set1_ps(tiles));
+    return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(tiles - 1.0f)));
+}
+#else
+static inline void ProjectRange(const float lo, const float hi, const float dmin, const float dmax, const float scale, float &ndcLo, float &ndcHi){
+    ndcLo = scale * (lo < 0.0f ? lo / dmin : lo / dmax);
+    ndcHi = scale * (hi > 0.0f ? hi / dmin : hi / dmax);
+}
+
+static inline int32_t ToTile(const float ndc, const float tiles){
+    return static_cast<int32_t>(std::clamp((ndc * 0.5f + 0.5f) * tiles, 0.0f, tiles - 1.0f));
+}
+#endif
+
+void ClusteredLighting::boundLights(const float time, const glm::mat4 &view, const glm::mat4 &proj, const float zNear, const float zFar, GpuLight *out,
+    const uint32_t begin, const uint32_t end){
+    const auto angle = time * kOrbitSpeed;
+    const auto cosA = std::cos(angle);
+    const auto sinA = std::sin(angle);
+    const auto sliceScale = kClusterZ / std::log(zFar / zNear);
+    const auto sliceBias = -std::log(zNear) * sliceScale;
+    const auto scaleX = proj[0][0];
+    // Vulkan projections flip y, the range is mirrored afterwards
+    const auto scaleY = std::abs(proj[1][1]);
+    const auto flipY = proj[1][1] < 0.0f;
+    const auto toSlice = [&](const float depth){
+        return static_cast<uint8_t>(std::clamp(std::floor(std::log(depth) * sliceScale + sliceBias), 0.0f, kClusterZ - 1.0f));
+    };
+
+    alignas(16) float worldX[4], worldY[4], depthMin[4], depthMax[4];
+    alignas(16) int32_t tiles[4][4];
+    for(uint32_t i = begin;i < end;i += 4){
+        int visible = 0;
+#if CLUSTER_SSE
+        const auto c = _mm_set1_ps(cosA);
+        const auto s = _mm_set1_ps(sinA);
+        const auto bx = _mm_loadu_ps(&_baseX[i]);
+        const auto by = _mm_loadu_ps(&_baseY[i]);
+        const auto wz = _mm_loadu_ps(&_baseZ[i]);
+        const auto r = _mm_loadu_ps(&_radius[i]);
+        // orbit around the z axis, the scene model spins around it as well
+        const auto wx = _mm_sub_ps(_mm_mul_ps(bx, c), _mm_mul_ps(by, s));
+        const auto wy = _mm_add_ps(_mm_mul_ps(bx, s), _mm_mul_ps(by, c));
+        const auto row = [&](const int k){
+            auto v = _mm_add_ps(_mm_mul_ps(wx, _mm_set1_ps(view[0][k])), _mm_mul_ps(wy, _mm_set1_ps(view[1][k])));
+            return _mm_add_ps(_mm_add_ps(v, _mm_mul_ps(wz, _mm_set1_ps(view[2][k]))), _mm_set1_ps(view[3][k]));
+        };
+        const auto vx = row(0);
+        const auto vy = row(1);
+        // the camera looks down -z
+        const auto depth = _mm_sub_ps(_mm_setzero_ps(), row(2));
+        const auto dmin = _mm_max_ps(_mm_sub_ps(depth, r), _mm_set1_ps(zNear));
+        const auto dmax = _mm_min_ps(_mm_add_ps(depth, r), _mm_set1_ps(zFar));
+
+        __m128 xLo, xHi, yLo, yHi;
+        ProjectRange(_mm_sub_ps(vx, r), _mm_add_ps(vx, r), dmin, dmax, _mm_set1_ps(scaleX), xLo, xHi);
+        ProjectRange(_mm_sub_ps(vy, r), _mm_add_ps(vy, r), dmin, dmax, _mm_set1_ps(scaleY), yLo, yHi);
+        if(flipY){
+            const auto lo = _mm_sub_ps(_mm_setzero_ps(), yHi);
+            yHi = _mm_sub_ps(_mm_setzero_ps(), yLo);
+            yLo = lo;
+        }
+
+        const auto one = _mm_set1_ps(1.0f);
+        const auto minusOne = _mm_set1_ps(-1.0f);
+        auto inside = _mm_cmple_ps(dmin, dmax);
+        inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmple_ps(xLo, one), _mm_cmpge_ps(xHi, minusOne)));
+        inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmple_ps(yLo, one), _mm_cmpge_ps(yHi, minusOne)));
+        visible = _mm_movemask_ps(inside);
+        _mm_store_ps(worldX, wx);
+        _mm_store_ps(worldY, wy);
+        _mm_store_ps(depthMin, dmin);
+        _mm_store_ps(depthMax, dmax);
+        _mm_store_si128(reinterpret_cast<__m128i*>(tiles[0]), ToTile(xLo, kClusterX));
+        _mm_store_si128(reinterpret_cast<__m128i*>(tiles[1]), ToTile(xHi, kClusterX));
+        _mm_store_si128(reinterpret_cast<__m128i*>(tiles[2]), ToTile(yLo, kClusterY));
+        _mm_store_si128(reinterpret_cast<__m128i*>(tiles[3]), ToTile(yHi, kClusterY));
+#else
+        for(uint32_t k = 0;k < 4;k ++){
+            const auto r = _radius[i + k];
+            const auto wx = _baseX[i + k] * cosA - _baseY[i + k] * sinA;
+            const auto wy = _baseX[i + k] * sinA + _baseY[i + k] * cosA;
+            const auto v = view * glm::vec4(wx, wy, _baseZ[i + k], 1.0f);
+            const auto depth = -v.z;
+            const auto dmin = std::max(depth - r, zNear);
+            const auto dmax = std::min(depth + r, zFar);
+            float xLo, xHi, yLo, yHi;
+            ProjectRange(v.x - r, v.x + r, dmin, dmax, scaleX, xLo, xHi);
+            ProjectRange(v.y - r, v.y + r, dmin, dmax, scaleY, yLo, yHi);
+            if(flipY){
+                std::swap(yLo, yHi);
+                yLo = -yLo;
+                yHi = -yHi;
+            }
+            if(dmin <= dmax && xLo <= 1.0f && xHi >= -1.0f && yLo <= 1.0f && yHi >= -1.0f){
+                visible |= 1 << k;
+            }
+            worldX[k] = wx;
+            worldY[k] = wy;
+            depthMin[k] = dmin;
+            depthMax[k] = dmax;
+            tiles[0][k] = ToTile(xLo, kClusterX);
+            tiles[1][k] = ToTile(xHi, kClusterX);
+            tiles[2][k] = ToTile(yLo, kClusterY);
+            tiles[3][k] = ToTile(yHi, kClusterY);
+        }
+#endif
+        for(uint32_t k = 0;k < 4;k ++){
+            auto &range = _ranges[i + k];
+            if(!(visible & (1 << k))){
+                range = {};
+                continue;
+            }
+            range.x0 = static_cast<uint8_t>(tiles[0][k]);
+            range.x1 = static_cast<uint8_t>(tiles[1][k]);
+            range.y0 = static_cast<uint8_t>(tiles[2][k]);
+            range.y1 = static_cast<uint8_t>(tiles[3][k]);
+            range.z0 = toSlice(depthMin[k]);
+            range.z1 = toSlice(depthMax[k]);
+        }
+
+        const auto count = std::min<uint32_t>(4, _count - std::min(i, _count));
+        for(uint32_t k = 0;k < count;k ++){
+            const auto &base = _base[i + k];
+            auto &light = out[i + k];
+            light.position = glm::vec4(worldX[k], worldY[k], base.position.z, base.position.w);
+            light.color = base.color;
+            light.spot = glm::vec4(base.spot.x * cosA - base.spot.y * sinA, base.spot.x * sinA + base.spot.y * cosA, base.spot.z, base.spot.w);
+        }
+    }
+}
+
+void ClusteredLighting::update(const uint32_t slot, const float time, const glm::mat4 &view, const glm::mat4 &proj, const float zNear, const float zFar,
+    const vk::Extent2D &viewport){
+    TRACE_ZONE("bin lights");
+    const auto start = std::chrono::steady_clock::now();
+    auto &buffers = _slots[slot];
+    auto *lights = static_cast<GpuLight*>(buffers.lights.mapped);
+    const auto padded = static_cast<uint32_t>(_radius.size());
+    if(_jobs && _count >= kParallelLights){
+        // every batch of four lights writes only its own ranges and lights
+        _jobs->wait(_jobs->parallelFor(padded / 4, kBatchesPerJob, [&](const uint32_t begin, const uint32_t end){
+            boundLights(time, view, proj, zNear, zFar, lights, begin * 4, end * 4);
+        }));
+    }else{
+        boundLights(time, view, proj, zNear, zFar, lights, 0, padded);
+    }
+
+    const auto clusterOf = [](const uint32_t x, const uint32_t y, const uint32_t z){
+        return (z * kClusterY + y) * kClusterX + x;
+    };
+    std::fill(_clusterCounts.begin(), _clusterCounts.end(), 0);
+    uint32_t visibleLights = 0;
+    for(uint32_t i = 0;i < _count;i ++){
+        const auto &range = _ranges[i];
+        visibleLights += range.z0 <= range.z1 ? 1 : 0;
+        for(uint32_t z = range.z0;z <= range.z1;z ++){
+            for(uint32_t y = range.y0;y <= range.y1;y ++){
+                for(uint32_t x = range.x0;x <= range.x1;x ++){
+                    _clusterCounts[clusterOf(x, y, z)]++;
+                }
+            }
+        }
+    }
+
+    // the mapped memory is write-combined, every value is written exactly once and never read back
+    auto *header = static_cast<ClusterHeader*>(buffers.clusters.mapped);
+    auto *clusters = reinterpret_cast<glm::uvec2*>(header + 1);
+    header->grid = glm::uvec4(kClusterX, kClusterY, kClusterZ, _count);
+    const auto sliceScale = kClusterZ / std::log(zFar / zNear);
+    header->depth = glm::vec4(zNear, zFar, sliceScale, -std::log(zNear) * sliceScale);
+    header->viewport = glm::vec4(static_cast<float>(viewport.width), static_cast<float>(viewport.height), 0.0f, 0.0f);
+
+    uint32_t offset = 0;
+    uint32_t dropped = 0;
+    for(uint32_t c = 0;c < kClusterCount;c ++){
+        const auto count = std::min(_clusterCounts[c], kMaxLightIndices - offset);
+        dropped += _clusterCounts[c] - count;
+        clusters[c] = glm::uvec2(offset, count);
+        _clusterCounts[c] = offset;
+        _clusterEnds[c] = offset + count;
+        offset += count;
+    }
+
+    auto *indices = static_cast<uint32_t*>(buffers.indices.mapped);
+    for(uint32_t i = 0;i < _count;i ++){
+        const auto &range = _ranges[i];
+        for(uint32_t z = range.z0;z <= range.z1;z ++){
+            for(uint32_t y = range.y0;y <= range.y1;y ++){
+                for(uint32_t x = range.x0;x <= range.x1;x ++){
+                    const auto cluster = clusterOf(x, y, z);
+                    if(_clusterCounts[cluster] < _clusterEnds[cluster]){
+                        indices[_clusterCounts[cluster]++] = i;
+                    }
+                }
+            }
+        }
+    }
+
+    const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    _stats.visibleLights = visibleLights;
+    _stats.indices = offset;
+    _stats.dropped = dropped;
+    _stats.binMs = _stats.binMs == 0.0 ? ms : _stats.binMs + (ms - _stats.binMs) * 0.05;
+}
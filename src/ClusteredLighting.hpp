@@ -0,0 +1,105 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.hpp>
+#include "JobSystem.hpp"
+
+// std430 layout of the Lights buffer in shader.frag
+struct GpuLight{
+    // xyz world position, w radius
+    glm::vec4 position{};
+    // rgb premultiplied by the intensity
+    glm::vec4 color{};
+    // xyz direction, w cosine of the outer cone, -1 for point lights
+    glm::vec4 spot{};
+};
+
+struct LightingStats{
+    uint32_t lights{};
+    // lights that touch at least one cluster
+    uint32_t visibleLights{};
+    uint32_t indices{};
+    // indices that did not fit into the index buffer
+    uint32_t dropped{};
+    double binMs{};
+};
+
+// Clustered light assignment. The view frustum is split into a grid of screen tiles and
+// exponential depth slices, every light is binned on the CPU into the clusters its bounds
+// touch, and the compact per-cluster lists are written into per-slot host-visible buffers:
+// Clusters holds a header and an {offset, count} pair per cluster into LightIndices.
+// Transforming and bounding the lights runs four at a time with SSE when available.
+class ClusteredLighting{
+public:
+    static constexpr const uint32_t kClusterX = 16;
+    static constexpr const uint32_t kClusterY = 9;
+    static constexpr const uint32_t kClusterZ = 24;
+    static constexpr const uint32_t kClusterCount = kClusterX * kClusterY * kClusterZ;
+    static constexpr const uint32_t kMaxLightIndices = 1u << 20;
+
+    // With a job system large light counts are bounded on the workers.
+    void initialize(const vk::Device &device, const vk::PhysicalDevice &phyDevice, const uint32_t slotCount, const uint32_t maxLights,
+        const glm::vec3 &sceneMin, const glm::vec3 &sceneMax, JobSystem *jobs = nullptr);
+    void destroy();
+
+    // Deterministic mix of point and spot lights filling the scene bounds, clamped to maxLights.
+    void setLightCount(const uint32_t count);
+    uint32_t lightCount() const { return _count; }
+
+    // Animates the lights, bins them for the camera and writes the slot's buffers. The slot must
+    // not be read by the GPU anymore. Assumes a symmetric perspective projection.
+    void update(const uint32_t slot, const float time, const glm::mat4 &view, const glm::mat4 &proj, const float zNear, const float zFar,
+        const vk::Extent2D &viewport);
+
+    // Storage buffers of bindings 3 to 5 of the scene set.
+    vk::Buffer lights(const uint32_t slot) const { return _slots[slot].lights.buffer; }
+    vk::Buffer clusters(const uint32_t slot) const { return _slots[slot].clusters.buffer; }
+    vk::Buffer indices(const uint32_t slot) const { return _slots[slot].indices.buffer; }
+    const LightingStats& stats() const { return _stats; }
+
+private:
+    struct Buffer{
+        vk::Buffer buffer{};
+        vk::DeviceMemory memory{};
+        void *mapped{};
+    };
+
+    struct Slot{
+        Buffer lights{};
+        Buffer clusters{};
+        Buffer indices{};
+    };
+
+    // cluster range of one light, empty when z0 > z1
+    struct LightRange{
+        uint8_t x0{}, x1{}, y0{}, y1{}, z0{1}, z1{};
+    };
+
+    Buffer createBuffer(const vk::DeviceSize size);
+    void destroyBuffer(Buffer &buffer);
+    // lights [begin, end), both multiples of four
+    void boundLights(const float time, const glm::mat4 &view, const glm::mat4 &proj, const float zNear, const float zFar, GpuLight *out,
+        const uint32_t begin, const uint32_t end);
+
+    vk::Device _device{};
+    vk::PhysicalDevice _phyDevice{};
+    JobSystem *_jobs{};
+    std::vector<Slot> _slots{};
+    uint32_t _maxLights{};
+    uint32_t _count{};
+    glm::vec3 _sceneMin{};
+    glm::vec3 _sceneMax{};
+
+    // structure of arrays, padded to a multiple of four with lights that never touch a cluster
+    std::vector<float> _baseX{};
+    std::vector<float> _baseY{};
+    std::vector<float> _baseZ{};
+    std::vector<float> _radius{};
+    std::vector<GpuLight> _base{};
+    std::vector<LightRange> _ranges{};
+    // light count per cluster, then reused as the write cursor
+    std::vector<uint32_t> _clusterCounts{};
+    std::vector<uint32_t> _clusterEnds{};
+    LightingStats _stats{};
+};
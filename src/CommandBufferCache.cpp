@@ -0,0 +1,161 @@
+#include "CommandBufferCache.hpp"
+#include "JobSystem.hpp"
+
+void CommandBufferCache::initialize(const vk::Device &device, const uint32_t queueFamily, const uint32_t imageCount, const uint32_t slotCount, const uint32_t groupCount,
+    JobSystem *jobs){
+    _device = device;
+    _slotCount = slotCount;
+    _groupCount = groupCount;
+    _jobs = jobs;
+
+    vk::CommandPoolCreateInfo poolInfo{};
+    poolInfo.queueFamilyIndex = queueFamily;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    _pool = _device.createCommandPool(poolInfo);
+
+    vk::CommandBufferAllocateInfo allocInfo{};
+    allocInfo.commandPool = _pool;
+    allocInfo.level = vk::CommandBufferLevel::ePrimary;
+    allocInfo.commandBufferCount = imageCount * slotCount;
+    auto primaries = _device.allocateCommandBuffers(allocInfo);
+    _primaries.resize(primaries.size());
+    for(size_t i = 0;i < primaries.size();i ++){
+        _primaries[i].cmd = primaries[i];
+        _primaries[i].secondaryVersions.assign(_groupCount, 0);
+    }
+
+    _secondaries.resize(slotCount * groupCount);
+    _groupPools.resize(groupCount);
+    for(uint32_t group = 0;group < groupCount;group ++){
+        _groupPools[group] = _device.createCommandPool(poolInfo);
+        allocInfo.commandPool = _groupPools[group];
+        allocInfo.level = vk::CommandBufferLevel::eSecondary;
+        allocInfo.commandBufferCount = slotCount;
+        auto secondaries = _device.allocateCommandBuffers(allocInfo);
+        for(uint32_t slot = 0;slot < slotCount;slot ++){
+            _secondaries[slot * groupCount + group].cmd = secondaries[slot];
+        }
+    }
+    _dirtyGroups.reserve(groupCount);
+}
+
+void CommandBufferCache::resizeImages(const uint32_t imageCount){
+    const auto count = imageCount * _slotCount;
+    if(!_pool || count <= _primaries.size()){
+        return;
+    }
+
+    vk::CommandBufferAllocateInfo allocInfo{};
+    allocInfo.commandPool = _pool;
+    allocInfo.level = vk::CommandBufferLevel::ePrimary;
+    allocInfo.commandBufferCount = count - _primaries.size();
+    for(auto cmd : _device.allocateCommandBuffers(allocInfo)){
+        PrimaryEntry entry{};
+        entry.cmd = cmd;
+        entry.secondaryVersions.assign(_groupCount, 0);
+        _primaries.push_back(std::move(entry));
+    }
+}
+
+void CommandBufferCache::destroy(){
+    if(!_device){
+        return;
+    }
+
+    // freeing the pools releases every buffer allocated from them
+    _device.destroyCommandPool(_pool);
+    _pool = nullptr;
+    for(auto pool : _groupPools){
+        _device.destroyCommandPool(pool);
+    }
+    _groupPools.clear();
+    _primaries.clear();
+    _secondaries.clear();
+    _device = nullptr;
+}
+
+void CommandBufferCache::invalidateAll(){
+    for(auto &primary : _primaries){
+        primary.dirty = true;
+    }
+
+    for(auto &secondary : _secondaries){
+        secondary.dirty = true;
+    }
+}
+
+void CommandBufferCache::invalidateGroup(const uint32_t group){
+    for(uint32_t slot = 0;slot < _slotCount;slot ++){
+        _secondaries[slot * _groupCount + group].dirty = true;
+    }
+}
+
+void CommandBufferCache::recordGroup(SecondaryEntry &entry, const uint32_t slot, const uint32_t group, const vk::RenderPass &renderPass,
+    const RecordSecondary &record){
+    vk::CommandBufferInheritanceInfo inheritance{};
+    inheritance.renderPass = renderPass;
+    inheritance.subpass = 0;
+
+    vk::CommandBufferBeginInfo beginInfo{};
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+    beginInfo.pInheritanceInfo = &inheritance;
+
+    entry.cmd.reset();
+    entry.cmd.begin(beginInfo);
+    record(entry.cmd, slot, group);
+    entry.cmd.end();
+    entry.version++;
+    entry.dirty = false;
+}
+
+vk::CommandBuffer CommandBufferCache::acquire(const uint32_t image, const uint32_t slot, const vk::RenderPass &renderPass,
+    const RecordPrimary &recordPrimary, const RecordSecondary &recordSecondary){
+    // reused between calls, a frame without dirty groups allocates nothing
+    auto &secondaries = _acquired;
+    secondaries.resize(_groupCount);
+    _dirtyGroups.clear();
+    for(uint32_t group = 0;group < _groupCount;group ++){
+        auto &entry = _secondaries[slot * _groupCount + group];
+        secondaries[group] = entry.cmd;
+        if(entry.dirty){
+            _dirtyGroups.push_back(group);
+        }
+    }
+
+    const auto dirtyCount = static_cast<uint32_t>(_dirtyGroups.size());
+    const auto record = [this, slot, &renderPass, &recordSecondary](const uint32_t begin, const uint32_t end){
+        for(uint32_t i = begin;i < end;i ++){
+            const auto group = _dirtyGroups[i];
+            recordGroup(_secondaries[slot * _groupCount + group], slot, group, renderPass, recordSecondary);
+        }
+    };
+    if(_jobs && dirtyCount > 1){
+        // every job touches one group's entry and pool only
+        _jobs->wait(_jobs->parallelFor(dirtyCount, 1, record));
+    }else{
+        record(0, dirtyCount);
+    }
+    _stats.secondaryRecords += dirtyCount;
+
+    auto &primary = _primaries[image * _slotCount + slot];
+    for(uint32_t group = 0;group < _groupCount && !primary.dirty;group ++){
+        // re-recording a secondary invalidates every primary that executes it
+        primary.dirty = primary.secondaryVersions[group] != _secondaries[slot * _groupCount + group].version;
+    }
+
+    if(!primary.dirty){
+        _stats.reuses++;
+        return primary.cmd;
+    }
+
+    primary.cmd.reset();
+    primary.cmd.begin(vk::CommandBufferBeginInfo{});
+    recordPrimary(primary.cmd, image, secondaries);
+    primary.cmd.end();
+    for(uint32_t group = 0;group < _groupCount;group ++){
+        primary.secondaryVersions[group] = _secondaries[slot * _groupCount + group].version;
+    }
+    primary.dirty = false;
+    _stats.primaryRecords++;
+    return primary.cmd;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+class JobSystem;
+
+struct CommandCacheStats{
+    uint64_t primaryRecords{};
+    uint64_t secondaryRecords{};
+    uint64_t reuses{};
+};
+
+// Keeps one primary command buffer per (swapchain image, frame slot) and one secondary per
+// (frame slot, draw group). Secondaries are re-recorded only when their group is dirty and
+// primaries only when the secondaries they execute or the render target changed. Every group
+// allocates its secondaries from its own pool, dirty groups are recorded in parallel on the jobs.
+class CommandBufferCache{
+public:
+    using RecordPrimary = std::function<void(const vk::CommandBuffer &cmd, const uint32_t image, const std::vector<vk::CommandBuffer> &secondaries)>;
+    using RecordSecondary = std::function<void(const vk::CommandBuffer &cmd, const uint32_t slot, const uint32_t group)>;
+
+    void initialize(const vk::Device &device, const uint32_t queueFamily, const uint32_t imageCount, const uint32_t slotCount, const uint32_t groupCount,
+        JobSystem *jobs = nullptr);
+    void destroy();
+    // The swapchain was recreated: makes room for more images, extra primaries are kept for later.
+    void resizeImages(const uint32_t imageCount);
+
+    // Render pass, pipeline or framebuffers changed: every buffer must be recorded again.
+    void invalidateAll();
+    // Only the draws of one group changed: its secondaries are recorded again, primaries just re-execute them.
+    void invalidateGroup(const uint32_t group);
+
+    // RecordSecondary may run on several job threads at once, each call on another group.
+    vk::CommandBuffer acquire(const uint32_t image, const uint32_t slot, const vk::RenderPass &renderPass,
+        const RecordPrimary &recordPrimary, const RecordSecondary &recordSecondary);
+
+    const CommandCacheStats& stats() const { return _stats; }
+
+private:
+    struct SecondaryEntry{
+        vk::CommandBuffer cmd{};
+        uint64_t version{};
+        bool dirty{true};
+    };
+
+    struct PrimaryEntry{
+        vk::CommandBuffer cmd{};
+        std::vector<uint64_t> secondaryVersions{};
+        bool dirty{true};
+    };
+
+    void recordGroup(SecondaryEntry &entry, const uint32_t slot, const uint32_t group, const vk::RenderPass &renderPass,
+        const RecordSecondary &record);
+
+    vk::Device _device{};
+    // primaries only, they are recorded on the calling thread
+    vk::CommandPool _pool{};
+    // a command pool must not be used by two threads at once, so one per draw group
+    std::vector<vk::CommandPool> _groupPools{};
+    JobSystem *_jobs{};
+    uint32_t _slotCount{};
+    uint32_t _groupCount{};
+    std::vector<PrimaryEntry> _primaries{};
+    std::vector<SecondaryEntry> _secondaries{};
+    // secondaries of the slot being acquired, handed to RecordPrimary
+    std::vector<vk::CommandBuffer> _acquired{};
+    std::vector<uint32_t> _dirtyGroups{};
+    CommandCacheStats _stats{};
+};
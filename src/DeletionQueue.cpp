@@ -0,0 +1,23 @@
+#include "DeletionQueue.hpp"
+
+void DeletionQueue::push(const uint64_t retireValue, std::function<void()> &&deleter){
+    _entries.push_back({retireValue, std::move(deleter)});
+}
+
+uint32_t DeletionQueue::flush(const uint64_t completedValue){
+    // entries are pushed with non-decreasing values, so the completed ones sit at the front
+    uint32_t count = 0;
+    while(!_entries.empty() && _entries.front().retireValue <= completedValue){
+        _entries.front().deleter();
+        _entries.pop_front();
+        count++;
+    }
+    return count;
+}
+
+void DeletionQueue::flushAll(){
+    for(auto &entry : _entries){
+        entry.deleter();
+    }
+    _entries.clear();
+}
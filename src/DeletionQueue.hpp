@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+// Defers destruction of GPU objects until the frame timeline passes the value they were
+// retired at, so resources still referenced by frames in flight never need a device idle wait.
+class DeletionQueue{
+public:
+    void push(const uint64_t retireValue, std::function<void()> &&deleter);
+    // Runs every deleter whose retire value has completed and returns how many ran.
+    uint32_t flush(const uint64_t completedValue);
+    // Only valid once the device is idle.
+    void flushAll();
+
+    size_t size() const { return _entries.size(); }
+
+private:
+    struct Entry{
+        uint64_t retireValue{};
+        std::function<void()> deleter{};
+    };
+
+    std::deque<Entry> _entries{};
+};
@@ -0,0 +1,172 @@
+#include "DescriptorAllocator.hpp"
+#include "Log.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <chrono>
+
+using namespace Utils;
+
+void DescriptorAllocator::initialize(const vk::Device &device, const std::vector<DescriptorPoolRatio> &ratios, const uint32_t setsPerPool){
+    _device = device;
+    _ratios = ratios;
+    _setsPerPool = std::clamp(setsPerPool, 1u, kMaxSetsPerPool);
+    _stats = {};
+}
+
+void DescriptorAllocator::destroy(){
+    if(!_device){
+        return;
+    }
+
+    for(auto pool : _usedPools){
+        _device.destroyDescriptorPool(pool);
+    }
+    for(auto pool : _freePools){
+        _device.destroyDescriptorPool(pool);
+    }
+    _usedPools.clear();
+    _freePools.clear();
+    _current = nullptr;
+    _device = nullptr;
+}
+
+vk::DescriptorPool DescriptorAllocator::createPool(const uint32_t setCount){
+    std::vector<vk::DescriptorPoolSize> sizes{};
+    sizes.reserve(_ratios.size());
+    for(auto &ratio : _ratios){
+        sizes.emplace_back(ratio.type, std::max(1u, static_cast<uint32_t>(ratio.ratio * setCount)));
+    }
+
+    vk::DescriptorPoolCreateInfo info{};
+    info.maxSets = setCount;
+    info.poolSizeCount = sizes.size();
+    info.pPoolSizes = sizes.data();
+    _stats.pools++;
+    return _device.createDescriptorPool(info);
+}
+
+vk::DescriptorPool DescriptorAllocator::grabPool(){
+    if(!_freePools.empty()){
+        auto pool = _freePools.back();
+        _freePools.pop_back();
+        return pool;
+    }
+
+    auto pool = createPool(_setsPerPool);
+    // every new pool is larger so a steadily growing workload settles on a few pools
+    _setsPerPool = std::min(_setsPerPool + _setsPerPool / 2, kMaxSetsPerPool);
+    return pool;
+}
+
+vk::DescriptorSet DescriptorAllocator::allocate(const vk::DescriptorSetLayout &layout){
+    if(!_current){
+        _current = grabPool();
+        _usedPools.push_back(_current);
+    }
+
+    vk::DescriptorSetAllocateInfo info{};
+    info.descriptorPool = _current;
+    info.descriptorSetCount = 1;
+    info.pSetLayouts = &layout;
+
+    vk::DescriptorSet set{};
+    auto ret = _device.allocateDescriptorSets(&info, &set);
+    if(ret == vk::Result::eErrorOutOfPoolMemory || ret == vk::Result::eErrorFragmentedPool){
+        _current = grabPool();
+        _usedPools.push_back(_current);
+        _stats.grows++;
+        info.descriptorPool = _current;
+        ret = _device.allocateDescriptorSets(&info, &set);
+    }
+
+    if(ret != vk::Result::eSuccess){
+        throw std::runtime_error(std::format("failed to allocate a descriptor set: {}", vk::to_string(ret)));
+    }
+
+    _stats.allocations++;
+    return set;
+}
+
+void DescriptorAllocator::reset(){
+    for(auto pool : _usedPools){
+        _device.resetDescriptorPool(pool);
+        _freePools.push_back(pool);
+    }
+    _usedPools.clear();
+    _current = nullptr;
+    _stats.resets++;
+}
+
+void DescriptorLayoutCache::initialize(const vk::Device &device){
+    _device = device;
+    _count = 0;
+}
+
+void DescriptorLayoutCache::destroy(){
+    if(!_device){
+        return;
+    }
+
+    for(auto &[key, entries] : _layouts){
+        for(auto &entry : entries){
+            _device.destroyDescriptorSetLayout(entry.layout);
+        }
+    }
+    _layouts.clear();
+    _count = 0;
+    _device = nullptr;
+}
+
+vk::DescriptorSetLayout DescriptorLayoutCache::get(std::vector<vk::DescriptorSetLayoutBinding> bindings){
+    // binding order does not change the layout, sort so permutations share one entry
+    std::sort(bindings.begin(), bindings.end(), [](const auto &a, const auto &b){ return a.binding < b.binding; });
+
+    uint64_t key = Hash::kFnvOffset;
+    for(auto &binding : bindings){
+        key = Hash::Combine(key, binding.binding);
+        key = Hash::Combine(key, binding.descriptorType);
+        key = Hash::Combine(key, binding.descriptorCount);
+        key = Hash::Combine(key, static_cast<VkShaderStageFlags>(binding.stageFlags));
+        key = Hash::Combine(key, binding.pImmutableSamplers);
+    }
+
+    auto &bucket = _layouts[key];
+    for(auto &entry : bucket){
+        if(entry.bindings == bindings){
+            return entry.layout;
+        }
+    }
+
+    vk::DescriptorSetLayoutCreateInfo info{};
+    info.bindingCount = bindings.size();
+    info.pBindings = bindings.data();
+    auto layout = _device.createDescriptorSetLayout(info);
+    bucket.push_back({std::move(bindings), layout});
+    _count++;
+    return layout;
+}
+
+DescriptorBenchmarkResult BenchmarkDescriptorAllocator(const vk::Device &device, const vk::DescriptorSetLayout &layout, const std::vector<DescriptorPoolRatio> &ratios,
+    const uint64_t count, const uint32_t setsPerFrame){
+    DescriptorAllocator allocator{};
+    allocator.initialize(device, ratios);
+
+    const auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0;i < count;i ++){
+        if(i != 0 && i % setsPerFrame == 0){
+            allocator.reset();
+        }
+        allocator.allocate(layout);
+    }
+    const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    const auto stats = allocator.stats();
+    allocator.destroy();
+
+    DescriptorBenchmarkResult result{};
+    result.sets = count;
+    result.ms = ms;
+    result.setsPerSecond = ms > 0.0 ? count * 1000.0 / ms : 0.0;
+    LOGI("Descriptor benchmark: {} sets in {:.3f} ms ({:.0f} sets/s), {} pools, {} resets", count, ms, result.setsPerSecond, stats.pools, stats.resets);
+    return result;
+}
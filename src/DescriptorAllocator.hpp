@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+struct DescriptorPoolRatio{
+    vk::DescriptorType type{};
+    float ratio{};
+};
+
+struct DescriptorAllocatorStats{
+    uint64_t allocations{};
+    uint32_t pools{};
+    uint32_t grows{};
+    uint32_t resets{};
+};
+
+// Allocates descriptor sets from a chain of pools. When the current pool runs out a new,
+// larger one is appended instead of failing; reset() recycles every pool with one call each,
+// so per-frame allocators only pay for vkResetDescriptorPool once the frame has retired.
+class DescriptorAllocator{
+public:
+    static constexpr const uint32_t kDefaultSetsPerPool = 64;
+    static constexpr const uint32_t kMaxSetsPerPool = 4096;
+
+    void initialize(const vk::Device &device, const std::vector<DescriptorPoolRatio> &ratios, const uint32_t setsPerPool = kDefaultSetsPerPool);
+    void destroy();
+
+    vk::DescriptorSet allocate(const vk::DescriptorSetLayout &layout);
+    // Returns every set to its pool, only valid once the GPU no longer reads them.
+    void reset();
+
+    const DescriptorAllocatorStats& stats() const { return _stats; }
+
+private:
+    vk::DescriptorPool grabPool();
+    vk::DescriptorPool createPool(const uint32_t setCount);
+
+    vk::Device _device{};
+    std::vector<DescriptorPoolRatio> _ratios{};
+    uint32_t _setsPerPool{kDefaultSetsPerPool};
+    vk::DescriptorPool _current{};
+    std::vector<vk::DescriptorPool> _usedPools{};
+    std::vector<vk::DescriptorPool> _freePools{};
+    DescriptorAllocatorStats _stats{};
+};
+
+// Deduplicates descriptor set layouts by their bindings, identical binding arrays share one
+// vk::DescriptorSetLayout no matter which pass asks for it.
+class DescriptorLayoutCache{
+public:
+    void initialize(const vk::Device &device);
+    void destroy();
+
+    vk::DescriptorSetLayout get(std::vector<vk::DescriptorSetLayoutBinding> bindings);
+
+    uint32_t size() const { return _count; }
+
+private:
+    struct Entry{
+        std::vector<vk::DescriptorSetLayoutBinding> bindings{};
+        vk::DescriptorSetLayout layout{};
+    };
+
+    vk::Device _device{};
+    std::unordered_map<uint64_t, std::vector<Entry>> _layouts{};
+    uint32_t _count{};
+};
+
+struct DescriptorBenchmarkResult{
+    uint64_t sets{};
+    double ms{};
+    double setsPerSecond{};
+};
+
+// Allocates `count` sets of `layout` through a per-frame allocator, resetting it every
+// `setsPerFrame` allocations the way the renderer does after each frame retires.
+DescriptorBenchmarkResult BenchmarkDescriptorAllocator(const vk::Device &device, const vk::DescriptorSetLayout &layout, const std::vector<DescriptorPoolRatio> &ratios,
+    const uint64_t count, const uint32_t setsPerFrame);
@@ -0,0 +1,55 @@
+#include "DynamicResolution.hpp"
+#include <algorithm>
+#include <cmath>
+
+static constexpr const float kScaleStep = 1.0f / 20.0f;
+static constexpr const double kSmoothing = 0.2;
+// aims below the target so a slightly heavier frame still fits
+static constexpr const double kHeadroom = 0.9;
+// relative distance from the aim that is left alone
+static constexpr const double kDeadband = 0.08;
+
+void ResolutionController::initialize(const double targetMs, const float minScale, const float maxScale, const uint32_t latencyFrames){
+    _targetMs = targetMs;
+    _minScale = minScale;
+    _maxScale = maxScale;
+    _scale = maxScale;
+    _latencyFrames = latencyFrames;
+    _cooldown = latencyFrames;
+    _stats = {};
+}
+
+bool ResolutionController::update(const double gpuMs){
+    _stats.lastGpuMs = gpuMs;
+    _stats.gpuMs = _stats.gpuMs == 0.0 ? gpuMs : _stats.gpuMs + (gpuMs - _stats.gpuMs) * kSmoothing;
+    if(_cooldown > 0){
+        _cooldown--;
+        return false;
+    }
+
+    const auto aimMs = _targetMs * kHeadroom;
+    if(std::abs(_stats.gpuMs - aimMs) <= aimMs * kDeadband){
+        return false;
+    }
+
+    const auto desired = _scale * std::sqrt(aimMs / std::max(_stats.gpuMs, 1e-3));
+    const auto quantized = std::clamp(std::round(static_cast<float>(desired) / kScaleStep) * kScaleStep, _minScale, _maxScale);
+    if(std::abs(quantized - _scale) < kScaleStep * 0.5f){
+        return false;
+    }
+
+    // expected time at the new scale, until frames rendered with it are measured
+    _stats.gpuMs *= (quantized * quantized) / (_scale * _scale);
+    _scale = quantized;
+    _stats.changes++;
+    // frames already in flight still use the old scale, and the average needs a few new samples
+    _cooldown = _latencyFrames + static_cast<uint32_t>(1.0 / kSmoothing);
+    return true;
+}
+
+vk::Extent2D ResolutionController::scaledExtent(const vk::Extent2D &extent) const {
+    return vk::Extent2D{
+        std::max(static_cast<uint32_t>(std::lround(extent.width * _scale)), 1u),
+        std::max(static_cast<uint32_t>(std::lround(extent.height * _scale)), 1u)
+    };
+}
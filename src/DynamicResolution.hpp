@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+struct ResolutionStats{
+    // smoothed GPU frame time the controller acts on
+    double gpuMs{};
+    double lastGpuMs{};
+    uint64_t changes{};
+};
+
+// Picks the render scale from the measured GPU frame time. GPU cost is taken to grow with the
+// pixel count, i.e. with the square of the scale, so the scale moves by the square root of the
+// budget ratio. Scales are quantized and the controller waits for frames rendered at a new
+// scale to be measured before it moves again, so it does not oscillate on noise or latency.
+class ResolutionController{
+public:
+    // latencyFrames: frames between choosing a scale and measuring a frame rendered with it
+    void initialize(const double targetMs, const float minScale, const float maxScale, const uint32_t latencyFrames);
+
+    // Feeds the GPU time of one retired frame, returns true when the scale changed.
+    bool update(const double gpuMs);
+
+    float scale() const { return _scale; }
+    double targetMs() const { return _targetMs; }
+    vk::Extent2D scaledExtent(const vk::Extent2D &extent) const;
+    const ResolutionStats& stats() const { return _stats; }
+
+private:
+    double _targetMs{};
+    float _minScale{1.0f};
+    float _maxScale{1.0f};
+    float _scale{1.0f};
+    uint32_t _latencyFrames{};
+    uint32_t _cooldown{};
+    ResolutionStats _stats{};
+};
@@ -0,0 +1,160 @@
+#include "FrameArena.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static constexpr const uint32_t kHeaderMagic = 0xa110ca7e;
+static constexpr const size_t kGuardSize = 16;
+static constexpr const int kAllocatedFill = 0xcd;
+static constexpr const int kRetiredFill = 0xdd;
+static constexpr const uint8_t kGuardFill = 0xfd;
+
+// in front of every allocation of the debug mode
+struct AllocationHeader{
+    uint64_t size{};
+    // one past the offset of the previous header in the block, 0 for the first allocation
+    uint32_t previous{};
+    uint32_t magic{};
+};
+static_assert(sizeof(AllocationHeader) == 16, "the header keeps 16 byte alignment");
+
+static size_t AlignUp(const size_t value, const size_t alignment){
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void FrameArena::initialize(const uint32_t slotCount, const size_t blockSize, const bool debug){
+    _blockSize = blockSize;
+    _debug = debug;
+    _stats = {};
+    _slots.resize(slotCount);
+    for(auto &slot : _slots){
+        slot.blocks.push_back(makeBlock(_blockSize));
+    }
+    _current = &_slots.front();
+    LOGI("Frame arena of {} KiB per frame slot{}", _blockSize / 1024, _debug ? " with poisoning and guard checks" : "");
+}
+
+void FrameArena::destroy(){
+    if(_slots.empty()){
+        return;
+    }
+
+    if(_debug){
+        // every frame retired, the last ones were never reset
+        for(auto &slot : _slots){
+            for(auto &block : slot.blocks){
+                checkBlock(block);
+            }
+        }
+    }
+    LOGD("Frame arena: {} KiB high water, {} blocks allocated, {} corruptions found", _stats.highWater / 1024, _stats.blockAllocations, _stats.corruptions);
+    _slots.clear();
+    _current = nullptr;
+}
+
+FrameArena::Block FrameArena::makeBlock(const size_t size){
+    Block block{};
+    // left uninitialized, the debug mode fills it
+    block.memory.reset(new std::byte[size]);
+    block.size = size;
+    if(_debug){
+        std::memset(block.memory.get(), kRetiredFill, size);
+    }
+    _stats.blockAllocations++;
+    return block;
+}
+
+void FrameArena::beginFrame(const uint32_t slot){
+    auto &current = _slots[slot];
+    size_t used = 0;
+    size_t total = 0;
+    for(auto &block : current.blocks){
+        if(_debug){
+            checkBlock(block);
+        }
+        used += block.used;
+        total += block.size;
+    }
+    _stats.highWater = std::max(_stats.highWater, used);
+
+    if(current.blocks.size() > 1){
+        // the frame overflowed, the next one gets it all in one block
+        current.blocks.clear();
+        current.blocks.push_back(makeBlock(total));
+    }else{
+        auto &block = current.blocks.front();
+        if(_debug){
+            std::memset(block.memory.get(), kRetiredFill, block.used);
+        }
+        block.used = 0;
+        block.lastHeader = 0;
+    }
+    _current = &current;
+    _stats.used = 0;
+}
+
+void* FrameArena::allocateFrom(Block &block, const size_t size, const size_t alignment){
+    const auto base = reinterpret_cast<uintptr_t>(block.memory.get());
+    if(!_debug){
+        const auto offset = AlignUp(base + block.used, alignment) - base;
+        if(offset + size > block.size){
+            return nullptr;
+        }
+        block.used = offset + size;
+        return block.memory.get() + offset;
+    }
+
+    const auto offset = AlignUp(base + block.used + sizeof(AllocationHeader), std::max(alignment, alignof(AllocationHeader))) - base;
+    if(offset + size + kGuardSize > block.size){
+        return nullptr;
+    }
+    AllocationHeader header{};
+    header.size = size;
+    header.previous = static_cast<uint32_t>(block.lastHeader);
+    header.magic = kHeaderMagic;
+    auto *memory = block.memory.get() + offset;
+    std::memcpy(memory - sizeof(header), &header, sizeof(header));
+    std::memset(memory, kAllocatedFill, size);
+    std::memset(memory + size, kGuardFill, kGuardSize);
+    block.lastHeader = offset - sizeof(header) + 1;
+    block.used = offset + size + kGuardSize;
+    return memory;
+}
+
+void* FrameArena::allocate(const size_t size, const size_t alignment){
+    if(!_current){
+        throw std::runtime_error("frame arena used before it was initialized");
+    }
+
+    auto &blocks = _current->blocks;
+    auto *memory = allocateFrom(blocks.back(), size, alignment);
+    if(!memory){
+        // overflow block for the rest of the frame, merged into the slot's block on its next reset
+        blocks.push_back(makeBlock(std::max(_blockSize, size + alignment + sizeof(AllocationHeader) + kGuardSize)));
+        memory = allocateFrom(blocks.back(), size, alignment);
+    }
+    _stats.used += size;
+    return memory;
+}
+
+void FrameArena::checkBlock(const Block &block){
+    const auto *memory = block.memory.get();
+    for(auto at = block.lastHeader;at != 0;){
+        AllocationHeader header{};
+        std::memcpy(&header, memory + at - 1, sizeof(header));
+        if(header.magic != kHeaderMagic){
+            // a write before the start of the next allocation, nothing below it can be trusted
+            LOGE("Frame arena header at offset {} is overwritten", at - 1);
+            _stats.corruptions++;
+            return;
+        }
+
+        const auto *guard = reinterpret_cast<const uint8_t*>(memory + at - 1 + sizeof(header) + header.size);
+        if(std::any_of(guard, guard + kGuardSize, [](const uint8_t value){ return value != kGuardFill; })){
+            LOGE("Frame arena allocation of {} bytes at offset {} was written past its end", header.size, at - 1 + sizeof(header));
+            _stats.corruptions++;
+        }
+        at = header.previous;
+    }
+}
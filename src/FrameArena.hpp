@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+struct FrameArenaStats{
+    // bytes handed out to the current frame so far
+    size_t used{};
+    // largest frame so far
+    size_t highWater{};
+    // blocks taken from the heap, flat once every slot has seen the largest frame
+    uint64_t blockAllocations{};
+    // overwritten guard bytes found by the debug checks
+    uint64_t corruptions{};
+};
+
+// Bump allocator for CPU data that lives until the end of a frame. Every frame slot owns its
+// memory and gets all of it back at once when the slot's previous frame retired, so allocating
+// is a pointer bump and freeing does nothing. A slot that runs out chains overflow blocks for
+// the rest of the frame and merges them into one block on its next reset, steady state frames
+// never reach the heap. Render thread only.
+//
+// The debug mode fills new allocations with 0xCD and retired frames with 0xDD, and puts a
+// header and guard bytes around every allocation that are checked when the slot is reset.
+class FrameArena{
+public:
+    FrameArena() = default;
+    // the memory resource points back at its arena
+    FrameArena(const FrameArena&) = delete;
+    FrameArena &operator=(const FrameArena&) = delete;
+
+    void initialize(const uint32_t slotCount, const size_t blockSize, const bool debug);
+    void destroy();
+
+    // The slot's previous frame retired: checks and reclaims its memory, later allocations come from it.
+    void beginFrame(const uint32_t slot);
+    void* allocate(const size_t size, const size_t alignment = alignof(std::max_align_t));
+    template<typename T>
+    T* allocateArray(const size_t count){
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    // Memory resource of the current slot for std::pmr containers, which must not outlive the frame.
+    std::pmr::memory_resource* resource() { return &_resource; }
+    const FrameArenaStats& stats() const { return _stats; }
+
+private:
+    class Resource : public std::pmr::memory_resource{
+    public:
+        explicit Resource(FrameArena *arena) : _arena(arena) {}
+
+    private:
+        void* do_allocate(const size_t bytes, const size_t alignment) override { return _arena->allocate(bytes, alignment); }
+        void do_deallocate(void*, const size_t, const size_t) override {}
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+        FrameArena *_arena{};
+    };
+
+    struct Block{
+        std::unique_ptr<std::byte[]> memory{};
+        size_t size{};
+        size_t used{};
+        // debug mode: one past the offset of the last allocation header, 0 when there is none
+        size_t lastHeader{};
+    };
+
+    struct Slot{
+        std::vector<Block> blocks{};
+    };
+
+    Block makeBlock(const size_t size);
+    void* allocateFrom(Block &block, const size_t size, const size_t alignment);
+    void checkBlock(const Block &block);
+
+    std::vector<Slot> _slots{};
+    Slot *_current{};
+    size_t _blockSize{};
+    bool _debug{false};
+    Resource _resource{this};
+    FrameArenaStats _stats{};
+};
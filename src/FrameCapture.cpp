@@ -0,0 +1,300 @@
+#include "FrameCapture.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+static constexpr const uint32_t kBytesPerPixel = 4;
+// host frames per writer thread, more only buys time against a slow disk
+static constexpr const uint32_t kFramesPerWriter = 3;
+
+void FrameCapture::initialize(const FrameCaptureDesc &desc){
+    _desc = desc;
+    _desc.threads = std::max(_desc.threads, 1u);
+    std::error_code ec{};
+    std::filesystem::create_directories(_desc.directory, ec);
+    if(ec){
+        LOGW("Cannot create the capture directory {}: {}, frames are not captured", _desc.directory, ec.message());
+        return;
+    }
+
+    _slots.resize(_desc.slotCount);
+    _poolSize = _desc.threads * kFramesPerWriter;
+    _stats = {};
+    _stop = false;
+    for(uint32_t i = 0;i < _desc.threads;i ++){
+        _writers.emplace_back(&FrameCapture::writerLoop, this);
+    }
+    _enabled = true;
+    LOGI("Capturing frames as {} into {} with {} writer threads", _desc.format == CaptureFormat::Png ? "PNG" : "raw RGBA", _desc.directory, _writers.size());
+}
+
+void FrameCapture::destroySlots(){
+    for(auto &slot : _slots){
+        if(slot.buffer){
+            _desc.tracker->forget(slot.buffer);
+            _desc.device.destroyBuffer(slot.buffer);
+            _desc.device.freeMemory(slot.memory);
+        }
+        slot = {};
+    }
+}
+
+void FrameCapture::destroy(){
+    if(_writers.empty()){
+        return;
+    }
+
+    if(_enabled){
+        for(auto &slot : _slots){
+            handOff(slot, true);
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _returned.wait(lock, [this](){ return _free.size() == _allocated; });
+        _stop = true;
+    }
+    _wake.notify_all();
+    for(auto &writer : _writers){
+        writer.join();
+    }
+    _writers.clear();
+    destroySlots();
+    _free.clear();
+    _allocated = 0;
+
+    const auto stats = this->stats();
+    LOGI("Capture wrote {} of {} read back frames ({:.1f} fps, {:.1f} MB), {} dropped, {} failed", stats.written, stats.readBack, stats.writeFps,
+        stats.bytes / (1024.0 * 1024.0), stats.dropped, stats.failed);
+    _enabled = false;
+}
+
+bool FrameCapture::resize(const vk::Extent2D extent, const vk::Format format, DeletionQueue &deferred, const uint64_t retireValue){
+    if(!_enabled){
+        return false;
+    }
+
+    bool bgra = false;
+    bool supported = true;
+    switch(format){
+    case vk::Format::eB8G8R8A8Unorm:
+    case vk::Format::eB8G8R8A8Srgb:
+        bgra = true;
+        break;
+    case vk::Format::eR8G8B8A8Unorm:
+    case vk::Format::eR8G8B8A8Srgb:
+        break;
+    default:
+        supported = false;
+        break;
+    }
+    if(supported && extent == _extent && bgra == _bgra && _slots.front().buffer){
+        return true;
+    }
+
+    const auto device = _desc.device;
+    for(auto &slot : _slots){
+        if(slot.buffer){
+            // the readback of a frame still in flight is lost with its buffer
+            _desc.tracker->forget(slot.buffer);
+            deferred.push(retireValue, [device, buffer = slot.buffer, memory = slot.memory](){
+                device.destroyBuffer(buffer);
+                device.freeMemory(memory);
+            });
+            if(slot.pending){
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stats.dropped++;
+            }
+        }
+        slot = {};
+    }
+    if(!supported){
+        // the writers keep running until destroy() so frames already queued are still written
+        LOGW("Frames in {} cannot be captured, the capture is disabled", vk::to_string(format));
+        _enabled = false;
+        return false;
+    }
+
+    _extent = extent;
+    _bgra = bgra;
+    _frameSize = static_cast<vk::DeviceSize>(extent.width) * extent.height * kBytesPerPixel;
+    for(auto &slot : _slots){
+        vk::BufferCreateInfo info{};
+        info.size = _frameSize;
+        info.usage = vk::BufferUsageFlagBits::eTransferDst;
+        info.sharingMode = vk::SharingMode::eExclusive;
+        slot.buffer = device.createBuffer(info);
+
+        const auto requirements = device.getBufferMemoryRequirements(slot.buffer);
+        vk::MemoryAllocateInfo allocInfo{};
+        allocInfo.allocationSize = requirements.size;
+        // cached memory keeps the CPU copy out of uncached reads, fall back to plain host-visible memory
+        const auto coherent = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+        try{
+            allocInfo.memoryTypeIndex = Utils::Vulkan::FindMemoryType(_desc.phyDevice, requirements.memoryTypeBits, coherent | vk::MemoryPropertyFlagBits::eHostCached);
+        }catch(const std::runtime_error&){
+            allocInfo.memoryTypeIndex = Utils::Vulkan::FindMemoryType(_desc.phyDevice, requirements.memoryTypeBits, coherent);
+        }
+        slot.memory = device.allocateMemory(allocInfo);
+        device.bindBufferMemory(slot.buffer, slot.memory, 0);
+        slot.mapped = device.mapMemory(slot.memory, 0, _frameSize);
+        _desc.tracker->registerBuffer(slot.buffer);
+    }
+    return true;
+}
+
+void FrameCapture::recordCopy(const vk::CommandBuffer &cmd, const uint32_t slot, const vk::Image &image) const {
+    auto &tracker = *_desc.tracker;
+    const auto buffer = _slots[slot].buffer;
+    tracker.useImage(image, ResourceUse::TransferSrc);
+    tracker.useBuffer(buffer, ResourceUse::TransferDst);
+    tracker.flush(cmd);
+
+    vk::BufferImageCopy region{};
+    region.imageSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+    region.imageExtent = vk::Extent3D{_extent.width, _extent.height, 1};
+    cmd.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, buffer, region);
+    // made visible to the host before the frame's timeline signal
+    tracker.useBuffer(buffer, ResourceUse::HostRead);
+    tracker.flush(cmd);
+}
+
+void FrameCapture::submitted(const uint32_t slot, const uint64_t frame){
+    if(!_enabled){
+        return;
+    }
+    _slots[slot].frame = frame;
+    _slots[slot].pending = true;
+}
+
+void FrameCapture::collect(const uint32_t slot){
+    if(_enabled){
+        handOff(_slots[slot], false);
+    }
+}
+
+void FrameCapture::handOff(Slot &slot, const bool wait){
+    if(!slot.pending){
+        return;
+    }
+    TRACE_ZONE("capture readback");
+    slot.pending = false;
+
+    std::unique_ptr<HostFrame> host{};
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if(_stats.readBack + _stats.dropped == 0){
+            _firstReadback = std::chrono::steady_clock::now();
+        }
+        if(wait){
+            _returned.wait(lock, [this](){ return !_free.empty() || _allocated < _poolSize; });
+        }
+        if(!_free.empty()){
+            host = std::move(_free.back());
+            _free.pop_back();
+        }else if(_allocated < _poolSize){
+            host = std::make_unique<HostFrame>();
+            _allocated++;
+        }else{
+            _stats.dropped++;
+            return;
+        }
+    }
+
+    // the only copy on the render thread, swizzling and encoding happen on the writers
+    host->pixels.resize(_frameSize);
+    std::memcpy(host->pixels.data(), slot.mapped, _frameSize);
+    host->frame = slot.frame;
+    host->extent = _extent;
+    host->bgra = _bgra;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.readBack++;
+        _queue.push_back(std::move(host));
+    }
+    _wake.notify_one();
+}
+
+bool FrameCapture::writeFrame(HostFrame &frame) const {
+    auto &pixels = frame.pixels;
+    for(size_t i = 0;i < pixels.size();i += kBytesPerPixel){
+        if(frame.bgra){
+            std::swap(pixels[i], pixels[i + 2]);
+        }
+        // the swapchain alpha is whatever blending left behind, the captures are opaque
+        pixels[i + 3] = 0xff;
+    }
+
+    const auto width = static_cast<int>(frame.extent.width);
+    const auto height = static_cast<int>(frame.extent.height);
+    if(_desc.format == CaptureFormat::Png){
+        const auto path = std::format("{}/frame_{:06}.png", _desc.directory, frame.frame);
+        return stbi_write_png(path.c_str(), width, height, kBytesPerPixel, pixels.data(), width * kBytesPerPixel) != 0;
+    }
+
+    // tightly packed RGBA8 rows, the size is in the name
+    const auto path = std::format("{}/frame_{:06}_{}x{}.rgba", _desc.directory, frame.frame, width, height);
+    auto *file = std::fopen(path.c_str(), "wb");
+    if(!file){
+        return false;
+    }
+    const bool ok = std::fwrite(pixels.data(), 1, pixels.size(), file) == pixels.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+void FrameCapture::writerLoop(){
+    trace::SetThreadName("capture writer");
+    for(;;){
+        std::unique_ptr<HostFrame> frame{};
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this](){ return _stop || !_queue.empty(); });
+            if(_queue.empty()){
+                return;
+            }
+            frame = std::move(_queue.front());
+            _queue.pop_front();
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        bool ok = false;
+        {
+            TRACE_ZONE("capture write");
+            ok = writeFrame(*frame);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        const auto ms = std::chrono::duration<double, std::milli>(end - start).count();
+        const auto bytes = frame->pixels.size();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(ok){
+                _stats.written++;
+                _stats.bytes += bytes;
+            }else{
+                _stats.failed++;
+                if(_stats.failed == 1){
+                    LOGW("Writing captured frame {} into {} failed", frame->frame, _desc.directory);
+                }
+            }
+            _stats.encodeMs = _stats.encodeMs == 0.0 ? ms : _stats.encodeMs + (ms - _stats.encodeMs) * 0.05;
+            _lastWrite = end;
+            _free.push_back(std::move(frame));
+        }
+        _returned.notify_all();
+    }
+}
+
+CaptureStats FrameCapture::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto stats = _stats;
+    stats.queued = _queue.size();
+    const auto seconds = std::chrono::duration<double>(_lastWrite - _firstReadback).count();
+    stats.writeFps = stats.written > 0 && seconds > 0.0 ? stats.written / seconds : 0.0;
+    return stats;
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "DeletionQueue.hpp"
+#include "RenderOptions.hpp"
+#include "ResourceStateTracker.hpp"
+
+struct CaptureStats{
+    // frames copied out of the readback ring
+    uint64_t readBack{};
+    uint64_t written{};
+    // readbacks skipped because every host frame was still waiting for a writer
+    uint64_t dropped{};
+    uint64_t failed{};
+    uint64_t queued{};
+    uint64_t bytes{};
+    // written frames per second since the first readback
+    double writeFps{};
+    double encodeMs{};
+};
+
+struct FrameCaptureDesc{
+    vk::Device device{};
+    vk::PhysicalDevice phyDevice{};
+    ResourceStateTracker *tracker{};
+    uint32_t slotCount{};
+    std::string directory{};
+    CaptureFormat format{CaptureFormat::Png};
+    uint32_t threads{1};
+};
+
+// Streams rendered frames to disk. Every frame copies the final image into the host-visible
+// buffer of its frame slot; once the slot retires the pixels move into a pooled host frame and
+// writer threads encode and write it. When the writers fall behind the pool runs dry and frames
+// are dropped, rendering never waits on them.
+class FrameCapture{
+public:
+    void initialize(const FrameCaptureDesc &desc);
+    // Only valid once the device is idle. Readbacks still in the ring and every queued frame are written first.
+    void destroy();
+
+    // Sizes the readback ring for the target. Buffers still used by frames in flight are retired
+    // through the queue. Returns false and disables the capture for formats it cannot write.
+    bool resize(const vk::Extent2D extent, const vk::Format format, DeletionQueue &deferred, const uint64_t retireValue);
+
+    // Copies the whole image into the slot's buffer, safe inside cached command buffers.
+    void recordCopy(const vk::CommandBuffer &cmd, const uint32_t slot, const vk::Image &image) const;
+    // The slot's frame, numbered by frame, was submitted with the copy.
+    void submitted(const uint32_t slot, const uint64_t frame);
+    // The slot retired, hands its readback to the writers without waiting for them.
+    void collect(const uint32_t slot);
+
+    bool enabled() const { return _enabled; }
+    CaptureStats stats() const;
+
+private:
+    struct Slot{
+        vk::Buffer buffer{};
+        vk::DeviceMemory memory{};
+        void *mapped{};
+        uint64_t frame{};
+        bool pending{false};
+    };
+
+    struct HostFrame{
+        std::vector<uint8_t> pixels{};
+        uint64_t frame{};
+        vk::Extent2D extent{};
+        bool bgra{false};
+    };
+
+    void handOff(Slot &slot, const bool wait);
+    void writerLoop();
+    bool writeFrame(HostFrame &frame) const;
+    void destroySlots();
+
+    FrameCaptureDesc _desc{};
+    bool _enabled{false};
+    std::vector<Slot> _slots{};
+    vk::Extent2D _extent{};
+    bool _bgra{false};
+    vk::DeviceSize _frameSize{};
+
+    std::vector<std::thread> _writers{};
+    mutable std::mutex _mutex{};
+    std::condition_variable _wake{};
+    std::condition_variable _returned{};
+    std::deque<std::unique_ptr<HostFrame>> _queue{};
+    std::vector<std::unique_ptr<HostFrame>> _free{};
+    // host frames allocated so far, bounded by the pool size
+    uint32_t _allocated{};
+    uint32_t _poolSize{};
+    bool _stop{false};
+    CaptureStats _stats{};
+    std::chrono::steady_clock::time_point _firstReadback{};
+    std::chrono::steady_clock::time_point _lastWrite{};
+};
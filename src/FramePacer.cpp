@@ -0,0 +1,151 @@
+#include "FramePacer.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <thread>
+
+// how early the next submit should land before the GPU runs dry
+static constexpr const double kLowLatencyMarginMs = 0.5;
+// the OS sleep is only trusted up to this point, the rest is spent yielding
+static constexpr const auto kSpinThreshold = std::chrono::milliseconds(1);
+static constexpr const double kSmoothing = 0.05;
+
+static double Smooth(const double value, const double sample){
+    return value == 0.0 ? sample : value + (sample - value) * kSmoothing;
+}
+
+void FramePacer::initialize(const vk::Device &device, const vk::PhysicalDevice &phyDevice, const uint32_t queueFamily, const uint32_t slotCount,
+    const uint32_t fpsLimit, const bool lowLatency, const double presentQueueFrames){
+    _device = device;
+    _fpsLimit = fpsLimit;
+    _lowLatency = lowLatency;
+    _presentQueueFrames = presentQueueFrames;
+    _slots.assign(slotCount, {});
+    _stats = {};
+
+    const auto props = phyDevice.getProperties();
+    const auto validBits = phyDevice.getQueueFamilyProperties()[queueFamily].timestampValidBits;
+    if(validBits == 0 || !props.limits.timestampComputeAndGraphics){
+        LOGW("Timestamps are not supported on the graphics queue, GPU frame time is unknown");
+        return;
+    }
+
+    _timestampPeriod = props.limits.timestampPeriod;
+    _timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    vk::QueryPoolCreateInfo info{};
+    info.queryType = vk::QueryType::eTimestamp;
+    info.queryCount = slotCount * 2;
+    _queries = _device.createQueryPool(info);
+}
+
+void FramePacer::destroy(){
+    if(!_device){
+        return;
+    }
+
+    _device.destroyQueryPool(_queries);
+    _queries = nullptr;
+    _device = nullptr;
+}
+
+void FramePacer::writeBegin(const vk::CommandBuffer &cmd, const uint32_t slot) const {
+    if(!_queries){
+        return;
+    }
+
+    cmd.resetQueryPool(_queries, slot * 2, 2);
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, _queries, slot * 2);
+}
+
+void FramePacer::writeEnd(const vk::CommandBuffer &cmd, const uint32_t slot) const {
+    if(!_queries){
+        return;
+    }
+
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, _queries, slot * 2 + 1);
+}
+
+void FramePacer::readGpuTime(const uint32_t slot){
+    auto &timing = _slots[slot];
+    if(!_queries || !timing.queried){
+        return;
+    }
+
+    timing.queried = false;
+    auto result = _device.getQueryPoolResults<uint64_t>(_queries, slot * 2, 2, 2 * sizeof(uint64_t), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    if(result.result != vk::Result::eSuccess){
+        return;
+    }
+
+    const auto ticks = (result.value[1] & _timestampMask) - (result.value[0] & _timestampMask);
+    _stats.lastGpuMs = ticks * _timestampPeriod / 1e6;
+    _stats.gpuMs = Smooth(_stats.gpuMs, _stats.lastGpuMs);
+    _stats.gpuSamples++;
+}
+
+void FramePacer::observeCompleted(const uint64_t completedFrame){
+    const auto now = Clock::now();
+    for(auto &timing : _slots){
+        if(timing.observed || timing.frame > completedFrame){
+            continue;
+        }
+
+        timing.observed = true;
+        const auto ms = std::chrono::duration<double, std::milli>(now - timing.inputTime).count();
+        _stats.latencyMs = Smooth(_stats.latencyMs, ms + _presentQueueFrames * _stats.frameMs);
+    }
+}
+
+void FramePacer::sleepUntil(const Clock::time_point target){
+    auto now = Clock::now();
+    if(target - now > kSpinThreshold){
+        std::this_thread::sleep_for(target - now - kSpinThreshold);
+    }
+    while(Clock::now() < target){
+        std::this_thread::yield();
+    }
+}
+
+void FramePacer::beginFrame(const uint32_t slot, const uint64_t frame, const uint64_t completedFrame){
+    observeCompleted(completedFrame);
+    // the scheduler released the slot, so its previous frame and timestamps are complete
+    readGpuTime(slot);
+
+    const auto now = Clock::now();
+    auto target = now;
+    if(_fpsLimit != 0 && _lastStart != Clock::time_point{}){
+        target = std::max(target, _lastStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / _fpsLimit)));
+    }
+
+    if(_lowLatency && _stats.gpuMs > 0.0 && _lastSubmit != Clock::time_point{}){
+        // the GPU finishes the previous frame around lastSubmit + gpu time, submit just before that
+        const auto ms = _stats.gpuMs - _stats.cpuMs - kLowLatencyMarginMs;
+        target = std::max(target, _lastSubmit + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms)));
+    }
+
+    _stats.delayMs = Smooth(_stats.delayMs, std::chrono::duration<double, std::milli>(target - now).count());
+    if(target > now){
+        sleepUntil(target);
+    }
+
+    const auto start = Clock::now();
+    if(_lastStart != Clock::time_point{}){
+        _stats.frameMs = Smooth(_stats.frameMs, std::chrono::duration<double, std::milli>(start - _lastStart).count());
+    }
+    _lastStart = start;
+    _slot = slot;
+
+    auto &timing = _slots[slot];
+    timing.frame = frame;
+    timing.inputTime = start;
+    timing.observed = true;
+    timing.queried = false;
+}
+
+void FramePacer::endFrame(){
+    _lastSubmit = Clock::now();
+    _stats.cpuMs = Smooth(_stats.cpuMs, std::chrono::duration<double, std::milli>(_lastSubmit - _lastStart).count());
+
+    auto &timing = _slots[_slot];
+    timing.observed = false;
+    timing.queried = _queries ? true : false;
+}
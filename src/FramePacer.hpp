@@ -0,0 +1,67 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+struct FramePacingStats{
+    double frameMs{};
+    double cpuMs{};
+    double gpuMs{};
+    // unsmoothed GPU time of the latest measured frame, gpuSamples counts the measurements
+    double lastGpuMs{};
+    uint64_t gpuSamples{};
+    double delayMs{};
+    // upper bound: input sample to GPU completion as first observed, plus the expected present queueing
+    double latencyMs{};
+};
+
+// Frame limiter and latency reduction. The GPU time of every frame is measured with timestamp
+// queries; in low-latency mode the CPU start of the next frame is delayed so its submit lands
+// right when the GPU finishes the previous one, instead of queueing behind it.
+class FramePacer{
+public:
+    void initialize(const vk::Device &device, const vk::PhysicalDevice &phyDevice, const uint32_t queueFamily, const uint32_t slotCount,
+        const uint32_t fpsLimit, const bool lowLatency, const double presentQueueFrames);
+    void destroy();
+
+    // Called once the slot was released by the scheduler, sleeps for the limiter or latency mode.
+    // Input has to be sampled after it returns, that moment is the start of the frame.
+    void beginFrame(const uint32_t slot, const uint64_t frame, const uint64_t completedFrame);
+    // Called right after the frame was submitted.
+    void endFrame();
+    // Observes frames that completed since the last call, used for the latency estimate.
+    void observeCompleted(const uint64_t completedFrame);
+
+    // Bracket the GPU work of the slot, safe inside cached command buffers since the queries are reset in them.
+    void writeBegin(const vk::CommandBuffer &cmd, const uint32_t slot) const;
+    void writeEnd(const vk::CommandBuffer &cmd, const uint32_t slot) const;
+
+    const FramePacingStats& stats() const { return _stats; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void readGpuTime(const uint32_t slot);
+    void sleepUntil(const Clock::time_point target);
+
+    struct SlotTiming{
+        uint64_t frame{};
+        Clock::time_point inputTime{};
+        bool observed{true};
+        bool queried{false};
+    };
+
+    vk::Device _device{};
+    vk::QueryPool _queries{};
+    double _timestampPeriod{};
+    uint64_t _timestampMask{};
+    uint32_t _fpsLimit{};
+    bool _lowLatency{false};
+    double _presentQueueFrames{};
+    std::vector<SlotTiming> _slots{};
+    uint32_t _slot{};
+    Clock::time_point _lastStart{};
+    Clock::time_point _lastSubmit{};
+    FramePacingStats _stats{};
+};
@@ -0,0 +1,79 @@
+#include "FrameScheduler.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <chrono>
+
+static constexpr const uint64_t kWaitTimeoutNs = 1000ull * 1000ull * 1000ull;
+static constexpr const uint64_t kStatsReportInterval = 600;
+static constexpr const double kStatsSmoothing = 0.05;
+
+void FrameScheduler::initialize(const vk::Device &device, const uint32_t framesInFlight){
+    _device = device;
+    _framesInFlight = std::max(framesInFlight, 1u);
+    _submitted = 0;
+    _slot = 0;
+    _stats = {};
+
+    vk::SemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.semaphoreType = vk::SemaphoreType::eTimeline;
+    typeInfo.initialValue = 0;
+
+    vk::SemaphoreCreateInfo info{};
+    info.pNext = &typeInfo;
+    _timeline = _device.createSemaphore(info);
+    LOGI("Frame scheduler uses a timeline semaphore with {} frames in flight", _framesInFlight);
+}
+
+void FrameScheduler::destroy(){
+    if(!_device){
+        return;
+    }
+
+    _device.destroySemaphore(_timeline);
+    _timeline = nullptr;
+    _device = nullptr;
+}
+
+uint64_t FrameScheduler::completedFrame() const {
+    return _device.getSemaphoreCounterValue(_timeline);
+}
+
+bool FrameScheduler::isFrameComplete(const uint64_t frame) const {
+    return completedFrame() >= frame;
+}
+
+void FrameScheduler::waitFrame(const uint64_t frame){
+    vk::SemaphoreWaitInfo waitInfo{};
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &_timeline;
+    waitInfo.pValues = &frame;
+    while(_device.waitSemaphores(waitInfo, kWaitTimeoutNs) == vk::Result::eTimeout){
+        LOGW("GPU has not finished frame {} after {} ms, completed frame is {}", frame, kWaitTimeoutNs / 1000000, completedFrame());
+    }
+}
+
+uint32_t FrameScheduler::beginFrame(){
+    const auto frame = frameValue();
+    _slot = static_cast<uint32_t>((frame - 1) % _framesInFlight);
+
+    double waitMs = 0.0;
+    if(frame > _framesInFlight && !isFrameComplete(frame - _framesInFlight)){
+        const auto start = std::chrono::steady_clock::now();
+        waitFrame(frame - _framesInFlight);
+        waitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    _stats.lastWaitMs = waitMs;
+    _stats.maxWaitMs = std::max(_stats.maxWaitMs, waitMs);
+    _stats.avgWaitMs = _stats.frames == 0 ? waitMs : _stats.avgWaitMs + (waitMs - _stats.avgWaitMs) * kStatsSmoothing;
+    return _slot;
+}
+
+void FrameScheduler::endFrame(){
+    _submitted++;
+    _stats.frames++;
+    if(_stats.frames % kStatsReportInterval == 0){
+        LOGD("Frame {}: CPU waited on GPU {:.3f} ms (avg {:.3f} ms, max {:.3f} ms) with {} frames in flight",
+            _submitted, _stats.lastWaitMs, _stats.avgWaitMs, _stats.maxWaitMs, _framesInFlight);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+struct FrameWaitStats{
+    double lastWaitMs{};
+    double avgWaitMs{};
+    double maxWaitMs{};
+    uint64_t frames{};
+};
+
+// Paces frames in flight with a single timeline semaphore. Frame N (1-based) signals
+// value N when its submission retires, so frame N may start once N - framesInFlight is done.
+class FrameScheduler{
+public:
+    void initialize(const vk::Device &device, const uint32_t framesInFlight);
+    void destroy();
+
+    // Waits until the slot of the next frame is released by the GPU and returns the slot index.
+    uint32_t beginFrame();
+    // Must be called once the frame returned by beginFrame() has been submitted.
+    void endFrame();
+
+    bool isFrameComplete(const uint64_t frame) const;
+    uint64_t completedFrame() const;
+    void waitFrame(const uint64_t frame);
+
+    vk::Semaphore timeline() const { return _timeline; }
+    uint64_t frameValue() const { return _submitted + 1; }
+    uint64_t submittedFrame() const { return _submitted; }
+    uint32_t currentSlot() const { return _slot; }
+    uint32_t framesInFlight() const { return _framesInFlight; }
+    const FrameWaitStats& stats() const { return _stats; }
+
+private:
+    vk::Device _device{};
+    vk::Semaphore _timeline{};
+    uint32_t _framesInFlight{};
+    uint32_t _slot{};
+    uint64_t _submitted{};
+    FrameWaitStats _stats{};
+};
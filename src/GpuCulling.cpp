@@ -0,0 +1,520 @@
+#include "GpuCulling.hpp"
+#include "Log.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+static constexpr const uint32_t kCullGroupSize = 64;
+static constexpr const uint32_t kPyramidGroupSize = 8;
+static constexpr const uint32_t kDrawStride = sizeof(vk::DrawIndexedIndirectCommand);
+// objects per job of the CPU reference
+static constexpr const uint32_t kReferenceGrain = 1024;
+// Visibility bits of cull.comp: drawn last frame, inside the frustum
+static constexpr const uint32_t kVisibleBit = 1;
+static constexpr const uint32_t kInFrustumBit = 2;
+
+static const std::vector<DescriptorPoolRatio> kCullDescriptorRatios = {
+    {vk::DescriptorType::eUniformBuffer, 0.5f},
+    {vk::DescriptorType::eStorageBuffer, 2.5f},
+    {vk::DescriptorType::eCombinedImageSampler, 1.0f},
+    {vk::DescriptorType::eStorageImage, 1.0f}
+};
+
+// matches the push constant block of cull.comp
+struct CullParams{
+    uint32_t objectCount{};
+    uint32_t indexCount{};
+    uint32_t pyramidMips{};
+    uint32_t pad{};
+    float pyramidWidth{};
+    float pyramidHeight{};
+};
+
+// matches the Stats block of cull.comp, the draw counts are copied in from the count buffer
+struct CullCounters{
+    uint32_t earlyDraws{};
+    uint32_t lateDraws{};
+    uint32_t frustumCulled{};
+    uint32_t occluded{};
+    uint32_t tested{};
+};
+
+static constexpr const vk::DeviceSize kCountsSize = 2 * sizeof(uint32_t);
+
+bool OutsideFrustum(const glm::mat4 &mvp, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax){
+    uint32_t outside = 0x3f;
+    for(uint32_t i = 0;i < 8;i ++){
+        const glm::vec3 corner((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z);
+        const auto clip = mvp * glm::vec4(corner, 1.0f);
+        uint32_t code = 0;
+        code |= clip.x < -clip.w ? 0x01 : 0;
+        code |= clip.x > clip.w ? 0x02 : 0;
+        code |= clip.y < -clip.w ? 0x04 : 0;
+        code |= clip.y > clip.w ? 0x08 : 0;
+        code |= clip.z < 0.0f ? 0x10 : 0;
+        code |= clip.z > clip.w ? 0x20 : 0;
+        outside &= code;
+    }
+    return outside != 0;
+}
+
+std::pmr::vector<uint32_t> FrustumCullReference(const std::vector<SceneObject> &objects, const glm::mat4 &viewProjModel, JobSystem *jobs,
+    std::pmr::memory_resource *scratch){
+    const auto count = static_cast<uint32_t>(objects.size());
+    std::pmr::vector<uint8_t> inside(count, scratch);
+    const auto test = [&](const uint32_t begin, const uint32_t end){
+        for(uint32_t i = begin;i < end;i ++){
+            const auto &object = objects[i];
+            inside[i] = OutsideFrustum(viewProjModel * object.model, object.boundsMin, object.boundsMax) ? 0 : 1;
+        }
+    };
+    if(jobs && count > kReferenceGrain){
+        jobs->wait(jobs->parallelFor(count, kReferenceGrain, test));
+    }else{
+        test(0, count);
+    }
+
+    // reserved up front, growing would leave every smaller copy behind in an arena
+    std::pmr::vector<uint32_t> visible(scratch);
+    visible.reserve(count);
+    for(uint32_t i = 0;i < count;i ++){
+        if(inside[i]){
+            visible.push_back(i);
+        }
+    }
+    return visible;
+}
+
+GpuCuller::Buffer GpuCuller::createBuffer(const vk::DeviceSize size, const vk::BufferUsageFlags usage, const vk::MemoryPropertyFlags properties, const bool map){
+    const auto &device = _desc.device;
+    Buffer result{};
+    vk::BufferCreateInfo info{};
+    info.size = size;
+    info.usage = usage;
+    info.sharingMode = vk::SharingMode::eExclusive;
+    result.buffer = device.createBuffer(info);
+
+    const auto requirements = device.getBufferMemoryRequirements(result.buffer);
+    vk::MemoryAllocateInfo allocInfo{};
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = Utils::Vulkan::FindMemoryType(_desc.phyDevice, requirements.memoryTypeBits, properties);
+    result.memory = device.allocateMemory(allocInfo);
+    device.bindBufferMemory(result.buffer, result.memory, 0);
+    if(map){
+        result.mapped = device.mapMemory(result.memory, 0, size);
+    }
+    _desc.tracker->registerBuffer(result.buffer);
+    return result;
+}
+
+void GpuCuller::destroyBuffer(Buffer &buffer){
+    if(!buffer.buffer){
+        return;
+    }
+
+    _desc.tracker->forget(buffer.buffer);
+    _desc.device.destroyBuffer(buffer.buffer);
+    _desc.device.freeMemory(buffer.memory);
+    buffer = {};
+}
+
+vk::Pipeline GpuCuller::createComputePipeline(const char *name, const vk::PipelineLayout layout, const ShaderSpecialization &spec){
+    const auto binary = _desc.shaders->load(name, ShaderStage::Compute);
+    auto module = _desc.device.createShaderModuleUnique({vk::ShaderModuleCreateFlags(), binary.code.size() * sizeof(uint32_t), binary.code.data()});
+
+    vk::SpecializationInfo specInfo{};
+    specInfo.mapEntryCount = spec.entries.size();
+    specInfo.pMapEntries = spec.entries.data();
+    specInfo.dataSize = spec.data.size();
+    specInfo.pData = spec.data.data();
+
+    vk::ComputePipelineCreateInfo info{};
+    info.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    info.stage.module = *module;
+    info.stage.pName = "main";
+    info.stage.pSpecializationInfo = spec.empty() ? nullptr : &specInfo;
+    info.layout = layout;
+    // small and needed before the first frame, compiled right here instead of on the pipeline workers
+    return _desc.device.createComputePipeline(_desc.pipelineCache, info).value;
+}
+
+void GpuCuller::initialize(const GpuCullerDesc &desc){
+    _desc = desc;
+    const auto &device = _desc.device;
+    const auto compute = vk::ShaderStageFlagBits::eCompute;
+    _pyramidInitLayout = _desc.layouts->get({
+        {0, vk::DescriptorType::eCombinedImageSampler, 1, compute},
+        {1, vk::DescriptorType::eStorageImage, 1, compute}
+    });
+    // same bindings, the cache hands out the same layout
+    _pyramidReduceLayout = _pyramidInitLayout;
+    _cullLayout = _desc.layouts->get({
+        {0, vk::DescriptorType::eUniformBuffer, 1, compute},
+        {1, vk::DescriptorType::eStorageBuffer, 1, compute},
+        {2, vk::DescriptorType::eStorageBuffer, 1, compute},
+        {3, vk::DescriptorType::eStorageBuffer, 1, compute},
+        {4, vk::DescriptorType::eStorageBuffer, 1, compute},
+        {5, vk::DescriptorType::eCombinedImageSampler, 1, compute},
+        {6, vk::DescriptorType::eStorageBuffer, 1, compute}
+    });
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &_pyramidInitLayout;
+    _pyramidInitPipelineLayout = device.createPipelineLayout(layoutInfo);
+    _pyramidReducePipelineLayout = device.createPipelineLayout(layoutInfo);
+
+    vk::PushConstantRange pushRange{compute, 0, sizeof(CullParams)};
+    layoutInfo.pSetLayouts = &_cullLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    _cullPipelineLayout = device.createPipelineLayout(layoutInfo);
+
+    try{
+        const auto occlusion = _desc.occlusion ? VK_TRUE : VK_FALSE;
+        ShaderSpecialization phase{};
+        phase.set<VkBool32>(0, VK_FALSE).set<VkBool32>(1, occlusion);
+        _cullEarly = createComputePipeline("cull.comp", _cullPipelineLayout, phase);
+        if(_desc.occlusion){
+            // a single sampled depth buffer is not a sampler2DMS, so it gets its own shader
+            const auto multisampled = _desc.depthSamples != vk::SampleCountFlagBits::e1;
+            ShaderSpecialization samples{};
+            samples.set<int32_t>(0, static_cast<int32_t>(_desc.depthSamples));
+            _pyramidInit = createComputePipeline(multisampled ? "hiz_depth_ms.comp" : "hiz_depth.comp", _pyramidInitPipelineLayout, multisampled ? samples : ShaderSpecialization{});
+            _pyramidReduce = createComputePipeline("hiz_reduce.comp", _pyramidReducePipelineLayout, {});
+            phase = {};
+            phase.set<VkBool32>(0, VK_TRUE).set<VkBool32>(1, occlusion);
+            _cullLate = createComputePipeline("cull.comp", _cullPipelineLayout, phase);
+        }
+    }catch(const std::runtime_error &err){
+        LOGW("GPU culling is disabled, its shaders are not available: {}", err.what());
+        destroy();
+        return;
+    }
+
+    vk::SamplerCreateInfo samplerInfo{};
+    samplerInfo.magFilter = vk::Filter::eNearest;
+    samplerInfo.minFilter = vk::Filter::eNearest;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    _sampler = device.createSampler(samplerInfo);
+
+    _visibility = createBuffer(_desc.objectCount * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal, false);
+    _slots.resize(_desc.uniforms.size());
+    for(auto &slot : _slots){
+        // early commands first, late ones after them
+        slot.draws = createBuffer(2ull * _desc.objectCount * kDrawStride, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+            vk::MemoryPropertyFlagBits::eDeviceLocal, false);
+        slot.counts = createBuffer(kCountsSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+            vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal, false);
+        slot.stats = createBuffer(sizeof(CullCounters), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, true);
+        if(_desc.readback){
+            slot.results = createBuffer(_desc.objectCount * sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferDst,
+                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, true);
+        }
+    }
+
+    _stats = {};
+    _stats.objects = _desc.objectCount;
+    _enabled = true;
+    LOGI("{} of {} objects", _desc.occlusion ? "Two-phase occlusion culling" : "GPU frustum culling", _desc.objectCount);
+}
+
+void GpuCuller::destroy(){
+    const auto &device = _desc.device;
+    if(!device){
+        return;
+    }
+
+    for(auto view : _mipViews){
+        device.destroyImageView(view);
+    }
+    _mipViews.clear();
+    _mipSets.clear();
+    if(_pyramid){
+        _desc.tracker->forget(_pyramid);
+        device.destroyImageView(_pyramidView);
+        device.destroyImage(_pyramid);
+        device.freeMemory(_pyramidMemory);
+        _pyramid = nullptr;
+        _pyramidView = nullptr;
+    }
+    if(_descriptors){
+        _descriptors->destroy();
+        _descriptors.reset();
+    }
+
+    for(auto &slot : _slots){
+        destroyBuffer(slot.draws);
+        destroyBuffer(slot.counts);
+        destroyBuffer(slot.stats);
+        destroyBuffer(slot.results);
+    }
+    _slots.clear();
+    destroyBuffer(_visibility);
+
+    device.destroySampler(_sampler);
+    device.destroyPipeline(_pyramidInit);
+    device.destroyPipeline(_pyramidReduce);
+    device.destroyPipeline(_cullEarly);
+    device.destroyPipeline(_cullLate);
+    device.destroyPipelineLayout(_pyramidInitPipelineLayout);
+    device.destroyPipelineLayout(_pyramidReducePipelineLayout);
+    device.destroyPipelineLayout(_cullPipelineLayout);
+    _sampler = nullptr;
+    _pyramidInit = _pyramidReduce = _cullEarly = _cullLate = nullptr;
+    _pyramidInitPipelineLayout = _pyramidReducePipelineLayout = _cullPipelineLayout = nullptr;
+    _extent = vk::Extent2D{};
+    _enabled = false;
+    _desc = {};
+}
+
+void GpuCuller::resize(const vk::Extent2D extent, const vk::ImageView depthView, DeletionQueue &deferred, const uint64_t retireValue){
+    if(!_enabled){
+        return;
+    }
+
+    const auto &device = _desc.device;
+    if(_pyramid){
+        _desc.tracker->forget(_pyramid);
+        deferred.push(retireValue, [device, image = _pyramid, memory = _pyramidMemory, view = _pyramidView, mipViews = _mipViews, descriptors = _descriptors](){
+            for(auto mipView : mipViews){
+                device.destroyImageView(mipView);
+            }
+            device.destroyImageView(view);
+            device.destroyImage(image);
+            device.freeMemory(memory);
+            descriptors->destroy();
+        });
+        _mipViews.clear();
+        _mipSets.clear();
+    }
+
+    // mip 0 matches the depth buffer texel for texel, later mips halve and round down like any mip chain.
+    // Frustum culling never samples it, a single texel keeps the cull sets valid
+    _extent = _desc.occlusion ? extent : vk::Extent2D{1, 1};
+    _viewport = extent;
+    const auto mips = static_cast<uint32_t>(std::floor(std::log2(std::max(_extent.width, _extent.height)))) + 1;
+    vk::ImageCreateInfo imageInfo{};
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = vk::Format::eR32Sfloat;
+    imageInfo.extent = vk::Extent3D{_extent.width, _extent.height, 1};
+    imageInfo.mipLevels = mips;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled;
+    imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+    _pyramid = device.createImage(imageInfo);
+
+    const auto requirements = device.getImageMemoryRequirements(_pyramid);
+    vk::MemoryAllocateInfo allocInfo{};
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = Utils::Vulkan::FindMemoryType(_desc.phyDevice, requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    _pyramidMemory = device.allocateMemory(allocInfo);
+    device.bindImageMemory(_pyramid, _pyramidMemory, 0);
+    _desc.tracker->registerImage(_pyramid, vk::ImageAspectFlagBits::eColor, mips);
+
+    vk::ImageViewCreateInfo viewInfo{};
+    viewInfo.image = _pyramid;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = imageInfo.format;
+    viewInfo.subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, mips, 0, 1};
+    _pyramidView = device.createImageView(viewInfo);
+    for(uint32_t mip = 0;mip < mips;mip ++){
+        viewInfo.subresourceRange.baseMipLevel = mip;
+        viewInfo.subresourceRange.levelCount = 1;
+        _mipViews.push_back(device.createImageView(viewInfo));
+    }
+
+    // the previous sets may still be bound by frames in flight, so every resize starts a new allocator
+    _descriptors = std::make_shared<DescriptorAllocator>();
+    _descriptors->initialize(device, kCullDescriptorRatios, mips + 2 * static_cast<uint32_t>(_slots.size()));
+
+    std::vector<vk::DescriptorImageInfo> imageInfos(mips * 2);
+    std::vector<vk::WriteDescriptorSet> writes{};
+    for(uint32_t mip = 0;mip < mips && _desc.occlusion;mip ++){
+        const auto set = _descriptors->allocate(_pyramidInitLayout);
+        _mipSets.push_back(set);
+        auto &src = imageInfos[mip * 2];
+        src.sampler = _sampler;
+        src.imageView = mip == 0 ? depthView : _mipViews[mip - 1];
+        src.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        auto &dst = imageInfos[mip * 2 + 1];
+        dst.imageView = _mipViews[mip];
+        dst.imageLayout = vk::ImageLayout::eGeneral;
+        writes.push_back({set, 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &src});
+        writes.push_back({set, 1, 0, 1, vk::DescriptorType::eStorageImage, &dst});
+    }
+
+    vk::DescriptorImageInfo pyramidInfo{_sampler, _pyramidView, vk::ImageLayout::eShaderReadOnlyOptimal};
+    std::vector<vk::DescriptorBufferInfo> bufferInfos(_slots.size() * 6);
+    for(size_t i = 0;i < _slots.size();i ++){
+        auto &slot = _slots[i];
+        auto *buffers = &bufferInfos[i * 6];
+        buffers[0] = {_desc.uniforms[i], 0, VK_WHOLE_SIZE};
+        buffers[1] = {_desc.objects, i * _desc.objectSlotSize, _desc.objectSlotSize ? _desc.objectSlotSize : VK_WHOLE_SIZE};
+        buffers[2] = {_visibility.buffer, 0, VK_WHOLE_SIZE};
+        buffers[3] = {slot.draws.buffer, 0, VK_WHOLE_SIZE};
+        buffers[4] = {slot.stats.buffer, 0, VK_WHOLE_SIZE};
+        buffers[5] = {slot.counts.buffer, 0, VK_WHOLE_SIZE};
+        slot.earlySet = _descriptors->allocate(_cullLayout);
+        slot.lateSet = _descriptors->allocate(_cullLayout);
+        for(auto set : {slot.earlySet, slot.lateSet}){
+            writes.push_back({set, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &buffers[0]});
+            for(uint32_t binding = 1;binding < 5;binding ++){
+                writes.push_back({set, binding, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &buffers[binding]});
+            }
+            writes.push_back({set, 5, 0, 1, vk::DescriptorType::eCombinedImageSampler, &pyramidInfo});
+            writes.push_back({set, 6, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &buffers[5]});
+        }
+    }
+    device.updateDescriptorSets(writes, {});
+}
+
+void GpuCuller::recordReset(const vk::CommandBuffer &cmd){
+    if(!_enabled){
+        return;
+    }
+
+    auto &tracker = *_desc.tracker;
+    tracker.useBuffer(_visibility.buffer, ResourceUse::TransferDst);
+    tracker.flush(cmd);
+    cmd.fillBuffer(_visibility.buffer, 0, VK_WHOLE_SIZE, kVisibleBit);
+    tracker.useBuffer(_visibility.buffer, ResourceUse::ComputeShaderRead);
+    tracker.flush(cmd);
+}
+
+void GpuCuller::beginFrame(const uint32_t slotIndex){
+    _slot = slotIndex;
+    if(!_enabled){
+        return;
+    }
+
+    auto &slot = _slots[slotIndex];
+    if(!slot.submitted){
+        slot.submitted = true;
+        return;
+    }
+
+    // written by the slot's previous frame, which the scheduler already waited for
+    const auto &counters = *static_cast<const CullCounters*>(slot.stats.mapped);
+    _stats.earlyDraws = counters.earlyDraws;
+    _stats.lateDraws = counters.lateDraws;
+    _stats.frustumCulled = counters.frustumCulled;
+    _stats.occluded = counters.occluded;
+    _stats.valid = counters.tested == _desc.objectCount;
+}
+
+std::pmr::vector<uint32_t> GpuCuller::frustumSurvivors(const uint32_t slot, std::pmr::memory_resource *scratch) const {
+    std::pmr::vector<uint32_t> survivors(scratch);
+    const auto *results = static_cast<const uint32_t*>(_slots[slot].results.mapped);
+    if(!results){
+        return survivors;
+    }
+
+    survivors.reserve(_desc.objectCount);
+    for(uint32_t i = 0;i < _desc.objectCount;i ++){
+        if(results[i] & kInFrustumBit){
+            survivors.push_back(i);
+        }
+    }
+    return survivors;
+}
+
+void GpuCuller::recordCull(const vk::CommandBuffer &cmd, const uint32_t slotIndex, const bool late){
+    auto &tracker = *_desc.tracker;
+    auto &slot = _slots[slotIndex];
+    if(!late){
+        tracker.useBuffer(slot.stats.buffer, ResourceUse::TransferDst);
+        tracker.useBuffer(slot.counts.buffer, ResourceUse::TransferDst);
+        tracker.flush(cmd);
+        cmd.fillBuffer(slot.stats.buffer, 0, VK_WHOLE_SIZE, 0);
+        cmd.fillBuffer(slot.counts.buffer, 0, VK_WHOLE_SIZE, 0);
+    }
+
+    // the last phase writes the visibility, which is the first one without occlusion
+    const auto last = late || !_desc.occlusion;
+    tracker.useBuffer(_visibility.buffer, last ? ResourceUse::ComputeShaderWrite : ResourceUse::ComputeShaderRead);
+    tracker.useBuffer(slot.draws.buffer, ResourceUse::ComputeShaderWrite);
+    tracker.useBuffer(slot.counts.buffer, ResourceUse::ComputeShaderWrite);
+    tracker.useBuffer(slot.stats.buffer, ResourceUse::ComputeShaderWrite);
+    // the early phase does not sample the pyramid, it only has to be in the layout the set was written with
+    tracker.useImage(_pyramid, ResourceUse::ComputeShaderRead);
+    tracker.flush(cmd);
+
+    CullParams params{};
+    params.objectCount = _desc.objectCount;
+    params.indexCount = _desc.indexCount;
+    params.pyramidMips = static_cast<uint32_t>(_mipViews.size());
+    params.pyramidWidth = static_cast<float>(_viewport.width);
+    params.pyramidHeight = static_cast<float>(_viewport.height);
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, late ? _cullLate : _cullEarly);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, _cullPipelineLayout, 0, late ? slot.lateSet : slot.earlySet, {});
+    cmd.pushConstants(_cullPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(params), &params);
+    cmd.dispatch((_desc.objectCount + kCullGroupSize - 1) / kCullGroupSize, 1, 1);
+
+    if(last){
+        // the statistics report the draws that were actually recorded
+        tracker.useBuffer(slot.counts.buffer, ResourceUse::TransferSrc);
+        tracker.useBuffer(slot.stats.buffer, ResourceUse::TransferDst);
+        if(slot.results.buffer){
+            tracker.useBuffer(_visibility.buffer, ResourceUse::TransferSrc);
+            tracker.useBuffer(slot.results.buffer, ResourceUse::TransferDst);
+        }
+        tracker.flush(cmd);
+        cmd.copyBuffer(slot.counts.buffer, slot.stats.buffer, vk::BufferCopy{0, 0, kCountsSize});
+        tracker.useBuffer(slot.stats.buffer, ResourceUse::HostRead);
+        if(slot.results.buffer){
+            cmd.copyBuffer(_visibility.buffer, slot.results.buffer, vk::BufferCopy{0, 0, _desc.objectCount * sizeof(uint32_t)});
+            tracker.useBuffer(slot.results.buffer, ResourceUse::HostRead);
+        }
+    }
+    tracker.useBuffer(slot.draws.buffer, ResourceUse::IndirectBuffer);
+    tracker.useBuffer(slot.counts.buffer, ResourceUse::IndirectBuffer);
+    tracker.flush(cmd);
+}
+
+void GpuCuller::recordEarly(const vk::CommandBuffer &cmd, const uint32_t slot){
+    recordCull(cmd, slot, false);
+}
+
+void GpuCuller::recordLate(const vk::CommandBuffer &cmd, const uint32_t slot){
+    recordCull(cmd, slot, true);
+}
+
+void GpuCuller::recordPyramid(const vk::CommandBuffer &cmd){
+    auto &tracker = *_desc.tracker;
+    const auto mips = static_cast<uint32_t>(_mipViews.size());
+    for(uint32_t mip = 0;mip < mips;mip ++){
+        if(mip > 0){
+            tracker.useImage(_pyramid, ResourceUse::ComputeShaderRead, mip - 1, 1);
+        }
+        tracker.useImage(_pyramid, ResourceUse::ComputeShaderWrite, mip, 1);
+        tracker.flush(cmd);
+
+        const auto width = std::max(_extent.width >> mip, 1u);
+        const auto height = std::max(_extent.height >> mip, 1u);
+        const auto layout = mip == 0 ? _pyramidInitPipelineLayout : _pyramidReducePipelineLayout;
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, mip == 0 ? _pyramidInit : _pyramidReduce);
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, layout, 0, _mipSets[mip], {});
+        cmd.dispatch((width + kPyramidGroupSize - 1) / kPyramidGroupSize, (height + kPyramidGroupSize - 1) / kPyramidGroupSize, 1);
+    }
+}
+
+void GpuCuller::drawEarly(const vk::CommandBuffer &cmd, const uint32_t slot) const {
+    const auto &buffers = _slots[slot];
+    cmd.drawIndexedIndirectCount(buffers.draws.buffer, 0, buffers.counts.buffer, 0, _desc.objectCount, kDrawStride);
+}
+
+void GpuCuller::drawLate(const vk::CommandBuffer &cmd, const uint32_t slot) const {
+    const auto &buffers = _slots[slot];
+    cmd.drawIndexedIndirectCount(buffers.draws.buffer, static_cast<vk::DeviceSize>(_desc.objectCount) * kDrawStride,
+        buffers.counts.buffer, sizeof(uint32_t), _desc.objectCount, kDrawStride);
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.hpp>
+#include "DeletionQueue.hpp"
+#include "DescriptorAllocator.hpp"
+#include "JobSystem.hpp"
+#include "ResourceStateTracker.hpp"
+#include "Scene.hpp"
+#include "ShaderLibrary.hpp"
+
+struct CullingStats{
+    uint32_t objects{};
+    // objects visible last frame, drawn before the pyramid is built
+    uint32_t earlyDraws{};
+    // objects that became visible this frame
+    uint32_t lateDraws{};
+    uint32_t frustumCulled{};
+    // inside the frustum but behind the depth pyramid
+    uint32_t occluded{};
+    bool valid{false};
+};
+
+struct GpuCullerDesc{
+    vk::Device device{};
+    vk::PhysicalDevice phyDevice{};
+    vk::PipelineCache pipelineCache{};
+    ShaderLibrary *shaders{};
+    DescriptorLayoutCache *layouts{};
+    ResourceStateTracker *tracker{};
+    // MVPUniformMatrix of every frame slot
+    std::vector<vk::Buffer> uniforms{};
+    vk::Buffer objects{};
+    // offset between the objects of consecutive frame slots, 0 when they share one copy
+    vk::DeviceSize objectSlotSize{};
+    uint32_t objectCount{};
+    uint32_t indexCount{};
+    vk::SampleCountFlagBits depthSamples{vk::SampleCountFlagBits::e1};
+    // false only culls against the frustum, without the depth pre-pass and the pyramid
+    bool occlusion{true};
+    // copies the per-object frustum results of every frame back for frustumSurvivors()
+    bool readback{false};
+};
+
+// Two-phase occlusion culling against a hierarchical depth pyramid. Phase one draws what was
+// visible last frame into the depth pre-pass, the pyramid is built from that depth, and phase
+// two tests every object against it: objects that turned visible are drawn late in the same
+// frame so nothing pops in, and the visibility is kept for the next frame's first phase.
+// Both phases also cull against the view frustum. Surviving objects are appended to a compacted
+// list of indirect commands with one instance each, firstInstance selects the object, and the
+// list length goes to a count buffer, so recording the draws costs the same for any object count.
+// Without occlusion only the first phase runs, it draws everything inside the frustum and needs
+// neither the pre-pass nor the pyramid.
+class GpuCuller{
+public:
+    void initialize(const GpuCullerDesc &desc);
+    void destroy();
+    // Follows the depth buffer size, resources still used by frames in flight are retired through the queue.
+    void resize(const vk::Extent2D extent, const vk::ImageView depthView, DeletionQueue &deferred, const uint64_t retireValue);
+    // Rendered part of the depth buffer, anchored at the origin. The rest has to hold the far depth.
+    void setViewport(const vk::Extent2D extent) { _viewport = extent; }
+    // Marks every object visible, so the first frame draws everything early. Needs a command buffer outside of any frame.
+    void recordReset(const vk::CommandBuffer &cmd);
+
+    // Reads back the statistics of the slot's previous frame, the slot has to be retired.
+    void beginFrame(const uint32_t slot);
+    // Objects the slot's previous frame found inside the frustum, in index order. Needs the readback.
+    std::pmr::vector<uint32_t> frustumSurvivors(const uint32_t slot, std::pmr::memory_resource *scratch) const;
+    void recordEarly(const vk::CommandBuffer &cmd, const uint32_t slot);
+    // depthImage has to be readable by compute shaders already.
+    void recordPyramid(const vk::CommandBuffer &cmd);
+    void recordLate(const vk::CommandBuffer &cmd, const uint32_t slot);
+    // Inside a render pass, both phases leave their draw commands and counts readable for indirect draws.
+    void drawEarly(const vk::CommandBuffer &cmd, const uint32_t slot) const;
+    void drawLate(const vk::CommandBuffer &cmd, const uint32_t slot) const;
+
+    bool enabled() const { return _enabled; }
+    // the two-phase mode, recordPyramid(), recordLate() and drawLate() are only used with it
+    bool occlusion() const { return _enabled && _desc.occlusion; }
+    const CullingStats& stats() const { return _stats; }
+
+private:
+    struct Buffer{
+        vk::Buffer buffer{};
+        vk::DeviceMemory memory{};
+        void *mapped{};
+    };
+
+    struct Slot{
+        Buffer draws{};
+        // early and late draw count, copied into stats at the end of the frame
+        Buffer counts{};
+        Buffer stats{};
+        // per-object results of the last phase, only with the readback
+        Buffer results{};
+        vk::DescriptorSet earlySet{};
+        vk::DescriptorSet lateSet{};
+        bool submitted{false};
+    };
+
+    Buffer createBuffer(const vk::DeviceSize size, const vk::BufferUsageFlags usage, const vk::MemoryPropertyFlags properties, const bool map);
+    void destroyBuffer(Buffer &buffer);
+    vk::Pipeline createComputePipeline(const char *name, const vk::PipelineLayout layout, const ShaderSpecialization &spec);
+    void recordCull(const vk::CommandBuffer &cmd, const uint32_t slot, const bool late);
+
+    GpuCullerDesc _desc{};
+    bool _enabled{false};
+    vk::DescriptorSetLayout _pyramidInitLayout{};
+    vk::DescriptorSetLayout _pyramidReduceLayout{};
+    vk::DescriptorSetLayout _cullLayout{};
+    vk::PipelineLayout _pyramidInitPipelineLayout{};
+    vk::PipelineLayout _pyramidReducePipelineLayout{};
+    vk::PipelineLayout _cullPipelineLayout{};
+    vk::Pipeline _pyramidInit{};
+    vk::Pipeline _pyramidReduce{};
+    vk::Pipeline _cullEarly{};
+    vk::Pipeline _cullLate{};
+    vk::Sampler _sampler{};
+    Buffer _visibility{};
+    std::vector<Slot> _slots{};
+    uint32_t _slot{};
+
+    // everything below depends on the depth buffer size and is replaced by resize()
+    vk::Extent2D _extent{};
+    vk::Extent2D _viewport{};
+    vk::Image _pyramid{};
+    vk::DeviceMemory _pyramidMemory{};
+    vk::ImageView _pyramidView{};
+    std::vector<vk::ImageView> _mipViews{};
+    std::vector<vk::DescriptorSet> _mipSets{};
+    std::shared_ptr<DescriptorAllocator> _descriptors{};
+
+    CullingStats _stats{};
+};
+
+// True when every corner of the bounds lies outside the same clip plane, the test of cull.comp.
+bool OutsideFrustum(const glm::mat4 &mvp, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
+
+// CPU version of the frustum test in cull.comp: indices of the objects that survive it for
+// the given projection * view * model matrix, used to validate the GPU results. Large scenes are
+// tested on the workers when a job system is given, those jobs still come from the heap. The
+// temporaries and the result come from scratch.
+std::pmr::vector<uint32_t> FrustumCullReference(const std::vector<SceneObject> &objects, const glm::mat4 &viewProjModel, JobSystem *jobs = nullptr,
+    std::pmr::memory_resource *scratch = std::pmr::get_default_resource());
@@ -0,0 +1,193 @@
+#include "GpuProfiler.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include <algorithm>
+#include <array>
+
+// two queries per scope
+static constexpr const uint32_t kMaxScopes = 64;
+static constexpr const double kSmoothing = 0.05;
+
+void GpuProfiler::initialize(const vk::Device &device, const vk::PhysicalDevice &phyDevice, const uint32_t queueFamily, const uint32_t slotCount, const bool pipelineStatistics){
+    _slots.assign(slotCount, {});
+    _scopes.clear();
+    _fragments = 0;
+
+    const auto props = phyDevice.getProperties();
+    const auto validBits = phyDevice.getQueueFamilyProperties()[queueFamily].timestampValidBits;
+    if(validBits == 0 || !props.limits.timestampComputeAndGraphics){
+        LOGW("Timestamps are not supported on the graphics queue, the GPU profiler is disabled");
+        return;
+    }
+
+    _device = device;
+    _timestampPeriod = props.limits.timestampPeriod;
+    _timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    vk::QueryPoolCreateInfo info{};
+    info.queryType = vk::QueryType::eTimestamp;
+    info.queryCount = kMaxScopes * 2;
+    for(auto &slot : _slots){
+        slot.queries = _device.createQueryPool(info);
+    }
+
+    if(pipelineStatistics){
+        vk::QueryPoolCreateInfo statsInfo{};
+        statsInfo.queryType = vk::QueryType::ePipelineStatistics;
+        statsInfo.queryCount = 1;
+        statsInfo.pipelineStatistics = vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+        for(auto &slot : _slots){
+            slot.statistics = _device.createQueryPool(statsInfo);
+        }
+    }
+}
+
+void GpuProfiler::destroy(){
+    if(!_device){
+        return;
+    }
+
+    for(auto &slot : _slots){
+        _device.destroyQueryPool(slot.queries);
+        _device.destroyQueryPool(slot.statistics);
+    }
+    _slots.clear();
+    _device = nullptr;
+}
+
+void GpuProfiler::beginCommandBuffer(const vk::CommandBuffer &cmd, const uint32_t slot){
+    _recordSlot = slot;
+    if(!_device){
+        return;
+    }
+
+    _slots[slot].scopeCount = 0;
+    _slots[slot].traceNames.clear();
+    _slots[slot].countsFragments = false;
+    cmd.resetQueryPool(_slots[slot].queries, 0, kMaxScopes * 2);
+    if(_slots[slot].statistics){
+        cmd.resetQueryPool(_slots[slot].statistics, 0, 1);
+    }
+}
+
+uint32_t GpuProfiler::beginScope(const vk::CommandBuffer &cmd, const std::string &name){
+    if(!_device){
+        return kInvalidScope;
+    }
+
+    auto &slot = _slots[_recordSlot];
+    if(slot.scopeCount >= kMaxScopes){
+        LOGW("GPU profiler is out of queries, scope {} is not measured", name);
+        return kInvalidScope;
+    }
+
+    const auto scope = slot.scopeCount++;
+    // the pass names repeat every frame, assigning into the old string does not allocate
+    if(scope < slot.names.size()){
+        slot.names[scope].assign(name);
+    }else{
+        slot.names.push_back(name);
+    }
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, slot.queries, scope * 2);
+    return scope;
+}
+
+void GpuProfiler::endScope(const vk::CommandBuffer &cmd, const uint32_t scope){
+    if(scope == kInvalidScope){
+        return;
+    }
+
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, _slots[_recordSlot].queries, scope * 2 + 1);
+}
+
+void GpuProfiler::beginFragmentCount(const vk::CommandBuffer &cmd){
+    if(!_device || !_slots[_recordSlot].statistics){
+        return;
+    }
+
+    _slots[_recordSlot].countsFragments = true;
+    cmd.beginQuery(_slots[_recordSlot].statistics, 0, {});
+}
+
+void GpuProfiler::endFragmentCount(const vk::CommandBuffer &cmd){
+    if(!_device || !_slots[_recordSlot].countsFragments){
+        return;
+    }
+
+    cmd.endQuery(_slots[_recordSlot].statistics, 0);
+}
+
+void GpuProfiler::resolve(const uint32_t slotIndex){
+    auto &slot = _slots[slotIndex];
+    if(!_device || !slot.submitted){
+        return;
+    }
+
+    if(slot.countsFragments){
+        uint64_t fragments = 0;
+        const auto status = _device.getQueryPoolResults(slot.statistics, 0, 1, sizeof(fragments), &fragments, sizeof(fragments), vk::QueryResultFlagBits::e64);
+        if(status == vk::Result::eSuccess){
+            _fragments = fragments;
+        }
+    }
+    if(slot.scopeCount == 0){
+        slot.submitted = false;
+        return;
+    }
+
+    slot.submitted = false;
+    const auto count = slot.scopeCount * 2;
+    // no wait flag: the frame retired, a result that is still not ready is dropped instead of stalling
+    std::array<uint64_t, kMaxScopes * 2> ticks{};
+    const auto status = _device.getQueryPoolResults(slot.queries, 0, count, count * sizeof(uint64_t), ticks.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    if(status != vk::Result::eSuccess){
+        return;
+    }
+
+    uint64_t frameBegin = ~0ull;
+    for(uint32_t i = 0;i < count;i += 2){
+        frameBegin = std::min(frameBegin, ticks[i] & _timestampMask);
+    }
+
+    const auto toMs = [this](const uint64_t from, const uint64_t to){
+        return ((to & _timestampMask) - (from & _timestampMask)) * _timestampPeriod / 1e6;
+    };
+    const auto tracing = trace::Enabled();
+    if(tracing){
+        slot.traceNames.resize(slot.scopeCount, nullptr);
+    }
+    // the GPU starts the frame no earlier than its submit and not before it finished the previous one
+    const auto baseNs = tracing ? std::max(trace::ToNs(slot.submitTime), _traceGpuEndNs) : 0;
+    for(uint32_t i = 0;i < count;i += 2){
+        const auto ms = toMs(ticks[i], ticks[i + 1]);
+        auto &stats = _scopes[slot.names[i / 2]];
+        stats.lastMs = ms;
+        stats.avgMs = stats.samples == 0 ? ms : stats.avgMs + (ms - stats.avgMs) * kSmoothing;
+        stats.samples++;
+
+        if(tracing){
+            auto &name = slot.traceNames[i / 2];
+            if(!name){
+                name = trace::Intern(slot.names[i / 2]);
+            }
+            const auto beginNs = baseNs + static_cast<uint64_t>(toMs(frameBegin, ticks[i]) * 1e6);
+            const auto endNs = beginNs + static_cast<uint64_t>(ms * 1e6);
+            trace::RecordGpu(name, beginNs, endNs);
+            _traceGpuEndNs = std::max(_traceGpuEndNs, endNs);
+        }
+    }
+}
+
+void GpuProfiler::beginFrame(const uint32_t slot){
+    resolve(slot);
+    _slot = slot;
+}
+
+void GpuProfiler::endFrame(){
+    if(_slots.empty()){
+        return;
+    }
+
+    auto &slot = _slots[_slot];
+    slot.submitted = true;
+    slot.submitTime = Clock::now();
+}
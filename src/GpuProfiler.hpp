@@ -0,0 +1,75 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+struct GpuScopeStats{
+    // rolling average over roughly the last 20 samples
+    double avgMs{};
+    double lastMs{};
+    uint64_t samples{};
+};
+
+// Measures named scopes of the GPU work with timestamp queries, one query pool per frame slot.
+// A slot is only read back once the scheduler released it again, i.e. framesInFlight frames
+// later, so the results are always available and reading them never stalls. While tracing, the
+// scopes are also recorded on the GPU track, anchored at the CPU time their frame was submitted.
+class GpuProfiler{
+public:
+    static constexpr const uint32_t kInvalidScope = ~0u;
+
+    // pipelineStatistics: the pipelineStatisticsQuery feature is enabled, fragment shader invocations can be counted
+    void initialize(const vk::Device &device, const vk::PhysicalDevice &phyDevice, const uint32_t queueFamily, const uint32_t slotCount, const bool pipelineStatistics = false);
+    void destroy();
+
+    // Called once the slot was released by the scheduler, resolves the scopes it measured last time.
+    void beginFrame(const uint32_t slot);
+    // Called right after the frame was submitted.
+    void endFrame();
+
+    // Resets the queries of the slot and forgets its scopes, has to come first in every command buffer
+    // that records scopes. A cached command buffer replays the scopes of its last recording.
+    void beginCommandBuffer(const vk::CommandBuffer &cmd, const uint32_t slot);
+    uint32_t beginScope(const vk::CommandBuffer &cmd, const std::string &name);
+    void endScope(const vk::CommandBuffer &cmd, const uint32_t scope);
+    // Counts the fragment shader invocations in between, at most once per command buffer and
+    // outside of a render pass.
+    void beginFragmentCount(const vk::CommandBuffer &cmd);
+    void endFragmentCount(const vk::CommandBuffer &cmd);
+
+    const std::map<std::string, GpuScopeStats>& scopes() const { return _scopes; }
+    // Fragment shader invocations of the last resolved frame, 0 while they are not counted.
+    uint64_t fragmentInvocations() const { return _fragments; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void resolve(const uint32_t slot);
+
+    struct Slot{
+        vk::QueryPool queries{};
+        vk::QueryPool statistics{};
+        bool countsFragments{false};
+        // names of the first scopeCount scopes, entries past it keep their storage for the next frames
+        std::vector<std::string> names{};
+        uint32_t scopeCount{};
+        // interned on the first traced readback
+        std::vector<const char*> traceNames{};
+        bool submitted{false};
+        Clock::time_point submitTime{};
+    };
+
+    vk::Device _device{};
+    double _timestampPeriod{};
+    uint64_t _timestampMask{};
+    std::vector<Slot> _slots{};
+    uint32_t _slot{};
+    uint32_t _recordSlot{};
+    std::map<std::string, GpuScopeStats> _scopes{};
+    uint64_t _fragments{};
+    // end of the last traced GPU frame, the queue never runs two frames at once
+    uint64_t _traceGpuEndNs{};
+};
@@ -0,0 +1,82 @@
+#include "HeapStats.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+// per thread only, a shared counter would make every allocation of the workers contend on it
+static thread_local uint64_t tAllocations = 0;
+
+namespace heap{
+    uint64_t ThreadAllocations(){
+        return tAllocations;
+    }
+}
+
+#if ENABLE_HEAP_COUNT
+static inline void CountAllocation(){
+    tAllocations++;
+}
+
+static void* Allocate(std::size_t size){
+    CountAllocation();
+    // malloc(0) may return nullptr, operator new must not
+    if(auto *p = std::malloc(size ? size : 1)){
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+static void* AllocateAligned(std::size_t size, const std::align_val_t align){
+    CountAllocation();
+    const auto alignment = static_cast<std::size_t>(align);
+    // aligned_alloc wants a multiple of the alignment
+    size = (std::max<std::size_t>(size, 1) + alignment - 1) / alignment * alignment;
+#if defined(_MSC_VER)
+    auto *p = _aligned_malloc(size, alignment);
+#else
+    auto *p = std::aligned_alloc(alignment, size);
+#endif
+    if(p){
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+static void FreeAligned(void *p){
+#if defined(_MSC_VER)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void* operator new(std::size_t size){ return Allocate(size); }
+void* operator new[](std::size_t size){ return Allocate(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try{ return Allocate(size); }catch(...){ return nullptr; }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try{ return Allocate(size); }catch(...){ return nullptr; }
+}
+void* operator new(std::size_t size, std::align_val_t align){ return AllocateAligned(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align){ return AllocateAligned(size, align); }
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    try{ return AllocateAligned(size, align); }catch(...){ return nullptr; }
+}
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    try{ return AllocateAligned(size, align); }catch(...){ return nullptr; }
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(p); }
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+
+// Compile-time switch for the operator new replacement in HeapStats.cpp, set by the
+// HEAP_COUNTING CMake option.
+#ifndef ENABLE_HEAP_COUNT
+#define ENABLE_HEAP_COUNT 1
+#endif
+
+// Counts calls into the global operator new. Only the number of allocations is kept, it is
+// meant to find code that should not allocate at all, like the render loop.
+namespace heap{
+    inline bool CountingEnabled(){
+        return ENABLE_HEAP_COUNT != 0;
+    }
+
+    // Allocations made by the calling thread.
+    uint64_t ThreadAllocations();
+}
@@ -0,0 +1,528 @@
+#include "JobSystem.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <string>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// jobs a worker can hold before it spills into the shared queue
+static constexpr const uint32_t kDequeCapacity = 4096;
+// coarse benchmark: few large ranges, fine benchmark: many tiny jobs
+static constexpr const uint32_t kBenchCoarseItems = 1u << 16;
+static constexpr const uint32_t kBenchCoarseIterations = 64;
+static constexpr const uint32_t kBenchFineTasks = 1u << 13;
+static constexpr const uint32_t kBenchFineIterations = 256;
+static constexpr const uint32_t kBenchRepeats = 5;
+
+static thread_local const JobSystem *tSystem = nullptr;
+static thread_local int32_t tWorker = -1;
+
+// Chase-Lev deque with a fixed ring (Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient
+// Work-Stealing for Weak Memory Models"). Only the owner pushes and pops, any thread steals.
+class WorkStealingDeque{
+public:
+    WorkStealingDeque() : _ring(kDequeCapacity) {}
+
+    bool push(Job *job){
+        const auto bottom = _bottom.load(std::memory_order_relaxed);
+        const auto top = _top.load(std::memory_order_acquire);
+        if(bottom - top >= static_cast<int64_t>(kDequeCapacity)){
+            return false;
+        }
+        _ring[bottom & (kDequeCapacity - 1)].store(job, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        _bottom.store(bottom + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    Job* pop(){
+        const auto bottom = _bottom.load(std::memory_order_relaxed) - 1;
+        _bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto top = _top.load(std::memory_order_relaxed);
+        if(top > bottom){
+            _bottom.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        auto *job = _ring[bottom & (kDequeCapacity - 1)].load(std::memory_order_relaxed);
+        if(top == bottom){
+            // the last job, race the thieves for it
+            if(!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)){
+                job = nullptr;
+            }
+            _bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    Job* steal(){
+        auto top = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto bottom = _bottom.load(std::memory_order_acquire);
+        if(top >= bottom){
+            return nullptr;
+        }
+        auto *job = _ring[top & (kDequeCapacity - 1)].load(std::memory_order_relaxed);
+        if(!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)){
+            return nullptr;
+        }
+        return job;
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> _top{0};
+    alignas(64) std::atomic<int64_t> _bottom{0};
+    std::vector<std::atomic<Job*>> _ring;
+};
+
+struct JobSystem::Worker{
+    WorkStealingDeque deque{};
+    std::mutex mailboxMutex{};
+    std::deque<Job*> mailbox{};
+    std::thread thread{};
+    // xorshift state picking the first victim to steal from
+    uint32_t seed{};
+};
+
+struct JobSystem::ParallelRange{
+    std::function<void(uint32_t, uint32_t)> fn{};
+    uint32_t grain{};
+    // ranges scheduled but not done
+    std::atomic<uint32_t> pending{1};
+    JobHandle done{};
+};
+
+static Job* PopFront(std::mutex &mutex, std::deque<Job*> &queue){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(queue.empty()){
+        return nullptr;
+    }
+    auto *job = queue.front();
+    queue.pop_front();
+    return job;
+}
+
+static void PinThread(std::thread &thread, const uint32_t core){
+#if defined(__linux__)
+    cpu_set_t set{};
+    CPU_ZERO(&set);
+    CPU_SET(core % std::max(std::thread::hardware_concurrency(), 1u), &set);
+    if(pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0){
+        LOGW("Failed to pin a job worker to core {}", core);
+    }
+#else
+    (void)thread;
+    (void)core;
+#endif
+}
+
+JobSystem::JobSystem() = default;
+
+JobSystem::~JobSystem(){
+    destroy();
+}
+
+void JobSystem::initialize(const uint32_t threads, const bool pinThreads){
+    const auto hardware = std::max(std::thread::hardware_concurrency(), 2u);
+    const auto count = threads == 0 ? hardware - 1 : threads;
+    _mainThread = std::this_thread::get_id();
+    _stop = false;
+    for(uint32_t i = 0;i < count;i ++){
+        _workers.push_back(std::make_unique<Worker>());
+        _workers.back()->seed = 0x9e3779b9u * (i + 1);
+    }
+    // the workers only start once every deque exists, they steal from each other right away
+    for(uint32_t i = 0;i < count;i ++){
+        auto &worker = *_workers[i];
+        worker.thread = std::thread(&JobSystem::workerLoop, this, i);
+        if(pinThreads){
+            // core 0 is left to the main thread
+            PinThread(worker.thread, i + 1);
+        }
+    }
+    LOGI("Job system with {} workers{}", count, pinThreads ? " pinned to cores" : "");
+}
+
+void JobSystem::destroy(){
+    if(_workers.empty()){
+        return;
+    }
+
+    _stop = true;
+    wake(true);
+    for(auto &worker : _workers){
+        worker->thread.join();
+    }
+    const auto stats = this->stats();
+    LOGI("Job system ran {} jobs, {} stolen, {} on the main thread", stats.executed, stats.stolen, stats.mainThread);
+
+    // queued jobs keep themselves alive, release them without running
+    const auto drop = [](Job *job){
+        job->self.reset();
+    };
+    for(auto &worker : _workers){
+        while(auto *job = worker->deque.pop()){
+            drop(job);
+        }
+        for(auto *job : worker->mailbox){
+            drop(job);
+        }
+    }
+    for(auto *job : _shared){
+        drop(job);
+    }
+    for(auto *job : _mainQueue){
+        drop(job);
+    }
+    _shared.clear();
+    _mainQueue.clear();
+    _workers.clear();
+}
+
+JobHandle JobSystem::schedule(std::function<void()> &&work, const std::vector<JobHandle> &dependencies, const JobAffinity affinity){
+    auto job = std::make_shared<Job>();
+    job->work = std::move(work);
+    job->affinity = affinity;
+    for(const auto &dependency : dependencies){
+        if(!dependency){
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if(!dependency->done.load(std::memory_order_relaxed)){
+            job->blockers.fetch_add(1, std::memory_order_relaxed);
+            dependency->dependents.push_back(job);
+        }
+    }
+    job->self = job;
+    // drops the setup blocker, the last dependency to finish enqueues the job otherwise
+    if(job->blockers.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        enqueue(job.get());
+    }
+    return job;
+}
+
+JobHandle JobSystem::parallelFor(const uint32_t count, const uint32_t grain, std::function<void(uint32_t begin, uint32_t end)> &&fn,
+    const std::vector<JobHandle> &dependencies){
+    auto range = std::make_shared<ParallelRange>();
+    range->fn = std::move(fn);
+    range->grain = std::max(grain, 1u);
+    range->done = std::make_shared<Job>();
+    auto done = range->done;
+    if(count == 0){
+        finish(*done);
+        return done;
+    }
+    schedule([this, range, count](){ runRange(range, 0, count); }, dependencies);
+    return done;
+}
+
+void JobSystem::runRange(const std::shared_ptr<ParallelRange> &range, uint32_t begin, uint32_t end){
+    // keep the first half, hand out the second: thieves take the largest halves from the top
+    while(end - begin > range->grain){
+        const auto mid = begin + (end - begin) / 2;
+        range->pending.fetch_add(1, std::memory_order_relaxed);
+        schedule([this, range, mid, end](){ runRange(range, mid, end); });
+        end = mid;
+    }
+    try{
+        range->fn(begin, end);
+    }catch(...){
+        std::lock_guard<std::mutex> lock(range->done->mutex);
+        if(!range->done->error){
+            range->done->error = std::current_exception();
+        }
+    }
+    if(range->pending.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        finish(*range->done);
+    }
+}
+
+JobHandle JobSystem::spawn(Task<void> &&task, const JobAffinity affinity){
+    auto done = std::make_shared<Job>();
+    done->affinity = affinity;
+    runTask(*this, std::move(task), done, affinity);
+    return done;
+}
+
+jobs::DetachedTask JobSystem::runTask(JobSystem &system, Task<void> task, JobHandle done, const JobAffinity affinity){
+    co_await system.resumeOn(affinity);
+    try{
+        co_await std::move(task);
+    }catch(...){
+        done->error = std::current_exception();
+    }
+    system.finish(*done);
+}
+
+void JobSystem::enqueue(Job *job){
+    const auto affinity = job->affinity;
+    if(affinity == kMainThread){
+        {
+            std::lock_guard<std::mutex> lock(_mainMutex);
+            _mainQueue.push_back(job);
+        }
+        // the main thread may sleep in wait() or in its event loop
+        wake(true);
+        if(_mainWake){
+            _mainWake();
+        }
+        return;
+    }
+    if(affinity >= 0 && !_workers.empty()){
+        auto &worker = *_workers[affinity % _workers.size()];
+        {
+            std::lock_guard<std::mutex> lock(worker.mailboxMutex);
+            worker.mailbox.push_back(job);
+        }
+        wake(true);
+        return;
+    }
+    if(tSystem == this && tWorker >= 0 && _workers[tWorker]->deque.push(job)){
+        wake(false);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_sharedMutex);
+        _shared.push_back(job);
+    }
+    wake(false);
+}
+
+void JobSystem::wake(const bool all){
+    _epoch.fetch_add(1, std::memory_order_seq_cst);
+    if(all){
+        _epoch.notify_all();
+    }else{
+        _epoch.notify_one();
+    }
+}
+
+Job* JobSystem::findJob(const int32_t worker, const bool mainThread){
+    if(worker >= 0){
+        auto &self = *_workers[worker];
+        if(auto *job = PopFront(self.mailboxMutex, self.mailbox)){
+            return job;
+        }
+        if(auto *job = self.deque.pop()){
+            return job;
+        }
+    }
+    if(mainThread){
+        if(auto *job = PopFront(_mainMutex, _mainQueue)){
+            return job;
+        }
+    }
+    if(auto *job = PopFront(_sharedMutex, _shared)){
+        return job;
+    }
+
+    const auto count = static_cast<uint32_t>(_workers.size());
+    if(count == 0){
+        return nullptr;
+    }
+    static thread_local uint32_t tSeed = 0x2545f491u;
+    auto &seed = worker >= 0 ? _workers[worker]->seed : tSeed;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    const auto first = seed % count;
+    for(uint32_t i = 0;i < count;i ++){
+        const auto victim = (first + i) % count;
+        if(static_cast<int32_t>(victim) == worker){
+            continue;
+        }
+        if(auto *job = _workers[victim]->deque.steal()){
+            _stolen.fetch_add(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void JobSystem::execute(Job &job){
+    {
+        TRACE_ZONE("job");
+        try{
+            job.work();
+        }catch(...){
+            job.error = std::current_exception();
+        }
+    }
+    _executed.fetch_add(1, std::memory_order_relaxed);
+    finish(job);
+}
+
+void JobSystem::finish(Job &job){
+    std::vector<JobHandle> dependents{};
+    {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.done.store(true, std::memory_order_seq_cst);
+        dependents.swap(job.dependents);
+    }
+    if(job.waiters.load(std::memory_order_seq_cst) > 0){
+        wake(true);
+    }
+    for(auto &dependent : dependents){
+        if(dependent->blockers.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            enqueue(dependent.get());
+        }
+    }
+    // the captures may own resources, they go with the job and not with the last handle
+    job.work = nullptr;
+    // may be the last reference, nothing touches the job afterwards
+    auto self = std::move(job.self);
+}
+
+void JobSystem::wait(const JobHandle &handle){
+    if(!handle){
+        return;
+    }
+    const auto worker = tSystem == this ? tWorker : -1;
+    const bool mainThread = std::this_thread::get_id() == _mainThread;
+    handle->waiters.fetch_add(1, std::memory_order_seq_cst);
+    while(!handle->done.load(std::memory_order_seq_cst)){
+        const auto epoch = _epoch.load(std::memory_order_seq_cst);
+        if(auto *job = findJob(worker, mainThread)){
+            if(mainThread && worker < 0 && job->affinity == kMainThread){
+                _mainExecuted.fetch_add(1, std::memory_order_relaxed);
+            }
+            execute(*job);
+            continue;
+        }
+        if(handle->done.load(std::memory_order_seq_cst)){
+            break;
+        }
+        _epoch.wait(epoch, std::memory_order_seq_cst);
+    }
+    handle->waiters.fetch_sub(1, std::memory_order_relaxed);
+    if(handle->error){
+        std::rethrow_exception(handle->error);
+    }
+}
+
+uint32_t JobSystem::pumpMainThread(){
+    // the batch keeps its capacity, an idle pump every frame never allocates
+    _mainBatch.clear();
+    {
+        std::lock_guard<std::mutex> lock(_mainMutex);
+        _mainBatch.assign(_mainQueue.begin(), _mainQueue.end());
+        _mainQueue.clear();
+    }
+    // jobs queued while these run wait for the next pump
+    for(auto *job : _mainBatch){
+        execute(*job);
+    }
+    _mainExecuted.fetch_add(_mainBatch.size(), std::memory_order_relaxed);
+    return static_cast<uint32_t>(_mainBatch.size());
+}
+
+void JobSystem::workerLoop(const uint32_t index){
+    tSystem = this;
+    tWorker = static_cast<int32_t>(index);
+    trace::SetThreadName(std::format("job worker {}", index));
+    while(!_stop.load(std::memory_order_relaxed)){
+        const auto epoch = _epoch.load(std::memory_order_seq_cst);
+        if(auto *job = findJob(tWorker, false)){
+            execute(*job);
+            continue;
+        }
+        _epoch.wait(epoch, std::memory_order_seq_cst);
+    }
+}
+
+JobStats JobSystem::stats() const {
+    JobStats stats{};
+    stats.executed = _executed.load(std::memory_order_relaxed);
+    stats.stolen = _stolen.load(std::memory_order_relaxed);
+    stats.mainThread = _mainExecuted.load(std::memory_order_relaxed);
+    return stats;
+}
+
+static float BenchWork(const uint32_t index, const uint32_t iterations){
+    auto x = static_cast<float>(index) * 1e-3f;
+    for(uint32_t i = 0;i < iterations;i ++){
+        x = std::sin(x) + 1.0f;
+    }
+    return x;
+}
+
+// best of kBenchRepeats runs, in milliseconds
+template<typename Fn>
+static double BenchBest(Fn &&fn){
+    auto best = 0.0;
+    for(uint32_t i = 0;i < kBenchRepeats;i ++){
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = i == 0 ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+void BenchmarkJobs(const uint32_t maxThreads){
+    std::vector<float> out(kBenchCoarseItems);
+    const auto fill = [&out](const uint32_t begin, const uint32_t end){
+        for(uint32_t i = begin;i < end;i ++){
+            out[i] = BenchWork(i, kBenchCoarseIterations);
+        }
+    };
+    const auto serial = BenchBest([&](){ fill(0, kBenchCoarseItems); });
+    LOGI("Job benchmark: {} items of {} iterations, serial {:.3f} ms", kBenchCoarseItems, kBenchCoarseIterations, serial);
+
+    const auto limit = std::max(maxThreads, 1u);
+    for(uint32_t threads = 1;;threads = std::min(threads * 2, limit)){
+        // the waiting main thread helps, so threads - 1 workers (at least one) and the main
+        // thread compete with threads std::async tasks
+        JobSystem system{};
+        system.initialize(std::max(threads - 1, 1u));
+        const auto grain = std::max(kBenchCoarseItems / (threads * 8), 1u);
+        const auto jobMs = BenchBest([&](){
+            system.wait(system.parallelFor(kBenchCoarseItems, grain, fill));
+        });
+        const auto asyncMs = BenchBest([&](){
+            std::vector<std::future<void>> futures{};
+            const auto chunk = (kBenchCoarseItems + threads - 1) / threads;
+            for(uint32_t begin = 0;begin < kBenchCoarseItems;begin += chunk){
+                futures.push_back(std::async(std::launch::async, fill, begin, std::min(begin + chunk, kBenchCoarseItems)));
+            }
+            for(auto &future : futures){
+                future.get();
+            }
+        });
+
+        // one job or one std::async per task, the scheduling overhead dominates
+        std::vector<float> fine(kBenchFineTasks);
+        const auto fineJobMs = BenchBest([&](){
+            std::vector<JobHandle> handles{};
+            handles.reserve(kBenchFineTasks);
+            for(uint32_t i = 0;i < kBenchFineTasks;i ++){
+                handles.push_back(system.schedule([&fine, i](){ fine[i] = BenchWork(i, kBenchFineIterations); }));
+            }
+            system.wait(system.schedule([](){}, handles));
+        });
+        const auto fineAsyncMs = BenchBest([&](){
+            std::vector<std::future<void>> futures{};
+            futures.reserve(kBenchFineTasks);
+            for(uint32_t i = 0;i < kBenchFineTasks;i ++){
+                futures.push_back(std::async(std::launch::async, [&fine, i](){ fine[i] = BenchWork(i, kBenchFineIterations); }));
+            }
+            for(auto &future : futures){
+                future.get();
+            }
+        });
+        system.destroy();
+
+        LOGI("Job benchmark {:>3} threads: coarse jobs {:8.3f} ms ({:5.2f}x) std::async {:8.3f} ms ({:5.2f}x), {} fine tasks jobs {:8.3f} ms std::async {:8.3f} ms",
+            threads, jobMs, serial / jobMs, asyncMs, serial / asyncMs, kBenchFineTasks, fineJobMs, fineAsyncMs);
+        if(threads == limit){
+            break;
+        }
+    }
+}
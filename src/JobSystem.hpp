@@ -0,0 +1,261 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Where a job runs: any worker, the main thread (GLFW and everything else that is main thread
+// only), or a worker index. Worker hints keep a job on that worker, it is never stolen.
+using JobAffinity = int32_t;
+static constexpr const JobAffinity kAnyThread = -1;
+static constexpr const JobAffinity kMainThread = -2;
+
+struct Job{
+    std::function<void()> work{};
+    JobAffinity affinity{kAnyThread};
+    // unfinished dependencies, plus one while the job is being set up
+    std::atomic<uint32_t> blockers{1};
+    // threads sleeping in JobSystem::wait() on this job
+    std::atomic<uint32_t> waiters{0};
+    std::atomic<bool> done{false};
+    // what the work threw, rethrown by JobSystem::wait()
+    std::exception_ptr error{};
+    std::mutex mutex{};
+    std::vector<std::shared_ptr<Job>> dependents{};
+    // keeps a queued job alive, dropped once it finished
+    std::shared_ptr<Job> self{};
+};
+using JobHandle = std::shared_ptr<Job>;
+
+template<typename T = void>
+class Task;
+
+namespace jobs{
+    struct TaskPromiseBase{
+        struct FinalAwaiter{
+            bool await_ready() const noexcept { return false; }
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                // symmetric transfer, a chain of finished tasks never grows the stack
+                const auto next = handle.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+        void unhandled_exception() { error = std::current_exception(); }
+
+        std::coroutine_handle<> continuation{};
+        std::exception_ptr error{};
+    };
+
+    template<typename T>
+    struct TaskPromise : TaskPromiseBase{
+        Task<T> get_return_object();
+        template<typename U>
+        void return_value(U &&value) { result.emplace(std::forward<U>(value)); }
+        T take(){
+            if(error){
+                std::rethrow_exception(error);
+            }
+            return std::move(*result);
+        }
+
+        std::optional<T> result{};
+    };
+
+    template<>
+    struct TaskPromise<void> : TaskPromiseBase{
+        Task<void> get_return_object();
+        void return_void() const {}
+        void take(){
+            if(error){
+                std::rethrow_exception(error);
+            }
+        }
+    };
+
+    // Fire and forget coroutine, starts right away and frees itself when it returns.
+    struct DetachedTask{
+        struct promise_type{
+            DetachedTask get_return_object() const { return {}; }
+            std::suspend_never initial_suspend() const noexcept { return {}; }
+            std::suspend_never final_suspend() const noexcept { return {}; }
+            void return_void() const {}
+            void unhandled_exception() const { std::terminate(); }
+        };
+    };
+}
+
+// Lazily started coroutine. It runs when it is awaited, on the thread of the awaiting
+// coroutine, and resumes that coroutine with its result. JobSystem::spawn() runs one as a job.
+template<typename T>
+class Task{
+public:
+    using promise_type = jobs::TaskPromise<T>;
+
+    Task() = default;
+    explicit Task(const std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+    Task(Task &&other) noexcept : _handle(std::exchange(other._handle, {})) {}
+    Task &operator=(Task &&other) noexcept {
+        if(this != &other){
+            if(_handle){
+                _handle.destroy();
+            }
+            _handle = std::exchange(other._handle, {});
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task &operator=(const Task&) = delete;
+    ~Task(){
+        if(_handle){
+            _handle.destroy();
+        }
+    }
+
+    bool valid() const { return static_cast<bool>(_handle); }
+
+    auto operator co_await() && noexcept {
+        struct Awaiter{
+            bool await_ready() const noexcept { return !handle || handle.done(); }
+            std::coroutine_handle<> await_suspend(const std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() { return handle.promise().take(); }
+
+            std::coroutine_handle<promise_type> handle{};
+        };
+        return Awaiter{_handle};
+    }
+
+private:
+    std::coroutine_handle<promise_type> _handle{};
+};
+
+template<typename T>
+Task<T> jobs::TaskPromise<T>::get_return_object(){
+    return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)};
+}
+
+inline Task<void> jobs::TaskPromise<void>::get_return_object(){
+    return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+}
+
+struct JobStats{
+    uint64_t executed{};
+    // jobs taken from the deque of another worker
+    uint64_t stolen{};
+    uint64_t mainThread{};
+};
+
+// Work-stealing job system. Every worker owns a lock-free deque: it pushes and pops its own end,
+// idle workers steal from the other end. Jobs scheduled from other threads go through a shared
+// queue, jobs pinned to a worker through that worker's mailbox and main thread jobs wait until
+// the main thread pumps them or waits on a job. Idle workers sleep on an epoch counter.
+class JobSystem{
+public:
+    // defined with Worker, which the header leaves incomplete
+    JobSystem();
+    ~JobSystem();
+
+    // 0 threads starts one worker per hardware thread but the calling one, which becomes the main thread.
+    void initialize(const uint32_t threads = 0, const bool pinThreads = false);
+    // Jobs still queued are dropped, wait for the ones that matter first.
+    void destroy();
+    uint32_t workerCount() const { return static_cast<uint32_t>(_workers.size()); }
+
+    // The work runs once every dependency finished. Exceptions are kept and rethrown by wait().
+    JobHandle schedule(std::function<void()> &&work, const std::vector<JobHandle> &dependencies = {}, const JobAffinity affinity = kAnyThread);
+    // Calls fn with ranges of at most grain indices covering [0, count). The range is split in
+    // halves on the workers so idle ones steal large pieces first.
+    JobHandle parallelFor(const uint32_t count, const uint32_t grain, std::function<void(uint32_t begin, uint32_t end)> &&fn,
+        const std::vector<JobHandle> &dependencies = {});
+    // Runs the task as a job, the handle finishes when the coroutine returns.
+    JobHandle spawn(Task<void> &&task, const JobAffinity affinity = kAnyThread);
+
+    // Runs other jobs until the handle finished, the main thread drains its own queue as well.
+    // Rethrows what the job threw.
+    void wait(const JobHandle &handle);
+    // Runs the main thread jobs queued so far, called once per frame by the main loop.
+    uint32_t pumpMainThread();
+    // Called by the thread queuing a main thread job, for main loops that block on something else
+    // than wait(). Set it before any such job is scheduled.
+    void setMainThreadWake(std::function<void()> &&wake) { _mainWake = std::move(wake); }
+
+    // co_await resumeOn(affinity) continues the coroutine as a job with that affinity.
+    auto resumeOn(const JobAffinity affinity){
+        struct Awaiter{
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(const std::coroutine_handle<> handle) const {
+                system->schedule([handle](){ handle.resume(); }, {}, affinity);
+            }
+            void await_resume() const noexcept {}
+
+            JobSystem *system{};
+            JobAffinity affinity{};
+        };
+        return Awaiter{this, affinity};
+    }
+    // co_await after(handle) continues the coroutine once the job finished. Errors of the job
+    // are not forwarded, check handle->error when they matter.
+    auto after(const JobHandle &handle, const JobAffinity affinity = kAnyThread){
+        struct Awaiter{
+            bool await_ready() const noexcept { return !job || job->done.load(std::memory_order_acquire); }
+            void await_suspend(const std::coroutine_handle<> handle) const {
+                system->schedule([handle](){ handle.resume(); }, {job}, affinity);
+            }
+            void await_resume() const noexcept {}
+
+            JobSystem *system{};
+            JobHandle job{};
+            JobAffinity affinity{};
+        };
+        return Awaiter{this, handle, affinity};
+    }
+
+    JobStats stats() const;
+
+private:
+    struct Worker;
+    struct ParallelRange;
+
+    void workerLoop(const uint32_t index);
+    void enqueue(Job *job);
+    Job* findJob(const int32_t worker, const bool mainThread);
+    void execute(Job &job);
+    void finish(Job &job);
+    void wake(const bool all);
+    void runRange(const std::shared_ptr<ParallelRange> &range, uint32_t begin, uint32_t end);
+    static jobs::DetachedTask runTask(JobSystem &system, Task<void> task, JobHandle done, const JobAffinity affinity);
+
+    std::vector<std::unique_ptr<Worker>> _workers{};
+    std::thread::id _mainThread{};
+    std::mutex _sharedMutex{};
+    std::deque<Job*> _shared{};
+    std::mutex _mainMutex{};
+    std::deque<Job*> _mainQueue{};
+    std::vector<Job*> _mainBatch{};
+    std::function<void()> _mainWake{};
+    // bumped whenever work arrives or a waited job finished, sleepers wait for it to change
+    std::atomic<uint32_t> _epoch{0};
+    std::atomic<bool> _stop{false};
+    std::atomic<uint64_t> _executed{0};
+    std::atomic<uint64_t> _stolen{0};
+    std::atomic<uint64_t> _mainExecuted{0};
+};
+
+// Scaling benchmark of parallelFor against std::async for coarse and fine grained work, from
+// one worker up to maxThreads.
+void BenchmarkJobs(const uint32_t maxThreads);
@@ -0,0 +1,223 @@
+#include "Log.hpp"
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+namespace sys{
+    // how many messages the writer collects before it writes them out
+    static constexpr const size_t kMaxBatch = 256;
+    static constexpr const char kLevelTags[] = { 'V', 'D', 'I', 'W', 'E', 'F' };
+
+    // setFile() is rare, it only has to exclude the writer while the file is swapped
+    static std::mutex gFileMutex{};
+
+    Logcat::Logcat() : _slots(std::make_unique<Slot[]>(kQueueCapacity)) {
+        for(size_t i = 0;i < kQueueCapacity;i ++){
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        _batch.reserve(kMaxBatch * 64);
+        _writer = std::thread(&Logcat::writerLoop, this);
+    }
+
+    Logcat::~Logcat(){
+        _stop.store(true, std::memory_order_release);
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_one();
+        _writer.join();
+        if(_file){
+            std::fclose(_file);
+        }
+    }
+
+    // Bounded MPSC queue after Vyukov: the sequence of a slot says whose turn it is. pos means it is
+    // free for the producer of pos, pos + 1 that it holds the message of pos for the writer.
+    Logcat::Slot& Logcat::claim(uint64_t &pos){
+        pos = _enqueue.load(std::memory_order_relaxed);
+        for(;;){
+            auto &slot = _slots[pos % kQueueCapacity];
+            const auto sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<int64_t>(sequence - pos);
+            if(diff == 0){
+                if(_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    return slot;
+                }
+            }else if(diff < 0){
+                // full, let the writer catch up
+                _signal.fetch_add(1, std::memory_order_release);
+                _signal.notify_one();
+                std::this_thread::yield();
+                pos = _enqueue.load(std::memory_order_relaxed);
+            }else{
+                pos = _enqueue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void Logcat::publish(Slot &slot, const uint64_t pos){
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_one();
+    }
+
+    void Logcat::flush(){
+        const auto target = _enqueue.load(std::memory_order_acquire);
+        while(_written.load(std::memory_order_acquire) < target){
+            _signal.fetch_add(1, std::memory_order_release);
+            _signal.notify_one();
+            std::this_thread::yield();
+        }
+    }
+
+    size_t Logcat::drain(){
+        size_t count = 0;
+        auto pos = _written.load(std::memory_order_relaxed);
+        for(;;){
+            _batch.clear();
+            size_t batched = 0;
+            while(batched < kMaxBatch){
+                auto &slot = _slots[(pos + batched) % kQueueCapacity];
+                if(slot.sequence.load(std::memory_order_acquire) != pos + batched + 1){
+                    break;
+                }
+
+                if(!_timestamped.load(std::memory_order_relaxed)){
+                    _batch.append(slot.text, slot.size);
+                }else{
+                    const auto now = std::chrono::system_clock::now();
+                    _batch += std::format("{:%F %T} {} ", std::chrono::floor<std::chrono::milliseconds>(now), kLevelTags[static_cast<int32_t>(slot.level)]);
+                    _batch.append(slot.text, slot.size);
+                }
+                if(slot.truncated){
+                    _batch += "...";
+                }
+                _batch.push_back('\n');
+                slot.sequence.store(pos + batched + kQueueCapacity, std::memory_order_release);
+                batched++;
+            }
+
+            if(batched == 0){
+                return count;
+            }
+
+            writeBatch(_batch);
+            pos += batched;
+            count += batched;
+            _written.store(pos, std::memory_order_release);
+        }
+    }
+
+    void Logcat::writerLoop(){
+        for(;;){
+            const auto signal = _signal.load(std::memory_order_acquire);
+            const auto stop = _stop.load(std::memory_order_acquire);
+            if(drain() == 0){
+                if(stop){
+                    return;
+                }
+                _signal.wait(signal, std::memory_order_acquire);
+            }
+        }
+    }
+
+    void Logcat::writeBatch(const std::string &batch){
+        std::lock_guard<std::mutex> lock(gFileMutex);
+        if(!_file){
+            std::fwrite(batch.data(), 1, batch.size(), stdout);
+            std::fflush(stdout);
+            return;
+        }
+
+        if(_rotateBytes != 0 && _fileBytes != 0 && _fileBytes + batch.size() > _rotateBytes){
+            rotate();
+        }
+        if(_file){
+            std::fwrite(batch.data(), 1, batch.size(), _file);
+            std::fflush(_file);
+            _fileBytes += batch.size();
+        }
+    }
+
+    void Logcat::rotate(){
+        std::fclose(_file);
+        std::error_code ec{};
+        const auto name = [this](const uint32_t index){
+            return index == 0 ? _logFile : std::format("{}.{}", _logFile, index);
+        };
+        std::filesystem::remove(name(_rotateFiles), ec);
+        for(auto i = _rotateFiles;i > 0;i --){
+            std::filesystem::rename(name(i - 1), name(i), ec);
+        }
+
+        _file = std::fopen(_logFile.c_str(), "wb");
+        _fileBytes = 0;
+        if(!_file){
+            // keep the messages instead of losing them
+            _logFile.clear();
+            _timestamped.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    void Logcat::setFile(const std::string &file, const uint64_t maxBytes, const uint32_t maxFiles){
+        // messages logged before the switch still go to the old destination
+        flush();
+        std::lock_guard<std::mutex> lock(gFileMutex);
+        if(_file){
+            std::fclose(_file);
+            _file = nullptr;
+        }
+
+        _logFile = file;
+        _rotateBytes = maxBytes;
+        _rotateFiles = std::max(maxFiles, 1u);
+        _fileBytes = 0;
+        _timestamped.store(false, std::memory_order_relaxed);
+        if(_logFile.empty()){
+            return;
+        }
+
+        _file = std::fopen(_logFile.c_str(), "ab");
+        if(!_file){
+            _logFile.clear();
+            std::fprintf(stderr, "can not open the log file %s, logging to stdout\n", file.c_str());
+            return;
+        }
+        std::error_code ec{};
+        _fileBytes = std::filesystem::file_size(_logFile, ec);
+        _timestamped.store(true, std::memory_order_relaxed);
+    }
+
+    void BenchmarkLogcat(const uint32_t threadCount, const uint32_t messagesPerThread){
+        auto &logcat = Logcat::instance();
+        const auto path = (std::filesystem::temp_directory_path() / "vulkanlearn_log_bench.log").string();
+        logcat.setFile(path, 0);
+
+        using Clock = std::chrono::steady_clock;
+        const auto start = Clock::now();
+        std::vector<std::thread> threads{};
+        for(uint32_t t = 0;t < threadCount;t ++){
+            threads.emplace_back([t, messagesPerThread](){
+                for(uint32_t i = 0;i < messagesPerThread;i ++){
+                    LOGI("benchmark thread {} message {} value {:.3f}", t, i, i * 0.5);
+                }
+            });
+        }
+        for(auto &thread : threads){
+            thread.join();
+        }
+        const auto produced = Clock::now();
+        logcat.flush();
+        const auto written = Clock::now();
+
+        logcat.setFile();
+        std::error_code ec{};
+        std::filesystem::remove(path, ec);
+
+        const double total = static_cast<double>(threadCount) * messagesPerThread;
+        const auto seconds = [](const Clock::time_point from, const Clock::time_point to){
+            return std::chrono::duration<double>(to - from).count();
+        };
+        LOGI("Logger benchmark: {} threads logged {} messages, {:.0f} msg/s accepted, {:.0f} msg/s written",
+            threadCount, static_cast<uint64_t>(total), total / seconds(start, produced), total / seconds(start, written));
+    }
+}
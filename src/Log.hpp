@@ -1,8 +1,18 @@
 #pragma once
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
 #include <format>
+#include <memory>
 #include <string>
+#include <thread>
+
+// Calls below this level compile to nothing, set by the LOG_LEVEL CMake cache variable (0 = verbose).
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
 
 namespace sys{
     enum class LogLevel : int32_t{
@@ -14,39 +24,109 @@ namespace sys{
         Fatal
     };
 
+    // Asynchronous logger. Callers format straight into a slot of a bounded lock-free MPSC queue,
+    // a writer thread drains it and writes the messages in batches to stdout or the log file.
+    // A full queue makes callers wait for the writer instead of dropping messages.
     class Logcat{
     public:
-        void setFile(const std::string &file = {}){
-            _logFile = file;
-        }
+        static constexpr const size_t kMaxMessage = 512;
+        static constexpr const size_t kQueueCapacity = 2048;
+        static constexpr const uint64_t kDefaultRotateBytes = 16ull << 20;
+        static constexpr const uint32_t kDefaultRotateFiles = 3;
+
+        Logcat();
+        ~Logcat();
+
+        // Empty writes to stdout. Once the file reaches maxBytes it is renamed to file.1, the older
+        // ones shift up to file.<maxFiles> and a new file is started.
+        void setFile(const std::string &file = {}, const uint64_t maxBytes = kDefaultRotateBytes, const uint32_t maxFiles = kDefaultRotateFiles);
 
         void setLevel(const LogLevel level = LogLevel::Verbos){
-            _level = level;
+            _level.store(level, std::memory_order_relaxed);
+        }
+
+        bool enabled(const LogLevel level) const {
+            return _level.load(std::memory_order_relaxed) <= level;
         }
 
         template<typename ...Args>
         void log(const LogLevel level, std::format_string<Args...> fmt, Args&& ...args) {
-            if(_level > level){
+            if(!enabled(level)){
                 return;
             }
 
-            if(_logFile.empty()){
-                std::cout << std::format(fmt, std::forward<Args>(args)...) << std::endl;
+            uint64_t pos = 0;
+            auto &slot = claim(pos);
+            // the slot is claimed, it has to be published even when formatting throws
+            try{
+                const auto result = std::format_to_n(slot.text, kMaxMessage, fmt, std::forward<Args>(args)...);
+                slot.size = static_cast<uint32_t>(std::min<size_t>(result.size, kMaxMessage));
+                slot.truncated = static_cast<size_t>(result.size) > kMaxMessage;
+            }catch(...){
+                slot.size = 0;
+                slot.truncated = true;
+            }
+            slot.level = level;
+            publish(slot, pos);
+            if(level >= LogLevel::Fatal){
+                flush();
             }
-            //TODO: write log message into file
         }
 
+        // Blocks until every message logged before the call was written.
+        void flush();
+
         static Logcat& instance(){
             static Logcat inst;
             return inst;
         }
-    public:
-        LogLevel _level{ LogLevel::Debug };
-        std::string _logFile;
+
+    private:
+        struct Slot{
+            std::atomic<uint64_t> sequence{};
+            LogLevel level{};
+            uint32_t size{};
+            bool truncated{false};
+            char text[kMaxMessage];
+        };
+
+        Slot& claim(uint64_t &pos);
+        void publish(Slot &slot, const uint64_t pos);
+        void writerLoop();
+        size_t drain();
+        void writeBatch(const std::string &batch);
+        void rotate();
+
+        std::atomic<LogLevel> _level{ LogLevel::Debug };
+        std::unique_ptr<Slot[]> _slots{};
+        alignas(64) std::atomic<uint64_t> _enqueue{0};
+        alignas(64) std::atomic<uint64_t> _written{0};
+        alignas(64) std::atomic<uint32_t> _signal{0};
+        std::atomic<bool> _stop{false};
+        // the writer only reads it while formatting, setFile() and rotate() store it under the file lock
+        std::atomic<bool> _timestamped{false};
+        // guarded by the file lock, setFile() swaps them from the caller's thread
+        std::string _logFile{};
+        std::FILE *_file{};
+        uint64_t _fileBytes{};
+        uint64_t _rotateBytes{kDefaultRotateBytes};
+        uint32_t _rotateFiles{kDefaultRotateFiles};
+        std::string _batch{};
+        std::thread _writer{};
     };
 
+    // Messages per second of threadCount threads logging into a temporary file, for --bench-log.
+    void BenchmarkLogcat(const uint32_t threadCount, const uint32_t messagesPerThread);
+
+    template<LogLevel kLevel, typename ...Args>
+    void Log(std::format_string<Args...> fmt, Args&& ...args){
+        Logcat::instance().log(kLevel, fmt, std::forward<Args>(args)...);
+    }
 }
 
+// A macro so the arguments of calls below LOG_MIN_LEVEL are still checked but never evaluated.
+#define SYS_LOG(kLevel, ...) do{ if constexpr (static_cast<int32_t>(kLevel) >= LOG_MIN_LEVEL){ sys::Log<kLevel>(__VA_ARGS__); } }while(0)
+
 inline void LOGSETFILE(const std::string &file){
     return sys::Logcat::instance().setFile(file);
 }
@@ -55,32 +135,9 @@ inline void LOGSETLEVEL(const sys::LogLevel level){
     return sys::Logcat::instance().setLevel(level);
 }
 
-template<typename ...Args>
-void LOGV(std::format_string<Args...> fmt, Args&& ...args){
-    return sys::Logcat::instance().log(sys::LogLevel::Verbos, fmt, std::forward<Args>(args)...);
-}
-
-template<typename ...Args>
-void LOGD(std::format_string<Args...> fmt, Args&& ...args){
-    return sys::Logcat::instance().log(sys::LogLevel::Debug, fmt, std::forward<Args>(args)...);
-}
-
-template<typename ...Args>
-void LOGI(std::format_string<Args...> fmt, Args&& ...args){
-    return sys::Logcat::instance().log(sys::LogLevel::Info, fmt, std::forward<Args>(args)...);
-}
-
-template<typename ...Args>
-void LOGW(std::format_string<Args...> fmt, Args&& ...args){
-    return sys::Logcat::instance().log(sys::LogLevel::Warn, fmt, std::forward<Args>(args)...);
-}
-
-template<typename ...Args>
-void LOGE(std::format_string<Args...> fmt, Args&& ...args){
-    return sys::Logcat::instance().log(sys::LogLevel::Error, fmt, std::forward<Args>(args)...);
-}
-
-template<typename ...Args>
-void LOGF(std::format_string<Args...> fmt, Args&& ...args){
-    return sys::Logcat::instance().log(sys::LogLevel::Fatal, fmt, std::forward<Args>(args)...);
-}
+#define LOGV(...) SYS_LOG(sys::LogLevel::Verbos, __VA_ARGS__)
+#define LOGD(...) SYS_LOG(sys::LogLevel::Debug, __VA_ARGS__)
+#define LOGI(...) SYS_LOG(sys::LogLevel::Info, __VA_ARGS__)
+#define LOGW(...) SYS_LOG(sys::LogLevel::Warn, __VA_ARGS__)
+#define LOGE(...) SYS_LOG(sys::LogLevel::Error, __VA_ARGS__)
+#define LOGF(...) SYS_LOG(sys::LogLevel::Fatal, __VA_ARGS__)
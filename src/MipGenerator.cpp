@@ -0,0 +1,241 @@
+#include "MipGenerator.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+static constexpr const uint32_t kTileSize = 64;
+// levels one workgroup reduces its tile into, the last workgroup continues from there
+static constexpr const uint32_t kTileMips = 6;
+// mip 6 of every workgroup has to fit the scratch buffer
+static constexpr const uint32_t kMaxGroupsPerAxis = 64;
+static constexpr const vk::DeviceSize kScratchHeader = 16;
+static constexpr const vk::DeviceSize kScratchSize = kScratchHeader + kMaxGroupsPerAxis * kMaxGroupsPerAxis * 16;
+
+static const std::vector<DescriptorPoolRatio> kMipDescriptorRatios = {
+    {vk::DescriptorType::eCombinedImageSampler, 1.0f},
+    {vk::DescriptorType::eStorageImage, static_cast<float>(MipGenerator::kMaxMips)},
+    {vk::DescriptorType::eStorageBuffer, 1.0f}
+};
+
+struct MipParams{
+    uint32_t mipCount{};
+    uint32_t workGroups{};
+    uint32_t sourceWidth{};
+    uint32_t sourceHeight{};
+};
+
+static vk::Format StorageFormat(const vk::Format format){
+    switch(format){
+    case vk::Format::eR8G8B8A8Srgb:
+        return vk::Format::eR8G8B8A8Unorm;
+    case vk::Format::eB8G8R8A8Srgb:
+        return vk::Format::eB8G8R8A8Unorm;
+    default:
+        return format;
+    }
+}
+
+static bool IsSrgb(const vk::Format format){
+    return StorageFormat(format) != format;
+}
+
+void MipGenerator::initialize(const MipGeneratorDesc &desc){
+    _desc = desc;
+    if(!_desc.writeWithoutFormat){
+        LOGW("shaderStorageImageWriteWithoutFormat is not supported, mip chains are blitted");
+        return;
+    }
+
+    const auto &device = _desc.device;
+    const auto compute = vk::ShaderStageFlagBits::eCompute;
+    _setLayout = _desc.layouts->get({
+        {0, vk::DescriptorType::eCombinedImageSampler, 1, compute},
+        {1, vk::DescriptorType::eStorageImage, kMaxMips, compute},
+        {2, vk::DescriptorType::eStorageBuffer, 1, compute}
+    });
+    vk::PushConstantRange pushRange{compute, 0, sizeof(MipParams)};
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &_setLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    _pipelineLayout = device.createPipelineLayout(layoutInfo);
+
+    vk::SamplerCreateInfo samplerInfo{};
+    samplerInfo.magFilter = vk::Filter::eNearest;
+    samplerInfo.minFilter = vk::Filter::eNearest;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    _sampler = device.createSampler(samplerInfo);
+
+    vk::BufferCreateInfo bufferInfo{};
+    bufferInfo.size = kScratchSize;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+    _scratch.buffer = device.createBuffer(bufferInfo);
+    const auto requirements = device.getBufferMemoryRequirements(_scratch.buffer);
+    vk::MemoryAllocateInfo allocInfo{};
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = Utils::Vulkan::FindMemoryType(_desc.phyDevice, requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    _scratch.memory = device.allocateMemory(allocInfo);
+    device.bindBufferMemory(_scratch.buffer, _scratch.memory, 0);
+    _desc.tracker->registerBuffer(_scratch.buffer);
+
+    try{
+        // the common case is compiled up front, the linear variant on first use
+        pipeline(true);
+    }catch(const std::runtime_error &err){
+        LOGW("Compute mip generation is disabled, its shader is not available: {}", err.what());
+        destroy();
+        return;
+    }
+    _enabled = true;
+}
+
+void MipGenerator::destroy(){
+    const auto &device = _desc.device;
+    if(!device){
+        return;
+    }
+
+    for(auto &pipeline : _pipelines){
+        device.destroyPipeline(pipeline);
+        pipeline = nullptr;
+    }
+    if(_scratch.buffer){
+        _desc.tracker->forget(_scratch.buffer);
+        device.destroyBuffer(_scratch.buffer);
+        device.freeMemory(_scratch.memory);
+        _scratch = {};
+    }
+    device.destroySampler(_sampler);
+    device.destroyPipelineLayout(_pipelineLayout);
+    _sampler = nullptr;
+    _pipelineLayout = nullptr;
+    _enabled = false;
+}
+
+vk::Pipeline MipGenerator::pipeline(const bool srgb){
+    auto &result = _pipelines[srgb ? 1 : 0];
+    if(result){
+        return result;
+    }
+
+    const auto binary = _desc.shaders->load("spd.comp", ShaderStage::Compute);
+    auto module = _desc.device.createShaderModuleUnique({vk::ShaderModuleCreateFlags(), binary.code.size() * sizeof(uint32_t), binary.code.data()});
+    ShaderSpecialization spec{};
+    spec.set<VkBool32>(0, srgb ? VK_TRUE : VK_FALSE);
+    vk::SpecializationInfo specInfo{};
+    specInfo.mapEntryCount = spec.entries.size();
+    specInfo.pMapEntries = spec.entries.data();
+    specInfo.dataSize = spec.data.size();
+    specInfo.pData = spec.data.data();
+
+    vk::ComputePipelineCreateInfo info{};
+    info.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    info.stage.module = *module;
+    info.stage.pName = "main";
+    info.stage.pSpecializationInfo = &specInfo;
+    info.layout = _pipelineLayout;
+    result = _desc.device.createComputePipeline(_desc.pipelineCache, info).value;
+    return result;
+}
+
+bool MipGenerator::supports(const vk::Format format, const vk::Extent2D extent, const uint32_t mipLevels) const {
+    if(!_enabled || mipLevels < 2 || mipLevels - 1 > kMaxMips){
+        return false;
+    }
+    if(mipLevels - 1 > kTileMips && ((extent.width + kTileSize - 1) / kTileSize > kMaxGroupsPerAxis || (extent.height + kTileSize - 1) / kTileSize > kMaxGroupsPerAxis)){
+        return false;
+    }
+
+    const auto sampled = _desc.phyDevice.getFormatProperties(format).optimalTilingFeatures;
+    const auto storage = _desc.phyDevice.getFormatProperties(StorageFormat(format)).optimalTilingFeatures;
+    return (sampled & vk::FormatFeatureFlagBits::eSampledImage) && (storage & vk::FormatFeatureFlagBits::eStorageImage);
+}
+
+vk::ImageCreateFlags MipGenerator::imageFlags(const vk::Format format){
+    // extended usage allows the storage usage the sRGB format itself does not support
+    return IsSrgb(format) ? vk::ImageCreateFlagBits::eMutableFormat | vk::ImageCreateFlagBits::eExtendedUsage : vk::ImageCreateFlags{};
+}
+
+void MipGenerator::generate(const vk::CommandBuffer &cmd, const vk::Image &image, const vk::Format format, const vk::Extent2D extent, const uint32_t mipLevels,
+    DeletionQueue &deferred, const uint64_t retireValue){
+    TRACE_ZONE("generate mips");
+    const auto &device = _desc.device;
+    const auto mipCount = mipLevels - 1;
+    const auto srgb = IsSrgb(format);
+    const auto computePipeline = pipeline(srgb);
+
+    // mip 0 is sampled in the image's own format, so sRGB texels arrive linear; the levels are written as UNORM.
+    // The image carries the storage usage, every view narrows it to what its format supports
+    vk::ImageViewUsageCreateInfo usageInfo{vk::ImageUsageFlagBits::eSampled};
+    vk::ImageViewCreateInfo viewInfo{};
+    viewInfo.pNext = &usageInfo;
+    viewInfo.image = image;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+    std::vector<vk::ImageView> views{device.createImageView(viewInfo)};
+    usageInfo.usage = vk::ImageUsageFlagBits::eStorage;
+    viewInfo.format = StorageFormat(format);
+    for(uint32_t mip = 1;mip <= mipCount;mip ++){
+        viewInfo.subresourceRange.baseMipLevel = mip;
+        views.push_back(device.createImageView(viewInfo));
+    }
+
+    auto descriptors = std::make_shared<DescriptorAllocator>();
+    descriptors->initialize(device, kMipDescriptorRatios, 1);
+    const auto set = descriptors->allocate(_setLayout);
+    const vk::DescriptorImageInfo sourceInfo{_sampler, views[0], vk::ImageLayout::eShaderReadOnlyOptimal};
+    std::array<vk::DescriptorImageInfo, kMaxMips> mipInfos{};
+    for(uint32_t i = 0;i < kMaxMips;i ++){
+        // entries past the chain alias its last level, the shader never writes them
+        mipInfos[i] = vk::DescriptorImageInfo{nullptr, views[std::min(i + 1, mipCount)], vk::ImageLayout::eGeneral};
+    }
+    const vk::DescriptorBufferInfo scratchInfo{_scratch.buffer, 0, VK_WHOLE_SIZE};
+    const std::array<vk::WriteDescriptorSet, 3> writes = {
+        vk::WriteDescriptorSet{set, 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &sourceInfo},
+        vk::WriteDescriptorSet{set, 1, 0, kMaxMips, vk::DescriptorType::eStorageImage, mipInfos.data()},
+        vk::WriteDescriptorSet{set, 2, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &scratchInfo}
+    };
+    device.updateDescriptorSets(writes, {});
+
+    auto &tracker = *_desc.tracker;
+    tracker.useBuffer(_scratch.buffer, ResourceUse::TransferDst);
+    tracker.flush(cmd);
+    cmd.fillBuffer(_scratch.buffer, 0, kScratchHeader, 0);
+    tracker.useBuffer(_scratch.buffer, ResourceUse::ComputeShaderWrite);
+    tracker.useImage(image, ResourceUse::ComputeShaderRead, 0, 1);
+    // the levels are overwritten completely, their old contents are not kept
+    tracker.useImage(image, ResourceUse::ComputeShaderWrite, 1, mipCount);
+    tracker.flush(cmd);
+
+    MipParams params{};
+    params.mipCount = mipCount;
+    const auto groupsX = (extent.width + kTileSize - 1) / kTileSize;
+    const auto groupsY = (extent.height + kTileSize - 1) / kTileSize;
+    params.workGroups = groupsX * groupsY;
+    params.sourceWidth = extent.width;
+    params.sourceHeight = extent.height;
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, computePipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, _pipelineLayout, 0, set, {});
+    cmd.pushConstants(_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(params), &params);
+    cmd.dispatch(groupsX, groupsY, 1);
+
+    tracker.useImage(image, ResourceUse::FragmentShaderRead);
+    tracker.flush(cmd);
+
+    deferred.push(retireValue, [device, views, descriptors](){
+        for(auto view : views){
+            device.destroyImageView(view);
+        }
+        descriptors->destroy();
+    });
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+#include "DeletionQueue.hpp"
+#include "DescriptorAllocator.hpp"
+#include "ResourceStateTracker.hpp"
+#include "ShaderLibrary.hpp"
+
+struct MipGeneratorDesc{
+    vk::Device device{};
+    vk::PhysicalDevice phyDevice{};
+    vk::PipelineCache pipelineCache{};
+    ShaderLibrary *shaders{};
+    DescriptorLayoutCache *layouts{};
+    ResourceStateTracker *tracker{};
+    // shaderStorageImageWriteWithoutFormat, lets one shader write every format
+    bool writeWithoutFormat{false};
+};
+
+// Compute downsampler in the style of a single pass downsampler: one dispatch writes up to
+// kMaxMips levels below mip 0, workgroups reduce their tile through shared memory and the last
+// one to finish, found with an atomic counter, reduces the remaining levels. Replaces the
+// serial blit chain and its barrier per level for formats that can be written as storage images.
+// Levels are box filtered, sRGB formats are averaged in linear space.
+class MipGenerator{
+public:
+    static constexpr const uint32_t kMaxMips = 12;
+
+    void initialize(const MipGeneratorDesc &desc);
+    void destroy();
+
+    // True when generate() can handle the format and mip chain, otherwise callers blit.
+    bool supports(const vk::Format format, const vk::Extent2D extent, const uint32_t mipLevels) const;
+    // sRGB images are written through a UNORM view, so they have to be created with these flags. Views
+    // in the sRGB format then have to chain a vk::ImageViewUsageCreateInfo without the storage usage.
+    static vk::ImageCreateFlags imageFlags(const vk::Format format);
+    static vk::ImageUsageFlags imageUsage() { return vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage; }
+
+    // Fills levels 1 to mipLevels - 1 from mip 0 and leaves the whole image readable by fragment
+    // shaders. The views and descriptors of the call retire through the queue at retireValue.
+    void generate(const vk::CommandBuffer &cmd, const vk::Image &image, const vk::Format format, const vk::Extent2D extent, const uint32_t mipLevels,
+        DeletionQueue &deferred, const uint64_t retireValue);
+
+private:
+    struct Buffer{
+        vk::Buffer buffer{};
+        vk::DeviceMemory memory{};
+    };
+
+    vk::Pipeline pipeline(const bool srgb);
+
+    MipGeneratorDesc _desc{};
+    bool _enabled{false};
+    vk::DescriptorSetLayout _setLayout{};
+    vk::PipelineLayout _pipelineLayout{};
+    vk::Sampler _sampler{};
+    // counter and mip 6 of every workgroup, shared by all calls since they are serialized on it
+    Buffer _scratch{};
+    // indexed by srgb, compiled on first use
+    std::array<vk::Pipeline, 2> _pipelines{};
+};
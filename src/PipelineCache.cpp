@@ -0,0 +1,96 @@
+#include "PipelineCache.hpp"
+#include "Log.hpp"
+#include "Utils.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+bool PipelineCache::validate(const std::vector<char> &data) const {
+    VkPipelineCacheHeaderVersionOne header{};
+    if(data.size() < sizeof(header)){
+        LOGW("Pipeline cache {} is too small ({} bytes)", _path, data.size());
+        return false;
+    }
+
+    std::memcpy(&header, data.data(), sizeof(header));
+    if(header.headerSize < sizeof(header) || header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE){
+        LOGW("Pipeline cache {} has an unknown header version {}", _path, static_cast<uint32_t>(header.headerVersion));
+        return false;
+    }
+
+    if(header.vendorID != _props.vendorID || header.deviceID != _props.deviceID){
+        LOGW("Pipeline cache {} was written by device {:#x}:{:#x}, running on {:#x}:{:#x}", _path, header.vendorID, header.deviceID, _props.vendorID, _props.deviceID);
+        return false;
+    }
+
+    if(std::memcmp(header.pipelineCacheUUID, _props.pipelineCacheUUID.data(), VK_UUID_SIZE) != 0){
+        LOGW("Pipeline cache {} was written by another driver version", _path);
+        return false;
+    }
+
+    return true;
+}
+
+void PipelineCache::initialize(const vk::Device &device, const vk::PhysicalDevice &phyDevice, const std::string &path){
+    _device = device;
+    _props = phyDevice.getProperties();
+    _path = path;
+    _warm = false;
+
+    std::vector<char> data{};
+    if(!_path.empty() && std::filesystem::exists(_path)){
+        data = Utils::FileSystem::ReadFile(_path);
+        _warm = validate(data);
+        if(!_warm){
+            data.clear();
+        }
+    }
+
+    vk::PipelineCacheCreateInfo info{};
+    info.initialDataSize = data.size();
+    info.pInitialData = data.empty() ? nullptr : data.data();
+    _cache = _device.createPipelineCache(info);
+    LOGI("Pipeline cache {} is {} ({} bytes)", _path, _warm ? "warm" : "cold", data.size());
+}
+
+void PipelineCache::save() const {
+    if(!_cache || _path.empty()){
+        return;
+    }
+
+    auto data = _device.getPipelineCacheData(_cache);
+    const auto tmpPath = _path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if(!file.is_open()){
+            LOGE("Failed to open {} to save the pipeline cache", tmpPath);
+            return;
+        }
+
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if(!file.good()){
+            LOGE("Failed to write the pipeline cache into {}", tmpPath);
+            return;
+        }
+    }
+
+    // rename is atomic on the same filesystem, readers either see the old or the new cache
+    std::error_code ec{};
+    std::filesystem::rename(tmpPath, _path, ec);
+    if(ec){
+        LOGE("Failed to replace {}: {}", _path, ec.message());
+        return;
+    }
+    LOGI("Saved {} bytes of pipeline cache into {}", data.size(), _path);
+}
+
+void PipelineCache::destroy(){
+    if(!_device){
+        return;
+    }
+
+    save();
+    _device.destroyPipelineCache(_cache);
+    _cache = nullptr;
+    _device = nullptr;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <vulkan/vulkan.hpp>
+
+// vk::PipelineCache persisted to disk. The file is only used when its header matches the
+// running driver and is replaced atomically, so a crash never leaves a truncated cache behind.
+class PipelineCache{
+public:
+    void initialize(const vk::Device &device, const vk::PhysicalDevice &phyDevice, const std::string &path);
+    void save() const;
+    void destroy();
+
+    vk::PipelineCache handle() const { return _cache; }
+    // true when the cache was seeded from a valid file
+    bool warm() const { return _warm; }
+
+private:
+    bool validate(const std::vector<char> &data) const;
+
+    vk::Device _device{};
+    vk::PhysicalDeviceProperties _props{};
+    vk::PipelineCache _cache{};
+    std::string _path{};
+    bool _warm{false};
+};
@@ -0,0 +1,286 @@
+#include "PipelineManager.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <array>
+
+using namespace Utils;
+
+uint64_t HashPipelineDesc(const PipelineDesc &desc){
+    uint64_t h = Hash::kFnvOffset;
+    h = Hash::Combine(h, desc.vertexHash);
+    h = Hash::Combine(h, desc.fragmentHash);
+    for(auto *spec : {&desc.vertexSpec, &desc.fragmentSpec}){
+        for(auto &entry : spec->entries){
+            h = Hash::Combine(h, entry.constantID);
+            h = Hash::Combine(h, entry.offset);
+        }
+        h = Hash::Fnv1a(spec->data.data(), spec->data.size(), h);
+    }
+    for(auto &b : desc.bindings){
+        h = Hash::Combine(h, b.binding);
+        h = Hash::Combine(h, b.stride);
+        h = Hash::Combine(h, b.inputRate);
+    }
+
+    for(auto &a : desc.attributes){
+        h = Hash::Combine(h, a.location);
+        h = Hash::Combine(h, a.binding);
+        h = Hash::Combine(h, a.format);
+        h = Hash::Combine(h, a.offset);
+    }
+
+    h = Hash::Combine(h, static_cast<VkPipelineLayout>(desc.layout));
+    h = Hash::Combine(h, static_cast<VkRenderPass>(desc.renderPass));
+    h = Hash::Combine(h, desc.subpass);
+    h = Hash::Combine(h, desc.colorAttachmentCount);
+    h = Hash::Combine(h, desc.samples);
+    h = Hash::Combine(h, static_cast<VkCullModeFlags>(desc.cullMode));
+    h = Hash::Combine(h, desc.blendEnable);
+    h = Hash::Combine(h, desc.depthTest);
+    h = Hash::Combine(h, desc.depthWrite);
+    h = Hash::Combine(h, desc.depthCompare);
+    return h;
+}
+
+void PipelineManager::initialize(const vk::Device &device, const PipelineCache &cache, const uint32_t threadCount){
+    _device = device;
+    _cache = &cache;
+    _stop = false;
+    for(uint32_t i = 0;i < std::max(threadCount, 1u);i ++){
+        _workers.emplace_back(&PipelineManager::workerLoop, this);
+    }
+    LOGI("Pipeline manager compiles on {} background threads", _workers.size());
+}
+
+void PipelineManager::destroy(){
+    if(!_device){
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _queue.clear();
+    }
+    _wake.notify_all();
+    for(auto &worker : _workers){
+        worker.join();
+    }
+    _workers.clear();
+
+    for(auto &[key, entry] : _entries){
+        _device.destroyPipeline(entry.pipeline);
+    }
+    _entries.clear();
+    _device = nullptr;
+}
+
+void PipelineManager::clear(){
+    std::unique_lock<std::mutex> lock(_mutex);
+    _queue.clear();
+    _idle.wait(lock, [this](){ return _inFlight == 0; });
+    for(auto &[key, entry] : _entries){
+        _device.destroyPipeline(entry.pipeline);
+    }
+    _entries.clear();
+    _generation.fetch_add(1, std::memory_order_release);
+}
+
+void PipelineManager::enqueueLocked(const uint64_t key, const PipelineDesc &desc){
+    if(_entries.count(key)){
+        return;
+    }
+
+    Entry entry{};
+    entry.queued = std::chrono::steady_clock::now();
+    _entries.emplace(key, entry);
+    _queue.emplace_back(key, desc);
+    _wake.notify_one();
+}
+
+void PipelineManager::enqueue(const PipelineDesc &desc){
+    const auto key = HashPipelineDesc(desc);
+    std::lock_guard<std::mutex> lock(_mutex);
+    enqueueLocked(key, desc);
+}
+
+vk::Pipeline PipelineManager::request(const PipelineDesc &desc){
+    const auto key = HashPipelineDesc(desc);
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(key);
+    if(it != _entries.end() && it->second.state == EntryState::Ready){
+        return it->second.pipeline;
+    }
+
+    enqueueLocked(key, desc);
+    _stats.hitches++;
+    return nullptr;
+}
+
+PipelineStats PipelineManager::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto stats = _stats;
+    stats.pending = _queue.size() + _inFlight;
+    return stats;
+}
+
+void PipelineManager::workerLoop(){
+    trace::SetThreadName("pipeline worker");
+    for(;;){
+        std::pair<uint64_t, PipelineDesc> job{};
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this](){ return _stop || !_queue.empty(); });
+            if(_stop){
+                return;
+            }
+
+            job = std::move(_queue.front());
+            _queue.pop_front();
+            _inFlight++;
+        }
+
+        vk::Pipeline pipeline{};
+        double createMs{};
+        try{
+            TRACE_ZONE("compile pipeline");
+            pipeline = compile(job.second, createMs);
+        }catch(const vk::SystemError &err){
+            LOGE("Failed to compile pipeline {:#018x}: {}", job.first, err.what());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto &entry = _entries[job.first];
+            entry.pipeline = pipeline;
+            entry.state = pipeline ? EntryState::Ready : EntryState::Failed;
+            if(pipeline){
+                const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - entry.queued).count();
+                _stats.compiled++;
+                _stats.lastCompileMs = ms;
+                _stats.maxCompileMs = std::max(_stats.maxCompileMs, ms);
+                _stats.avgCompileMs += (ms - _stats.avgCompileMs) / _stats.compiled;
+                LOGI("Graphics pipeline {:#018x} created in {:.3f} ms with a {} pipeline cache, ready {:.3f} ms after it was requested",
+                    job.first, createMs, _cache->warm() ? "warm" : "cold", ms);
+            }else{
+                _stats.failed++;
+            }
+            _inFlight--;
+        }
+        _generation.fetch_add(1, std::memory_order_release);
+        _idle.notify_all();
+    }
+}
+
+static vk::SpecializationInfo MakeSpecializationInfo(const ShaderSpecialization &spec){
+    vk::SpecializationInfo info{};
+    info.mapEntryCount = spec.entries.size();
+    info.pMapEntries = spec.entries.data();
+    info.dataSize = spec.data.size();
+    info.pData = spec.data.data();
+    return info;
+}
+
+vk::Pipeline PipelineManager::compile(const PipelineDesc &desc, double &createMs) const {
+    const auto vertexSpec = MakeSpecializationInfo(desc.vertexSpec);
+    const auto fragmentSpec = MakeSpecializationInfo(desc.fragmentSpec);
+    vk::PipelineShaderStageCreateInfo shaderStages[] = {
+        {
+            vk::PipelineShaderStageCreateFlags(),
+            vk::ShaderStageFlagBits::eVertex,
+            desc.vertexModule,
+            "main",
+            desc.vertexSpec.empty() ? nullptr : &vertexSpec
+        },
+        {
+            vk::PipelineShaderStageCreateFlags(),
+            vk::ShaderStageFlagBits::eFragment,
+            desc.fragmentModule,
+            "main",
+            desc.fragmentSpec.empty() ? nullptr : &fragmentSpec
+        }
+    };
+
+    vk::PipelineVertexInputStateCreateInfo vertexInputInfo = {};
+    vertexInputInfo.vertexBindingDescriptionCount = desc.bindings.size();
+    vertexInputInfo.pVertexBindingDescriptions = desc.bindings.data();
+    vertexInputInfo.vertexAttributeDescriptionCount = desc.attributes.size();
+    vertexInputInfo.pVertexAttributeDescriptions = desc.attributes.data();
+
+    vk::PipelineInputAssemblyStateCreateInfo inputAssembly = {};
+    inputAssembly.topology = vk::PrimitiveTopology::eTriangleList;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    // viewport and scissor are dynamic so the extent is not part of the key
+    vk::PipelineViewportStateCreateInfo viewportState = {};
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    vk::PipelineRasterizationStateCreateInfo rasterizer = {};
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = vk::PolygonMode::eFill;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = desc.cullMode;
+    rasterizer.frontFace = vk::FrontFace::eCounterClockwise;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    vk::PipelineMultisampleStateCreateInfo multisampling = {};
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = desc.samples;
+
+    vk::PipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.depthTestEnable = desc.depthTest;
+    depthStencil.depthWriteEnable = desc.depthWrite;
+    depthStencil.depthCompareOp = desc.depthCompare;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
+    vk::PipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    colorBlendAttachment.blendEnable = desc.blendEnable;
+    colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+    colorBlendAttachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+    colorBlendAttachment.colorBlendOp = vk::BlendOp::eAdd;
+    colorBlendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+    colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eZero;
+    colorBlendAttachment.alphaBlendOp = vk::BlendOp::eAdd;
+
+    vk::PipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.logicOp = vk::LogicOp::eCopy;
+    colorBlending.attachmentCount = desc.colorAttachmentCount;
+    colorBlending.pAttachments = desc.colorAttachmentCount ? &colorBlendAttachment : nullptr;
+
+    std::array<vk::DynamicState, 2> dynamicStates = {
+        vk::DynamicState::eViewport,
+        vk::DynamicState::eScissor
+    };
+
+    vk::PipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.dynamicStateCount = dynamicStates.size();
+    dynamicState.pDynamicStates = dynamicStates.data();
+
+    vk::GraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.stageCount = desc.fragmentModule ? 2 : 1;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.layout = desc.layout;
+    pipelineInfo.renderPass = desc.renderPass;
+    pipelineInfo.subpass = desc.subpass;
+    pipelineInfo.basePipelineHandle = nullptr;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pDynamicState = &dynamicState;
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto pipeline = _device.createGraphicsPipeline(_cache->handle(), pipelineInfo).value;
+    createMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return pipeline;
+}
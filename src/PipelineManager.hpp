@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "PipelineCache.hpp"
+#include "ShaderLibrary.hpp"
+
+// Complete graphics pipeline state. Shader identity is the hash of the SPIR-V, so keys stay
+// stable while the modules themselves only have to outlive the compile.
+struct PipelineDesc{
+    vk::ShaderModule vertexModule{};
+    // null for depth only pipelines
+    vk::ShaderModule fragmentModule{};
+    uint64_t vertexHash{};
+    uint64_t fragmentHash{};
+    ShaderSpecialization vertexSpec{};
+    ShaderSpecialization fragmentSpec{};
+    std::vector<vk::VertexInputBindingDescription> bindings{};
+    std::vector<vk::VertexInputAttributeDescription> attributes{};
+    vk::PipelineLayout layout{};
+    vk::RenderPass renderPass{};
+    uint32_t subpass{};
+    // 0 for depth only render passes, otherwise one blended attachment
+    uint32_t colorAttachmentCount{1};
+    vk::SampleCountFlagBits samples{vk::SampleCountFlagBits::e1};
+    vk::CullModeFlags cullMode{vk::CullModeFlagBits::eBack};
+    bool blendEnable{false};
+    bool depthTest{true};
+    bool depthWrite{true};
+    vk::CompareOp depthCompare{vk::CompareOp::eLess};
+};
+
+uint64_t HashPipelineDesc(const PipelineDesc &desc);
+
+struct PipelineStats{
+    uint32_t pending{};
+    uint64_t compiled{};
+    uint64_t failed{};
+    uint64_t hitches{};
+    double lastCompileMs{};
+    double avgCompileMs{};
+    double maxCompileMs{};
+};
+
+// Compiles pipeline permutations on background threads through the shared pipeline cache.
+// The render thread never blocks: request() returns a null pipeline until the compile is done.
+class PipelineManager{
+public:
+    ~PipelineManager(){
+        destroy();
+    }
+
+    void initialize(const vk::Device &device, const PipelineCache &cache, const uint32_t threadCount);
+    void destroy();
+    // Waits for in-flight compiles and destroys every pipeline, e.g. when the render pass changes.
+    void clear();
+
+    // Queues the permutation if it is unknown, never counts as a hitch.
+    void enqueue(const PipelineDesc &desc);
+    // Returns the pipeline or a null handle (counted as a hitch) while it is still compiling.
+    vk::Pipeline request(const PipelineDesc &desc);
+
+    // Bumped whenever a pipeline becomes ready, recorded command buffers compare against it.
+    uint64_t generation() const { return _generation.load(std::memory_order_acquire); }
+    PipelineStats stats() const;
+
+private:
+    enum class EntryState{
+        Pending,
+        Ready,
+        Failed
+    };
+
+    struct Entry{
+        EntryState state{EntryState::Pending};
+        vk::Pipeline pipeline{};
+        std::chrono::steady_clock::time_point queued{};
+    };
+
+    void workerLoop();
+    // createMs is the time spent in vkCreateGraphicsPipelines alone
+    vk::Pipeline compile(const PipelineDesc &desc, double &createMs) const;
+    void enqueueLocked(const uint64_t key, const PipelineDesc &desc);
+
+    vk::Device _device{};
+    const PipelineCache *_cache{};
+    std::vector<std::thread> _workers{};
+    mutable std::mutex _mutex{};
+    std::condition_variable _wake{};
+    std::condition_variable _idle{};
+    std::deque<std::pair<uint64_t, PipelineDesc>> _queue{};
+    std::unordered_map<uint64_t, Entry> _entries{};
+    uint32_t _inFlight{};
+    bool _stop{false};
+    std::atomic<uint64_t> _generation{0};
+    PipelineStats _stats{};
+};
@@ -0,0 +1,448 @@
+#include "RenderGraph.hpp"
+#include "GpuProfiler.hpp"
+#include "Log.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+static vk::ImageUsageFlags GetImageUsage(const ResourceUse use){
+    switch(use){
+    case ResourceUse::ColorAttachment:
+        return vk::ImageUsageFlagBits::eColorAttachment;
+    case ResourceUse::DepthAttachment:
+    case ResourceUse::DepthAttachmentRead:
+        return vk::ImageUsageFlagBits::eDepthStencilAttachment;
+    case ResourceUse::FragmentShaderRead:
+    case ResourceUse::ComputeShaderRead:
+        return vk::ImageUsageFlagBits::eSampled;
+    case ResourceUse::ComputeShaderWrite:
+        return vk::ImageUsageFlagBits::eStorage;
+    case ResourceUse::TransferSrc:
+        return vk::ImageUsageFlagBits::eTransferSrc;
+    case ResourceUse::TransferDst:
+        return vk::ImageUsageFlagBits::eTransferDst;
+    default:
+        return {};
+    }
+}
+
+void RGPassBuilder::read(const RGResource res, const ResourceUse use){
+    auto &pass = _graph._passes[_pass];
+    pass.reads.push_back(res);
+    pass.accesses.push_back({_graph._versions.at(res).resource, use});
+}
+
+RGResource RGPassBuilder::write(const RGResource res, const ResourceUse use){
+    auto &pass = _graph._passes[_pass];
+    auto version = _graph.newVersion(res, _pass);
+    pass.writes.push_back(version);
+    pass.accesses.push_back({_graph._versions[version].resource, use});
+    return version;
+}
+
+RGResource RGPassBuilder::modify(const RGResource res, const ResourceUse use){
+    _graph._passes[_pass].reads.push_back(res);
+    return write(res, use);
+}
+
+void RGPassBuilder::sideEffect(){
+    _graph._passes[_pass].sideEffect = true;
+}
+
+void RenderGraph::initialize(const vk::Device &device, const vk::PhysicalDevice &phyDevice, ResourceStateTracker *tracker){
+    _device = device;
+    _phyDevice = phyDevice;
+    _tracker = tracker;
+}
+
+void RenderGraph::reset(DeletionQueue *deferred, const uint64_t retireValue){
+    std::vector<vk::Image> images{};
+    std::vector<vk::ImageView> views{};
+    std::vector<vk::DeviceMemory> memories{};
+    for(auto &res : _resources){
+        if(res.imported || !res.image){
+            continue;
+        }
+
+        _tracker->forget(res.image);
+        images.push_back(res.image);
+        views.push_back(res.view);
+    }
+
+    for(auto &block : _blocks){
+        memories.push_back(block.memory);
+    }
+
+    auto release = [device = _device, images, views, memories](){
+        for(size_t i = 0;i < images.size();i ++){
+            device.destroyImageView(views[i]);
+            device.destroyImage(images[i]);
+        }
+        for(auto memory : memories){
+            device.freeMemory(memory);
+        }
+    };
+    if(deferred){
+        deferred->push(retireValue, std::move(release));
+    }else{
+        release();
+    }
+
+    _passes.clear();
+    _resources.clear();
+    _versions.clear();
+    _outputs.clear();
+    _order.clear();
+    _blocks.clear();
+    _compiled = false;
+}
+
+RGResource RenderGraph::addResource(const std::string &name, const RGImageDesc &desc, const bool imported){
+    Resource res{};
+    res.name = name;
+    res.desc = desc;
+    res.imported = imported;
+    _resources.push_back(res);
+    _versions.push_back({static_cast<uint32_t>(_resources.size() - 1), UINT32_MAX});
+    return _versions.size() - 1;
+}
+
+RGResource RenderGraph::newVersion(const RGResource res, const uint32_t producer){
+    _versions.push_back({_versions.at(res).resource, producer});
+    return _versions.size() - 1;
+}
+
+RGResource RenderGraph::createImage(const std::string &name, const RGImageDesc &desc){
+    return addResource(name, desc, false);
+}
+
+RGResource RenderGraph::importImage(const std::string &name, const RGImageDesc &desc){
+    return addResource(name, desc, true);
+}
+
+void RenderGraph::addPass(const std::string &name, const SetupFunc &setup, const ExecuteFunc &execute){
+    Pass pass{};
+    pass.name = name;
+    pass.execute = execute;
+    _passes.push_back(std::move(pass));
+
+    RGPassBuilder builder(*this, _passes.size() - 1);
+    setup(builder);
+}
+
+void RenderGraph::markOutput(const RGResource res, const ResourceUse finalUse){
+    _outputs.push_back({res, finalUse});
+}
+
+void RenderGraph::cullPasses(){
+    for(auto &pass : _passes){
+        pass.culled = true;
+    }
+
+    std::vector<uint32_t> worklist{};
+    for(auto &out : _outputs){
+        if(_versions[out.version].producer != UINT32_MAX){
+            worklist.push_back(_versions[out.version].producer);
+        }
+    }
+
+    for(uint32_t i = 0;i < _passes.size();i ++){
+        if(_passes[i].sideEffect){
+            worklist.push_back(i);
+        }
+    }
+
+    while(!worklist.empty()){
+        auto index = worklist.back();
+        worklist.pop_back();
+        if(!_passes[index].culled){
+            continue;
+        }
+
+        _passes[index].culled = false;
+        for(auto read : _passes[index].reads){
+            if(_versions[read].producer != UINT32_MAX){
+                worklist.push_back(_versions[read].producer);
+            }
+        }
+    }
+}
+
+void RenderGraph::sortPasses(){
+    // edge a -> b means pass a has to run before pass b
+    const auto count = _passes.size();
+    std::vector<std::vector<uint32_t>> edges(count);
+    std::vector<uint32_t> indegree(count, 0);
+    auto addEdge = [&](const uint32_t from, const uint32_t to){
+        if(from == UINT32_MAX || from == to || _passes[from].culled || _passes[to].culled){
+            return;
+        }
+
+        if(std::find(edges[from].begin(), edges[from].end(), to) == edges[from].end()){
+            edges[from].push_back(to);
+            indegree[to]++;
+        }
+    };
+
+    for(uint32_t i = 0;i < count;i ++){
+        for(auto read : _passes[i].reads){
+            addEdge(_versions[read].producer, i);
+        }
+
+        // a new version may only be written once every reader of older versions is done
+        for(auto written : _passes[i].writes){
+            const auto resource = _versions[written].resource;
+            for(uint32_t other = 0;other < count;other ++){
+                for(auto read : _passes[other].reads){
+                    if(_versions[read].resource == resource && read < written){
+                        addEdge(other, i);
+                    }
+                }
+
+                for(auto otherWritten : _passes[other].writes){
+                    if(_versions[otherWritten].resource == resource && otherWritten < written){
+                        addEdge(other, i);
+                    }
+                }
+            }
+        }
+    }
+
+    // Kahn's algorithm, ties broken by declaration order
+    _order.clear();
+    std::vector<bool> done(count, false);
+    for(;;){
+        uint32_t next = UINT32_MAX;
+        for(uint32_t i = 0;i < count;i ++){
+            if(!done[i] && !_passes[i].culled && indegree[i] == 0){
+                next = i;
+                break;
+            }
+        }
+
+        if(next == UINT32_MAX){
+            break;
+        }
+
+        done[next] = true;
+        _order.push_back(next);
+        for(auto to : edges[next]){
+            indegree[to]--;
+        }
+    }
+
+    const auto alive = std::count_if(_passes.begin(), _passes.end(), [](const Pass &pass){ return !pass.culled; });
+    if(_order.size() != static_cast<size_t>(alive)){
+        throw std::runtime_error("render graph contains a dependency cycle");
+    }
+}
+
+void RenderGraph::computeLifetimes(){
+    for(uint32_t pos = 0;pos < _order.size();pos ++){
+        for(auto &access : _passes[_order[pos]].accesses){
+            auto &res = _resources[access.resource];
+            res.firstUse = std::min(res.firstUse, pos);
+            res.lastUse = std::max(res.lastUse, pos);
+            res.lastUseKind = access.use;
+        }
+    }
+
+    for(auto &out : _outputs){
+        auto &res = _resources[_versions[out.version].resource];
+        res.lastUseKind = out.finalUse;
+    }
+}
+
+void RenderGraph::allocateTransients(){
+    std::vector<uint32_t> transients{};
+    for(uint32_t i = 0;i < _resources.size();i ++){
+        auto &res = _resources[i];
+        if(res.imported || res.firstUse == UINT32_MAX){
+            continue;
+        }
+
+        auto usage = res.desc.usage;
+        for(auto index : _order){
+            for(auto &access : _passes[index].accesses){
+                if(access.resource == i){
+                    usage |= GetImageUsage(access.use);
+                }
+            }
+        }
+
+        vk::ImageCreateInfo imageInfo{};
+        imageInfo.imageType = vk::ImageType::e2D;
+        imageInfo.extent = vk::Extent3D{res.desc.extent.width, res.desc.extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = res.desc.format;
+        imageInfo.tiling = vk::ImageTiling::eOptimal;
+        imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+        imageInfo.usage = usage;
+        imageInfo.samples = res.desc.samples;
+        imageInfo.sharingMode = vk::SharingMode::eExclusive;
+        res.image = _device.createImage(imageInfo);
+
+        auto requirements = _device.getImageMemoryRequirements(res.image);
+        res.size = requirements.size;
+        res.memoryType = Utils::Vulkan::FindMemoryType(_phyDevice, requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        transients.push_back(i);
+    }
+
+    // largest first, each image joins the first block whose occupants are all dead or not yet alive
+    std::sort(transients.begin(), transients.end(), [&](const uint32_t a, const uint32_t b){
+        return _resources[a].size > _resources[b].size;
+    });
+
+    for(auto index : transients){
+        auto &res = _resources[index];
+        for(uint32_t b = 0;b < _blocks.size() && res.block == UINT32_MAX;b ++){
+            auto &block = _blocks[b];
+            if(block.memoryType != res.memoryType){
+                continue;
+            }
+
+            const bool overlaps = std::any_of(block.occupants.begin(), block.occupants.end(), [&](const uint32_t other){
+                return _resources[other].firstUse <= res.lastUse && res.firstUse <= _resources[other].lastUse;
+            });
+            if(!overlaps){
+                res.block = b;
+                block.occupants.push_back(index);
+                block.size = std::max(block.size, res.size);
+            }
+        }
+
+        if(res.block == UINT32_MAX){
+            res.block = _blocks.size();
+            _blocks.push_back({nullptr, res.size, res.memoryType, {index}});
+        }
+    }
+
+    for(auto &block : _blocks){
+        vk::MemoryAllocateInfo allocInfo{};
+        allocInfo.allocationSize = block.size;
+        allocInfo.memoryTypeIndex = block.memoryType;
+        block.memory = _device.allocateMemory(allocInfo);
+
+        std::sort(block.occupants.begin(), block.occupants.end(), [&](const uint32_t a, const uint32_t b){
+            return _resources[a].firstUse < _resources[b].firstUse;
+        });
+
+        for(size_t i = 0;i < block.occupants.size();i ++){
+            auto &res = _resources[block.occupants[i]];
+            res.aliasedFrom = i == 0 ? -1 : static_cast<int32_t>(block.occupants[i - 1]);
+            _device.bindImageMemory(res.image, block.memory, 0);
+
+            vk::ImageViewCreateInfo viewInfo{};
+            viewInfo.image = res.image;
+            viewInfo.viewType = vk::ImageViewType::e2D;
+            viewInfo.format = res.desc.format;
+            viewInfo.subresourceRange = vk::ImageSubresourceRange{res.desc.aspect, 0, 1, 0, 1};
+            res.view = _device.createImageView(viewInfo);
+            _tracker->registerImage(res.image, res.desc.aspect, 1);
+        }
+    }
+}
+
+void RenderGraph::compile(){
+    cullPasses();
+    sortPasses();
+    computeLifetimes();
+    allocateTransients();
+    _compiled = true;
+}
+
+void RenderGraph::bindImported(const RGResource res, const vk::Image &image, const vk::ImageView &view, const ResourceUse acquiredUse){
+    auto &resource = _resources[_versions.at(res).resource];
+    resource.image = image;
+    resource.view = view;
+    _tracker->assume(image, acquiredUse);
+    _tracker->discard(image);
+}
+
+void RenderGraph::execute(const vk::CommandBuffer &cmd, std::pmr::memory_resource *scratch){
+    if(!_compiled){
+        throw std::runtime_error("render graph executed before compile");
+    }
+
+    std::pmr::vector<bool> started(_resources.size(), false, scratch);
+    for(auto index : _order){
+        auto &pass = _passes[index];
+        const auto scope = _profiler ? _profiler->beginScope(cmd, pass.name) : GpuProfiler::kInvalidScope;
+        for(auto &access : pass.accesses){
+            auto &res = _resources[access.resource];
+            if(!res.imported && !started[access.resource]){
+                // transient contents never survive a frame, the first use only has to wait for the previous owner of the memory
+                started[access.resource] = true;
+                if(res.aliasedFrom >= 0){
+                    _tracker->alias(_resources[res.aliasedFrom].image, res.image);
+                }else{
+                    const auto &lastOwner = _resources[_blocks[res.block].occupants.back()];
+                    _tracker->assume(res.image, lastOwner.lastUseKind);
+                    _tracker->discard(res.image);
+                }
+            }
+            _tracker->useImage(res.image, access.use);
+        }
+
+        _tracker->flush(cmd);
+        pass.execute(cmd);
+        if(_profiler){
+            _profiler->endScope(cmd, scope);
+        }
+    }
+
+    for(auto &out : _outputs){
+        _tracker->useImage(image(out.version), out.finalUse);
+    }
+    _tracker->flush(cmd);
+}
+
+vk::Image RenderGraph::image(const RGResource res) const {
+    return _resources[_versions.at(res).resource].image;
+}
+
+vk::ImageView RenderGraph::view(const RGResource res) const {
+    return _resources[_versions.at(res).resource].view;
+}
+
+void RenderGraph::dump() const {
+    LOGI("Render graph: {} passes, {} executed", _passes.size(), _order.size());
+    for(uint32_t pos = 0;pos < _order.size();pos ++){
+        auto &pass = _passes[_order[pos]];
+        std::string accesses{};
+        for(auto &access : pass.accesses){
+            accesses += std::format(" {}({})", _resources[access.resource].name, static_cast<uint32_t>(access.use));
+        }
+        LOGI("  [{}] {}:{}", pos, pass.name, accesses);
+    }
+
+    for(auto &pass : _passes){
+        if(pass.culled){
+            LOGI("  culled {}", pass.name);
+        }
+    }
+
+    vk::DeviceSize requested = 0;
+    vk::DeviceSize allocated = 0;
+    for(auto &res : _resources){
+        if(res.imported){
+            LOGI("  imported {} {}x{}", res.name, res.desc.extent.width, res.desc.extent.height);
+            continue;
+        }
+
+        if(res.block == UINT32_MAX){
+            continue;
+        }
+
+        requested += res.size;
+        LOGI("  transient {} {}x{} x{} samples, {} KiB, passes [{}, {}], block {}", res.name, res.desc.extent.width, res.desc.extent.height,
+            static_cast<uint32_t>(res.desc.samples), res.size / 1024, res.firstUse, res.lastUse, res.block);
+    }
+
+    for(auto &block : _blocks){
+        allocated += block.size;
+    }
+
+    LOGI("  transient memory {} KiB in {} blocks, aliasing saved {} KiB", allocated / 1024, _blocks.size(), (requested - allocated) / 1024);
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory_resource>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "ResourceStateTracker.hpp"
+#include "DeletionQueue.hpp"
+
+class GpuProfiler;
+
+// Handle to one version of a graph resource. Every write produces a new version, so readers
+// name exactly the producer they depend on and passes may be declared in any order.
+using RGResource = uint32_t;
+static constexpr const RGResource kInvalidRGResource = UINT32_MAX;
+
+struct RGImageDesc{
+    vk::Format format{};
+    vk::Extent2D extent{};
+    vk::SampleCountFlagBits samples{vk::SampleCountFlagBits::e1};
+    vk::ImageUsageFlags usage{};
+    vk::ImageAspectFlags aspect{vk::ImageAspectFlagBits::eColor};
+};
+
+class RenderGraph;
+
+class RGPassBuilder{
+public:
+    RGPassBuilder(RenderGraph &graph, const uint32_t pass) : _graph(graph), _pass(pass) {}
+
+    void read(const RGResource res, const ResourceUse use);
+    // The pass overwrites the whole resource, earlier contents are not needed.
+    RGResource write(const RGResource res, const ResourceUse use);
+    // The pass reads the current contents and writes a new version.
+    RGResource modify(const RGResource res, const ResourceUse use);
+    // Keep the pass even if nothing reads what it writes.
+    void sideEffect();
+
+private:
+    RenderGraph &_graph;
+    uint32_t _pass{};
+};
+
+class RenderGraph{
+public:
+    using SetupFunc = std::function<void(RGPassBuilder &builder)>;
+    using ExecuteFunc = std::function<void(const vk::CommandBuffer &cmd)>;
+
+    void initialize(const vk::Device &device, const vk::PhysicalDevice &phyDevice, ResourceStateTracker *tracker);
+    // Every executed pass, including its barriers, is measured as a GPU scope named after the pass.
+    void setProfiler(GpuProfiler *profiler) { _profiler = profiler; }
+    // Destroys the compiled graph and every transient image, the graph can then be declared again.
+    // With a deletion queue the transients are only destroyed once `retireValue` completes.
+    void reset(DeletionQueue *deferred = nullptr, const uint64_t retireValue = 0);
+
+    RGResource createImage(const std::string &name, const RGImageDesc &desc);
+    RGResource importImage(const std::string &name, const RGImageDesc &desc);
+    void addPass(const std::string &name, const SetupFunc &setup, const ExecuteFunc &execute);
+    void markOutput(const RGResource res, const ResourceUse finalUse);
+
+    // Culls passes that do not contribute to an output, orders the rest and allocates transient memory.
+    void compile();
+    // Binds the physical image of an imported resource for the next execute(). acquiredUse is the
+    // access that last touched the image outside of the graph; its contents are discarded.
+    void bindImported(const RGResource res, const vk::Image &image, const vk::ImageView &view, const ResourceUse acquiredUse);
+    // Per-frame bookkeeping comes from scratch, usually the frame arena.
+    void execute(const vk::CommandBuffer &cmd, std::pmr::memory_resource *scratch = std::pmr::get_default_resource());
+
+    vk::Image image(const RGResource res) const;
+    vk::ImageView view(const RGResource res) const;
+    void dump() const;
+
+private:
+    friend class RGPassBuilder;
+
+    struct Access{
+        uint32_t resource{};
+        ResourceUse use{};
+    };
+
+    struct Pass{
+        std::string name{};
+        ExecuteFunc execute{};
+        std::vector<Access> accesses{};
+        std::vector<RGResource> reads{};
+        std::vector<RGResource> writes{};
+        bool sideEffect{false};
+        bool culled{false};
+    };
+
+    struct Resource{
+        std::string name{};
+        RGImageDesc desc{};
+        bool imported{false};
+        vk::Image image{};
+        vk::ImageView view{};
+        vk::DeviceSize size{};
+        uint32_t memoryType{};
+        uint32_t block{UINT32_MAX};
+        uint32_t firstUse{UINT32_MAX};
+        uint32_t lastUse{};
+        ResourceUse lastUseKind{ResourceUse::Undefined};
+        int32_t aliasedFrom{-1};
+    };
+
+    struct Version{
+        uint32_t resource{};
+        uint32_t producer{UINT32_MAX};
+    };
+
+    struct MemoryBlock{
+        vk::DeviceMemory memory{};
+        vk::DeviceSize size{};
+        uint32_t memoryType{};
+        std::vector<uint32_t> occupants{};
+    };
+
+    struct Output{
+        RGResource version{};
+        ResourceUse finalUse{};
+    };
+
+    RGResource addResource(const std::string &name, const RGImageDesc &desc, const bool imported);
+    RGResource newVersion(const RGResource res, const uint32_t producer);
+    void cullPasses();
+    void sortPasses();
+    void computeLifetimes();
+    void allocateTransients();
+
+    vk::Device _device{};
+    vk::PhysicalDevice _phyDevice{};
+    ResourceStateTracker *_tracker{};
+    GpuProfiler *_profiler{};
+    std::vector<Pass> _passes{};
+    std::vector<Resource> _resources{};
+    std::vector<Version> _versions{};
+    std::vector<Output> _outputs{};
+    std::vector<uint32_t> _order{};
+    std::vector<MemoryBlock> _blocks{};
+    bool _compiled{false};
+};
@@ -0,0 +1,248 @@
+#include "RenderOptions.hpp"
+#include "ErrorCode.hpp"
+#include "Log.hpp"
+#include <charconv>
+#include <cstdint>
+#include <string_view>
+
+static constexpr const uint32_t kMaxFramesInFlight = 8;
+static constexpr const uint32_t kDefaultHeadlessFrames = 100;
+static constexpr const uint32_t kDefaultBenchmarkFrames = 600;
+static constexpr const float kMinRenderScale = 0.25f;
+
+static bool ParsePresentMode(const std::string_view str, PresentMode &mode){
+    if(str == "auto"){
+        mode = PresentMode::Auto;
+    }else if(str == "fifo"){
+        mode = PresentMode::Fifo;
+    }else if(str == "fifo-relaxed"){
+        mode = PresentMode::FifoRelaxed;
+    }else if(str == "mailbox"){
+        mode = PresentMode::Mailbox;
+    }else if(str == "immediate"){
+        mode = PresentMode::Immediate;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+static bool ParseLightingMode(const std::string_view str, LightingMode &mode){
+    if(str == "clustered"){
+        mode = LightingMode::Clustered;
+    }else if(str == "naive"){
+        mode = LightingMode::Naive;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+static bool ParseCaptureFormat(const std::string_view str, CaptureFormat &format){
+    if(str == "png"){
+        format = CaptureFormat::Png;
+    }else if(str == "raw"){
+        format = CaptureFormat::Raw;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+static bool ParseUint(const std::string_view str, uint32_t &value){
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    return ec == std::errc() && ptr == str.data() + str.size();
+}
+
+static bool ParseResolution(const std::string_view str, uint32_t &width, uint32_t &height){
+    const auto pos = str.find('x');
+    if(pos == std::string_view::npos){
+        return false;
+    }
+    return ParseUint(str.substr(0, pos), width) && ParseUint(str.substr(pos + 1), height) && width != 0 && height != 0;
+}
+
+std::error_code ParseRenderOptions(const int argc, char **argv, RenderOptions &options){
+    for(auto i = 1;i < argc;i ++){
+        const std::string_view arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if(arg == "--frames-in-flight" && hasValue){
+            if(!ParseUint(argv[++i], options.framesInFlight) || options.framesInFlight == 0 || options.framesInFlight > kMaxFramesInFlight){
+                LOGE("--frames-in-flight expects a value in [1, {}]", kMaxFramesInFlight);
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--cache-command-buffers"){
+            options.cacheCommandBuffers = true;
+        }else if(arg == "--debug-barriers"){
+            options.debugBarriers = true;
+        }else if(arg == "--debug-arena"){
+            options.debugArena = true;
+        }else if(arg == "--heap-scratch"){
+            options.heapScratch = true;
+        }else if(arg == "--pipeline-cache" && hasValue){
+            options.pipelineCachePath = argv[++i];
+        }else if(arg == "--pipeline-threads" && hasValue){
+            if(!ParseUint(argv[++i], options.pipelineThreads) || options.pipelineThreads == 0){
+                LOGE("--pipeline-threads expects a positive value");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--shader-cache" && hasValue){
+            options.shaderCachePath = argv[++i];
+        }else if(arg == "--resources" && hasValue){
+            options.resourcesPath = argv[++i];
+        }else if(arg == "--untextured"){
+            options.untextured = true;
+        }else if(arg == "--bench-descriptors"){
+            options.benchDescriptors = true;
+        }else if(arg == "--present-mode" && hasValue){
+            if(!ParsePresentMode(argv[++i], options.presentMode)){
+                LOGE("--present-mode expects one of auto, fifo, fifo-relaxed, mailbox, immediate");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--swap-images" && hasValue){
+            if(!ParseUint(argv[++i], options.swapImageCount) || options.swapImageCount == 0){
+                LOGE("--swap-images expects a positive value");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--fps-limit" && hasValue){
+            if(!ParseUint(argv[++i], options.fpsLimit)){
+                LOGE("--fps-limit expects a frame rate, 0 disables the limiter");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--low-latency"){
+            options.lowLatency = true;
+        }else if(arg == "--headless"){
+            options.headless = true;
+        }else if(arg == "--frames" && hasValue){
+            if(!ParseUint(argv[++i], options.frames)){
+                LOGE("--frames expects a frame count");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--benchmark" && hasValue){
+            options.benchmarkPath = argv[++i];
+        }else if(arg == "--warmup" && hasValue){
+            if(!ParseUint(argv[++i], options.warmupFrames)){
+                LOGE("--warmup expects a frame count");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--baseline" && hasValue){
+            options.baselinePath = argv[++i];
+        }else if(arg == "--regression-threshold" && hasValue){
+            const std::string_view value = argv[++i];
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), options.regressionThreshold);
+            if(ec != std::errc() || ptr != value.data() + value.size() || options.regressionThreshold < 0.0){
+                LOGE("--regression-threshold expects a percentage");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--trace" && hasValue){
+            options.tracePath = argv[++i];
+        }else if(arg == "--bench-trace"){
+            options.benchTrace = true;
+        }else if(arg == "--log-file" && hasValue){
+            options.logPath = argv[++i];
+        }else if(arg == "--bench-log"){
+            options.benchLog = true;
+        }else if(arg == "--job-threads" && hasValue){
+            if(!ParseUint(argv[++i], options.jobThreads)){
+                LOGE("--job-threads expects a worker count, 0 picks one per hardware thread");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--pin-job-threads"){
+            options.pinJobThreads = true;
+        }else if(arg == "--bench-jobs"){
+            options.benchJobs = true;
+        }else if(arg == "--depth-prepass"){
+            options.depthPrepass = true;
+        }else if(arg == "--gpu-culling"){
+            options.gpuCulling = true;
+        }else if(arg == "--occlusion-culling"){
+            options.occlusionCulling = true;
+        }else if(arg == "--occlusion-scene"){
+            options.occlusionScene = true;
+        }else if(arg == "--validate-culling"){
+            options.validateCulling = true;
+        }else if(arg == "--animate-objects"){
+            options.animateObjects = true;
+        }else if(arg == "--bench-transforms"){
+            options.benchTransforms = true;
+        }else if(arg == "--on-demand"){
+            options.onDemand = true;
+        }else if(arg == "--dynamic-resolution" && hasValue){
+            const std::string_view value = argv[++i];
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), options.targetFrameMs);
+            if(ec != std::errc() || ptr != value.data() + value.size() || options.targetFrameMs <= 0.0){
+                LOGE("--dynamic-resolution expects the GPU frame time target in milliseconds");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+            options.dynamicResolution = true;
+        }else if(arg == "--min-render-scale" && hasValue){
+            const std::string_view value = argv[++i];
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), options.minRenderScale);
+            if(ec != std::errc() || ptr != value.data() + value.size() || options.minRenderScale < kMinRenderScale || options.minRenderScale > 1.0f){
+                LOGE("--min-render-scale expects a value in [{}, 1]", kMinRenderScale);
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--lights" && hasValue){
+            if(!ParseUint(argv[++i], options.lights)){
+                LOGE("--lights expects a light count");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--light-mode" && hasValue){
+            if(!ParseLightingMode(argv[++i], options.lightingMode)){
+                LOGE("--light-mode expects clustered or naive");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--bench-lights"){
+            options.benchLights = true;
+        }else if(arg == "--capture" && hasValue){
+            options.capturePath = argv[++i];
+        }else if(arg == "--capture-format" && hasValue){
+            if(!ParseCaptureFormat(argv[++i], options.captureFormat)){
+                LOGE("--capture-format expects png or raw");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--capture-threads" && hasValue){
+            if(!ParseUint(argv[++i], options.captureThreads) || options.captureThreads == 0){
+                LOGE("--capture-threads expects a positive value");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else if(arg == "--blit-mips"){
+            options.blitMips = true;
+        }else if(arg == "--resolution" && hasValue){
+            if(!ParseResolution(argv[++i], options.width, options.height)){
+                LOGE("--resolution expects WIDTHxHEIGHT");
+                return MakeGenerateError(AppStatus::FAIL);
+            }
+        }else{
+            LOGE("unknown or incomplete command line option {}", arg);
+            return MakeGenerateError(AppStatus::FAIL);
+        }
+    }
+
+    if(!options.benchmarkPath.empty() && options.frames == 0){
+        options.frames = kDefaultBenchmarkFrames;
+    }
+    if(!options.baselinePath.empty() && options.benchmarkPath.empty()){
+        LOGE("--baseline needs --benchmark");
+        return MakeGenerateError(AppStatus::FAIL);
+    }
+    if(options.occlusionCulling){
+        // the first culling phase renders into the pre-pass depth the pyramid is built from
+        options.depthPrepass = true;
+        options.gpuCulling = true;
+    }
+    if(options.benchLights){
+        // the sweep ends the run once every step was measured
+        options.frames = 0;
+    }
+    if(options.onDemand && (options.headless || !options.benchmarkPath.empty() || options.benchLights)){
+        // these measure or write every frame, idling would only stretch them
+        LOGW("--on-demand needs a window and is ignored by headless runs and benchmarks");
+        options.onDemand = false;
+    }
+    if(options.headless && options.frames == 0 && !options.benchLights){
+        // a headless run has no window to close, it always stops on its own
+        options.frames = kDefaultHeadlessFrames;
+    }
+    return {};
+}
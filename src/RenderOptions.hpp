@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+enum class PresentMode{
+    Auto,
+    Fifo,
+    FifoRelaxed,
+    Mailbox,
+    Immediate
+};
+
+enum class LightingMode : int32_t{
+    // texture only, the lights are not read
+    Unlit,
+    // every fragment loops over the lights of its cluster
+    Clustered,
+    // every fragment loops over all lights, the reference the clustered path is measured against
+    Naive
+};
+
+enum class CaptureFormat{
+    Png,
+    // tightly packed RGBA8, one file per frame
+    Raw
+};
+
+struct RenderOptions{
+    uint32_t framesInFlight{2};
+    bool cacheCommandBuffers{false};
+    bool debugBarriers{false};
+    // poisons frame arena memory and checks guard bytes around every allocation
+    bool debugArena{false};
+    // per-frame scratch comes from the heap instead of the frame arena, to compare the allocation counts
+    bool heapScratch{false};
+    std::string pipelineCachePath{"pipeline_cache.bin"};
+    uint32_t pipelineThreads{2};
+    std::string shaderCachePath{"shader_cache"};
+    // model and texture directory, empty uses the one the build was configured with
+    std::string resourcesPath{};
+    // selects the texture-less specialization of the fragment shader
+    bool untextured{false};
+    bool benchDescriptors{false};
+    PresentMode presentMode{PresentMode::Auto};
+    // 0 keeps the surface minimum + 1
+    uint32_t swapImageCount{0};
+    // 0 renders unlimited
+    uint32_t fpsLimit{0};
+    bool lowLatency{false};
+    // renders into offscreen images without GLFW, a surface or a swapchain
+    bool headless{false};
+    // 0 renders until the window is closed
+    uint32_t frames{0};
+    uint32_t width{800};
+    uint32_t height{600};
+    // writes frame time percentiles into this file after the run, empty disables the benchmark
+    std::string benchmarkPath{};
+    uint32_t warmupFrames{60};
+    // previous benchmark output to compare against, the run fails when a metric regresses
+    std::string baselinePath{};
+    double regressionThreshold{10.0};
+    // Chrome trace JSON with the CPU zones and GPU scopes of the whole run, empty disables tracing
+    std::string tracePath{};
+    // runs the trace zone overhead benchmark and exits
+    bool benchTrace{false};
+    // empty logs to stdout
+    std::string logPath{};
+    // runs the multi-threaded logger benchmark and exits
+    bool benchLog{false};
+    // job system workers, 0 starts one per hardware thread but the main one
+    uint32_t jobThreads{0};
+    bool pinJobThreads{false};
+    // runs the job system scaling benchmark against std::async and exits
+    bool benchJobs{false};
+    // lays down the depth of the scene before shading it
+    bool depthPrepass{false};
+    // frustum culling on the GPU into compacted indirect draws, without a pre-pass
+    bool gpuCulling{false};
+    // two-phase Hi-Z occlusion culling on the GPU, implies GPU culling and the depth pre-pass
+    bool occlusionCulling{false};
+    // replaces the single model by a dense grid of copies that mostly hide each other
+    bool occlusionScene{false};
+    // checks the GPU frustum culling of every frame against the CPU reference
+    bool validateCulling{false};
+    // turns every other layer of the scene through the transform hierarchy, objects are written every frame
+    bool animateObjects{false};
+    // runs the transform update benchmark and exits
+    bool benchTransforms{false};
+    // sleeps in the event loop and only renders when input, animation, a resize or streamed work changed the frame
+    bool onDemand{false};
+    // renders at a scale that keeps the GPU frame time under targetFrameMs and upscales to the swapchain
+    bool dynamicResolution{false};
+    double targetFrameMs{16.0};
+    float minRenderScale{0.5f};
+    // dynamic point and spot lights, 0 renders unlit
+    uint32_t lights{0};
+    LightingMode lightingMode{LightingMode::Clustered};
+    // sweeps the light count for clustered and naive shading, then exits
+    bool benchLights{false};
+    // streams every rendered frame into this directory, empty disables the capture
+    std::string capturePath{};
+    CaptureFormat captureFormat{CaptureFormat::Png};
+    uint32_t captureThreads{2};
+    // generates texture mips with the blit chain instead of the compute downsampler
+    bool blitMips{false};
+};
+
+std::error_code ParseRenderOptions(const int argc, char **argv, RenderOptions &options);
@@ -0,0 +1,280 @@
+#include "ResourceStateTracker.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+using Stage = vk::PipelineStageFlagBits2;
+using Access = vk::AccessFlagBits2;
+
+struct UseInfo{
+    vk::PipelineStageFlags2 stage{};
+    vk::AccessFlags2 access{};
+    vk::ImageLayout layout{vk::ImageLayout::eUndefined};
+    bool write{false};
+};
+
+static UseInfo GetUseInfo(const ResourceUse use){
+    switch(use){
+    case ResourceUse::Undefined:
+        return {};
+    case ResourceUse::TransferSrc:
+        return {Stage::eTransfer, Access::eTransferRead, vk::ImageLayout::eTransferSrcOptimal, false};
+    case ResourceUse::TransferDst:
+        return {Stage::eTransfer, Access::eTransferWrite, vk::ImageLayout::eTransferDstOptimal, true};
+    case ResourceUse::VertexBuffer:
+        return {Stage::eVertexInput, Access::eVertexAttributeRead, vk::ImageLayout::eUndefined, false};
+    case ResourceUse::IndexBuffer:
+        return {Stage::eVertexInput, Access::eIndexRead, vk::ImageLayout::eUndefined, false};
+    case ResourceUse::IndirectBuffer:
+        return {Stage::eDrawIndirect, Access::eIndirectCommandRead, vk::ImageLayout::eUndefined, false};
+    case ResourceUse::UniformBuffer:
+        return {Stage::eVertexShader | Stage::eFragmentShader | Stage::eComputeShader, Access::eUniformRead, vk::ImageLayout::eUndefined, false};
+    case ResourceUse::FragmentShaderRead:
+        return {Stage::eFragmentShader, Access::eShaderRead, vk::ImageLayout::eShaderReadOnlyOptimal, false};
+    case ResourceUse::ComputeShaderRead:
+        return {Stage::eComputeShader, Access::eShaderRead, vk::ImageLayout::eShaderReadOnlyOptimal, false};
+    case ResourceUse::ComputeShaderWrite:
+        return {Stage::eComputeShader, Access::eShaderRead | Access::eShaderWrite, vk::ImageLayout::eGeneral, true};
+    case ResourceUse::ColorAttachment:
+        return {Stage::eColorAttachmentOutput, Access::eColorAttachmentRead | Access::eColorAttachmentWrite, vk::ImageLayout::eColorAttachmentOptimal, true};
+    case ResourceUse::DepthAttachment:
+        return {Stage::eEarlyFragmentTests | Stage::eLateFragmentTests, Access::eDepthStencilAttachmentRead | Access::eDepthStencilAttachmentWrite,
+            vk::ImageLayout::eDepthStencilAttachmentOptimal, true};
+    case ResourceUse::DepthAttachmentRead:
+        return {Stage::eEarlyFragmentTests | Stage::eLateFragmentTests, Access::eDepthStencilAttachmentRead, vk::ImageLayout::eDepthStencilReadOnlyOptimal, false};
+    case ResourceUse::HostRead:
+        return {Stage::eHost, Access::eHostRead, vk::ImageLayout::eGeneral, false};
+    case ResourceUse::HostWrite:
+        return {Stage::eHost, Access::eHostWrite, vk::ImageLayout::eGeneral, true};
+    case ResourceUse::Present:
+        return {Stage::eBottomOfPipe, {}, vk::ImageLayout::ePresentSrcKHR, false};
+    }
+
+    throw std::invalid_argument("unknown resource use");
+}
+
+// Every stage and access bit used above has the same value in the legacy 32-bit masks.
+static vk::PipelineStageFlags ToLegacyStage(const vk::PipelineStageFlags2 stage, const vk::PipelineStageFlagBits fallback){
+    const auto bits = static_cast<VkPipelineStageFlags>(static_cast<VkPipelineStageFlags2>(stage));
+    return bits ? vk::PipelineStageFlags(bits) : vk::PipelineStageFlags(fallback);
+}
+
+static vk::AccessFlags ToLegacyAccess(const vk::AccessFlags2 access){
+    return vk::AccessFlags(static_cast<VkAccessFlags>(static_cast<VkAccessFlags2>(access)));
+}
+
+void ResourceStateTracker::initialize(const bool useSynchronization2){
+    _sync2 = useSynchronization2;
+    _images.clear();
+    _buffers.clear();
+    _imageBarriers.clear();
+    _bufferBarriers.clear();
+    _stats = {};
+}
+
+void ResourceStateTracker::registerImage(const vk::Image &image, const vk::ImageAspectFlags aspect, const uint32_t mipLevels, const vk::ImageLayout layout){
+    ImageState state{};
+    state.aspect = aspect;
+    state.mips.resize(mipLevels);
+    for(auto &mip : state.mips){
+        mip.layout = layout;
+    }
+    _images[image] = std::move(state);
+}
+
+void ResourceStateTracker::registerBuffer(const vk::Buffer &buffer){
+    _buffers[buffer] = AccessState{};
+}
+
+void ResourceStateTracker::forget(const vk::Image &image){
+    _images.erase(image);
+}
+
+void ResourceStateTracker::forget(const vk::Buffer &buffer){
+    _buffers.erase(buffer);
+}
+
+void ResourceStateTracker::discard(const vk::Image &image){
+    for(auto &mip : _images.at(image).mips){
+        // keep the stages so that the next writer still waits for pending readers
+        mip.layout = vk::ImageLayout::eUndefined;
+    }
+}
+
+void ResourceStateTracker::assume(const vk::Image &image, const ResourceUse use){
+    const auto info = GetUseInfo(use);
+    for(auto &mip : _images.at(image).mips){
+        mip.layout = info.layout;
+        mip.writeStages = info.stage;
+        mip.writeAccess = info.write ? info.access : vk::AccessFlags2{};
+        mip.readStages = info.write ? vk::PipelineStageFlags2{} : info.stage;
+        mip.visibleStages = info.write ? vk::PipelineStageFlags2{} : info.stage;
+        mip.visibleAccess = info.write ? vk::AccessFlags2{} : info.access;
+    }
+}
+
+void ResourceStateTracker::alias(const vk::Image &previous, const vk::Image &next){
+    AccessState merged{};
+    for(auto &mip : _images.at(previous).mips){
+        merged.writeStages |= mip.writeStages | mip.readStages;
+        merged.writeAccess |= mip.writeAccess;
+    }
+
+    for(auto &mip : _images.at(next).mips){
+        mip = merged;
+    }
+}
+
+vk::ImageLayout ResourceStateTracker::layout(const vk::Image &image, const uint32_t mip) const {
+    return _images.at(image).mips.at(mip).layout;
+}
+
+bool ResourceStateTracker::transition(AccessState &state, const ResourceUse use, const bool isImage, vk::PipelineStageFlags2 &srcStage, vk::AccessFlags2 &srcAccess){
+    const auto info = GetUseInfo(use);
+    const bool layoutChange = isImage && state.layout != info.layout;
+    if(!layoutChange && !info.write){
+        // read after read, or the last write is already visible to this stage
+        const bool visible = (state.visibleStages & info.stage) == info.stage && (state.visibleAccess & info.access) == info.access;
+        if(!state.writeStages || visible){
+            state.readStages |= info.stage;
+            return false;
+        }
+
+        srcStage = state.writeStages;
+        srcAccess = state.writeAccess;
+        state.readStages |= info.stage;
+        state.visibleStages |= info.stage;
+        state.visibleAccess |= info.access;
+        return true;
+    }
+
+    // writes and layout transitions wait for every earlier access, only writes need to be made available
+    srcStage = state.writeStages | state.readStages;
+    srcAccess = state.writeAccess;
+    const bool needed = layoutChange || srcStage;
+    state.layout = isImage ? info.layout : state.layout;
+    if(info.write){
+        state.writeStages = info.stage;
+        state.writeAccess = info.access;
+        state.readStages = {};
+        state.visibleStages = {};
+        state.visibleAccess = {};
+    }else{
+        // the layout transition behaves like a write that is already visible to this use
+        state.writeStages = info.stage;
+        state.writeAccess = {};
+        state.readStages = info.stage;
+        state.visibleStages = info.stage;
+        state.visibleAccess = info.access;
+    }
+    return needed;
+}
+
+void ResourceStateTracker::useImage(const vk::Image &image, const ResourceUse use, const uint32_t baseMip, const uint32_t mipCount){
+    auto &state = _images.at(image);
+    const auto info = GetUseInfo(use);
+    const uint32_t endMip = mipCount == VK_REMAINING_MIP_LEVELS ? state.mips.size() : std::min<uint32_t>(baseMip + mipCount, state.mips.size());
+
+    vk::ImageMemoryBarrier2 *last = nullptr;
+    for(uint32_t mip = baseMip;mip < endMip;mip ++){
+        const auto oldLayout = state.mips[mip].layout;
+        vk::PipelineStageFlags2 srcStage{};
+        vk::AccessFlags2 srcAccess{};
+        if(!transition(state.mips[mip], use, true, srcStage, srcAccess)){
+            _stats.skipped++;
+            last = nullptr;
+            continue;
+        }
+
+        // neighbouring mips in the same state share one barrier
+        if(last && last->oldLayout == oldLayout && last->srcStageMask == srcStage && last->srcAccessMask == srcAccess){
+            last->subresourceRange.levelCount++;
+            continue;
+        }
+
+        vk::ImageMemoryBarrier2 barrier{};
+        barrier.srcStageMask = srcStage;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstStageMask = info.stage;
+        barrier.dstAccessMask = info.access;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = info.layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = state.aspect;
+        barrier.subresourceRange.baseMipLevel = mip;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        _imageBarriers.push_back(barrier);
+        last = &_imageBarriers.back();
+    }
+}
+
+void ResourceStateTracker::useBuffer(const vk::Buffer &buffer, const ResourceUse use){
+    auto &state = _buffers.at(buffer);
+    const auto info = GetUseInfo(use);
+    vk::PipelineStageFlags2 srcStage{};
+    vk::AccessFlags2 srcAccess{};
+    if(!transition(state, use, false, srcStage, srcAccess)){
+        _stats.skipped++;
+        return;
+    }
+
+    vk::BufferMemoryBarrier2 barrier{};
+    barrier.srcStageMask = srcStage;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstStageMask = info.stage;
+    barrier.dstAccessMask = info.access;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    _bufferBarriers.push_back(barrier);
+}
+
+void ResourceStateTracker::flush(const vk::CommandBuffer &cmd){
+    if(!hasPending()){
+        return;
+    }
+
+    _stats.imageBarriers += _imageBarriers.size();
+    _stats.bufferBarriers += _bufferBarriers.size();
+    _stats.batches++;
+
+    if(_sync2){
+        vk::DependencyInfo dependency{};
+        dependency.imageMemoryBarrierCount = _imageBarriers.size();
+        dependency.pImageMemoryBarriers = _imageBarriers.data();
+        dependency.bufferMemoryBarrierCount = _bufferBarriers.size();
+        dependency.pBufferMemoryBarriers = _bufferBarriers.data();
+        cmd.pipelineBarrier2(dependency);
+    }else{
+        vk::PipelineStageFlags2 srcStages{};
+        vk::PipelineStageFlags2 dstStages{};
+        auto &imageBarriers = _legacyImageBarriers;
+        auto &bufferBarriers = _legacyBufferBarriers;
+        imageBarriers.clear();
+        bufferBarriers.clear();
+        for(auto &b : _imageBarriers){
+            srcStages |= b.srcStageMask;
+            dstStages |= b.dstStageMask;
+            imageBarriers.emplace_back(ToLegacyAccess(b.srcAccessMask), ToLegacyAccess(b.dstAccessMask), b.oldLayout, b.newLayout,
+                b.srcQueueFamilyIndex, b.dstQueueFamilyIndex, b.image, b.subresourceRange);
+        }
+
+        for(auto &b : _bufferBarriers){
+            srcStages |= b.srcStageMask;
+            dstStages |= b.dstStageMask;
+            bufferBarriers.emplace_back(ToLegacyAccess(b.srcAccessMask), ToLegacyAccess(b.dstAccessMask),
+                b.srcQueueFamilyIndex, b.dstQueueFamilyIndex, b.buffer, b.offset, b.size);
+        }
+
+        cmd.pipelineBarrier(ToLegacyStage(srcStages, vk::PipelineStageFlagBits::eTopOfPipe), ToLegacyStage(dstStages, vk::PipelineStageFlagBits::eBottomOfPipe),
+            {}, {}, bufferBarriers, imageBarriers);
+    }
+
+    _imageBarriers.clear();
+    _bufferBarriers.clear();
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+enum class ResourceUse : uint32_t{
+    Undefined,
+    TransferSrc,
+    TransferDst,
+    VertexBuffer,
+    IndexBuffer,
+    IndirectBuffer,
+    UniformBuffer,
+    FragmentShaderRead,
+    ComputeShaderRead,
+    ComputeShaderWrite,
+    ColorAttachment,
+    DepthAttachment,
+    DepthAttachmentRead,
+    HostRead,
+    HostWrite,
+    Present
+};
+
+struct BarrierStats{
+    uint32_t imageBarriers{};
+    uint32_t bufferBarriers{};
+    uint32_t batches{};
+    uint32_t skipped{};
+};
+
+// Remembers the layout, last writer and readers of every registered image subresource and
+// buffer, so callers only state the next use. The tracker emits the smallest barrier that
+// makes the previous accesses visible and merges everything pending into one pipelineBarrier.
+class ResourceStateTracker{
+public:
+    void initialize(const bool useSynchronization2);
+
+    void registerImage(const vk::Image &image, const vk::ImageAspectFlags aspect, const uint32_t mipLevels, const vk::ImageLayout layout = vk::ImageLayout::eUndefined);
+    void registerBuffer(const vk::Buffer &buffer);
+    void forget(const vk::Image &image);
+    void forget(const vk::Buffer &buffer);
+
+    // The next use of the image does not need its contents, so no layout has to be preserved.
+    void discard(const vk::Image &image);
+    // Something outside the tracker (a render pass, the presentation engine) moved the image to a new use.
+    void assume(const vk::Image &image, const ResourceUse use);
+    // next takes over the memory of previous, so its first use has to wait for every access to previous.
+    void alias(const vk::Image &previous, const vk::Image &next);
+
+    void useImage(const vk::Image &image, const ResourceUse use, const uint32_t baseMip = 0, const uint32_t mipCount = VK_REMAINING_MIP_LEVELS);
+    void useBuffer(const vk::Buffer &buffer, const ResourceUse use);
+    void flush(const vk::CommandBuffer &cmd);
+
+    bool hasPending() const { return !_imageBarriers.empty() || !_bufferBarriers.empty(); }
+    vk::ImageLayout layout(const vk::Image &image, const uint32_t mip = 0) const;
+
+    // Counters since the last resetStats(), used by the per-frame barrier report.
+    const BarrierStats& stats() const { return _stats; }
+    void resetStats() { _stats = {}; }
+
+private:
+    struct AccessState{
+        vk::ImageLayout layout{vk::ImageLayout::eUndefined};
+        vk::PipelineStageFlags2 writeStages{};
+        vk::AccessFlags2 writeAccess{};
+        vk::PipelineStageFlags2 readStages{};
+        vk::PipelineStageFlags2 visibleStages{};
+        vk::AccessFlags2 visibleAccess{};
+    };
+
+    struct ImageState{
+        vk::ImageAspectFlags aspect{};
+        std::vector<AccessState> mips{};
+    };
+
+    bool transition(AccessState &state, const ResourceUse use, const bool isImage, vk::PipelineStageFlags2 &srcStage, vk::AccessFlags2 &srcAccess);
+
+    bool _sync2{false};
+    std::unordered_map<VkImage, ImageState> _images{};
+    std::unordered_map<VkBuffer, AccessState> _buffers{};
+    std::vector<vk::ImageMemoryBarrier2> _imageBarriers{};
+    std::vector<vk::BufferMemoryBarrier2> _bufferBarriers{};
+    // conversions for devices without synchronization2, kept to reuse their capacity
+    std::vector<vk::ImageMemoryBarrier> _legacyImageBarriers{};
+    std::vector<vk::BufferMemoryBarrier> _legacyBufferBarriers{};
+    BarrierStats _stats{};
+};
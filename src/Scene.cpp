@@ -0,0 +1,82 @@
+#include "Scene.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+
+static constexpr const uint32_t kOcclusionGridSize = 12;
+
+std::vector<SceneObject> BuildScene(const bool occlusionGrid, const glm::vec3 &meshMin, const glm::vec3 &meshMax){
+    SceneObject base{};
+    base.boundsMin = glm::vec4(meshMin, 1.0f);
+    base.boundsMax = glm::vec4(meshMax, 1.0f);
+    if(!occlusionGrid){
+        return {base};
+    }
+
+    const auto size = meshMax - meshMin;
+    const auto center = (meshMin + meshMax) * 0.5f;
+    const auto cell = size / static_cast<float>(kOcclusionGridSize);
+    // uniform scale so the copies keep the proportions of the mesh and never overlap
+    const auto scale = 1.0f / kOcclusionGridSize;
+
+    std::vector<SceneObject> objects{};
+    objects.reserve(kOcclusionGridSize * kOcclusionGridSize * kOcclusionGridSize);
+    for(uint32_t z = 0;z < kOcclusionGridSize;z ++){
+        for(uint32_t y = 0;y < kOcclusionGridSize;y ++){
+            for(uint32_t x = 0;x < kOcclusionGridSize;x ++){
+                const auto cellCenter = meshMin + cell * (glm::vec3(x, y, z) + 0.5f);
+                auto object = base;
+                object.model = glm::translate(glm::mat4(1.0f), cellCenter) * glm::scale(glm::mat4(1.0f), glm::vec3(scale)) * glm::translate(glm::mat4(1.0f), -center);
+                objects.push_back(object);
+            }
+        }
+    }
+    return objects;
+}
+
+std::vector<TransformId> BuildSceneTransforms(TransformStore &store, const bool occlusionGrid, const glm::vec3 &meshMin, const glm::vec3 &meshMax){
+    store.clear();
+    const auto center = (meshMin + meshMax) * 0.5f;
+    if(!occlusionGrid){
+        const auto layer = store.add(kNoTransform, center);
+        store.add(layer, -center, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f), 0);
+        return {layer};
+    }
+
+    const auto cell = (meshMax - meshMin) / static_cast<float>(kOcclusionGridSize);
+    const auto scale = 1.0f / kOcclusionGridSize;
+    std::vector<TransformId> layers{};
+    uint32_t instance = 0;
+    for(uint32_t z = 0;z < kOcclusionGridSize;z ++){
+        const glm::vec3 layerCenter(center.x, center.y, meshMin.z + cell.z * (z + 0.5f));
+        const auto layer = store.add(kNoTransform, layerCenter);
+        layers.push_back(layer);
+        for(uint32_t y = 0;y < kOcclusionGridSize;y ++){
+            for(uint32_t x = 0;x < kOcclusionGridSize;x ++){
+                const auto cellCenter = meshMin + cell * (glm::vec3(x, y, z) + 0.5f);
+                // translate(cellCenter) * scale * translate(-center) relative to the layer
+                store.add(layer, cellCenter - layerCenter - center * scale, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(scale), instance++);
+            }
+        }
+    }
+    return layers;
+}
+
+std::vector<SceneDrawGroup> BuildDrawGroups(const std::vector<SceneObject> &objects, const uint32_t groupCount){
+    const auto count = static_cast<uint32_t>(objects.size());
+    std::vector<SceneDrawGroup> groups(groupCount);
+    for(uint32_t group = 0;group < groupCount;group ++){
+        auto &range = groups[group];
+        range.firstInstance = count * group / groupCount;
+        range.instanceCount = count * (group + 1) / groupCount - range.firstInstance;
+        for(uint32_t i = range.firstInstance;i < range.firstInstance + range.instanceCount;i ++){
+            const auto &object = objects[i];
+            for(uint32_t corner = 0;corner < 8;corner ++){
+                const glm::vec4 local((corner & 1) ? object.boundsMax.x : object.boundsMin.x, (corner & 2) ? object.boundsMax.y : object.boundsMin.y,
+                    (corner & 4) ? object.boundsMax.z : object.boundsMin.z, 1.0f);
+                const auto position = glm::vec3(object.model * local);
+                range.boundsMin = glm::min(range.boundsMin, position);
+                range.boundsMax = glm::max(range.boundsMax, position);
+            }
+        }
+    }
+    return groups;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+#include "TransformStore.hpp"
+
+// Per-object data in the std430 layout of the Objects buffer read by shader.vert and cull.comp.
+// Draws select their object through the instance index.
+struct SceneObject{
+    // first member, TransformStore::writeWorld() writes it in place
+    glm::mat4 model{1.0f};
+    // mesh bounds in object space, w is unused
+    glm::vec4 boundsMin{};
+    glm::vec4 boundsMax{};
+};
+
+// One copy of the mesh, or a dense grid of smaller copies that fills the same volume. From any
+// view the outer layers of the grid hide most of the inner ones, which makes it the test scene
+// for occlusion culling.
+std::vector<SceneObject> BuildScene(const bool occlusionGrid, const glm::vec3 &meshMin, const glm::vec3 &meshMax);
+// The placement of BuildScene() as a hierarchy: one node per layer of the grid along z with its
+// copies below it, instance i being object i. Returns the layer nodes, turning one turns its layer.
+std::vector<TransformId> BuildSceneTransforms(TransformStore &store, const bool occlusionGrid, const glm::vec3 &meshMin, const glm::vec3 &meshMax);
+
+// Contiguous instance range of the scene, recorded into its own secondary command buffer.
+struct SceneDrawGroup{
+    uint32_t firstInstance{};
+    uint32_t instanceCount{};
+    // bounds of the range after the object model matrices
+    glm::vec3 boundsMin{std::numeric_limits<float>::max()};
+    glm::vec3 boundsMax{std::numeric_limits<float>::lowest()};
+    // last frustum test, groups outside record no draws
+    bool visible{true};
+};
+
+// Splits the objects into groupCount ranges of about the same size. The grid is built layer by
+// layer, so every range covers a slab of it; groups past the object count stay empty.
+std::vector<SceneDrawGroup> BuildDrawGroups(const std::vector<SceneObject> &objects, const uint32_t groupCount);
@@ -0,0 +1,160 @@
+#include "ShaderLibrary.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include "Utils.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#ifdef HAS_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+using namespace Utils;
+
+// bump when the cache layout or the compile options change
+static constexpr const uint32_t kShaderCacheVersion = 1;
+static constexpr const uint32_t kSpirvMagic = 0x07230203;
+
+void ShaderLibrary::initialize(const std::string &sourceDir, const std::string &spirvDir, const std::string &cacheDir){
+    _sourceDir = sourceDir;
+    _spirvDir = spirvDir;
+    _cacheDir = cacheDir;
+    _stats = {};
+    _compilerHash = Hash::Combine(Hash::kFnvOffset, kShaderCacheVersion);
+#ifdef HAS_SHADERC
+    unsigned int version = 0, revision = 0;
+    shaderc_get_spv_version(&version, &revision);
+    _compilerHash = Hash::Combine(_compilerHash, version);
+    _compilerHash = Hash::Combine(_compilerHash, revision);
+#endif
+
+    std::error_code ec{};
+    std::filesystem::create_directories(_cacheDir, ec);
+    if(ec){
+        LOGW("Failed to create shader cache directory {}: {}", _cacheDir, ec.message());
+    }
+}
+
+bool ShaderLibrary::readCache(const std::string &path, std::vector<uint32_t> &code) const {
+    std::error_code ec{};
+    if(!std::filesystem::exists(path, ec)){
+        return false;
+    }
+
+    auto data = FileSystem::ReadFile(path);
+    if(data.empty() || data.size() % sizeof(uint32_t) != 0){
+        LOGW("Shader cache entry {} is truncated, recompiling", path);
+        return false;
+    }
+
+    code.resize(data.size() / sizeof(uint32_t));
+    std::memcpy(code.data(), data.data(), data.size());
+    if(code[0] != kSpirvMagic){
+        LOGW("Shader cache entry {} is not SPIR-V, recompiling", path);
+        return false;
+    }
+    return true;
+}
+
+void ShaderLibrary::writeCache(const std::string &path, const std::vector<uint32_t> &code) const {
+    const auto tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if(!file.is_open()){
+            LOGW("Failed to open {} to cache a shader", tmpPath);
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(code.data()), code.size() * sizeof(uint32_t));
+    }
+
+    std::error_code ec{};
+    std::filesystem::rename(tmpPath, path, ec);
+    if(ec){
+        LOGW("Failed to replace shader cache entry {}: {}", path, ec.message());
+    }
+}
+
+ShaderBinary ShaderLibrary::loadPrecompiled(const std::string &name) const {
+    // the build compiles every shader into <name>.spv
+    const auto path = FileSystem::PathJoin(_spirvDir, name + ".spv");
+
+    ShaderBinary binary{};
+    if(!readCache(path, binary.code)){
+        throw std::runtime_error(std::format("no precompiled SPIR-V for shader {}", name));
+    }
+    binary.hash = Hash::Fnv1a(binary.code.data(), binary.code.size() * sizeof(uint32_t));
+    return binary;
+}
+
+bool ShaderLibrary::compile(const std::string &name, const std::string &source, const ShaderStage stage, const std::vector<ShaderDefine> &defines, std::vector<uint32_t> &code) const {
+#ifdef HAS_SHADERC
+    shaderc::Compiler compiler{};
+    shaderc::CompileOptions options{};
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+    // runs the spirv-opt performance passes on the result
+    options.SetOptimizationLevel(shaderc_optimization_level_performance);
+    for(auto &define : defines){
+        options.AddMacroDefinition(define.name, define.value);
+    }
+
+    shaderc_shader_kind kind = shaderc_glsl_vertex_shader;
+    switch(stage){
+    case ShaderStage::Vertex: kind = shaderc_glsl_vertex_shader; break;
+    case ShaderStage::Fragment: kind = shaderc_glsl_fragment_shader; break;
+    case ShaderStage::Compute: kind = shaderc_glsl_compute_shader; break;
+    }
+
+    auto result = compiler.CompileGlslToSpv(source, kind, name.c_str(), options);
+    if(result.GetCompilationStatus() != shaderc_compilation_status_success){
+        LOGE("Failed to compile shader {}: {}", name, result.GetErrorMessage());
+        return false;
+    }
+
+    code.assign(result.cbegin(), result.cend());
+    return true;
+#else
+    return false;
+#endif
+}
+
+ShaderBinary ShaderLibrary::load(const std::string &name, const ShaderStage stage, const std::vector<ShaderDefine> &defines){
+    TRACE_ZONE("load shader");
+#ifndef HAS_SHADERC
+    if(!defines.empty()){
+        LOGW("Built without shaderc, defines of shader {} are ignored", name);
+    }
+    return loadPrecompiled(name);
+#else
+    const auto sourceData = FileSystem::ReadFile(FileSystem::PathJoin(_sourceDir, name));
+    const std::string source(sourceData.begin(), sourceData.end());
+
+    auto key = Hash::Fnv1a(source.data(), source.size(), _compilerHash);
+    key = Hash::Combine(key, stage);
+    for(auto &define : defines){
+        key = Hash::Fnv1a(define.name.data(), define.name.size(), key);
+        key = Hash::Fnv1a(define.value.data(), define.value.size(), key);
+    }
+
+    ShaderBinary binary{};
+    binary.hash = key;
+    const auto cachePath = FileSystem::PathJoin(_cacheDir, std::format("{}-{:016x}.spv", name, key));
+    if(readCache(cachePath, binary.code)){
+        _stats.cacheHits++;
+        LOGD("Shader {} loaded from cache {}", name, cachePath);
+        return binary;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    if(!compile(name, source, stage, defines, binary.code)){
+        throw std::runtime_error(std::format("failed to compile shader {}", name));
+    }
+    const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    _stats.compiled++;
+    _stats.compileMs += ms;
+    LOGI("Shader {} compiled in {:.3f} ms ({} words)", name, ms, binary.code.size());
+
+    writeCache(cachePath, binary.code);
+    return binary;
+#endif
+}
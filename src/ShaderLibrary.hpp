@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+enum class ShaderStage{
+    Vertex,
+    Fragment,
+    Compute
+};
+
+struct ShaderDefine{
+    std::string name{};
+    std::string value{};
+};
+
+struct ShaderBinary{
+    // key of the cache entry, stable across runs as long as source, defines and compiler match
+    uint64_t hash{};
+    std::vector<uint32_t> code{};
+};
+
+// Specialization constants of one shader stage. Variants of the same SPIR-V are selected at
+// pipeline creation time, so they share one cache entry instead of being recompiled.
+struct ShaderSpecialization{
+    std::vector<vk::SpecializationMapEntry> entries{};
+    std::vector<uint8_t> data{};
+
+    template<typename T>
+    ShaderSpecialization &set(const uint32_t constantId, const T &value){
+        static_assert(std::is_trivially_copyable_v<T>, "specialization constants are plain values");
+        const auto offset = static_cast<uint32_t>(data.size());
+        data.resize(data.size() + sizeof(T));
+        std::memcpy(data.data() + offset, &value, sizeof(T));
+        entries.emplace_back(constantId, offset, sizeof(T));
+        return *this;
+    }
+
+    bool empty() const { return entries.empty(); }
+};
+
+struct ShaderLibraryStats{
+    uint32_t cacheHits{};
+    uint32_t compiled{};
+    double compileMs{};
+};
+
+// Compiles GLSL to SPIR-V at runtime and keeps the optimized binaries in a cache directory
+// keyed by source, defines and compiler version. Warm runs only read the cached SPIR-V. Without
+// shaderc the binaries the build compiled into spirvDir are loaded instead.
+class ShaderLibrary{
+public:
+    void initialize(const std::string &sourceDir, const std::string &spirvDir, const std::string &cacheDir);
+
+    ShaderBinary load(const std::string &name, const ShaderStage stage, const std::vector<ShaderDefine> &defines = {});
+
+    ShaderLibraryStats stats() const { return _stats; }
+
+private:
+    bool readCache(const std::string &path, std::vector<uint32_t> &code) const;
+    void writeCache(const std::string &path, const std::vector<uint32_t> &code) const;
+    ShaderBinary loadPrecompiled(const std::string &name) const;
+    bool compile(const std::string &name, const std::string &source, const ShaderStage stage, const std::vector<ShaderDefine> &defines, std::vector<uint32_t> &code) const;
+
+    std::string _sourceDir{};
+    std::string _spirvDir{};
+    std::string _cacheDir{};
+    uint64_t _compilerHash{};
+    ShaderLibraryStats _stats{};
+};
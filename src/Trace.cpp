@@ -0,0 +1,294 @@
+#include "Trace.hpp"
+#include "ChromeTrace.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// per thread, a full ring drops zones until the flusher caught up
+static constexpr const uint32_t kRingCapacity = 1 << 14;
+static constexpr const auto kFlushInterval = std::chrono::milliseconds(10);
+
+namespace trace{
+    std::atomic<bool> gEnabled{false};
+
+    namespace{
+        struct Event{
+            const char *name;
+            uint64_t begin;
+            uint64_t end;
+        };
+
+        // Single producer, single consumer. The producer owns head, the flusher owns tail.
+        struct ThreadBuffer{
+            alignas(64) std::atomic<uint64_t> head{0};
+            // the producer's last look at tail, it only reads the flusher's line again when the ring seems full
+            uint64_t cachedTail{0};
+            alignas(64) std::atomic<uint64_t> tail{0};
+            std::atomic<uint64_t> dropped{0};
+            uint32_t pid{ChromeTrace::kCpuProcess};
+            uint32_t tid{};
+            std::string name{};
+            Event events[kRingCapacity];
+
+            void push(const char *zone, const uint64_t begin, const uint64_t end){
+                const auto h = head.load(std::memory_order_relaxed);
+                if(h - cachedTail >= kRingCapacity){
+                    cachedTail = tail.load(std::memory_order_acquire);
+                    if(h - cachedTail >= kRingCapacity){
+                        dropped.fetch_add(1, std::memory_order_relaxed);
+                        return;
+                    }
+                }
+                events[h & (kRingCapacity - 1)] = {zone, begin, end};
+                head.store(h + 1, std::memory_order_release);
+            }
+        };
+
+        struct Tracer{
+            std::mutex mutex{};
+            // buffers outlive their threads so zones recorded right before a thread exits are still written
+            std::vector<std::shared_ptr<ThreadBuffer>> buffers{};
+            std::shared_ptr<ThreadBuffer> gpu{};
+            std::unordered_set<std::string> names{};
+            std::condition_variable wake{};
+            std::thread flusher{};
+            bool stop{false};
+            ChromeTrace file{};
+            // both clocks sampled at Start(), the tick rate is measured again on every drain
+            uint64_t startNs{};
+            uint64_t startTicks{};
+
+            // a process that exits without Stop() must not destroy a joinable thread
+            ~Tracer(){
+                if(flusher.joinable()){
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        stop = true;
+                    }
+                    wake.notify_all();
+                    flusher.join();
+                }
+            }
+        };
+
+        uint64_t SteadyNs(){
+            return ToNs(Clock::now());
+        }
+
+        Tracer& GetTracer(){
+            static Tracer tracer{};
+            return tracer;
+        }
+
+        std::shared_ptr<ThreadBuffer> RegisterBuffer(const uint32_t pid){
+            auto &tracer = GetTracer();
+            auto buffer = std::make_shared<ThreadBuffer>();
+            std::lock_guard<std::mutex> lock(tracer.mutex);
+            buffer->pid = pid;
+            buffer->tid = static_cast<uint32_t>(tracer.buffers.size());
+            buffer->name = pid == ChromeTrace::kGpuProcess ? "graphics queue" : std::format("thread {}", buffer->tid);
+            tracer.buffers.push_back(buffer);
+            return buffer;
+        }
+
+        // a plain pointer needs no TLS guard on every zone, the registry owns the buffer
+        thread_local ThreadBuffer *tLocalBuffer = nullptr;
+
+        ThreadBuffer& LocalBuffer(){
+            if(!tLocalBuffer){
+                tLocalBuffer = RegisterBuffer(ChromeTrace::kCpuProcess).get();
+            }
+            return *tLocalBuffer;
+        }
+
+        // called by the flusher, or by Stop() once the flusher exited
+        void Drain(Tracer &tracer){
+            std::vector<std::shared_ptr<ThreadBuffer>> buffers{};
+            {
+                std::lock_guard<std::mutex> lock(tracer.mutex);
+                buffers = tracer.buffers;
+            }
+
+            const auto elapsedTicks = Now() - tracer.startTicks;
+            const auto nsPerTick = elapsedTicks == 0 ? 1.0 : static_cast<double>(SteadyNs() - tracer.startNs) / elapsedTicks;
+            for(auto &buffer : buffers){
+                const auto tail = buffer->tail.load(std::memory_order_relaxed);
+                const auto head = buffer->head.load(std::memory_order_acquire);
+                // the GPU track already is in steady_clock nanoseconds
+                const auto cpu = buffer->pid == ChromeTrace::kCpuProcess;
+                const auto start = cpu ? tracer.startTicks : tracer.startNs;
+                const auto scale = cpu ? nsPerTick : 1.0;
+                for(auto i = tail;i < head;i ++){
+                    const auto &event = buffer->events[i & (kRingCapacity - 1)];
+                    // zones that started before Start() are clamped instead of landing at negative times
+                    const auto begin = std::max(event.begin, start);
+                    const auto end = std::max(event.end, begin);
+                    tracer.file.writeZone(event.name, buffer->pid, buffer->tid, (begin - start) * scale / 1000.0, (end - begin) * scale / 1000.0);
+                }
+                buffer->tail.store(head, std::memory_order_release);
+            }
+        }
+
+        void FlusherLoop(){
+            auto &tracer = GetTracer();
+            std::unique_lock<std::mutex> lock(tracer.mutex);
+            while(!tracer.stop){
+                tracer.wake.wait_for(lock, kFlushInterval, [&tracer](){ return tracer.stop; });
+                lock.unlock();
+                Drain(tracer);
+                lock.lock();
+            }
+        }
+    }
+
+    bool Start(const std::string &path){
+#if ENABLE_TRACE
+        auto &tracer = GetTracer();
+        if(tracer.flusher.joinable()){
+            LOGW("Tracing already started");
+            return false;
+        }
+        if(!tracer.file.open(path)){
+            return false;
+        }
+
+        tracer.stop = false;
+        tracer.startNs = SteadyNs();
+        tracer.startTicks = Now();
+        tracer.flusher = std::thread(FlusherLoop);
+        SetEnabled(true);
+        LOGI("Tracing CPU zones and GPU scopes into {}", path);
+        return true;
+#else
+        LOGW("Built without tracing, {} is not written", path);
+        return false;
+#endif
+    }
+
+    void Stop(){
+        auto &tracer = GetTracer();
+        if(!tracer.flusher.joinable()){
+            return;
+        }
+
+        SetEnabled(false);
+        {
+            std::lock_guard<std::mutex> lock(tracer.mutex);
+            tracer.stop = true;
+        }
+        tracer.wake.notify_all();
+        tracer.flusher.join();
+        // zones that were being recorded while tracing got disabled end up in this last pass
+        Drain(tracer);
+
+        uint64_t dropped = 0;
+        std::lock_guard<std::mutex> lock(tracer.mutex);
+        for(auto &buffer : tracer.buffers){
+            tracer.file.writeThreadName(buffer->pid, buffer->tid, buffer->name);
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        if(dropped != 0){
+            LOGW("Trace lost {} zones to full thread buffers", dropped);
+        }
+        tracer.file.close();
+    }
+
+    void SetEnabled(const bool enabled){
+        gEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    const char* Intern(std::string_view name){
+        auto &tracer = GetTracer();
+        std::lock_guard<std::mutex> lock(tracer.mutex);
+        // node based, the strings never move while the set grows
+        return tracer.names.emplace(name).first->c_str();
+    }
+
+    void SetThreadName(const std::string &name){
+        auto &buffer = LocalBuffer();
+        std::lock_guard<std::mutex> lock(GetTracer().mutex);
+        buffer.name = name;
+    }
+
+    void Record(const char *name, const uint64_t beginTicks, const uint64_t endTicks){
+        LocalBuffer().push(name, beginTicks, endTicks);
+    }
+
+    void RecordGpu(const char *name, const uint64_t beginNs, const uint64_t endNs){
+        auto &tracer = GetTracer();
+        if(!tracer.gpu){
+            tracer.gpu = RegisterBuffer(ChromeTrace::kGpuProcess);
+        }
+        tracer.gpu->push(name, beginNs, endNs);
+    }
+
+    void BenchmarkZones(const uint32_t threadCount, const uint32_t zonesPerThread){
+#if ENABLE_TRACE
+        using BenchClock = std::chrono::steady_clock;
+        // batches stay below the ring size and wait for the flusher in between, so nothing is dropped
+        static constexpr const uint32_t kBatch = kRingCapacity / 2;
+        const auto zoneNs = [zonesPerThread](){
+            std::chrono::nanoseconds spent{};
+            for(uint32_t done = 0;done < zonesPerThread;){
+                auto &buffer = LocalBuffer();
+                while(buffer.head.load(std::memory_order_relaxed) != buffer.tail.load(std::memory_order_acquire) && Enabled()){
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                const auto count = std::min(kBatch, zonesPerThread - done);
+                const auto start = BenchClock::now();
+                for(uint32_t i = 0;i < count;i ++){
+                    TRACE_ZONE("bench");
+                }
+                spent += BenchClock::now() - start;
+                done += count;
+            }
+            return static_cast<double>(spent.count()) / zonesPerThread;
+        };
+        const auto timeThreads = [threadCount, &zoneNs](){
+            std::vector<double> results(threadCount);
+            std::vector<std::thread> threads{};
+            for(uint32_t t = 0;t < threadCount;t ++){
+                threads.emplace_back([t, &results, &zoneNs](){ results[t] = zoneNs(); });
+            }
+            for(auto &thread : threads){
+                thread.join();
+            }
+            double sum = 0.0;
+            for(const auto ns : results){
+                sum += ns;
+            }
+            return sum / threadCount;
+        };
+
+        // the TSC read is a volatile builtin, the loop is not optimized away
+        const auto clockStart = BenchClock::now();
+        for(uint32_t i = 0;i < zonesPerThread;i ++){
+            Now();
+        }
+        const auto clockNs = std::chrono::duration<double, std::nano>(BenchClock::now() - clockStart).count() / zonesPerThread;
+
+        const auto disabledNs = zoneNs();
+        const auto path = (std::filesystem::temp_directory_path() / "vulkanlearn_trace_bench.json").string();
+        if(!Start(path)){
+            return;
+        }
+        const auto singleNs = zoneNs();
+        const auto threadedNs = timeThreads();
+        Stop();
+        std::error_code ec{};
+        std::filesystem::remove(path, ec);
+
+        LOGI("Trace benchmark: disabled zone {:.2f} ns, enabled zone {:.2f} ns on one thread and {:.2f} ns on each of {} threads, clock read {:.2f} ns",
+            disabledNs, singleNs, threadedNs, threadCount, clockNs);
+#else
+        LOGW("Built without tracing, nothing to benchmark for {} threads x {} zones", threadCount, zonesPerThread);
+#endif
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Compile-time switch for the TRACE_ZONE instrumentation, set by the TRACING CMake option.
+#ifndef ENABLE_TRACE
+#define ENABLE_TRACE 1
+#endif
+
+// Low-overhead CPU trace zones. Every thread records into its own single-producer ring buffer
+// without locks, a background flusher drains the rings into a Chrome trace file. A disabled
+// zone costs one relaxed atomic load, an enabled one two clock reads and a ring write, the clock
+// reads are most of it (--bench-trace prints both). On x86-64 the clock is the (invariant) TSC,
+// the flusher converts it to nanoseconds against steady_clock.
+namespace trace{
+    using Clock = std::chrono::steady_clock;
+
+    extern std::atomic<bool> gEnabled;
+
+    inline bool Enabled(){
+        return gEnabled.load(std::memory_order_relaxed);
+    }
+
+    // trace clock ticks, only meaningful for Record()
+    inline uint64_t Now(){
+#if defined(_M_X64) || defined(__x86_64__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    inline uint64_t ToNs(const Clock::time_point time){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    // Starts the flusher writing into path and enables recording.
+    bool Start(const std::string &path);
+    // Drains every ring one last time and closes the file.
+    void Stop();
+    // Pauses or resumes recording while the flusher keeps running.
+    void SetEnabled(const bool enabled);
+
+    // Zone names are kept by pointer until they are flushed, names that are not string literals
+    // have to be interned first. Interning takes a lock, keep it off hot paths.
+    const char* Intern(std::string_view name);
+    void SetThreadName(const std::string &name);
+
+    // Records a finished zone of the calling thread, timestamps come from Now().
+    void Record(const char *name, const uint64_t beginTicks, const uint64_t endTicks);
+    // Records a zone on the GPU track with steady_clock timestamps (see ToNs), only one thread may call it.
+    void RecordGpu(const char *name, const uint64_t beginNs, const uint64_t endNs);
+
+    // ns per zone disabled and enabled on one and on threadCount threads, for --bench-trace.
+    void BenchmarkZones(const uint32_t threadCount, const uint32_t zonesPerThread);
+
+    class Zone{
+    public:
+        explicit Zone(const char *name) : _name(Enabled() ? name : nullptr) {
+            if(_name){
+                _begin = Now();
+            }
+        }
+
+        ~Zone(){
+            if(_name){
+                Record(_name, _begin, Now());
+            }
+        }
+
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+    private:
+        const char *_name{};
+        uint64_t _begin{};
+    };
+}
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#if ENABLE_TRACE
+#define TRACE_ZONE(name) trace::Zone TRACE_CONCAT(_traceZone, __LINE__){name}
+#else
+#define TRACE_ZONE(name) ((void)0)
+#endif
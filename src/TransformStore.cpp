@@ -0,0 +1,585 @@
+#include "TransformStore.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TRANSFORM_AVX2_TARGET
+#else
+// only the kernels are compiled for AVX2, the rest of the binary still runs on any x86-64
+#define TRANSFORM_AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+#define TRANSFORM_AVX2 1
+#else
+#define TRANSFORM_AVX2 0
+#endif
+
+static constexpr const std::array<float, TransformStore::kLocalCount> kIdentityLocal = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+static constexpr const std::array<float, TransformStore::kWorldCount> kIdentityWorld = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f};
+static constexpr const std::array<uint32_t, 3> kBenchTransformCounts = {10000, 100000, 1000000};
+// leaves per inner node of the benchmark hierarchy
+static constexpr const uint32_t kBenchFanOut = 64;
+// every hundredth inner node changes in the partial update
+static constexpr const uint32_t kBenchPartialStep = 100;
+static constexpr const double kBenchSeconds = 0.25;
+
+// Raw pointers into the component arrays, what the kernels work on.
+struct TransformArrays{
+    std::array<const float*, TransformStore::kLocalCount> local{};
+    std::array<float*, TransformStore::kWorldCount> world{};
+    const int32_t *parent{};
+    const uint32_t *instance{};
+};
+
+static bool CpuHasAvx2(){
+#if !TRANSFORM_AVX2
+    return false;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int info[4]{};
+    __cpuid(info, 1);
+    const auto fma = (info[2] & (1 << 12)) != 0;
+    // the OS has to save the YMM registers as well
+    const auto osxsave = (info[2] & (1 << 27)) != 0;
+    if(!fma || !osxsave || (_xgetbv(0) & 6) != 6){
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+// Affine local matrix of one transform, translate * rotate * scale, as 4 columns of xyz.
+static void LocalMatrix(const TransformArrays &a, const uint32_t s, float *m){
+    const auto x = a.local[TransformStore::kQx][s];
+    const auto y = a.local[TransformStore::kQy][s];
+    const auto z = a.local[TransformStore::kQz][s];
+    const auto w = a.local[TransformStore::kQw][s];
+    const auto sx = a.local[TransformStore::kSx][s];
+    const auto sy = a.local[TransformStore::kSy][s];
+    const auto sz = a.local[TransformStore::kSz][s];
+    m[0] = (1.0f - 2.0f * (y * y + z * z)) * sx;
+    m[1] = 2.0f * (x * y + w * z) * sx;
+    m[2] = 2.0f * (x * z - w * y) * sx;
+    m[3] = 2.0f * (x * y - w * z) * sy;
+    m[4] = (1.0f - 2.0f * (x * x + z * z)) * sy;
+    m[5] = 2.0f * (y * z + w * x) * sy;
+    m[6] = 2.0f * (x * z + w * y) * sz;
+    m[7] = 2.0f * (y * z - w * x) * sz;
+    m[8] = (1.0f - 2.0f * (x * x + y * y)) * sz;
+    m[9] = a.local[TransformStore::kPx][s];
+    m[10] = a.local[TransformStore::kPy][s];
+    m[11] = a.local[TransformStore::kPz][s];
+}
+
+static void ComposeScalar(const TransformArrays &a, const uint32_t begin, const uint32_t end){
+    for(uint32_t s = begin;s < end;s ++){
+        float l[TransformStore::kWorldCount];
+        LocalMatrix(a, s, l);
+        const auto p = a.parent[s];
+        if(p < 0){
+            for(uint32_t c = 0;c < TransformStore::kWorldCount;c ++){
+                a.world[c][s] = l[c];
+            }
+            continue;
+        }
+        // parent * local, both affine
+        for(uint32_t col = 0;col < 4;col ++){
+            for(uint32_t row = 0;row < 3;row ++){
+                auto value = a.world[row][p] * l[col * 3] + a.world[3 + row][p] * l[col * 3 + 1] + a.world[6 + row][p] * l[col * 3 + 2];
+                if(col == 3){
+                    value += a.world[9 + row][p];
+                }
+                a.world[col * 3 + row][s] = value;
+            }
+        }
+    }
+}
+
+static void WriteWorldScalar(const TransformArrays &a, const uint32_t begin, const uint32_t end, std::byte *dst, const size_t stride){
+    for(uint32_t s = begin;s < end;s ++){
+        if(a.instance[s] == kNoInstance){
+            continue;
+        }
+        float m[16];
+        for(uint32_t col = 0;col < 4;col ++){
+            m[col * 4] = a.world[col * 3][s];
+            m[col * 4 + 1] = a.world[col * 3 + 1][s];
+            m[col * 4 + 2] = a.world[col * 3 + 2][s];
+            m[col * 4 + 3] = col == 3 ? 1.0f : 0.0f;
+        }
+        std::memcpy(dst + a.instance[s] * stride, m, sizeof(m));
+    }
+}
+
+static void WriteMvpScalar(const TransformArrays &a, const uint32_t begin, const uint32_t end, const float *vp, std::byte *dst, const size_t stride){
+    for(uint32_t s = begin;s < end;s ++){
+        if(a.instance[s] == kNoInstance){
+            continue;
+        }
+        // viewProj * world, the world matrix is affine
+        float m[16];
+        for(uint32_t col = 0;col < 4;col ++){
+            for(uint32_t row = 0;row < 4;row ++){
+                auto value = vp[row] * a.world[col * 3][s] + vp[4 + row] * a.world[col * 3 + 1][s] + vp[8 + row] * a.world[col * 3 + 2][s];
+                if(col == 3){
+                    value += vp[12 + row];
+                }
+                m[col * 4 + row] = value;
+            }
+        }
+        std::memcpy(dst + a.instance[s] * stride, m, sizeof(m));
+    }
+}
+
+#if TRANSFORM_AVX2
+// rows[i] holds component i of eight transforms, afterwards rows[j] holds eight components of transform j
+TRANSFORM_AVX2_TARGET static inline void Transpose8(__m256 *rows){
+    const auto t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+    const auto t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+    const auto t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+    const auto t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+    const auto t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+    const auto t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+    const auto t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+    const auto t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+    const auto s0 = _mm256_shuffle_ps(t0, t2, 0x44);
+    const auto s1 = _mm256_shuffle_ps(t0, t2, 0xee);
+    const auto s2 = _mm256_shuffle_ps(t1, t3, 0x44);
+    const auto s3 = _mm256_shuffle_ps(t1, t3, 0xee);
+    const auto s4 = _mm256_shuffle_ps(t4, t6, 0x44);
+    const auto s5 = _mm256_shuffle_ps(t4, t6, 0xee);
+    const auto s6 = _mm256_shuffle_ps(t5, t7, 0x44);
+    const auto s7 = _mm256_shuffle_ps(t5, t7, 0xee);
+    rows[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    rows[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    rows[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    rows[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    rows[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    rows[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    rows[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    rows[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+// Both 8x8 halves of eight column major 4x4 matrices, one per lane, stored to their instances.
+TRANSFORM_AVX2_TARGET static inline void StoreMatrices(const TransformArrays &a, const uint32_t base, __m256 *first, __m256 *second, std::byte *dst, const size_t stride){
+    Transpose8(first);
+    Transpose8(second);
+    for(uint32_t lane = 0;lane < TransformStore::kBatch;lane ++){
+        const auto instance = a.instance[base + lane];
+        if(instance == kNoInstance){
+            continue;
+        }
+        auto *out = reinterpret_cast<float*>(dst + instance * stride);
+        _mm256_storeu_ps(out, first[lane]);
+        _mm256_storeu_ps(out + 8, second[lane]);
+    }
+}
+
+TRANSFORM_AVX2_TARGET static void ComposeAvx2(const TransformArrays &a, const uint32_t base){
+    // lambdas would not inherit the target attribute, the loads are spelled out
+    const auto x = _mm256_loadu_ps(a.local[TransformStore::kQx] + base);
+    const auto y = _mm256_loadu_ps(a.local[TransformStore::kQy] + base);
+    const auto z = _mm256_loadu_ps(a.local[TransformStore::kQz] + base);
+    const auto w = _mm256_loadu_ps(a.local[TransformStore::kQw] + base);
+    const auto sx = _mm256_loadu_ps(a.local[TransformStore::kSx] + base);
+    const auto sy = _mm256_loadu_ps(a.local[TransformStore::kSy] + base);
+    const auto sz = _mm256_loadu_ps(a.local[TransformStore::kSz] + base);
+    const auto one = _mm256_set1_ps(1.0f);
+    const auto two = _mm256_set1_ps(2.0f);
+    const auto xx = _mm256_mul_ps(x, x);
+    const auto yy = _mm256_mul_ps(y, y);
+    const auto zz = _mm256_mul_ps(z, z);
+    const auto xy = _mm256_mul_ps(x, y);
+    const auto xz = _mm256_mul_ps(x, z);
+    const auto yz = _mm256_mul_ps(y, z);
+    const auto wx = _mm256_mul_ps(w, x);
+    const auto wy = _mm256_mul_ps(w, y);
+    const auto wz = _mm256_mul_ps(w, z);
+
+    // same expressions as LocalMatrix()
+    __m256 l[TransformStore::kWorldCount];
+    l[0] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one), sx);
+    l[1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx);
+    l[2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx);
+    l[3] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy);
+    l[4] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one), sy);
+    l[5] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy);
+    l[6] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz);
+    l[7] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz);
+    l[8] = _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one), sz);
+    l[9] = _mm256_loadu_ps(a.local[TransformStore::kPx] + base);
+    l[10] = _mm256_loadu_ps(a.local[TransformStore::kPy] + base);
+    l[11] = _mm256_loadu_ps(a.local[TransformStore::kPz] + base);
+
+    // parents sit on the previous depth level, already computed; roots gather the identity
+    const auto parents = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a.parent + base));
+    const auto hasParent = _mm256_castsi256_ps(_mm256_cmpgt_epi32(parents, _mm256_set1_epi32(-1)));
+    __m256 p[TransformStore::kWorldCount];
+    for(uint32_t c = 0;c < TransformStore::kWorldCount;c ++){
+        p[c] = _mm256_mask_i32gather_ps(_mm256_set1_ps(kIdentityWorld[c]), a.world[c], parents, hasParent, 4);
+    }
+
+    for(uint32_t col = 0;col < 4;col ++){
+        for(uint32_t row = 0;row < 3;row ++){
+            auto value = _mm256_mul_ps(p[row], l[col * 3]);
+            value = _mm256_fmadd_ps(p[3 + row], l[col * 3 + 1], value);
+            value = _mm256_fmadd_ps(p[6 + row], l[col * 3 + 2], value);
+            if(col == 3){
+                value = _mm256_add_ps(value, p[9 + row]);
+            }
+            _mm256_storeu_ps(a.world[col * 3 + row] + base, value);
+        }
+    }
+}
+
+TRANSFORM_AVX2_TARGET static void WriteWorldAvx2(const TransformArrays &a, const uint32_t base, std::byte *dst, const size_t stride){
+    __m256 w[TransformStore::kWorldCount];
+    for(uint32_t c = 0;c < TransformStore::kWorldCount;c ++){
+        w[c] = _mm256_loadu_ps(a.world[c] + base);
+    }
+    // columns padded with the implicit last row
+    const auto zero = _mm256_setzero_ps();
+    __m256 first[8] = {w[0], w[1], w[2], zero, w[3], w[4], w[5], zero};
+    __m256 second[8] = {w[6], w[7], w[8], zero, w[9], w[10], w[11], _mm256_set1_ps(1.0f)};
+    StoreMatrices(a, base, first, second, dst, stride);
+}
+
+TRANSFORM_AVX2_TARGET static void WriteMvpAvx2(const TransformArrays &a, const uint32_t base, const float *vp, std::byte *dst, const size_t stride){
+    __m256 w[TransformStore::kWorldCount];
+    for(uint32_t c = 0;c < TransformStore::kWorldCount;c ++){
+        w[c] = _mm256_loadu_ps(a.world[c] + base);
+    }
+    __m256 m[16];
+    for(uint32_t col = 0;col < 4;col ++){
+        for(uint32_t row = 0;row < 4;row ++){
+            auto value = _mm256_mul_ps(_mm256_set1_ps(vp[row]), w[col * 3]);
+            value = _mm256_fmadd_ps(_mm256_set1_ps(vp[4 + row]), w[col * 3 + 1], value);
+            value = _mm256_fmadd_ps(_mm256_set1_ps(vp[8 + row]), w[col * 3 + 2], value);
+            if(col == 3){
+                value = _mm256_add_ps(value, _mm256_set1_ps(vp[12 + row]));
+            }
+            m[col * 4 + row] = value;
+        }
+    }
+    StoreMatrices(a, base, m, m + 8, dst, stride);
+}
+#endif
+
+TransformStore::TransformStore() : _simd(CpuHasAvx2()) {}
+
+void TransformStore::setSimd(const bool enabled){
+    _simd = enabled && CpuHasAvx2();
+}
+
+TransformId TransformStore::add(const TransformId parent, const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale, const uint32_t instance){
+    const auto id = static_cast<TransformId>(_slotOf.size());
+    if(parent != kNoTransform && parent >= id){
+        throw std::runtime_error("transform parents have to be added before their children");
+    }
+
+    // appended unsorted, the next update() moves it to its depth level
+    const auto slot = static_cast<uint32_t>(_parent.size());
+    const std::array<float, kLocalCount> local = {position.x, position.y, position.z, rotation.x, rotation.y, rotation.z, rotation.w, scale.x, scale.y, scale.z};
+    for(uint32_t c = 0;c < kLocalCount;c ++){
+        _local[c].push_back(local[c]);
+    }
+    for(uint32_t c = 0;c < kWorldCount;c ++){
+        _world[c].push_back(kIdentityWorld[c]);
+    }
+    _parent.push_back(parent == kNoTransform ? -1 : static_cast<int32_t>(_slotOf[parent]));
+    _instance.push_back(instance);
+    _dirty.push_back(1);
+    _slotOf.push_back(slot);
+    _parentOf.push_back(parent);
+    _sorted = false;
+    _changed = true;
+    return id;
+}
+
+void TransformStore::clear(){
+    for(auto &component : _local){
+        component.clear();
+    }
+    for(auto &component : _world){
+        component.clear();
+    }
+    _parent.clear();
+    _instance.clear();
+    _dirty.clear();
+    _batchVersion.clear();
+    _slotOf.clear();
+    _parentOf.clear();
+    _sorted = true;
+    _changed = false;
+    _stats = {};
+}
+
+void TransformStore::markDirty(const TransformId id){
+    _dirty[_slotOf[id]] = 1;
+    _changed = true;
+}
+
+void TransformStore::setPosition(const TransformId id, const glm::vec3 &position){
+    const auto slot = _slotOf[id];
+    _local[kPx][slot] = position.x;
+    _local[kPy][slot] = position.y;
+    _local[kPz][slot] = position.z;
+    markDirty(id);
+}
+
+void TransformStore::setRotation(const TransformId id, const glm::quat &rotation){
+    const auto slot = _slotOf[id];
+    _local[kQx][slot] = rotation.x;
+    _local[kQy][slot] = rotation.y;
+    _local[kQz][slot] = rotation.z;
+    _local[kQw][slot] = rotation.w;
+    markDirty(id);
+}
+
+void TransformStore::setScale(const TransformId id, const glm::vec3 &scale){
+    const auto slot = _slotOf[id];
+    _local[kSx][slot] = scale.x;
+    _local[kSy][slot] = scale.y;
+    _local[kSz][slot] = scale.z;
+    markDirty(id);
+}
+
+void TransformStore::layout(){
+    TRACE_ZONE("transform layout");
+    // ids are topologically sorted, a parent's depth is known before its children's
+    const auto count = size();
+    std::vector<uint32_t> depth(count);
+    std::vector<uint32_t> levelSize{};
+    for(TransformId id = 0;id < count;id ++){
+        depth[id] = _parentOf[id] == kNoTransform ? 0 : depth[_parentOf[id]] + 1;
+        if(depth[id] >= levelSize.size()){
+            levelSize.resize(depth[id] + 1, 0);
+        }
+        levelSize[depth[id]]++;
+    }
+    // a batch never mixes levels, so its parents are all computed before it
+    std::vector<uint32_t> levelStart(levelSize.size() + 1, 0);
+    for(size_t level = 0;level < levelSize.size();level ++){
+        levelStart[level + 1] = levelStart[level] + (levelSize[level] + kBatch - 1) / kBatch * kBatch;
+    }
+    const auto slots = levelStart.back();
+
+    std::array<std::vector<float>, kLocalCount> local{};
+    for(uint32_t c = 0;c < kLocalCount;c ++){
+        local[c].assign(slots, kIdentityLocal[c]);
+    }
+    std::array<std::vector<float>, kWorldCount> world{};
+    for(uint32_t c = 0;c < kWorldCount;c ++){
+        world[c].assign(slots, kIdentityWorld[c]);
+    }
+    std::vector<int32_t> parent(slots, -1);
+    std::vector<uint32_t> instance(slots, kNoInstance);
+    std::vector<uint32_t> slotOf(count);
+    auto next = levelStart;
+    for(TransformId id = 0;id < count;id ++){
+        const auto from = _slotOf[id];
+        const auto to = next[depth[id]]++;
+        for(uint32_t c = 0;c < kLocalCount;c ++){
+            local[c][to] = _local[c][from];
+        }
+        for(uint32_t c = 0;c < kWorldCount;c ++){
+            world[c][to] = _world[c][from];
+        }
+        parent[to] = _parentOf[id] == kNoTransform ? -1 : static_cast<int32_t>(slotOf[_parentOf[id]]);
+        instance[to] = _instance[from];
+        slotOf[id] = to;
+    }
+
+    _local = std::move(local);
+    _world = std::move(world);
+    _parent = std::move(parent);
+    _instance = std::move(instance);
+    _slotOf = std::move(slotOf);
+    // every batch changed its members, all of them are computed and written again
+    _dirty.assign(slots, 1);
+    _batchVersion.assign(slots / kBatch, 0);
+    _stats.depth = static_cast<uint32_t>(levelSize.size());
+    _sorted = true;
+}
+
+void TransformStore::update(){
+    TRACE_ZONE("update transforms");
+    _stats.transforms = size();
+    _stats.updated = 0;
+    if(!_changed){
+        return;
+    }
+    if(!_sorted){
+        layout();
+    }
+
+    // changes flow down the hierarchy, parents come first
+    const auto slots = static_cast<uint32_t>(_parent.size());
+    for(uint32_t s = 0;s < slots;s ++){
+        const auto p = _parent[s];
+        if(p >= 0 && _dirty[p]){
+            _dirty[s] = 1;
+        }
+    }
+
+    TransformArrays arrays{};
+    for(uint32_t c = 0;c < kLocalCount;c ++){
+        arrays.local[c] = _local[c].data();
+    }
+    for(uint32_t c = 0;c < kWorldCount;c ++){
+        arrays.world[c] = _world[c].data();
+    }
+    arrays.parent = _parent.data();
+    const auto version = _version + 1;
+    for(uint32_t base = 0;base < slots;base += kBatch){
+        uint64_t flags = 0;
+        static_assert(kBatch == sizeof(flags));
+        std::memcpy(&flags, _dirty.data() + base, sizeof(flags));
+        if(flags == 0){
+            continue;
+        }
+#if TRANSFORM_AVX2
+        if(_simd){
+            ComposeAvx2(arrays, base);
+        }else{
+            ComposeScalar(arrays, base, base + kBatch);
+        }
+#else
+        ComposeScalar(arrays, base, base + kBatch);
+#endif
+        _batchVersion[base / kBatch] = version;
+        _stats.updated += kBatch;
+    }
+    std::fill(_dirty.begin(), _dirty.end(), 0);
+    _changed = false;
+    if(_stats.updated > 0){
+        _version = version;
+    }
+}
+
+glm::mat4 TransformStore::world(const TransformId id) const {
+    const auto slot = _slotOf[id];
+    glm::mat4 result(1.0f);
+    for(uint32_t col = 0;col < 4;col ++){
+        result[col] = glm::vec4(_world[col * 3][slot], _world[col * 3 + 1][slot], _world[col * 3 + 2][slot], col == 3 ? 1.0f : 0.0f);
+    }
+    return result;
+}
+
+void TransformStore::writeWorld(void *dst, const size_t stride, const uint64_t since) const {
+    TRACE_ZONE("write world matrices");
+    TransformArrays arrays{};
+    for(uint32_t c = 0;c < kWorldCount;c ++){
+        arrays.world[c] = const_cast<float*>(_world[c].data());
+    }
+    arrays.instance = _instance.data();
+    auto *out = static_cast<std::byte*>(dst);
+    for(uint32_t batch = 0;batch < _batchVersion.size();batch ++){
+        if(_batchVersion[batch] <= since){
+            continue;
+        }
+#if TRANSFORM_AVX2
+        if(_simd){
+            WriteWorldAvx2(arrays, batch * kBatch, out, stride);
+            continue;
+        }
+#endif
+        WriteWorldScalar(arrays, batch * kBatch, (batch + 1) * kBatch, out, stride);
+    }
+}
+
+void TransformStore::writeMvp(const glm::mat4 &viewProj, void *dst, const size_t stride) const {
+    TRACE_ZONE("write MVP matrices");
+    TransformArrays arrays{};
+    for(uint32_t c = 0;c < kWorldCount;c ++){
+        arrays.world[c] = const_cast<float*>(_world[c].data());
+    }
+    arrays.instance = _instance.data();
+    float vp[16];
+    for(uint32_t col = 0;col < 4;col ++){
+        for(uint32_t row = 0;row < 4;row ++){
+            vp[col * 4 + row] = viewProj[col][row];
+        }
+    }
+    auto *out = static_cast<std::byte*>(dst);
+    const auto slots = static_cast<uint32_t>(_instance.size());
+#if TRANSFORM_AVX2
+    if(_simd){
+        for(uint32_t base = 0;base < slots;base += kBatch){
+            WriteMvpAvx2(arrays, base, vp, out, stride);
+        }
+        return;
+    }
+#endif
+    WriteMvpScalar(arrays, 0, slots, vp, out, stride);
+}
+
+void BenchmarkTransforms(){
+    using Clock = std::chrono::steady_clock;
+    // repeats the step for a while, returns the average seconds per call
+    const auto measure = [](const auto &step){
+        uint32_t runs = 0;
+        const auto start = Clock::now();
+        double seconds = 0.0;
+        do{
+            step(runs++);
+            seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        }while(seconds < kBenchSeconds);
+        return seconds / runs;
+    };
+
+    LOGI("Transform benchmark, AVX2 {}", CpuHasAvx2() ? "available" : "not available, scalar kernels only");
+    for(const auto count : kBenchTransformCounts){
+        // one root, inner nodes below it and kBenchFanOut leaves below each of those
+        TransformStore store{};
+        const auto inner = count / (kBenchFanOut + 1);
+        const auto root = store.add(kNoTransform, glm::vec3(0.0f));
+        std::vector<TransformId> inners{};
+        for(uint32_t i = 0;i < inner;i ++){
+            inners.push_back(store.add(root, glm::vec3(static_cast<float>(i % 100), static_cast<float>(i / 100), 0.0f)));
+        }
+        uint32_t instance = 0;
+        for(uint32_t i = 0;store.size() < count;i ++){
+            const auto angle = static_cast<float>(i) * 0.01f;
+            store.add(inners[std::min(i / kBenchFanOut, inner - 1)], glm::vec3(static_cast<float>(i % kBenchFanOut), 0.0f, 1.0f), glm::angleAxis(angle, glm::vec3(0.0f, 0.0f, 1.0f)),
+                glm::vec3(0.5f), instance++);
+        }
+        store.update();
+        // stands in for the mapped instance buffer, one matrix plus bounds per instance
+        std::vector<std::byte> instances(static_cast<size_t>(instance) * 96);
+        const auto viewProj = glm::mat4(1.0f);
+
+        for(const auto simd : {false, true}){
+            if(simd && !CpuHasAvx2()){
+                continue;
+            }
+            store.setSimd(simd);
+            const auto all = measure([&](const uint32_t run){
+                store.setRotation(root, glm::angleAxis(static_cast<float>(run) * 0.001f, glm::vec3(0.0f, 0.0f, 1.0f)));
+                store.update();
+            });
+            // one percent of the inner nodes, their leaves follow
+            uint32_t partialUpdated = 0;
+            const auto partial = measure([&](const uint32_t run){
+                for(uint32_t i = run % kBenchPartialStep;i < inner;i += kBenchPartialStep){
+                    store.setPosition(inners[i], glm::vec3(static_cast<float>(run % 7), static_cast<float>(i / 100), 0.0f));
+                }
+                store.update();
+                partialUpdated = store.stats().updated;
+            });
+            const auto write = measure([&](const uint32_t){ store.writeWorld(instances.data(), 96, 0); });
+            const auto mvp = measure([&](const uint32_t){ store.writeMvp(viewProj, instances.data(), 96); });
+            LOGI("{:>7} transforms, {}: all dirty {:.3f} ms ({:.1f} M/s), {} dirty {:.3f} ms, write world {:.3f} ms ({:.1f} M/s), write MVP {:.3f} ms ({:.1f} M/s)",
+                count, simd ? "AVX2  " : "scalar", all * 1e3, count / all / 1e6, partialUpdated, partial * 1e3,
+                write * 1e3, instance / write / 1e6, mvp * 1e3, instance / mvp / 1e6);
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+using TransformId = uint32_t;
+static constexpr const TransformId kNoTransform = UINT32_MAX;
+static constexpr const uint32_t kNoInstance = UINT32_MAX;
+
+struct TransformStats{
+    uint32_t transforms{};
+    // world matrices recomputed by the last update, whole batches of kBatch
+    uint32_t updated{};
+    uint32_t depth{};
+};
+
+// Transform hierarchy in structure of arrays layout. Positions, rotations, scales and the affine
+// part of the world matrices are one array per component, sorted by depth so every parent is
+// computed before its children, and every depth level is padded to whole batches of kBatch.
+// Setters only flag the transform, update() recomputes the flagged subtrees batch by batch,
+// eight at a time with AVX2 when the CPU has it. Parents have to be added before their children.
+class TransformStore{
+public:
+    static constexpr const uint32_t kBatch = 8;
+    // local position, rotation and scale, one array each
+    enum Local : uint32_t{ kPx, kPy, kPz, kQx, kQy, kQz, kQw, kSx, kSy, kSz, kLocalCount };
+    // columns 0 to 3 of the world matrix, the last row is always 0 0 0 1
+    static constexpr const uint32_t kWorldCount = 12;
+
+    // picks the AVX2 kernels when the CPU supports them
+    TransformStore();
+
+    // The instance is the index writeWorld() and writeMvp() write the transform to, kNoInstance
+    // for inner nodes that are never drawn. Rotations are unit quaternions.
+    TransformId add(const TransformId parent, const glm::vec3 &position, const glm::quat &rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+        const glm::vec3 &scale = glm::vec3(1.0f), const uint32_t instance = kNoInstance);
+    void clear();
+    uint32_t size() const { return static_cast<uint32_t>(_slotOf.size()); }
+
+    void setPosition(const TransformId id, const glm::vec3 &position);
+    void setRotation(const TransformId id, const glm::quat &rotation);
+    void setScale(const TransformId id, const glm::vec3 &scale);
+
+    // Recomputes the world matrices of the changed transforms and everything below them.
+    void update();
+    glm::mat4 world(const TransformId id) const;
+    // Bumped by every update() that changed a world matrix.
+    uint64_t version() const { return _version; }
+
+    // Writes the world matrix of every instance changed after version `since` to dst + instance * stride,
+    // meant for mapped buffers: each matrix is written once as a whole and nothing is read back.
+    void writeWorld(void *dst, const size_t stride, const uint64_t since) const;
+    // Writes viewProj * world of every instance to dst + instance * stride.
+    void writeMvp(const glm::mat4 &viewProj, void *dst, const size_t stride) const;
+
+    // False runs the scalar kernels, for comparisons. Ignored without AVX2.
+    void setSimd(const bool enabled);
+    bool simd() const { return _simd; }
+    const TransformStats& stats() const { return _stats; }
+
+private:
+    void layout();
+    void markDirty(const TransformId id);
+
+    std::array<std::vector<float>, kLocalCount> _local{};
+    std::array<std::vector<float>, kWorldCount> _world{};
+    // slot of the parent, -1 for roots and padding
+    std::vector<int32_t> _parent{};
+    std::vector<uint32_t> _instance{};
+    std::vector<uint8_t> _dirty{};
+    // version of the last update() that changed the batch
+    std::vector<uint64_t> _batchVersion{};
+    // by id
+    std::vector<uint32_t> _slotOf{};
+    std::vector<TransformId> _parentOf{};
+    // transforms added since the last layout(), they sit unsorted at the end of the slots
+    bool _sorted{true};
+    // a setter ran since the last update()
+    bool _changed{false};
+    bool _simd{false};
+    uint64_t _version{};
+    TransformStats _stats{};
+};
+
+// Updates per second of the scalar and AVX2 kernels for 10k, 100k and 1M transforms, with every
+// transform and with one percent of the subtrees changed, and the cost of writing the results out.
+void BenchmarkTransforms();
@@ -14,6 +14,12 @@
 #include <set>
 #include <filesystem>
 #include <fstream>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <ctime>
+#endif
 
 namespace Utils {
 namespace Vulkan {
@@ -83,7 +89,12 @@ VKQueueFamilyIndices QueryQueueFamilyIndices(const vk::PhysicalDevice &dev, cons
 			indices.graphics = i;
 		}
 
-		if(q.queueCount > 0 && dev.getSurfaceSupportKHR(i, surface)){
+		if(!surface){
+			// headless, nothing is presented so the graphics queue stands in for the present queue
+			if(indices.graphics){
+				indices.present = indices.graphics;
+			}
+		}else if(q.queueCount > 0 && dev.getSurfaceSupportKHR(i, surface)){
 			indices.present = i;
 		}
 
@@ -111,6 +122,29 @@ VKSwapChainSupportStatus QuerySwapChainStatus(const vk::PhysicalDevice &device,
 	status.modes = device.getSurfacePresentModesKHR(surface);
 	return status;
 }
+
+uint32_t FindMemoryType(const vk::PhysicalDevice &physicalDevice, uint32_t typeFilter, vk::MemoryPropertyFlags properties) {
+	vk::PhysicalDeviceMemoryProperties memProperties = physicalDevice.getMemoryProperties();
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+}
+
+namespace Hash{
+uint64_t Fnv1a(const void *data, const size_t size, const uint64_t seed){
+	uint64_t hash = seed;
+	auto bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
 }
 
 namespace FileSystem{
@@ -133,5 +167,27 @@ std::string PathJoin(const std::string &path, const std::string file){
 	return std::filesystem::path(path) / std::filesystem::path(file);
 }
 
+}
+
+namespace System{
+double ProcessCpuSeconds(){
+#ifdef _WIN32
+	FILETIME creation{}, exit{}, kernel{}, user{};
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+		return 0.0;
+	}
+	const auto ticks = [](const FILETIME &time){
+		return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+	};
+	// 100 ns units
+	return (ticks(kernel) + ticks(user)) * 1e-7;
+#else
+	timespec time{};
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time) != 0) {
+		return 0.0;
+	}
+	return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
 }
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan.hpp>
 #include <string_view>
+#include <type_traits>
 
 namespace Utils {
 	namespace Vulkan {
@@ -35,6 +36,20 @@ namespace Utils {
 		bool CheckDeviceExtensionSupport(const vk::PhysicalDevice &device, std::vector<const char*> deviceExtenions);
 		 
 		VKSwapChainSupportStatus QuerySwapChainStatus(const vk::PhysicalDevice &device, const vk::SurfaceKHR &surface);
+
+		uint32_t FindMemoryType(const vk::PhysicalDevice &physicalDevice, uint32_t typeFilter, vk::MemoryPropertyFlags properties);
+	}
+
+	namespace Hash{
+		static constexpr const uint64_t kFnvOffset = 14695981039346656037ull;
+
+		uint64_t Fnv1a(const void *data, const size_t size, const uint64_t seed = kFnvOffset);
+
+		template<typename T>
+		uint64_t Combine(const uint64_t seed, const T &value){
+			static_assert(std::is_trivially_copyable_v<T>, "only plain values can be hashed byte-wise");
+			return Fnv1a(&value, sizeof(T), seed);
+		}
 	}
 
 	namespace FileSystem{
@@ -42,4 +57,9 @@ namespace Utils {
 
 		std::string PathJoin(const std::string &path, const std::string file);
 	}
+
+	namespace System{
+		// CPU time used by every thread of the process so far.
+		double ProcessCpuSeconds();
+	}
 }
\ No newline at end of file
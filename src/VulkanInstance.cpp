@@ -6,6 +6,8 @@
 #include "VulkanInstance.hpp"
 #include "Utils.hpp"
 #include "Log.hpp"
+#include "Trace.hpp"
+#include "HeapStats.hpp"
 #include "ErrorCode.hpp"
 #include "Vertext.hpp"
 #include <GLFW/glfw3.h>
@@ -25,6 +27,7 @@
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
 #include <chrono>
+#include <cmath>
 #include <glm/gtx/transform2.hpp>
 #include <glm/gtx/hash.hpp>
 #define STB_IMAGE_IMPLEMENTATION
@@ -36,13 +39,33 @@
 using namespace Utils;
 using namespace Utils::Vulkan;
 
+static constexpr const uint64_t kFrameReportInterval = 600;
+// grows by merging overflow blocks when a frame needs more
+static constexpr const size_t kFrameArenaSize = 64 * 1024;
+static constexpr const uint32_t kSceneDrawGroups = 4;
+static constexpr const uint64_t kDescriptorBenchSets = 100000;
+static constexpr const float kBenchmarkTimeStep = 1.0f / 60.0f;
+static constexpr const uint32_t kDescriptorBenchSetsPerFrame = 1000;
+static constexpr const float kNearPlane = 0.1f;
+static constexpr const float kFarPlane = 10.0f;
+// light counts swept by --bench-lights, each one with clustered and naive shading
+static constexpr const std::array<uint32_t, 6> kLightBenchCounts = {16, 64, 256, 1024, 4096, 10000};
+static constexpr const uint32_t kLightBenchWarmup = 30;
+static constexpr const uint32_t kLightBenchSamples = 120;
+// descriptors per set handed to every pool, scaled by the pool's set count
+static const std::vector<DescriptorPoolRatio> kDescriptorRatios = {
+    {vk::DescriptorType::eUniformBuffer, 1.0f},
+    {vk::DescriptorType::eCombinedImageSampler, 1.0f},
+    {vk::DescriptorType::eStorageBuffer, 4.0f},
+    {vk::DescriptorType::eStorageImage, 0.5f}
+};
+
 struct MVPUniformMatrix{
     alignas(16) glm::mat4 model;
     alignas(16) glm::mat4 view;
     alignas(16) glm::mat4 proj;
 };
 
-static constexpr const int MAX_FRAMES_IN_FLIGHT = 2;
 const std::vector<const char*> kValidationLayers = {
     "VK_LAYER_KHRONOS_validation"
 };
@@ -52,19 +75,32 @@ static constexpr const bool gEnableValidationLayer = false;
 static constexpr const bool gEnableValidationLayer = false;
 #endif//NDEBUG
 
-static constexpr const char* kShaderPath = "/home/ares/home/Code/VulkanLearn/shader";
-static constexpr const char* kResourcesPath = "/home/ares/home/Code/VulkanLearn/resources";
+#ifdef SHADER_DIR
+static constexpr const char* kShaderPath = SHADER_DIR;
+#else
+static constexpr const char* kShaderPath = "shader";
+#endif
+#ifdef SHADER_BINARY_DIR
+static constexpr const char* kShaderBinaryPath = SHADER_BINARY_DIR;
+#else
+static constexpr const char* kShaderBinaryPath = "shader";
+#endif
+#ifdef RESOURCE_DIR
+static constexpr const char* kResourcesPath = RESOURCE_DIR;
+#else
+static constexpr const char* kResourcesPath = "resources";
+#endif
 static constexpr const char* kChaletModelFileName = "chalet.obj";
 static constexpr const char* kChaletTextureFileName = "chalet.jpg";
 static constexpr const char* kVikingModelFileName = "viking_room.obj";
 static constexpr const char* kVikingTextureFileName = "viking_room.png";
 
-std::string GetImageTexurePath(){
-    return FileSystem::PathJoin(kResourcesPath, kVikingTextureFileName);
+std::string GetImageTexurePath(const std::string &resources){
+    return FileSystem::PathJoin(resources, kVikingTextureFileName);
 }
 
-std::string GetModelPath(){
-    return FileSystem::PathJoin(kResourcesPath, kVikingModelFileName);
+std::string GetModelPath(const std::string &resources){
+    return FileSystem::PathJoin(resources, kVikingModelFileName);
 }
 
 static const std::vector<const char*> kDeviceExtensions = {
@@ -118,15 +154,21 @@ void DestroyDebugUtilsMessengerEXT(VkInstance _instance, VkDebugUtilsMessengerEX
 
 inline static bool CheckDeviceSuitable(const vk::PhysicalDevice& device, const vk::SurfaceKHR &surface){
     const auto indices = Utils::Vulkan::QueryQueueFamilyIndices(device, surface).isComplete();
-    bool extSupported = Vulkan::CheckDeviceExtensionSupport(device, kDeviceExtensions);
-    bool swapChainAdequate{false};
-    if(extSupported){
+    // headless runs have no surface and need no swapchain
+    bool extSupported = !surface || Vulkan::CheckDeviceExtensionSupport(device, kDeviceExtensions);
+    bool swapChainAdequate{!surface};
+    if(surface && extSupported){
         const auto status = Utils::Vulkan::QuerySwapChainStatus(device, surface);
         swapChainAdequate = !status.formats.empty() && !status.modes.empty();
     }
 
     auto feat = device.getFeatures();
-    return indices && extSupported && swapChainAdequate && feat.samplerAnisotropy;
+    bool timelineSupported{false};
+    if(device.getProperties().apiVersion >= VK_API_VERSION_1_2){
+        auto feats = device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+        timelineSupported = feats.get<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore;
+    }
+    return indices && extSupported && swapChainAdequate && feat.samplerAnisotropy && timelineSupported;
 }
 
 inline static vk::Extent2D ChooseSwapExtend(const vk::SurfaceCapabilitiesKHR &capas, const uint32_t width, const uint32_t height){
@@ -140,7 +182,35 @@ inline static vk::Extent2D ChooseSwapExtend(const vk::SurfaceCapabilitiesKHR &ca
     }
 }
 
-vk::PresentModeKHR ChooseSwapPresentMode(const std::vector<vk::PresentModeKHR> availablePresentModes) {
+static vk::PresentModeKHR ToVkPresentMode(const PresentMode mode){
+    switch(mode){
+    case PresentMode::FifoRelaxed: return vk::PresentModeKHR::eFifoRelaxed;
+    case PresentMode::Mailbox: return vk::PresentModeKHR::eMailbox;
+    case PresentMode::Immediate: return vk::PresentModeKHR::eImmediate;
+    default: return vk::PresentModeKHR::eFifo;
+    }
+}
+
+// display refreshes a presented image waits on average before it is scanned out
+static double PresentQueueFrames(const vk::PresentModeKHR mode){
+    switch(mode){
+    case vk::PresentModeKHR::eImmediate: return 0.0;
+    case vk::PresentModeKHR::eMailbox: return 0.5;
+    default: return 1.0;
+    }
+}
+
+vk::PresentModeKHR ChooseSwapPresentMode(const std::vector<vk::PresentModeKHR> availablePresentModes, const PresentMode requested) {
+    if(requested != PresentMode::Auto){
+        const auto mode = ToVkPresentMode(requested);
+        if(std::find(availablePresentModes.begin(), availablePresentModes.end(), mode) != availablePresentModes.end()){
+            return mode;
+        }
+        // FIFO is the only mode every surface has to support
+        LOGW("Present mode {} is not supported by the surface, falling back to FIFO", vk::to_string(mode));
+        return vk::PresentModeKHR::eFifo;
+    }
+
     vk::PresentModeKHR bestMode = vk::PresentModeKHR::eFifo;
     for (const auto& availablePresentMode : availablePresentModes) {
         if (availablePresentMode == vk::PresentModeKHR::eMailbox) {
@@ -168,12 +238,13 @@ vk::SurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<vk::SurfaceFormat
 }
 
 void VulkanInstance::loadModel(){
+    TRACE_ZONE("loadModel");
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
     std::string warn, err;
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, GetModelPath().c_str())) {
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, GetModelPath(_options.resourcesPath).c_str())) {
         throw std::runtime_error(warn + err);
     }
 
@@ -203,45 +274,98 @@ void VulkanInstance::loadModel(){
             _indices.push_back(uniqueVertices[vertex]);
         }
     }
-}
 
-void VulkanInstance::cleanSwapChain(){
-    _logicDevice->destroyImageView(_depthImageView);
-    _logicDevice->destroyImage(_depthImage);
-    _logicDevice->freeMemory(_depthImageMemory);
-
-    for (auto framebuffer : _framebuffers) {
-        _logicDevice->destroyFramebuffer(framebuffer);
+    _meshMin = glm::vec3(std::numeric_limits<float>::max());
+    _meshMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for(const auto &vertex : _vertices){
+        _meshMin = glm::min(_meshMin, vertex.pos);
+        _meshMax = glm::max(_meshMax, vertex.pos);
     }
+    _objects = BuildScene(_options.occlusionScene, _meshMin, _meshMax);
+    _drawGroups = BuildDrawGroups(_objects, kSceneDrawGroups);
+    LOGI("Scene of {} objects, {} triangles each", _objects.size(), _indices.size() / 3);
+}
 
-    _logicDevice->freeCommandBuffers(_cmdPool, _cmdBuffers);
-    _logicDevice->destroyPipeline(_renderPipeline);
-    _logicDevice->destroyPipelineLayout(_renderLayout);
-    _logicDevice->destroyRenderPass(_renderPass);
-    for(auto && view : _swapChainImageViews){
-        _logicDevice->destroyImageView(view);
+void VulkanInstance::cleanSwapChain(const uint64_t retireValue){
+    // frames up to retireValue may still use these objects, destroy them once they complete
+    _renderGraph.reset(&_deletionQueue, retireValue);
+    for(auto && image : _swapImages){
+        _stateTracker.forget(image);
     }
 
-    if(_swapChain && _logicDevice){
-        _logicDevice->destroySwapchainKHR(_swapChain);
-    }
+    _deletionQueue.push(retireValue, [device = *_logicDevice, framebuffers = _framebuffers, depthFramebuffer = _depthFramebuffer, views = _swapChainImageViews, semaphores = _renderFinishedSemaphores](){
+        for (auto framebuffer : framebuffers) {
+            device.destroyFramebuffer(framebuffer);
+        }
+        device.destroyFramebuffer(depthFramebuffer);
+        for(auto && view : views){
+            device.destroyImageView(view);
+        }
+        for (auto semaphore : semaphores) {
+            device.destroySemaphore(semaphore);
+        }
+    });
+    _framebuffers.clear();
+    _depthFramebuffer = nullptr;
+    _swapChainImageViews.clear();
+    _renderFinishedSemaphores.clear();
 }
 
 void VulkanInstance::recreateSwapChain(){
+    if(_options.headless || !_pwindows){
+        // the offscreen targets keep the size they were created with, there is no window to query
+        LOGW("Headless runs have no swapchain to recreate, the request is ignored");
+        _frameBufferResized = false;
+        return;
+    }
+
     int width = 0, height = 0;
+    glfwGetFramebufferSize(_pwindows, &width, &height);
     while(width == 0 || height == 0){
-        glfwGetFramebufferSize(_pwindows, &width, &height);
+        // minimized, nothing can be presented until the window is restored
         glfwWaitEvents();
+        glfwGetFramebufferSize(_pwindows, &width, &height);
     }
+    _width = width;
+    _height = height;
+
+    const auto start = std::chrono::steady_clock::now();
+    // presentation is not tracked by the timeline, so keep the old objects for one more round of frames
+    const auto retireValue = _scheduler.submittedFrame() + _options.framesInFlight;
+    const auto oldSwapChain = _swapChain;
+    const auto oldFormat = _swapForamt;
+    cleanSwapChain(retireValue);
+
+    createSwapChain(oldSwapChain);
+    _deletionQueue.push(retireValue, [device = *_logicDevice, oldSwapChain](){
+        device.destroySwapchainKHR(oldSwapChain);
+    });
 
-    _logicDevice->waitIdle();
-    cleanSwapChain();
+    if(_swapForamt != oldFormat){
+        // the render pass and the pipelines built against it depend on the surface format
+        LOGW("Swapchain format changed from {} to {}, rebuilding the render pass", vk::to_string(oldFormat), vk::to_string(_swapForamt));
+        _logicDevice->waitIdle();
+        _pipelines.clear();
+        _logicDevice->destroyRenderPass(_renderPass);
+        createRenderPass();
+        _scenePipeline.renderPass = _renderPass;
+        _pipelines.enqueue(_scenePipeline);
+        if(_options.depthPrepass){
+            _pipelines.enqueue(_depthPipeline);
+        }
+    }
 
-    createSwapChain();
     createImageViews();
-    createColorResources();
-    createDepthResources();
+    buildRenderGraph();
     createFrameBuffers();
+    createPresentSemaphores();
+    // framebuffers changed, recorded primaries refer to the old ones
+    _cmdCache.resizeImages(_swapImages.size());
+    _cmdCache.invalidateAll();
+
+    const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOGI("Swapchain resized to {}x{} in {:.3f} ms, {} frames dropped so far, {} objects awaiting retirement",
+        _swapExtent.width, _swapExtent.height, ms, _droppedFrames, _deletionQueue.size());
 }
 
 void VulkanInstance::createLogicDevice(){
@@ -259,15 +383,44 @@ void VulkanInstance::createLogicDevice(){
 
     auto deviceFeat = vk::PhysicalDeviceFeatures();
     deviceFeat.samplerAnisotropy = vk::True;
+    const auto supported = _phyDevice.getFeatures();
+    _indirectDrawSupported = supported.multiDrawIndirect && supported.drawIndirectFirstInstance;
+    deviceFeat.multiDrawIndirect = supported.multiDrawIndirect;
+    deviceFeat.drawIndirectFirstInstance = supported.drawIndirectFirstInstance;
+    _pipelineStatisticsSupported = supported.pipelineStatisticsQuery;
+    deviceFeat.pipelineStatisticsQuery = supported.pipelineStatisticsQuery;
+    _writeWithoutFormatSupported = supported.shaderStorageImageWriteWithoutFormat;
+    deviceFeat.shaderStorageImageWriteWithoutFormat = supported.shaderStorageImageWriteWithoutFormat;
+
+    auto vk12Feat = vk::PhysicalDeviceVulkan12Features();
+    vk12Feat.timelineSemaphore = vk::True;
+    const auto drawIndirectCount = _phyDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>().get<vk::PhysicalDeviceVulkan12Features>().drawIndirectCount;
+    vk12Feat.drawIndirectCount = drawIndirectCount;
+    _indirectDrawSupported = _indirectDrawSupported && drawIndirectCount;
+
+    bool sync2Supported{false};
+    if(_apiVersion >= VK_API_VERSION_1_3 && _phyDevice.getProperties().apiVersion >= VK_API_VERSION_1_3){
+        auto feats = _phyDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features>();
+        sync2Supported = feats.get<vk::PhysicalDeviceVulkan13Features>().synchronization2;
+    }
+
+    auto vk13Feat = vk::PhysicalDeviceVulkan13Features();
+    vk13Feat.synchronization2 = vk::True;
+    if(sync2Supported){
+        vk12Feat.pNext = &vk13Feat;
+    }
 
     auto createInfo = vk::DeviceCreateInfo(
         vk::DeviceCreateFlags(),
         queueCreateInfos.size(),
         queueCreateInfos.data()
     );
+    createInfo.pNext = &vk12Feat;
     createInfo.pEnabledFeatures = &deviceFeat;
-    createInfo.enabledExtensionCount = kDeviceExtensions.size();
-    createInfo.ppEnabledExtensionNames = kDeviceExtensions.data();
+    if(!_options.headless){
+        createInfo.enabledExtensionCount = kDeviceExtensions.size();
+        createInfo.ppEnabledExtensionNames = kDeviceExtensions.data();
+    }
     if(gEnableValidationLayer){
         createInfo.enabledLayerCount = kValidationLayers.size();
         createInfo.ppEnabledLayerNames = kValidationLayers.data();
@@ -276,16 +429,24 @@ void VulkanInstance::createLogicDevice(){
     _logicDevice = _phyDevice.createDeviceUnique(createInfo);
     _graphicsQueue = _logicDevice->getQueue(indics.graphics.value(), 0);
     _presentQueue = _logicDevice->getQueue(indics.present.value(), 0);
+    _stateTracker.initialize(sync2Supported);
+    _renderGraph.initialize(*_logicDevice, _phyDevice, &_stateTracker);
+    _renderGraph.setProfiler(&_profiler);
+    LOGI("Pipeline barriers use {}", sync2Supported ? "synchronization2" : "legacy vkCmdPipelineBarrier");
 }
 
 struct ImageCreateInfo{
     vk::Format format{};
     vk::ImageAspectFlags flag{};
     uint32_t mipLevel{};
+    // empty inherits the usage of the image
+    vk::ImageUsageFlags usage{};
 };
 
 vk::ImageView CreateImageView(const vk::Device &device, const vk::Image &image, const ImageCreateInfo info){
+    const vk::ImageViewUsageCreateInfo usageInfo{info.usage};
     vk::ImageViewCreateInfo viewInfo{};
+    viewInfo.pNext = info.usage ? &usageInfo : nullptr;
     viewInfo.image = image;
     viewInfo.viewType = vk::ImageViewType::e2D;
     viewInfo.format = info.format;
@@ -319,15 +480,16 @@ void VulkanInstance::createTextureSampler() {
 }
 
 void VulkanInstance::createTextureImageView() {
-    _textureView = CreateImageView(*_logicDevice, _imageTexture, {vk::Format::eR8G8B8A8Srgb, vk::ImageAspectFlagBits::eColor, _mipLevels});
+    // the image may carry the storage usage of the mip generator, which the sRGB format does not support
+    _textureView = CreateImageView(*_logicDevice, _imageTexture, {vk::Format::eR8G8B8A8Srgb, vk::ImageAspectFlagBits::eColor, _mipLevels, vk::ImageUsageFlagBits::eSampled});
 }
 
-void VulkanInstance::createSwapChain(){
+void VulkanInstance::createSwapChain(const vk::SwapchainKHR &oldSwapChain){
     VKSwapChainSupportStatus status = Utils::Vulkan::QuerySwapChainStatus(_phyDevice, _surface);
     auto format = ChooseSwapSurfaceFormat(status.formats);
-    auto mode = ChooseSwapPresentMode(status.modes);
+    auto mode = ChooseSwapPresentMode(status.modes, _options.presentMode);
     auto extent = ChooseSwapExtend(status.capas, _width, _height);
-    uint32_t imgCount = status.capas.minImageCount + 1;
+    uint32_t imgCount = _options.swapImageCount != 0 ? std::max(_options.swapImageCount, status.capas.minImageCount) : status.capas.minImageCount + 1;
     if(status.capas.maxImageCount > 0 && imgCount > status.capas.maxImageCount){
         imgCount = status.capas.maxImageCount;
     }
@@ -342,6 +504,14 @@ void VulkanInstance::createSwapChain(){
         1,
         vk::ImageUsageFlagBits::eColorAttachment
     };
+    if(_options.dynamicResolution && (status.capas.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferDst)){
+        // the scaled scene is blitted into the swapchain image
+        createInfo.imageUsage |= vk::ImageUsageFlagBits::eTransferDst;
+    }
+    if(!_options.capturePath.empty() && (status.capas.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc)){
+        // captured frames are copied out of the swapchain image
+        createInfo.imageUsage |= vk::ImageUsageFlagBits::eTransferSrc;
+    }
 
     auto indics = QueryQueueFamilyIndices(_phyDevice, _surface);
     uint32_t famIndics[] = { indics.graphics.value(), indics.present.value()};
@@ -356,11 +526,17 @@ void VulkanInstance::createSwapChain(){
     createInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
     createInfo.presentMode = mode;
     createInfo.clipped = VK_TRUE;
-    //createInfo.oldSwapchain = vk::SwapchainKHR(nullptr);
+    // lets the driver hand over images of the old swapchain while it is still being presented
+    createInfo.oldSwapchain = oldSwapChain;
     _swapChain = _logicDevice->createSwapchainKHR(createInfo);
     _swapImages = _logicDevice->getSwapchainImagesKHR(_swapChain);
     _swapForamt = format.format;
     _swapExtent = extent;
+    _swapUsage = createInfo.imageUsage;
+    if(!oldSwapChain){
+        LOGI("Swapchain uses {} with {} images", vk::to_string(mode), _swapImages.size());
+    }
+    _presentMode = mode;
 }
 
 vk::SampleCountFlagBits GetMaxUsableSampleCount(const vk::PhysicalDevice& physicalDevice) {
@@ -410,14 +586,26 @@ void VulkanInstance::createInstance(){
         throw std::runtime_error("Enable Validation Layer, but can not find any supported validate layer!");
     }
 
+    _apiVersion = std::min(vk::enumerateInstanceVersion(), VK_API_VERSION_1_3);
+    if(_apiVersion < VK_API_VERSION_1_2){
+        throw std::runtime_error("Vulkan 1.2 is required for timeline semaphores");
+    }
+
     vk::ApplicationInfo appInfo = { 
         "Hello Vulkan", 
         VK_MAKE_VERSION(1, 0, 0), 
         "Everything but engine", 
         VK_MAKE_VERSION(1, 0, 0), 
-        VK_API_VERSION_1_0 };   
+        _apiVersion };   
         
-    auto glfwExts = Vulkan::QueryGlfwExtension();
+    std::vector<const char*> glfwExts{};
+    if(_options.headless){
+#ifndef NDEBUG
+        glfwExts.emplace_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+#endif//NDEBUG
+    }else{
+        glfwExts = Vulkan::QueryGlfwExtension();
+    }
     vk::InstanceCreateInfo createInfo = { 
         vk::InstanceCreateFlags{}, 
         &appInfo,
@@ -485,138 +673,119 @@ void VulkanInstance::createImageViews(){
     _swapChainImageViews.resize(_swapImages.size());
     for (size_t i = 0; i < _swapImages.size(); i++) {
         _swapChainImageViews[i] = CreateImageView(*_logicDevice, _swapImages[i], {_swapForamt, vk::ImageAspectFlagBits::eColor, 1});
+        _stateTracker.registerImage(_swapImages[i], vk::ImageAspectFlagBits::eColor, 1);
+    }
+}
+
+void VulkanInstance::createResolutionController(){
+    _dynamicResolution = false;
+    if(!_options.dynamicResolution){
+        return;
+    }
+
+    const auto blit = vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+    if(!(_swapUsage & vk::ImageUsageFlagBits::eTransferDst) || (_phyDevice.getFormatProperties(_swapForamt).optimalTilingFeatures & blit) != blit){
+        LOGW("{} cannot be upscaled with a linear blit, dynamic resolution is disabled", vk::to_string(_swapForamt));
+        return;
+    }
+
+    _dynamicResolution = true;
+    // the targets are sized for scale 1, scaling only changes the viewport
+    _resolution.initialize(_options.targetFrameMs, _options.minRenderScale, 1.0f, _options.framesInFlight);
+    LOGI("Dynamic resolution between {:.2f} and 1.00 for a {:.3f} ms GPU frame", _options.minRenderScale, _options.targetFrameMs);
+}
+
+void VulkanInstance::createCapture(){
+    if(_options.capturePath.empty()){
+        return;
     }
+    if(!(_swapUsage & vk::ImageUsageFlagBits::eTransferSrc)){
+        LOGW("Swapchain images cannot be copied from, frames are not captured");
+        return;
+    }
+
+    FrameCaptureDesc desc{};
+    desc.device = *_logicDevice;
+    desc.phyDevice = _phyDevice;
+    desc.tracker = &_stateTracker;
+    desc.slotCount = _options.framesInFlight;
+    desc.directory = _options.capturePath;
+    desc.format = _options.captureFormat;
+    desc.threads = _options.captureThreads;
+    _capture.initialize(desc);
 }
 
-const vk::UniqueShaderModule CreateShaderModule(const vk::Device device,const std::vector<char> &code){
+vk::UniqueShaderModule CreateShaderModule(const vk::Device device,const ShaderBinary &binary){
     return device.createShaderModuleUnique({
         vk::ShaderModuleCreateFlags(),
-        code.size(),
-        reinterpret_cast<const uint32_t*>(code.data())
+        binary.code.size() * sizeof(uint32_t),
+        binary.code.data()
     });
 }
 
 void VulkanInstance::createGraphicsPipeline(){
-    auto vertShaderStr = Utils::FileSystem::ReadFile(FileSystem::PathJoin(kShaderPath, "vert.spv"));
-    auto fragShaderStr = Utils::FileSystem::ReadFile(FileSystem::PathJoin(kShaderPath, "frag.spv"));
-    LOGD("Vertex Shader:{}", vertShaderStr.size());
-    LOGD("Fragment Shader:{}", fragShaderStr.size());
-    auto vertModule = CreateShaderModule(*_logicDevice, vertShaderStr);
-    auto fragModule = CreateShaderModule(*_logicDevice, fragShaderStr);
-    vk::PipelineShaderStageCreateInfo shaderStages[] = {
-        {
-            vk::PipelineShaderStageCreateFlags(),
-            vk::ShaderStageFlagBits::eVertex,
-            *vertModule,
-            "main"
-        },
-        {
-            vk::PipelineShaderStageCreateFlags(),
-            vk::ShaderStageFlagBits::eFragment,
-            *fragModule,
-            "main"
-        }
-    };
-
-    vk::PipelineVertexInputStateCreateInfo vertexInputInfo = {};
-    vertexInputInfo.vertexBindingDescriptionCount = 0;
-    vertexInputInfo.vertexAttributeDescriptionCount = 0;
-
-    auto bindDesc = Vertex::getBindingDesc();
-    auto attDesc = Vertex::getAttributeDesc();
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindDesc;
-    vertexInputInfo.vertexAttributeDescriptionCount = attDesc.size();
-    vertexInputInfo.pVertexAttributeDescriptions = attDesc.data();
-
-    vk::PipelineInputAssemblyStateCreateInfo inputAssembly = {};
-    inputAssembly.topology = vk::PrimitiveTopology::eTriangleList;
-    inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-    vk::Viewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)_swapExtent.width;
-    viewport.height = (float)_swapExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    vk::Rect2D scissor = {};
-    scissor.offset = vk::Offset2D{0, 0};
-    scissor.extent = _swapExtent;
-
-    vk::PipelineViewportStateCreateInfo viewportState = {};
-    viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
-    viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
-
-    vk::PipelineRasterizationStateCreateInfo rasterizer = {};
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = vk::PolygonMode::eFill;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = vk::CullModeFlagBits::eBack;
-    rasterizer.frontFace = vk::FrontFace::eCounterClockwise;
-    rasterizer.depthBiasEnable = VK_FALSE;
-    
-    vk::PipelineMultisampleStateCreateInfo multisampling = {};
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = _msaaSamples;
-
-    vk::PipelineDepthStencilStateCreateInfo depthStencil{};
-    depthStencil.depthTestEnable = VK_TRUE;
-    depthStencil.depthWriteEnable = VK_TRUE;
-    depthStencil.depthCompareOp = vk::CompareOp::eLess;
-    depthStencil.depthBoundsTestEnable = VK_FALSE;
-    depthStencil.stencilTestEnable = VK_FALSE;
-        
-    vk::PipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-
-    vk::PipelineColorBlendStateCreateInfo colorBlending = {};
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.logicOp = vk::LogicOp::eCopy;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
-    colorBlending.blendConstants[0] = 0.0f;
-    colorBlending.blendConstants[1] = 0.0f;
-    colorBlending.blendConstants[2] = 0.0f;
-    colorBlending.blendConstants[3] = 0.0f;
+    TRACE_ZONE("createGraphicsPipeline");
+    const auto start = std::chrono::steady_clock::now();
+    auto vertShader = _shaders.load("shader.vert", ShaderStage::Vertex);
+    auto fragShader = _shaders.load("shader.frag", ShaderStage::Fragment);
+    const auto shaderStats = _shaders.stats();
+    LOGI("Shaders ready in {:.3f} ms, {} from cache, {} compiled", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+        shaderStats.cacheHits, shaderStats.compiled);
+    _vertModule = CreateShaderModule(*_logicDevice, vertShader);
+    _fragModule = CreateShaderModule(*_logicDevice, fragShader);
 
     vk::PipelineLayoutCreateInfo pipelineLayoutInfo = {};
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &_descSetLayout;
     _renderLayout = _logicDevice->createPipelineLayout(pipelineLayoutInfo);
 
+    auto bindDesc = Vertex::getBindingDesc();
+    auto attDesc = Vertex::getAttributeDesc();
+    _scenePipeline = PipelineDesc{};
+    _scenePipeline.vertexModule = *_vertModule;
+    _scenePipeline.fragmentModule = *_fragModule;
+    _scenePipeline.vertexHash = vertShader.hash;
+    _scenePipeline.fragmentHash = fragShader.hash;
+    // constant ids match the layout(constant_id) declarations in shader.vert and shader.frag
+    _scenePipeline.vertexSpec.set<VkBool32>(0, VK_FALSE).set<float>(1, 1.0f);
+    setLightingMode(_lightingMode);
+    _scenePipeline.bindings = {bindDesc};
+    _scenePipeline.attributes.assign(attDesc.begin(), attDesc.end());
+    _scenePipeline.layout = _renderLayout;
+    _scenePipeline.renderPass = _renderPass;
+    _scenePipeline.subpass = 0;
+    _scenePipeline.samples = _msaaSamples;
+    _scenePipeline.cullMode = vk::CullModeFlagBits::eBack;
+    _scenePipeline.blendEnable = false;
+    _scenePipeline.depthTest = true;
+    _scenePipeline.depthWrite = true;
+    // the pre-pass already wrote the depth of the early objects, shading them has to pass on equal depth
+    _scenePipeline.depthCompare = _options.depthPrepass ? vk::CompareOp::eLessOrEqual : vk::CompareOp::eLess;
+
+    // compiled in the background, draws are skipped until it is ready
+    _pipelines.enqueue(_scenePipeline);
+    if(_options.benchLights){
+        // the sweep flips between both variants, neither should stall it
+        const auto mode = _lightingMode;
+        setLightingMode(mode == LightingMode::Clustered ? LightingMode::Naive : LightingMode::Clustered);
+        _pipelines.enqueue(_scenePipeline);
+        setLightingMode(mode);
+    }
+    if(_options.depthPrepass){
+        _depthPipeline = _scenePipeline;
+        _depthPipeline.fragmentModule = nullptr;
+        _depthPipeline.fragmentHash = 0;
+        _depthPipeline.fragmentSpec = {};
+        _depthPipeline.renderPass = _depthRenderPass;
+        _depthPipeline.colorAttachmentCount = 0;
+        _depthPipeline.depthCompare = vk::CompareOp::eLess;
+        _pipelines.enqueue(_depthPipeline);
+    }
+}
 
-    std::vector<vk::DynamicState> dynamicStates = {
-        vk::DynamicState::eViewport,
-        vk::DynamicState::eScissor
-    };
-
-    vk::PipelineDynamicStateCreateInfo dynamicState{};
-    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-    dynamicState.pDynamicStates = dynamicStates.data();
-
-    vk::GraphicsPipelineCreateInfo pipelineInfo = {};
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
-    pipelineInfo.pViewportState = &viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.layout = _renderLayout;
-    pipelineInfo.renderPass = _renderPass;
-    pipelineInfo.subpass = 0;
-    pipelineInfo.basePipelineHandle = nullptr;
-    pipelineInfo.pDepthStencilState = &depthStencil;
-    pipelineInfo.pDynamicState = &dynamicState;
-
-    _renderPipeline = _logicDevice->createGraphicsPipeline(nullptr, pipelineInfo).value;
+void VulkanInstance::createPipelineCache(){
+    _pipelineCache.initialize(*_logicDevice, _phyDevice, _options.pipelineCachePath);
+    _pipelines.initialize(*_logicDevice, _pipelineCache, _options.pipelineThreads);
 }
 
 void VulkanInstance::createFrameBuffers(){
@@ -624,9 +793,9 @@ void VulkanInstance::createFrameBuffers(){
 
     for (size_t i = 0; i < _swapChainImageViews.size(); i++) {
         std::array<vk::ImageView, 3> attachments = {
-            _colorImageView,
-            _depthImageView,
-            _swapChainImageViews[i]
+            _renderGraph.view(_graphColor),
+            _renderGraph.view(_graphDepth),
+            _dynamicResolution ? _renderGraph.view(_graphSceneColor) : _swapChainImageViews[i]
         };
 
         vk::FramebufferCreateInfo framebufferInfo = {};
@@ -638,6 +807,18 @@ void VulkanInstance::createFrameBuffers(){
         framebufferInfo.layers = 1;
         _framebuffers[i] = _logicDevice->createFramebuffer(framebufferInfo);
     }
+
+    if(_options.depthPrepass){
+        const auto depthView = _renderGraph.view(_graphDepth);
+        vk::FramebufferCreateInfo framebufferInfo = {};
+        framebufferInfo.renderPass = _depthRenderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = &depthView;
+        framebufferInfo.width = _swapExtent.width;
+        framebufferInfo.height = _swapExtent.height;
+        framebufferInfo.layers = 1;
+        _depthFramebuffer = _logicDevice->createFramebuffer(framebufferInfo);
+    }
 }
 
 vk::Format FindSupportedFormat(const vk::PhysicalDevice &device, const std::vector<vk::Format>& candidates, const vk::ImageTiling tiling, const vk::FormatFeatureFlags features) {
@@ -673,17 +854,17 @@ void VulkanInstance::createRenderPass(){
     colorAttachment.storeOp = vk::AttachmentStoreOp::eStore;
     colorAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
     colorAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    colorAttachment.initialLayout = vk::ImageLayout::eUndefined;
-    colorAttachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+    colorAttachment.initialLayout = vk::ImageLayout::eColorAttachmentOptimal;
+    colorAttachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
 
     vk::AttachmentDescription depthAttachment{};
     depthAttachment.format = FindDepthFormat(_phyDevice);
     depthAttachment.samples = _msaaSamples;
-    depthAttachment.loadOp = vk::AttachmentLoadOp::eClear;
+    depthAttachment.loadOp = _options.depthPrepass ? vk::AttachmentLoadOp::eLoad : vk::AttachmentLoadOp::eClear;
     depthAttachment.storeOp = vk::AttachmentStoreOp::eDontCare;
     depthAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
     depthAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    depthAttachment.initialLayout = vk::ImageLayout::eUndefined;
+    depthAttachment.initialLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
     depthAttachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
 
     vk::AttachmentReference colorAttachmentRef = {};
@@ -697,8 +878,9 @@ void VulkanInstance::createRenderPass(){
     colorAttachmentResolve.storeOp = vk::AttachmentStoreOp::eStore;
     colorAttachmentResolve.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
     colorAttachmentResolve.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    colorAttachmentResolve.initialLayout = vk::ImageLayout::eUndefined;
-    colorAttachmentResolve.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+    // the render graph moves every attachment into its layout before the pass and to present afterwards
+    colorAttachmentResolve.initialLayout = vk::ImageLayout::eColorAttachmentOptimal;
+    colorAttachmentResolve.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
 
 
     vk::AttachmentReference depthAttachmentRef = {};
@@ -735,6 +917,35 @@ void VulkanInstance::createRenderPass(){
     _renderPass = _logicDevice->createRenderPass(renderPassInfo);
 }
 
+void VulkanInstance::createDepthRenderPass(){
+    vk::AttachmentDescription depthAttachment{};
+    depthAttachment.format = FindDepthFormat(_phyDevice);
+    depthAttachment.samples = _msaaSamples;
+    depthAttachment.loadOp = vk::AttachmentLoadOp::eClear;
+    // kept for the occlusion pyramid and the shading pass
+    depthAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+    depthAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    depthAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    depthAttachment.initialLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    depthAttachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+    vk::AttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = 0;
+    depthAttachmentRef.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+    vk::SubpassDescription subpass = {};
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    subpass.colorAttachmentCount = 0;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    vk::RenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &depthAttachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    _depthRenderPass = _logicDevice->createRenderPass(renderPassInfo);
+}
+
 void VulkanInstance::createCommandPool(){
     auto queueFamilyIndices = Vulkan::QueryQueueFamilyIndices(_phyDevice, _surface);
     vk::CommandPoolCreateInfo poolInfo = {};
@@ -743,17 +954,6 @@ void VulkanInstance::createCommandPool(){
     _cmdPool = _logicDevice->createCommandPool(poolInfo);
 }
 
-uint32_t FindMemoryType(const vk::PhysicalDevice &physicalDevice, uint32_t typeFilter, vk::MemoryPropertyFlags properties) {
-    vk::PhysicalDeviceMemoryProperties memProperties = physicalDevice.getMemoryProperties();
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
-    }
-
-    throw std::runtime_error("failed to find suitable memory type!");
-}
-
 std::pair<vk::Buffer, vk::DeviceMemory> CreateBuffer(const vk::PhysicalDevice &pdevice, const vk::Device device, const vk::DeviceSize size, const vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags properFlags){
     vk::BufferCreateInfo info{};
     info.size = size;
@@ -820,8 +1020,7 @@ struct CommandContext{
     vk::PhysicalDevice phyDevice;
 };
 
-void CopyBuffer2Image(const vk::Buffer &buffer, vk::Image &image, const Size &sz, const CommandContext &context){
-    vk::CommandBuffer cb = SingleTimeCommandBegin(context.cmdPool, context.device);
+void CopyBuffer2Image(const vk::CommandBuffer &cb, const vk::Buffer &buffer, vk::Image &image, const Size &sz){
     vk::BufferImageCopy region{};
     region.bufferOffset = 0;
     region.bufferRowLength = 0;
@@ -838,47 +1037,6 @@ void CopyBuffer2Image(const vk::Buffer &buffer, vk::Image &image, const Size &sz
     };
 
     cb.copyBufferToImage(buffer, image, vk::ImageLayout::eTransferDstOptimal, region);
-    SingleTimeCommandEnd(context.cmdPool, context.device, cb, context.queue);
-}
-
-void TransitionImageLayout(const vk::Image& image, const vk::Format format, const vk::ImageLayout& oldLayout, const vk::ImageLayout &newLayout, const CommandContext &context, const uint32_t mlevel){
-    vk::CommandBuffer cb = SingleTimeCommandBegin(context.cmdPool, context.device);
-    vk::ImageMemoryBarrier barrier{};
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = mlevel;
-    vk::PipelineStageFlags sourceStage;
-    vk::PipelineStageFlags destinationStage;
-
-    if (oldLayout == vk::ImageLayout::eUndefined && newLayout == vk::ImageLayout::eTransferDstOptimal) {
-        barrier.srcAccessMask = {};
-        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-        sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
-        destinationStage = vk::PipelineStageFlagBits::eTransfer;
-    } else if (oldLayout == vk::ImageLayout::eTransferDstOptimal && newLayout == vk::ImageLayout::eShaderReadOnlyOptimal) {
-        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-        sourceStage = vk::PipelineStageFlagBits::eTransfer;
-        destinationStage = vk::PipelineStageFlagBits::eFragmentShader;
-    } else {
-        throw std::invalid_argument("unsupported layout transition!");
-    }
-
-    cb.pipelineBarrier(sourceStage, destinationStage,
-        {},
-        0, nullptr,
-        0, nullptr,
-        1, &barrier);
-
-    SingleTimeCommandEnd(context.cmdPool, context.device, cb, context.queue);
 }
 
 struct ImageParam{
@@ -889,6 +1047,7 @@ struct ImageParam{
     vk::MemoryPropertyFlags properties;
     uint32_t mipLevel{};
     vk::SampleCountFlagBits msaaSamples{};
+    vk::ImageCreateFlags flags{};
 };
 
 auto CreateImage(const ImageParam &param, const CommandContext &context) {
@@ -905,6 +1064,7 @@ auto CreateImage(const ImageParam &param, const CommandContext &context) {
     imageInfo.samples = param.msaaSamples;
     imageInfo.sharingMode = vk::SharingMode::eExclusive;
     imageInfo.mipLevels = param.mipLevel;
+    imageInfo.flags = param.flags;
 
     auto image = context.device.createImage(imageInfo);
 
@@ -919,37 +1079,42 @@ auto CreateImage(const ImageParam &param, const CommandContext &context) {
     return std::make_pair(image, imageMemory);
 }
 
-void GenerateMipmaps(const vk::Image& image, const ImageParam &param, const CommandContext &context) {
+void VulkanInstance::createOffscreenTargets(){
+    // stands in for the swapchain, one image per frame slot so a slot never overwrites an image in flight
+    _swapForamt = vk::Format::eR8G8B8A8Unorm;
+    _swapExtent = vk::Extent2D{_width, _height};
+    CommandContext context{_cmdPool, *_logicDevice, _graphicsQueue, _phyDevice};
+    ImageParam param{};
+    param.size = {_width, _height};
+    param.format = _swapForamt;
+    param.tiling = vk::ImageTiling::eOptimal;
+    param.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+    param.properties = vk::MemoryPropertyFlagBits::eDeviceLocal;
+    param.mipLevel = 1;
+    param.msaaSamples = vk::SampleCountFlagBits::e1;
+    _swapUsage = param.usage;
+
+    _swapImages.resize(_options.framesInFlight);
+    _offscreenMemory.resize(_options.framesInFlight);
+    for(size_t i = 0;i < _swapImages.size();i ++){
+        std::tie(_swapImages[i], _offscreenMemory[i]) = CreateImage(param, context);
+    }
+    LOGI("Rendering headless into {} offscreen {}x{} images", _swapImages.size(), _width, _height);
+}
+
+void GenerateMipmaps(const vk::CommandBuffer &commandBuffer, const vk::Image& image, const ImageParam &param, const CommandContext &context, ResourceStateTracker &tracker) {
     // Check if image format supports linear blitting
     vk::FormatProperties formatProperties = context.phyDevice.getFormatProperties(param.format);    
     if (!(formatProperties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear)) {
         throw std::runtime_error("texture image format does not support linear blitting!");
     }
 
-    auto commandBuffer = SingleTimeCommandBegin(context.cmdPool, context.device);
-
-    vk::ImageMemoryBarrier barrier{};
-    barrier.image = image;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = 1;
-
     int32_t mipWidth = param.size.width;
     int32_t mipHeight = param.size.height;
 
     for (uint32_t i = 1; i < param.mipLevel; i++) {
-        barrier.subresourceRange.baseMipLevel = i - 1;
-        barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-        barrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
-        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-        barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
-        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, 
-                                    0, nullptr, 
-                                    0, nullptr, 
-                                    1, &barrier);
+        tracker.useImage(image, ResourceUse::TransferSrc, i - 1, 1);
+        tracker.flush(commandBuffer);
 
         vk::ImageBlit blit{};
         blit.srcOffsets[0] = vk::Offset3D{0, 0, 0};
@@ -965,41 +1130,36 @@ void GenerateMipmaps(const vk::Image& image, const ImageParam &param, const Comm
         blit.dstSubresource.baseArrayLayer = 0;
         blit.dstSubresource.layerCount = 1;
         commandBuffer.blitImage(image, vk::ImageLayout::eTransferSrcOptimal, image, vk::ImageLayout::eTransferDstOptimal, {blit}, vk::Filter::eLinear);
-        
-        barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
-        barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-        barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
-        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-
-        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, 
-                                    0, nullptr, 
-                                    0, nullptr, 
-                                    1, &barrier);
 
         if (mipWidth > 1) mipWidth /= 2;
         if (mipHeight > 1) mipHeight /= 2;
     }
 
-    barrier.subresourceRange.baseMipLevel = param.mipLevel - 1;
-    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-    barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;;
-    barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
-    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-
-    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, 
-                                    0, nullptr, 
-                                    0, nullptr, 
-                                    1, &barrier);
-
-    SingleTimeCommandEnd(context.cmdPool, context.device, commandBuffer, context.queue);
+    // all levels move to the sampled layout in one batch once the chain is done
+    tracker.useImage(image, ResourceUse::FragmentShaderRead);
+    tracker.flush(commandBuffer);
 }
 
-void VulkanInstance::createTextureImage(){
+void VulkanInstance::decodeTexture(){
+    TRACE_ZONE("decodeTexture");
     int width, height, channel;
-    auto pixels = stbi_load(GetImageTexurePath().c_str(), &width, &height, &channel, STBI_rgb_alpha);
+    auto pixels = stbi_load(GetImageTexurePath(_options.resourcesPath).c_str(), &width, &height, &channel, STBI_rgb_alpha);
     if(!pixels){
         throw std::runtime_error("Failed to load image");
     }
+    _decodedTexture.pixels = pixels;
+    _decodedTexture.width = static_cast<uint32_t>(width);
+    _decodedTexture.height = static_cast<uint32_t>(height);
+}
+
+void VulkanInstance::createTextureImage(){
+    TRACE_ZONE("createTextureImage");
+    if(_jobs){
+        _jobs->wait(_textureJob);
+    }
+    const auto width = _decodedTexture.width;
+    const auto height = _decodedTexture.height;
+    auto pixels = std::exchange(_decodedTexture.pixels, nullptr);
 
     _mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
     const vk::DeviceSize imageSize = width * height * 4;
@@ -1018,6 +1178,12 @@ void VulkanInstance::createTextureImage(){
     param.properties = vk::MemoryPropertyFlagBits::eDeviceLocal;
     param.mipLevel = _mipLevels;
     param.msaaSamples = vk::SampleCountFlagBits::e1;
+    const vk::Extent2D extent{param.size.width, param.size.height};
+    const bool computeMips = !_options.blitMips && _mipGenerator.supports(param.format, extent, _mipLevels);
+    if(computeMips){
+        param.flags = MipGenerator::imageFlags(param.format);
+        param.usage |= MipGenerator::imageUsage();
+    }
 
     auto context = CommandContext{_cmdPool,
         *_logicDevice,
@@ -1025,15 +1191,29 @@ void VulkanInstance::createTextureImage(){
         _phyDevice};
 
      std::tie(_imageTexture, _imageMemory) = CreateImage(param, context);
+    _stateTracker.registerImage(_imageTexture, vk::ImageAspectFlagBits::eColor, _mipLevels);
+
+    const auto before = _stateTracker.stats();
+    const auto start = std::chrono::steady_clock::now();
+    auto cb = SingleTimeCommandBegin(_cmdPool, *_logicDevice);
+    _stateTracker.useImage(_imageTexture, ResourceUse::TransferDst);
+    _stateTracker.flush(cb);
+    CopyBuffer2Image(cb, buffer, _imageTexture, param.size);
+    if(computeMips){
+        // the upload waits for the queue, the views can go with the first retired frame
+        _mipGenerator.generate(cb, _imageTexture, param.format, extent, _mipLevels, _deletionQueue, 0);
+    }else{
+        GenerateMipmaps(cb, _imageTexture, param, context, _stateTracker);
+    }
+    SingleTimeCommandEnd(_cmdPool, *_logicDevice, cb, _graphicsQueue);
+    LOGI("Texture upload with {} mips generated by the {} in {:.3f} ms", _mipLevels, computeMips ? "compute downsampler" : "blit chain",
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
 
-    TransitionImageLayout(_imageTexture, param.format, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, context, _mipLevels);
-    CopyBuffer2Image(buffer, _imageTexture, param.size, context);
-    //TransitionImageLayout(_imageTexture, param.format, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, context);\
+    const auto &after = _stateTracker.stats();
+    LOGD("Texture upload of {} mips used {} image barriers in {} batches", _mipLevels, after.imageBarriers - before.imageBarriers, after.batches - before.batches);
 
     _logicDevice->destroyBuffer(buffer);
     _logicDevice->freeMemory(memory);
-
-    GenerateMipmaps(_imageTexture, param, context);
 }
 
 void VulkanInstance::createVertexBuffer(){
@@ -1079,8 +1259,173 @@ void VulkanInstance::createIndexBuffer(){
 
 }
 
+void VulkanInstance::createObjectBuffer(){
+    vk::DeviceSize bufferSize = sizeof(_objects[0]) * _objects.size();
+    if(_options.animateObjects){
+        if(_options.validateCulling){
+            LOGW("The CPU culling reference only knows the static placement, --validate-culling is ignored while objects animate");
+            _options.validateCulling = false;
+        }
+        _sceneLayers = BuildSceneTransforms(_transforms, _options.occlusionScene, _meshMin, _meshMax);
+        _transforms.update();
+        const auto alignment = _phyDevice.getProperties().limits.minStorageBufferOffsetAlignment;
+        _objectSlotSize = (bufferSize + alignment - 1) / alignment * alignment;
+        std::tie(_objectBuffer, _objectMemory) = CreateBuffer(_phyDevice, *_logicDevice, _objectSlotSize * _options.framesInFlight, vk::BufferUsageFlagBits::eStorageBuffer,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        _objectData = _logicDevice->mapMemory(_objectMemory, 0, _objectSlotSize * _options.framesInFlight);
+        for(uint32_t i = 0;i < _options.framesInFlight;i ++){
+            memcpy(static_cast<std::byte*>(_objectData) + i * _objectSlotSize, _objects.data(), bufferSize);
+        }
+        _objectVersions.assign(_options.framesInFlight, _transforms.version());
+        LOGI("Animating {} objects through {} transforms, {} kernels", _objects.size(), _transforms.size(), _transforms.simd() ? "AVX2" : "scalar");
+        return;
+    }
+
+    auto [buffer, bufferMemory] = CreateBuffer(_phyDevice, *_logicDevice, bufferSize, vk::BufferUsageFlagBits::eTransferSrc,
+    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+
+    auto data = _logicDevice->mapMemory(bufferMemory, 0, bufferSize);
+    memcpy(data, _objects.data(), bufferSize);
+    _logicDevice->unmapMemory(bufferMemory);
+
+    std::tie(_objectBuffer, _objectMemory) = CreateBuffer(_phyDevice, *_logicDevice, bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer,
+    vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    copyBuffer(buffer, _objectBuffer, bufferSize);
+    _logicDevice->destroyBuffer(buffer);
+    _logicDevice->freeMemory(bufferMemory);
+}
+
+void VulkanInstance::createCuller(){
+    if(!_options.gpuCulling){
+        return;
+    }
+    if(!_indirectDrawSupported){
+        LOGW("GPU culling needs multiDrawIndirect, drawIndirectFirstInstance and drawIndirectCount, it is disabled");
+        return;
+    }
+    const auto depthFormat = FindDepthFormat(_phyDevice);
+    if(_options.occlusionCulling && !(_phyDevice.getFormatProperties(depthFormat).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage)){
+        LOGW("Depth format {} cannot be sampled, occlusion culling is disabled", vk::to_string(depthFormat));
+        return;
+    }
+
+    GpuCullerDesc desc{};
+    desc.device = *_logicDevice;
+    desc.phyDevice = _phyDevice;
+    desc.pipelineCache = _pipelineCache.handle();
+    desc.shaders = &_shaders;
+    desc.layouts = &_layoutCache;
+    desc.tracker = &_stateTracker;
+    desc.uniforms = _mvpBuffer;
+    desc.objects = _objectBuffer;
+    desc.objectSlotSize = _objectSlotSize;
+    desc.objectCount = static_cast<uint32_t>(_objects.size());
+    desc.indexCount = static_cast<uint32_t>(_indices.size());
+    desc.depthSamples = _msaaSamples;
+    desc.occlusion = _options.occlusionCulling;
+    desc.readback = _options.validateCulling;
+    _culler.initialize(desc);
+    if(!_culler.enabled()){
+        return;
+    }
+
+    auto commandBuffer = SingleTimeCommandBegin(_cmdPool, *_logicDevice);
+    _culler.recordReset(commandBuffer);
+    SingleTimeCommandEnd(_cmdPool, *_logicDevice, commandBuffer, _graphicsQueue);
+}
+
+void VulkanInstance::createLighting(){
+    glm::vec3 sceneMin(std::numeric_limits<float>::max());
+    glm::vec3 sceneMax(std::numeric_limits<float>::lowest());
+    for(const auto &object : _objects){
+        sceneMin = glm::min(sceneMin, glm::vec3(object.boundsMin));
+        sceneMax = glm::max(sceneMax, glm::vec3(object.boundsMax));
+    }
+    const auto maxLights = _options.benchLights ? std::max(_options.lights, kLightBenchCounts.back()) : _options.lights;
+    _lighting.initialize(*_logicDevice, _phyDevice, _options.framesInFlight, maxLights, sceneMin, sceneMax, _jobs);
+    if(!_options.benchLights){
+        _lighting.setLightCount(_options.lights);
+        return;
+    }
+
+    for(const auto count : kLightBenchCounts){
+        _lightBench.push_back({count, LightingMode::Clustered});
+        _lightBench.push_back({count, LightingMode::Naive});
+    }
+    _lighting.setLightCount(_lightBench.front().lights);
+    LOGI("Light benchmark: {} steps of {} warmup and {} measured frames", _lightBench.size(), kLightBenchWarmup, kLightBenchSamples);
+}
+
+void VulkanInstance::setLightingMode(const LightingMode mode){
+    _lightingMode = mode;
+    _scenePipeline.fragmentSpec = {};
+    _scenePipeline.fragmentSpec.set<VkBool32>(0, _options.untextured ? VK_FALSE : VK_TRUE).set<int32_t>(1, static_cast<int32_t>(mode));
+}
+
+void VulkanInstance::advanceLightBenchmark(){
+    if(_lightBenchDone){
+        return;
+    }
+
+    // GPU times arrive a few frames late, the warmup also covers the frames of the previous step still in flight
+    const auto &pacing = _pacer.stats();
+    const bool newSample = pacing.gpuSamples != _lightBenchGpuSamples;
+    _lightBenchGpuSamples = pacing.gpuSamples;
+    if(_lightBenchFrames < kLightBenchWarmup){
+        _lightBenchFrames++;
+        return;
+    }
+    if(!newSample){
+        return;
+    }
+
+    auto &step = _lightBench[_lightBenchStep];
+    step.gpuMs += pacing.lastGpuMs;
+    step.binMs += _lighting.stats().binMs;
+    if(++_lightBenchSamples < kLightBenchSamples){
+        return;
+    }
+
+    step.gpuMs /= kLightBenchSamples;
+    step.binMs /= kLightBenchSamples;
+    _lightBenchFrames = 0;
+    _lightBenchSamples = 0;
+    if(++_lightBenchStep == _lightBench.size()){
+        _lightBenchDone = true;
+        LOGI("Light benchmark, GPU frame ms and CPU binning ms:");
+        LOGI("{:>8} {:>12} {:>12} {:>10}", "lights", "clustered", "naive", "binning");
+        for(size_t i = 0;i + 1 < _lightBench.size();i += 2){
+            const auto &clustered = _lightBench[i];
+            const auto &naive = _lightBench[i + 1];
+            LOGI("{:>8} {:>12.3f} {:>12.3f} {:>10.3f}", clustered.lights, clustered.gpuMs, naive.gpuMs, clustered.binMs);
+        }
+        return;
+    }
+
+    const auto &next = _lightBench[_lightBenchStep];
+    if(next.lights != _lighting.lightCount()){
+        _lighting.setLightCount(next.lights);
+    }
+    setLightingMode(next.mode);
+    // the recorded command buffers bind the previous variant
+    _cmdCache.invalidateAll();
+}
+
+void VulkanInstance::createMipGenerator(){
+    MipGeneratorDesc desc{};
+    desc.device = *_logicDevice;
+    desc.phyDevice = _phyDevice;
+    desc.pipelineCache = _pipelineCache.handle();
+    desc.shaders = &_shaders;
+    desc.layouts = &_layoutCache;
+    desc.tracker = &_stateTracker;
+    desc.writeWithoutFormat = _writeWithoutFormatSupported;
+    _mipGenerator.initialize(desc);
+}
+
 void VulkanInstance::createCommandBuffer(){
-    _cmdBuffers.resize(_framebuffers.size());
+    _cmdBuffers.resize(_options.framesInFlight);
 
     vk::CommandBufferAllocateInfo allocInfo = {};
     allocInfo.commandPool = _cmdPool;
@@ -1088,6 +1433,11 @@ void VulkanInstance::createCommandBuffer(){
     allocInfo.commandBufferCount = (uint32_t)_cmdBuffers.size();
 
     _cmdBuffers = _logicDevice->allocateCommandBuffers(allocInfo);
+    if(_options.cacheCommandBuffers){
+        auto indices = QueryQueueFamilyIndices(_phyDevice, _surface);
+        _cmdCache.destroy();
+        _cmdCache.initialize(*_logicDevice, indices.graphics.value(), _swapImages.size(), _options.framesInFlight, kSceneDrawGroups, _jobs);
+    }
     // for (size_t i = 0; i < _cmdBuffers.size(); i++) {
     //     vk::CommandBufferBeginInfo beginInfo = {};
     //     beginInfo.flags = vk::CommandBufferUsageFlagBits::eSimultaneousUse;
@@ -1118,14 +1468,26 @@ void VulkanInstance::createCommandBuffer(){
 }
 
 void VulkanInstance::createSyncObject(){
-    _imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    _renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    _inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    _scheduler.initialize(*_logicDevice, _options.framesInFlight);
+    _pacer.initialize(*_logicDevice, _phyDevice, QueryQueueFamilyIndices(_phyDevice, _surface).graphics.value(), _options.framesInFlight,
+        _options.fpsLimit, _options.lowLatency, PresentQueueFrames(_presentMode));
+    _profiler.initialize(*_logicDevice, _phyDevice, QueryQueueFamilyIndices(_phyDevice, _surface).graphics.value(), _options.framesInFlight, _pipelineStatisticsSupported);
+    _frameArena.initialize(_options.framesInFlight, kFrameArenaSize, _options.debugArena);
+    _imageAvailableSemaphores.resize(_options.framesInFlight);
+    for (auto &semaphore : _imageAvailableSemaphores) {
+        semaphore = _logicDevice->createSemaphore({});
+    }
+    createPresentSemaphores();
+}
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        _imageAvailableSemaphores[i] = _logicDevice->createSemaphore({});
-        _renderFinishedSemaphores[i] = _logicDevice->createSemaphore({});
-        _inFlightFences[i] = _logicDevice->createFence({vk::FenceCreateFlagBits::eSignaled});
+void VulkanInstance::createPresentSemaphores(){
+    // presentation consumes the render finished semaphore, so it can only be reused with the same swapchain image
+    for (auto &semaphore : _renderFinishedSemaphores) {
+        _logicDevice->destroySemaphore(semaphore);
+    }
+    _renderFinishedSemaphores.resize(_swapImages.size());
+    for (auto &semaphore : _renderFinishedSemaphores) {
+        semaphore = _logicDevice->createSemaphore({});
     }
 }
 
@@ -1134,6 +1496,29 @@ static void FrameBufferResizedCallback(GLFWwindow* pwin, int width, int height){
     app->_frameBufferResized = true;
 }
 
+// On-demand rendering redraws after input and when the window system asks for a repaint, e.g.
+// after the window was uncovered. Cursor motion alone changes nothing in this viewer.
+static void RedrawCallback(GLFWwindow* pwin){
+    reinterpret_cast<VulkanInstance*>(glfwGetWindowUserPointer(pwin))->invalidate();
+}
+
+static void KeyCallback(GLFWwindow* pwin, int key, int scancode, int action, int mods){
+    auto app = reinterpret_cast<VulkanInstance*>(glfwGetWindowUserPointer(pwin));
+    // space pauses and resumes the animation
+    if(key == GLFW_KEY_SPACE && action == GLFW_PRESS){
+        app->setAnimating(!app->animating());
+    }
+    app->invalidate();
+}
+
+static void MouseButtonCallback(GLFWwindow* pwin, int button, int action, int mods){
+    RedrawCallback(pwin);
+}
+
+static void ScrollCallback(GLFWwindow* pwin, double x, double y){
+    RedrawCallback(pwin);
+}
+
 void VulkanInstance::createDescriptorSetLayout(){
     vk::DescriptorSetLayoutBinding uboLayout{};
     uboLayout.binding = 0;
@@ -1149,49 +1534,55 @@ void VulkanInstance::createDescriptorSetLayout(){
     samplerLayoutBinding.pImmutableSamplers = nullptr;
     samplerLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
 
-    std::array<vk::DescriptorSetLayoutBinding, 2> binds{uboLayout, samplerLayoutBinding};
-    vk::DescriptorSetLayoutCreateInfo info{};
-    info.bindingCount = binds.size();
-    info.pBindings = binds.data();
+    vk::DescriptorSetLayoutBinding objectLayout{};
+    objectLayout.binding = 2;
+    objectLayout.descriptorCount = 1;
+    objectLayout.descriptorType = vk::DescriptorType::eStorageBuffer;
+    objectLayout.pImmutableSamplers = nullptr;
+    objectLayout.stageFlags = vk::ShaderStageFlagBits::eVertex;
+
+    // lights, clusters and light indices, bound even when the scene is unlit
+    std::array<vk::DescriptorSetLayoutBinding, 3> lightLayouts{};
+    for(uint32_t i = 0;i < lightLayouts.size();i ++){
+        lightLayouts[i].binding = 3 + i;
+        lightLayouts[i].descriptorCount = 1;
+        lightLayouts[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        lightLayouts[i].pImmutableSamplers = nullptr;
+        lightLayouts[i].stageFlags = vk::ShaderStageFlagBits::eFragment;
+    }
 
-    _descSetLayout = _logicDevice->createDescriptorSetLayout(info);
+    _layoutCache.initialize(*_logicDevice);
+    _descSetLayout = _layoutCache.get({uboLayout, samplerLayoutBinding, objectLayout, lightLayouts[0], lightLayouts[1], lightLayouts[2]});
 }
 
 void VulkanInstance::createUniformBuffer(){
     vk::DeviceSize size = sizeof(MVPUniformMatrix);
-    _mvpBuffer.resize(MAX_FRAMES_IN_FLIGHT);
-    _mvpData.resize(MAX_FRAMES_IN_FLIGHT);
-    _mvpMemory.resize(MAX_FRAMES_IN_FLIGHT);
-    for(auto i = 0;i < MAX_FRAMES_IN_FLIGHT;i ++){
+    _mvpBuffer.resize(_options.framesInFlight);
+    _mvpData.resize(_options.framesInFlight);
+    _mvpMemory.resize(_options.framesInFlight);
+    for(auto i = 0;i < _options.framesInFlight;i ++){
         std::tie(_mvpBuffer[i], _mvpMemory[i]) = CreateBuffer(_phyDevice, _logicDevice.get(), size, vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
         _mvpData[i] = _logicDevice->mapMemory(_mvpMemory[i], 0, size);
     }
+    _writtenUniforms.assign(_options.framesInFlight, {});
 }
 
 void VulkanInstance::createDescriptorPool(){
-    std::array<vk::DescriptorPoolSize, 2> poolSizes{};
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    poolSizes[0].type = vk::DescriptorType::eUniformBuffer;
-    poolSizes[1].type = vk::DescriptorType::eCombinedImageSampler;
-
-    vk::DescriptorPoolCreateInfo poolInfo{};
-    poolInfo.poolSizeCount = poolSizes.size();
-    poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-
-    _descriptorPool = _logicDevice->createDescriptorPool(poolInfo, nullptr);
+    _descriptors.initialize(*_logicDevice, kDescriptorRatios);
+    _frameDescriptors.resize(_options.framesInFlight);
+    for(auto &allocator : _frameDescriptors){
+        allocator.initialize(*_logicDevice, kDescriptorRatios);
+    }
 }
 
 void VulkanInstance::createDescriptorSets(){
-    std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, _descSetLayout);
-    vk::DescriptorSetAllocateInfo allocInfo{};
-    allocInfo.descriptorPool = _descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    allocInfo.pSetLayouts = layouts.data();
-
-    _descriptorSets = _logicDevice->allocateDescriptorSets(allocInfo);
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    // the scene sets are referenced by cached command buffers, so they live in the persistent allocator
+    _descriptorSets.resize(_options.framesInFlight);
+    for (size_t i = 0; i < _options.framesInFlight; i++) {
+        _descriptorSets[i] = _descriptors.allocate(_descSetLayout);
+    }
+
+    for (size_t i = 0; i < _options.framesInFlight; i++) {
         vk::DescriptorBufferInfo bufferInfo{};
         bufferInfo.buffer = _mvpBuffer[i];
         bufferInfo.offset = 0;
@@ -1202,7 +1593,18 @@ void VulkanInstance::createDescriptorSets(){
         imageInfo.imageView = _textureView;
         imageInfo.sampler = _textureSampler;
 
-        std::array<vk::WriteDescriptorSet, 2> descriptorWrites{};
+        vk::DescriptorBufferInfo objectInfo{};
+        objectInfo.buffer = _objectBuffer;
+        objectInfo.offset = i * _objectSlotSize;
+        objectInfo.range = _objectSlotSize ? _objectSlotSize : VK_WHOLE_SIZE;
+
+        const std::array<vk::DescriptorBufferInfo, 3> lightInfos = {
+            vk::DescriptorBufferInfo{_lighting.lights(i), 0, VK_WHOLE_SIZE},
+            vk::DescriptorBufferInfo{_lighting.clusters(i), 0, VK_WHOLE_SIZE},
+            vk::DescriptorBufferInfo{_lighting.indices(i), 0, VK_WHOLE_SIZE}
+        };
+
+        std::array<vk::WriteDescriptorSet, 6> descriptorWrites{};
         descriptorWrites[0].dstSet = _descriptorSets[i];
         descriptorWrites[0].dstBinding = 0;
         descriptorWrites[0].dstArrayElement = 0;
@@ -1217,92 +1619,357 @@ void VulkanInstance::createDescriptorSets(){
         descriptorWrites[1].descriptorCount = 1;
         descriptorWrites[1].pImageInfo = &imageInfo;
 
+        descriptorWrites[2].dstSet = _descriptorSets[i];
+        descriptorWrites[2].dstBinding = 2;
+        descriptorWrites[2].dstArrayElement = 0;
+        descriptorWrites[2].descriptorType = vk::DescriptorType::eStorageBuffer;
+        descriptorWrites[2].descriptorCount = 1;
+        descriptorWrites[2].pBufferInfo = &objectInfo;
+
+        for(uint32_t j = 0;j < lightInfos.size();j ++){
+            auto &write = descriptorWrites[3 + j];
+            write.dstSet = _descriptorSets[i];
+            write.dstBinding = 3 + j;
+            write.dstArrayElement = 0;
+            write.descriptorType = vk::DescriptorType::eStorageBuffer;
+            write.descriptorCount = 1;
+            write.pBufferInfo = &lightInfos[j];
+        }
+
         _logicDevice->updateDescriptorSets(descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
     }
 }
-void VulkanInstance::createColorResources(){
-    ImageParam param;
-    param.format = _swapForamt;
-    param.size = Size{(uint32_t)_swapExtent.width, (uint32_t)_swapExtent.height};
-    param.tiling = vk::ImageTiling::eOptimal;
-    param.usage = vk::ImageUsageFlagBits::eTransientAttachment | vk::ImageUsageFlagBits::eColorAttachment;
-    param.properties = vk::MemoryPropertyFlagBits::eDeviceLocal;
-    param.mipLevel = 1;
-    param.msaaSamples = _msaaSamples;
-    
-    auto context = CommandContext{_cmdPool,
-        *_logicDevice,
-        _graphicsQueue,
-        _phyDevice};
-    std::tie(_colorImage, _colorImageMemory) = CreateImage(param, context);
-    _colorImageView = CreateImageView(*_logicDevice, _colorImage, {param.format, vk::ImageAspectFlagBits::eColor,1});
+
+void VulkanInstance::benchmarkDescriptors(){
+    BenchmarkDescriptorAllocator(*_logicDevice, _descSetLayout, kDescriptorRatios, kDescriptorBenchSets, kDescriptorBenchSetsPerFrame);
+
+    const auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0;i < kDescriptorBenchSets;i ++){
+        _layoutCache.get({
+            {0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex},
+            {1, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment}
+        });
+    }
+    const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOGI("Descriptor layout cache: {} lookups in {:.3f} ms, {} unique layouts", kDescriptorBenchSets, ms, _layoutCache.size());
 }
+void VulkanInstance::buildRenderGraph(){
+    _renderGraph.reset();
+    _renderExtent = _dynamicResolution ? _resolution.scaledExtent(_swapExtent) : _swapExtent;
+
+    RGImageDesc colorDesc{};
+    colorDesc.format = _swapForamt;
+    colorDesc.extent = _swapExtent;
+    colorDesc.samples = _msaaSamples;
+    colorDesc.usage = vk::ImageUsageFlagBits::eTransientAttachment;
+    colorDesc.aspect = vk::ImageAspectFlagBits::eColor;
+
+    RGImageDesc depthDesc{};
+    depthDesc.format = FindDepthFormat(_phyDevice);
+    depthDesc.extent = _swapExtent;
+    depthDesc.samples = _msaaSamples;
+    depthDesc.aspect = vk::ImageAspectFlagBits::eDepth;
+
+    RGImageDesc backbufferDesc{};
+    backbufferDesc.format = _swapForamt;
+    backbufferDesc.extent = _swapExtent;
+
+    auto color = _renderGraph.createImage("msaa_color", colorDesc);
+    auto depth = _renderGraph.createImage("msaa_depth", depthDesc);
+    _graphBackbuffer = _renderGraph.importImage("backbuffer", backbufferDesc);
+
+    RGResource sceneDepth{kInvalidRGResource};
+    if(_options.depthPrepass){
+        _renderGraph.addPass("depth_prepass", [&](RGPassBuilder &builder){
+            sceneDepth = builder.write(depth, ResourceUse::DepthAttachment);
+        }, [this](const vk::CommandBuffer &cmd){
+            if(_culler.occlusion()){
+                _culler.recordEarly(cmd, _currentFrame);
+            }
+            beginDepthRenderPass(cmd);
+            recordSceneDraws(cmd, _currentFrame, true);
+            cmd.endRenderPass();
+        });
+    }
+    if(_culler.enabled() && !_culler.occlusion()){
+        // only writes buffers the graph does not know about, so it has to be kept explicitly
+        _renderGraph.addPass("frustum_cull", [&](RGPassBuilder &builder){
+            builder.sideEffect();
+        }, [this](const vk::CommandBuffer &cmd){
+            _culler.recordEarly(cmd, _currentFrame);
+        });
+    }
+    if(_culler.occlusion()){
+        // only writes buffers the graph does not know about, so it has to be kept explicitly
+        _renderGraph.addPass("occlusion_cull", [&](RGPassBuilder &builder){
+            builder.read(sceneDepth, ResourceUse::ComputeShaderRead);
+            builder.sideEffect();
+        }, [this](const vk::CommandBuffer &cmd){
+            _culler.recordPyramid(cmd);
+            _culler.recordLate(cmd, _currentFrame);
+        });
+    }
 
-void VulkanInstance::createDepthResources(){
-    const auto depthFormat = FindDepthFormat(_phyDevice);
-    ImageParam param;
-    param.format = depthFormat;
-    param.size = Size{(uint32_t)_swapExtent.width, (uint32_t)_swapExtent.height};
-    param.tiling = vk::ImageTiling::eOptimal;
-    param.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
-    param.properties = vk::MemoryPropertyFlagBits::eDeviceLocal;
-    param.mipLevel = 1;
-    param.msaaSamples = _msaaSamples;
+    // with dynamic resolution the MSAA color resolves into a full size target that is upscaled afterwards
+    _graphSceneColor = kInvalidRGResource;
+    RGResource resolveTarget = _graphBackbuffer;
+    if(_dynamicResolution){
+        RGImageDesc sceneDesc{};
+        sceneDesc.format = _swapForamt;
+        sceneDesc.extent = _swapExtent;
+        resolveTarget = _renderGraph.createImage("scene_color", sceneDesc);
+    }
 
-    auto context = CommandContext{_cmdPool,
-        *_logicDevice,
-        _graphicsQueue,
-        _phyDevice};
-    std::tie(_depthImage, _depthImageMemory) = CreateImage(param, context);
-    _depthImageView = CreateImageView(*_logicDevice, _depthImage, {depthFormat, vk::ImageAspectFlagBits::eDepth,1});
+    RGResource presented{};
+    _renderGraph.addPass("forward_msaa", [&](RGPassBuilder &builder){
+        _graphColor = builder.write(color, ResourceUse::ColorAttachment);
+        _graphDepth = sceneDepth == kInvalidRGResource ? builder.write(depth, ResourceUse::DepthAttachment) : builder.modify(sceneDepth, ResourceUse::DepthAttachment);
+        presented = builder.write(resolveTarget, ResourceUse::ColorAttachment);
+    }, [this](const vk::CommandBuffer &cmd){
+        if(_graphSecondaries){
+            beginMainRenderPass(cmd, _graphImageIndex, vk::SubpassContents::eSecondaryCommandBuffers);
+            cmd.executeCommands(*_graphSecondaries);
+        }else{
+            // secondaries would have to inherit the query, only inline draws are counted
+            _profiler.beginFragmentCount(cmd);
+            beginMainRenderPass(cmd, _graphImageIndex, vk::SubpassContents::eInline);
+            recordSceneDraws(cmd, _currentFrame);
+        }
+        cmd.endRenderPass();
+        if(!_graphSecondaries){
+            _profiler.endFragmentCount(cmd);
+        }
+    });
+    if(_dynamicResolution){
+        _graphSceneColor = presented;
+        _renderGraph.addPass("upscale", [&](RGPassBuilder &builder){
+            builder.read(_graphSceneColor, ResourceUse::TransferSrc);
+            presented = builder.write(_graphBackbuffer, ResourceUse::TransferDst);
+        }, [this](const vk::CommandBuffer &cmd){
+            vk::ImageBlit blit{};
+            blit.srcSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+            blit.srcOffsets[1] = vk::Offset3D{static_cast<int32_t>(_renderExtent.width), static_cast<int32_t>(_renderExtent.height), 1};
+            blit.dstSubresource = blit.srcSubresource;
+            blit.dstOffsets[1] = vk::Offset3D{static_cast<int32_t>(_swapExtent.width), static_cast<int32_t>(_swapExtent.height), 1};
+            cmd.blitImage(_renderGraph.image(_graphSceneColor), vk::ImageLayout::eTransferSrcOptimal, _swapImages[_graphImageIndex], vk::ImageLayout::eTransferDstOptimal,
+                blit, vk::Filter::eLinear);
+        });
+    }
+    // the ring follows the target size, buffers of frames in flight retire with them
+    if(_capture.resize(_swapExtent, _swapForamt, _deletionQueue, _scheduler.submittedFrame() + _options.framesInFlight)){
+        _renderGraph.addPass("readback", [&](RGPassBuilder &builder){
+            builder.read(presented, ResourceUse::TransferSrc);
+            builder.sideEffect();
+        }, [this](const vk::CommandBuffer &cmd){
+            _capture.recordCopy(cmd, _currentFrame, _swapImages[_graphImageIndex]);
+        });
+    }
+    // headless targets end ready to be copied out instead of presented
+    _renderGraph.markOutput(presented, _options.headless ? ResourceUse::TransferSrc : ResourceUse::Present);
+
+    _renderGraph.compile();
+    _renderGraph.dump();
+    // the pyramid follows the depth buffer, the old one may still be read by frames in flight
+    _culler.resize(_swapExtent, _renderGraph.view(_graphDepth), _deletionQueue, _scheduler.submittedFrame() + _options.framesInFlight);
+    _culler.setViewport(_renderExtent);
 }
 
-void VulkanInstance::updateUniformBuffer(const uint32_t currentImage) {
-    static auto startTime = std::chrono::high_resolution_clock::now();
+void VulkanInstance::executeRenderGraph(const vk::CommandBuffer &cmdBuffer, const uint32_t imageIndex, const std::vector<vk::CommandBuffer> *secondaries){
+    _graphImageIndex = imageIndex;
+    _graphSecondaries = secondaries;
+    // a freshly acquired image is only ordered against the acquire semaphore wait
+    _renderGraph.bindImported(_graphBackbuffer, _swapImages[imageIndex], _swapChainImageViews[imageIndex], ResourceUse::ColorAttachment);
+    _profiler.beginCommandBuffer(cmdBuffer, _currentFrame);
+    _pacer.writeBegin(cmdBuffer, _currentFrame);
+    const auto frameScope = _profiler.beginScope(cmdBuffer, "frame");
+    _renderGraph.execute(cmdBuffer, frameScratch());
+    _profiler.endScope(cmdBuffer, frameScope);
+    _pacer.writeEnd(cmdBuffer, _currentFrame);
+    _graphSecondaries = nullptr;
+}
+
+// camera keyframes of the benchmark script, one second apart and looped
+static const std::array<glm::vec3, 4> kBenchmarkCameraPath = {
+    glm::vec3(2.0f, 2.0f, 2.0f),
+    glm::vec3(-2.0f, 2.0f, 1.0f),
+    glm::vec3(-1.5f, -2.0f, 2.5f),
+    glm::vec3(2.0f, -1.5f, 1.0f)
+};
 
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count() * 0.1;
+void VulkanInstance::updateUniformBuffer(const uint32_t currentImage) {
+    TRACE_ZONE("updateUniformBuffer");
+    // the clock stands still while the animation is paused, paused frames repeat the same matrices
+    const auto currentTime = std::chrono::steady_clock::now();
+    if(_animating && _animationLast != std::chrono::steady_clock::time_point{}){
+        _animationSeconds += std::chrono::duration<double>(currentTime - _animationLast).count();
+    }
+    _animationLast = currentTime;
+    float time = static_cast<float>(_animationSeconds * 0.1);
+    glm::vec3 eye(2.0f, 2.0f, 2.0f);
+    if(!_options.benchmarkPath.empty() || _options.benchLights){
+        // benchmarks advance a fixed step per frame so every run renders the same images
+        const float seconds = _scheduler.frameValue() * kBenchmarkTimeStep;
+        time = seconds * 0.1f;
+        const auto key = static_cast<size_t>(seconds) % kBenchmarkCameraPath.size();
+        const auto next = (key + 1) % kBenchmarkCameraPath.size();
+        eye = glm::mix(kBenchmarkCameraPath[key], kBenchmarkCameraPath[next], seconds - std::floor(seconds));
+    }
 
     MVPUniformMatrix ubo = {};
     ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    ubo.proj = glm::perspective(glm::radians(45.0f), _swapExtent.width / (float) _swapExtent.height, 0.1f, 10.0f);
+    ubo.view = glm::lookAt(eye, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.proj = glm::perspective(glm::radians(45.0f), _swapExtent.width / (float) _swapExtent.height, kNearPlane, kFarPlane);
     ubo.proj[1][1] *= -1;  // Vulkan Y coordinate correction
 
+    // lights and objects only depend on the time, the matrices and the light setup, the slot may already hold all of it
+    auto &written = _writtenUniforms[currentImage];
+    const auto lightCount = _lighting.lightCount();
+    if(written.valid && written.time == time && written.extent == _renderExtent && written.model == ubo.model && written.view == ubo.view && written.proj == ubo.proj
+        && written.lightingMode == _lightingMode && written.lightCount == lightCount){
+        _skippedUniformWrites++;
+        return;
+    }
+    written = {ubo.model, ubo.view, ubo.proj, time, _renderExtent, _lightingMode, lightCount, true};
+
     // Copy data to the mapped memory
     memcpy(_mvpData[currentImage], &ubo, sizeof(ubo));
+    if(_options.animateObjects){
+        updateObjectTransforms(currentImage, time);
+    }
+    if(_lightingMode != LightingMode::Unlit){
+        // time runs at a tenth of the clock, the lights orbit on seconds
+        _lighting.update(currentImage, time * 10.0f, ubo.view, ubo.proj, kNearPlane, kFarPlane, _renderExtent);
+    }
+}
+
+bool VulkanInstance::needsRedraw() const {
+    // a pipeline that finished compiling may fill in draws the last frame skipped
+    return _redraw || _animating || _frameBufferResized || _pipelines.generation() != _pipelineGeneration;
+}
+
+void VulkanInstance::setAnimating(const bool animating){
+    _animating = animating;
+    _redraw = true;
+}
+
+void VulkanInstance::updateObjectTransforms(const uint32_t slot, const float time){
+    // every other layer turns, alternating directions, the rest of the hierarchy stays clean
+    for(size_t i = 0;i < _sceneLayers.size();i += 2){
+        const auto direction = i % 4 == 0 ? 1.0f : -1.0f;
+        _transforms.setRotation(_sceneLayers[i], glm::angleAxis(direction * time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+    }
+    _transforms.update();
+    // the slot's previous frame retired, its copy only misses what changed since it was written
+    _transforms.writeWorld(static_cast<std::byte*>(_objectData) + slot * _objectSlotSize, sizeof(SceneObject), _objectVersions[slot]);
+    _objectVersions[slot] = _transforms.version();
+}
+
+JobHandle VulkanInstance::loadAsset(std::function<void()> &&load){
+    if(!_jobs){
+        load();
+        return {};
+    }
+    return _jobs->schedule(std::move(load));
 }
 
-std::error_code VulkanInstance::initialize(GLFWwindow *window, const uint32_t width, const uint32_t height) {
-    glfwSetWindowUserPointer(window, this);
-    glfwSetFramebufferSizeCallback(window, FrameBufferResizedCallback);
+void VulkanInstance::waitForAssets(){
+    // a failed initialization must not free what the loaders still write into
+    for(auto &job : {_modelJob, _textureJob}){
+        if(_jobs && job){
+            try{
+                _jobs->wait(job);
+            }catch(const std::exception &err){
+                LOGE("Asset loading failed: {}", err.what());
+            }
+        }
+    }
+    _modelJob = nullptr;
+    _textureJob = nullptr;
+}
+
+std::error_code VulkanInstance::initialize(GLFWwindow *window, const uint32_t width, const uint32_t height, const RenderOptions &options, JobSystem *jobs) {
+    _options = options;
+    _jobs = jobs;
+    if(_options.resourcesPath.empty()){
+        _options.resourcesPath = kResourcesPath;
+    }
+    if(_options.benchLights){
+        // the sweep starts with the clustered step of the smallest light count
+        _lightingMode = LightingMode::Clustered;
+    }else{
+        _lightingMode = _options.lights == 0 ? LightingMode::Unlit : _options.lightingMode;
+    }
+    _width = width;
+    _height = height;
+    _pwindows = window;
+    if(window){
+        glfwSetWindowUserPointer(window, this);
+        glfwSetFramebufferSizeCallback(window, FrameBufferResizedCallback);
+        if(_options.onDemand){
+            glfwSetWindowRefreshCallback(window, RedrawCallback);
+            glfwSetKeyCallback(window, KeyCallback);
+            glfwSetMouseButtonCallback(window, MouseButtonCallback);
+            glfwSetScrollCallback(window, ScrollCallback);
+            // paused until space is pressed, otherwise every frame would change
+            _animating = false;
+            LOGI("Rendering on demand, space toggles the animation");
+        }
+    }
     try{
-        loadModel();
+        // the model and the texture are decoded on the workers while the device is set up
+        _modelJob = loadAsset([this](){ loadModel(); });
+        _textureJob = loadAsset([this](){ decodeTexture(); });
         createInstance();
         setupDebugCallback();
-        createSurface(window);
+        if(!_options.headless){
+            createSurface(window);
+        }
         SelectRunningDevice();
         createLogicDevice();
-        createSwapChain();
+        createPipelineCache();
+        _shaders.initialize(kShaderPath, kShaderBinaryPath, _options.shaderCachePath);
+        if(_options.headless){
+            createOffscreenTargets();
+        }else{
+            createSwapChain();
+        }
         createImageViews();
+        createResolutionController();
+        createCapture();
         createRenderPass();
+        if(_options.depthPrepass){
+            createDepthRenderPass();
+        }
         createDescriptorSetLayout();
         createGraphicsPipeline();
         createCommandPool();
-        createColorResources();
-        createDepthResources();
+        createMipGenerator();
+        if(_jobs){
+            _jobs->wait(_modelJob);
+        }
+        // the culler needs the scene buffers and decides which passes the graph has
+        createVertexBuffer();
+        createIndexBuffer();
+        createObjectBuffer();
+        createUniformBuffer();
+        createCuller();
+        createLighting();
+        buildRenderGraph();
         createFrameBuffers();
         createTextureImage();
         createTextureImageView();
         createTextureSampler();
-        createVertexBuffer();
-        createIndexBuffer();
-        createUniformBuffer();
         createDescriptorPool();
         createDescriptorSets();
+        if(_options.benchDescriptors){
+            benchmarkDescriptors();
+        }
         createCommandBuffer();
         createSyncObject();
     }catch(const std::runtime_error &err){
+        LOGE("Failed to initialize Vulkan: {}", err.what());
+        waitForAssets();
+        stbi_image_free(std::exchange(_decodedTexture.pixels, nullptr));
         destroy();
         return std::make_error_code(std::errc::operation_canceled);
     }
@@ -1312,29 +1979,62 @@ std::error_code VulkanInstance::initialize(GLFWwindow *window, const uint32_t wi
 
 void VulkanInstance::destroy(){
     if(!_instance) return;
-    cleanSwapChain();
-    _logicDevice->destroyImageView(_colorImageView);
-    _logicDevice->destroyImage(_colorImage);
-    _logicDevice->freeMemory(_colorImageMemory);
+    if(_logicDevice){
+        _logicDevice->waitIdle();
+    }
+    cleanSwapChain(0);
+    _deletionQueue.flushAll();
+    if(_swapChain){
+        _logicDevice->destroySwapchainKHR(_swapChain);
+    }
+    for(size_t i = 0;i < _offscreenMemory.size();i ++){
+        _logicDevice->destroyImage(_swapImages[i]);
+        _logicDevice->freeMemory(_offscreenMemory[i]);
+    }
+    _offscreenMemory.clear();
+    _logicDevice->freeCommandBuffers(_cmdPool, _cmdBuffers);
+    _cmdCache.destroy();
+    _pipelines.clear();
+    _logicDevice->destroyPipelineLayout(_renderLayout);
+    _logicDevice->destroyRenderPass(_renderPass);
+    _logicDevice->destroyRenderPass(_depthRenderPass);
+    _culler.destroy();
+    _lighting.destroy();
+    _frameArena.destroy();
+    _capture.destroy();
+    _logicDevice->destroyBuffer(_objectBuffer);
+    _logicDevice->freeMemory(_objectMemory);
     _logicDevice->destroyBuffer(_indexBuffer);
     _logicDevice->freeMemory(_indexMemory);
     _logicDevice->destroyBuffer(_vertexBuffer);
     _logicDevice->freeMemory(_vertexBufferMemory);
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        _logicDevice->destroySemaphore(_renderFinishedSemaphores[i]);
-        _logicDevice->destroySemaphore(_imageAvailableSemaphores[i]);
-        _logicDevice->destroyFence(_inFlightFences[i]);
+    for (auto semaphore : _imageAvailableSemaphores) {
+        _logicDevice->destroySemaphore(semaphore);
+    }
+    _scheduler.destroy();
+    _pacer.destroy();
+    _profiler.destroy();
+    for (size_t i = 0; i < _mvpBuffer.size(); i++) {
         _logicDevice->destroyBuffer(_mvpBuffer[i]);
         _logicDevice->freeMemory(_mvpMemory[i]);
     }
 
     _logicDevice->destroySampler(_textureSampler);
     _logicDevice->destroyImageView(_textureView);
-    _logicDevice->destroyDescriptorPool(_descriptorPool);
+    for(auto &allocator : _frameDescriptors){
+        allocator.destroy();
+    }
+    _descriptors.destroy();
+    _stateTracker.forget(_imageTexture);
     _logicDevice->destroyImage(_imageTexture);
     _logicDevice->freeMemory(_imageMemory);
-    _logicDevice->destroyDescriptorSetLayout(_descSetLayout);
+    _mipGenerator.destroy();
+    _layoutCache.destroy();
     _logicDevice->destroyCommandPool(_cmdPool);    
+    _pipelines.destroy();
+    _vertModule.reset();
+    _fragModule.reset();
+    _pipelineCache.destroy();
     if(_logicDevice){
         _logicDevice->waitIdle();
         _logicDevice.reset();
@@ -1354,95 +2054,336 @@ void VulkanInstance::destroy(){
     _instance.reset();
 }
 
+void VulkanInstance::beginMainRenderPass(const vk::CommandBuffer &cmdBuffer, const uint32_t imageIndex, const vk::SubpassContents contents){
+    vk::RenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.renderPass = _renderPass;
+    renderPassInfo.framebuffer = _framebuffers[imageIndex];
+    renderPassInfo.renderArea.offset = vk::Offset2D{ 0, 0 };
+    renderPassInfo.renderArea.extent = _swapExtent;
+
+    std::array<vk::ClearValue, 2> clearColor{};
+    clearColor[0].color = vk::ClearColorValue{std::array<float, 4>{1.0f, 1.0f, 1.0f, 1.0f}};
+    clearColor[1].depthStencil = vk::ClearDepthStencilValue{1.0f, 0};
+
+    renderPassInfo.clearValueCount = clearColor.size();
+    renderPassInfo.pClearValues = clearColor.data();
+
+    cmdBuffer.beginRenderPass(renderPassInfo, contents);
+}
+
+void VulkanInstance::beginDepthRenderPass(const vk::CommandBuffer &cmdBuffer){
+    vk::RenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.renderPass = _depthRenderPass;
+    renderPassInfo.framebuffer = _depthFramebuffer;
+    renderPassInfo.renderArea.offset = vk::Offset2D{ 0, 0 };
+    // cleared in full even when the render scale is below 1, the occlusion pyramid reads the far depth outside the viewport
+    renderPassInfo.renderArea.extent = _swapExtent;
+
+    vk::ClearValue clearDepth{};
+    clearDepth.depthStencil = vk::ClearDepthStencilValue{1.0f, 0};
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearDepth;
+
+    cmdBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+}
+
+void VulkanInstance::updateDrawGroups(const uint32_t slot){
+    // the GPU culler tests every object itself, animated objects move out of the group bounds
+    if(_culler.enabled() || _options.animateObjects){
+        return;
+    }
+
+    const auto &ubo = *static_cast<const MVPUniformMatrix*>(_mvpData[slot]);
+    const auto viewProjModel = ubo.proj * ubo.view * ubo.model;
+    for(uint32_t group = 0;group < _drawGroups.size();group ++){
+        auto &drawGroup = _drawGroups[group];
+        const auto visible = drawGroup.instanceCount > 0 && !OutsideFrustum(viewProjModel, drawGroup.boundsMin, drawGroup.boundsMax);
+        if(visible != drawGroup.visible){
+            drawGroup.visible = visible;
+            // the other groups and the primaries that execute them stay as they are
+            _cmdCache.invalidateGroup(group);
+        }
+    }
+}
+
+void VulkanInstance::recordSceneDraws(const vk::CommandBuffer &cmdBuffer, const uint32_t slot, const bool depthOnly){
+    for(uint32_t group = 0;group < _drawGroups.size();group ++){
+        recordDrawGroup(cmdBuffer, slot, group, depthOnly);
+    }
+}
+
+void VulkanInstance::recordDrawGroup(const vk::CommandBuffer &cmdBuffer, const uint32_t slot, const uint32_t group, const bool depthOnly){
+    const auto &drawGroup = _drawGroups[group];
+    // the culler draws its compacted lists for the whole scene, they go into the first group
+    if(_culler.enabled() ? group != 0 : !drawGroup.visible || drawGroup.instanceCount == 0){
+        return;
+    }
+
+    auto pipeline = _pipelines.request(depthOnly ? _depthPipeline : _scenePipeline);
+    if(!pipeline){
+        // still compiling in the background, render only the clear instead of stalling
+        return;
+    }
+
+    cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    {
+        vk::Viewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        // dynamic resolution only renders into the top left part of the full size targets
+        viewport.width = (float) _renderExtent.width;
+        viewport.height = (float) _renderExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+
+        vk::Rect2D scissor{};
+        scissor.offset = vk::Offset2D{0, 0};
+        scissor.extent = _renderExtent;
+
+        cmdBuffer.setViewport(0, 1, &viewport);
+        cmdBuffer.setScissor(0, 1, &scissor);
+    }
+
+    {
+        vk::Buffer vertexBuffers[] = { _vertexBuffer };
+        vk::DeviceSize offsets[] = { 0 };
+        cmdBuffer.bindVertexBuffers(0, 1, vertexBuffers, offsets);
+        cmdBuffer.bindIndexBuffer(_indexBuffer, 0, vk::IndexType::eUint32);
+        cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, _renderLayout, 0, _descriptorSets[slot], {});
+        //_cmdBuffers[i].draw(3, 1, 0, 0);
+        if(!_culler.enabled()){
+            cmdBuffer.drawIndexed(_indices.size(), drawGroup.instanceCount, 0, 0, drawGroup.firstInstance);
+        }else if(depthOnly || !_culler.occlusion()){
+            _culler.drawEarly(cmdBuffer, slot);
+        }else{
+            // early objects only have their depth so far, the late ones are drawn for the first time
+            _culler.drawEarly(cmdBuffer, slot);
+            _culler.drawLate(cmdBuffer, slot);
+        }
+    }
+}
+
 void VulkanInstance::recordCommandBuffer(const uint32_t imageIndex){
+    TRACE_ZONE("recordCommandBuffer");
     vk::CommandBufferBeginInfo beginInfo = {};
     const auto cmdBuffer = _cmdBuffers[_currentFrame];
     cmdBuffer.begin(beginInfo);
+    executeRenderGraph(cmdBuffer, imageIndex, nullptr);
+    cmdBuffer.end();
+}
+
+vk::CommandBuffer VulkanInstance::acquireCachedCommandBuffer(const uint32_t imageIndex){
+    return _cmdCache.acquire(imageIndex, _currentFrame, _renderPass,
+        [this](const vk::CommandBuffer &cmd, const uint32_t image, const std::vector<vk::CommandBuffer> &secondaries){
+            executeRenderGraph(cmd, image, &secondaries);
+        },
+        [this](const vk::CommandBuffer &cmd, const uint32_t slot, const uint32_t group){
+            recordDrawGroup(cmd, slot, group);
+        });
+}
 
+void VulkanInstance::beginFrame(){
+    _frameHeapStart = heap::ThreadAllocations();
     {
-        vk::RenderPassBeginInfo renderPassInfo = {};
-        renderPassInfo.renderPass = _renderPass;
-        renderPassInfo.framebuffer = _framebuffers[imageIndex];
-        renderPassInfo.renderArea.offset = vk::Offset2D{ 0, 0 };
-        renderPassInfo.renderArea.extent = _swapExtent;
-
-        std::array<vk::ClearValue, 2> clearColor{};
-        clearColor[0].color = vk::ClearColorValue{std::array<float, 4>{1.0f, 1.0f, 1.0f, 1.0f}};
-        clearColor[1].depthStencil = vk::ClearDepthStencilValue{1.0f, 0};
-
-        renderPassInfo.clearValueCount = clearColor.size();
-        renderPassInfo.pClearValues = clearColor.data();
-
-        cmdBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
-        cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, _renderPipeline);
-        {
-            vk::Viewport viewport{};
-            viewport.x = 0.0f;
-            viewport.y = 0.0f;
-            viewport.width = (float) _swapExtent.width;
-            viewport.height = (float) _swapExtent.height;
-            viewport.minDepth = 0.0f;
-            viewport.maxDepth = 1.0f;
-
-            vk::Rect2D scissor{};
-            scissor.offset = vk::Offset2D{0, 0};
-            scissor.extent = _swapExtent;
-
-            cmdBuffer.setViewport(0, 1, &viewport);
-            cmdBuffer.setScissor(0, 1, &scissor);
+        TRACE_ZONE("wait for frame slot");
+        _currentFrame = _scheduler.beginFrame();
+    }
+    // the slot's previous frame retired, so did everything it allocated from the arena
+    _frameArena.beginFrame(_currentFrame);
+    const auto completed = _scheduler.completedFrame();
+    _deletionQueue.flush(completed);
+    // the slot's previous frame has retired, its transient sets can be recycled in bulk
+    _frameDescriptors[_currentFrame].reset();
+    _profiler.beginFrame(_currentFrame);
+    _culler.beginFrame(_currentFrame);
+    _capture.collect(_currentFrame);
+    if(_options.validateCulling && _culler.stats().valid){
+        // the slot's uniforms still hold the matrices its previous frame was culled with
+        const auto &ubo = *static_cast<const MVPUniformMatrix*>(_mvpData[_currentFrame]);
+        const auto expected = FrustumCullReference(_objects, ubo.proj * ubo.view * ubo.model, _jobs, frameScratch());
+        const auto survivors = _culler.frustumSurvivors(_currentFrame, frameScratch());
+        if(survivors != expected){
+            // both lists are in index order, the first difference names an object only one of them kept
+            const auto [gpu, cpu] = std::mismatch(survivors.begin(), survivors.end(), expected.begin(), expected.end());
+            const auto object = gpu == survivors.end() ? *cpu : cpu == expected.end() ? *gpu : std::min(*gpu, *cpu);
+            LOGW("GPU frustum culling kept {} objects, the CPU reference {}, they first differ at object {}", survivors.size(), expected.size(), object);
         }
+    }
+    _pacer.beginFrame(_currentFrame, _scheduler.frameValue(), completed);
+    if(_options.benchLights){
+        advanceLightBenchmark();
+    }
 
-        {
-            vk::Buffer vertexBuffers[] = { _vertexBuffer };
-            vk::DeviceSize offsets[] = { 0 };
-            cmdBuffer.bindVertexBuffers(0, 1, vertexBuffers, offsets);
-            cmdBuffer.bindIndexBuffer(_indexBuffer, 0, vk::IndexType::eUint32);
-            cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, _renderLayout, 0, _descriptorSets[_currentFrame], {});
-            //_cmdBuffers[i].draw(3, 1, 0, 0);
-            cmdBuffer.drawIndexed(_indices.size(), 1, 0, 0, 0);
+    const auto &pacing = _pacer.stats();
+    if(_dynamicResolution && pacing.gpuSamples != _resolutionSamples){
+        _resolutionSamples = pacing.gpuSamples;
+        if(_resolution.update(pacing.lastGpuMs)){
+            _renderExtent = _resolution.scaledExtent(_swapExtent);
+            _culler.setViewport(_renderExtent);
+            // viewport and upscale region are baked into recorded command buffers
+            _cmdCache.invalidateAll();
+            LOGD("Render scale {:.2f}, {}x{}, GPU frame {:.3f} ms", _resolution.scale(), _renderExtent.width, _renderExtent.height, _resolution.stats().gpuMs);
         }
-        cmdBuffer.endRenderPass();
     }
-
-    cmdBuffer.end();
 }
 
 void VulkanInstance::draw(){
-    [[maybe_unused]]auto t = _logicDevice->waitForFences(1, &_inFlightFences[_currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-    uint32_t imageIndex{};
-    try{
-        imageIndex = _logicDevice->acquireNextImageKHR(_swapChain, std::numeric_limits<uint64_t>::max(), 
-        _imageAvailableSemaphores[_currentFrame], nullptr).value;
-    }catch(vk::OutOfDateKHRError &err){
-        recreateSwapChain();
-        return;
+    TRACE_ZONE("draw");
+    using Clock = std::chrono::steady_clock;
+    const auto elapsedMs = [](const Clock::time_point from, const Clock::time_point to){
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    };
+
+    _frameTimings = {};
+    const auto acquireStart = Clock::now();
+    _stateTracker.resetStats();
+    uint32_t imageIndex = _currentFrame;
+    if(!_options.headless){
+        TRACE_ZONE("acquire");
+        try{
+            imageIndex = _logicDevice->acquireNextImageKHR(_swapChain, std::numeric_limits<uint64_t>::max(),
+            _imageAvailableSemaphores[_currentFrame], nullptr).value;
+        }catch(vk::OutOfDateKHRError &err){
+            _droppedFrames++;
+            recreateSwapChain();
+            return;
+        }
     }
     
+    const auto uboStart = Clock::now();
     updateUniformBuffer(_currentFrame);
-    [[maybe_unused]]auto r = _logicDevice->resetFences(1, &_inFlightFences[_currentFrame]);
-    _cmdBuffers[_currentFrame].reset();
-    recordCommandBuffer(imageIndex);
+    updateDrawGroups(_currentFrame);
+    if(const auto generation = _pipelines.generation(); generation != _pipelineGeneration){
+        // a pipeline finished compiling, cached command buffers may have skipped its draws
+        _pipelineGeneration = generation;
+        _cmdCache.invalidateAll();
+    }
+
+    const auto recordStart = Clock::now();
+    vk::CommandBuffer cmdBuffer{};
+    if(_options.cacheCommandBuffers){
+        cmdBuffer = acquireCachedCommandBuffer(imageIndex);
+    }else{
+        _cmdBuffers[_currentFrame].reset();
+        recordCommandBuffer(imageIndex);
+        cmdBuffer = _cmdBuffers[_currentFrame];
+    }
 
+    const auto submitStart = Clock::now();
     vk::SubmitInfo submitInfo = {};
     vk::Semaphore waitSemaphores[] = { _imageAvailableSemaphores[_currentFrame] };
     vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
-    submitInfo.waitSemaphoreCount = 1;
+    // headless targets are not acquired, nothing to wait for
+    submitInfo.waitSemaphoreCount = _options.headless ? 0 : 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
 
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &_cmdBuffers[_currentFrame];
+    submitInfo.pCommandBuffers = &cmdBuffer;
+
+    // the timeline comes last so headless runs can drop the present semaphore in front of it
+    const uint32_t signalOffset = _options.headless ? 1 : 0;
+    vk::Semaphore signalSemaphores[] = { _options.headless ? vk::Semaphore{} : _renderFinishedSemaphores[imageIndex], _scheduler.timeline() };
+    submitInfo.signalSemaphoreCount = 2 - signalOffset;
+    submitInfo.pSignalSemaphores = signalSemaphores + signalOffset;
+
+    // binary semaphores ignore their entry in the value arrays
+    const uint64_t waitValues[] = { 0 };
+    const uint64_t signalValues[] = { 0, _scheduler.frameValue() };
+    vk::TimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.waitSemaphoreValueCount = submitInfo.waitSemaphoreCount;
+    timelineInfo.pWaitSemaphoreValues = waitValues;
+    timelineInfo.signalSemaphoreValueCount = submitInfo.signalSemaphoreCount;
+    timelineInfo.pSignalSemaphoreValues = signalValues + signalOffset;
+    submitInfo.pNext = &timelineInfo;
 
-    vk::Semaphore signalSemaphores[] = { _renderFinishedSemaphores[_currentFrame] };
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signalSemaphores;
+    {
+        TRACE_ZONE("submit");
+        _graphicsQueue.submit(submitInfo, nullptr);
+    }
+    _capture.submitted(_currentFrame, _scheduler.frameValue());
+    _scheduler.endFrame();
+    _pacer.endFrame();
+    _profiler.endFrame();
+    const auto presentStart = Clock::now();
+    _frameTimings.acquireMs = elapsedMs(acquireStart, uboStart);
+    _frameTimings.uboMs = elapsedMs(uboStart, recordStart);
+    _frameTimings.recordMs = elapsedMs(recordStart, submitStart);
+    _frameTimings.submitMs = elapsedMs(submitStart, presentStart);
+    _frameTimings.heapAllocations = heap::ThreadAllocations() - _frameHeapStart;
+    _frameTimings.complete = true;
+    _redraw = false;
+    if(_frameTimings.heapAllocations > 0){
+        _heapAllocatingFrames++;
+        _heapMaxAllocations = std::max(_heapMaxAllocations, _frameTimings.heapAllocations);
+    }
+    if(_options.debugBarriers){
+        const auto &barriers = _stateTracker.stats();
+        LOGD("Frame {} recorded {} image and {} buffer barriers in {} batches, {} redundant barriers skipped",
+            _scheduler.submittedFrame(), barriers.imageBarriers, barriers.bufferBarriers, barriers.batches, barriers.skipped);
+    }
 
-    
-    _graphicsQueue.submit(submitInfo, _inFlightFences[_currentFrame]);
+    const auto recordMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+    _recordCpuMs = _recordCpuMs == 0.0 ? recordMs : _recordCpuMs + (recordMs - _recordCpuMs) * 0.05;
+    if(_scheduler.submittedFrame() % kFrameReportInterval == 0){
+        const auto &cacheStats = _cmdCache.stats();
+        LOGD("Record and submit CPU time {:.4f} ms with command buffer caching {} (primary records {}, secondary records {}, reuses {})",
+            _recordCpuMs, _options.cacheCommandBuffers ? "on" : "off", cacheStats.primaryRecords, cacheStats.secondaryRecords, cacheStats.reuses);
+        const auto pipelineStats = _pipelines.stats();
+        LOGD("Pipelines: {} pending, {} compiled, {} failed, compile latency avg {:.3f} ms max {:.3f} ms, {} hitches",
+            pipelineStats.pending, pipelineStats.compiled, pipelineStats.failed, pipelineStats.avgCompileMs, pipelineStats.maxCompileMs, pipelineStats.hitches);
+        const auto &pacing = _pacer.stats();
+        LOGI("{}{}{}: frame {:.3f} ms, CPU {:.3f} ms, GPU {:.3f} ms, pacing delay {:.3f} ms, estimated input to present latency {:.3f} ms",
+            _options.headless ? "headless" : vk::to_string(_presentMode), _options.lowLatency ? " low-latency" : "", _options.fpsLimit ? std::format(" limited to {} fps", _options.fpsLimit) : "",
+            pacing.frameMs, pacing.cpuMs, pacing.gpuMs, pacing.delayMs, pacing.latencyMs);
+        for(auto &[name, scope] : _profiler.scopes()){
+            LOGD("GPU scope {:<24} avg {:.4f} ms, last {:.4f} ms", name, scope.avgMs, scope.lastMs);
+        }
+        if(_dynamicResolution){
+            const auto &resolution = _resolution.stats();
+            LOGI("Dynamic resolution: scale {:.2f} ({}x{} of {}x{}), GPU frame {:.3f} ms for a {:.3f} ms target, {} scale changes",
+                _resolution.scale(), _renderExtent.width, _renderExtent.height, _swapExtent.width, _swapExtent.height, resolution.gpuMs, _resolution.targetMs(), resolution.changes);
+        }
+        if(_capture.enabled()){
+            const auto capture = _capture.stats();
+            LOGI("Capture: {} frames read back, {} written ({:.1f} fps, {:.3f} ms each per writer), {} queued, {} dropped",
+                capture.readBack, capture.written, capture.writeFps, capture.encodeMs, capture.queued, capture.dropped);
+        }
+        if(_lightingMode != LightingMode::Unlit){
+            const auto &lighting = _lighting.stats();
+            LOGI("{} lighting: {} lights, {} in view, {} cluster indices ({} dropped), binning {:.3f} ms",
+                _lightingMode == LightingMode::Clustered ? "Clustered" : "Naive", lighting.lights, lighting.visibleLights, lighting.indices, lighting.dropped, lighting.binMs);
+        }
+        const auto &culling = _culler.stats();
+        if(culling.valid){
+            const auto drawn = culling.earlyDraws + culling.lateDraws;
+            LOGI("GPU culling: {} of {} objects drawn ({} early, {} late), {} outside the frustum, {} occluded ({:.1f}%), {} fragments shaded",
+                drawn, culling.objects, culling.earlyDraws, culling.lateDraws, culling.frustumCulled, culling.occluded, 100.0 * culling.occluded / culling.objects, _profiler.fragmentInvocations());
+        }else{
+            LOGI("{} objects drawn{}, {} fragments shaded", _objects.size(), _options.depthPrepass ? " after a depth pre-pass" : "", _profiler.fragmentInvocations());
+        }
+        LOGD("Uniform writes skipped for unchanged frames: {}", _skippedUniformWrites);
+        if(_options.animateObjects){
+            const auto &transforms = _transforms.stats();
+            LOGI("Transforms: {} of {} recomputed last frame, {} levels, {} kernels", transforms.updated, transforms.transforms, transforms.depth, _transforms.simd() ? "AVX2" : "scalar");
+        }
+        const auto &arena = _frameArena.stats();
+        if(heap::CountingEnabled()){
+            LOGI("Heap with {} scratch: {} of the last {} frames allocated, at most {} allocations in a frame, {} in the last one",
+                _options.heapScratch ? "heap" : "frame arena", _heapAllocatingFrames, kFrameReportInterval, _heapMaxAllocations, _frameTimings.heapAllocations);
+        }
+        LOGD("Frame arena: {} bytes used, {} bytes high water, {} blocks allocated, {} corruptions", arena.used, arena.highWater, arena.blockAllocations, arena.corruptions);
+        _heapAllocatingFrames = 0;
+        _heapMaxAllocations = 0;
+    }
+
+    if(_options.headless){
+        return;
+    }
 
     vk::PresentInfoKHR presentInfo = {};
     presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = signalSemaphores;
+    presentInfo.pWaitSemaphores = &_renderFinishedSemaphores[imageIndex];
 
     vk::SwapchainKHR swapChains[] = { _swapChain };
     presentInfo.swapchainCount = 1;
@@ -1450,14 +2391,22 @@ void VulkanInstance::draw(){
     presentInfo.pImageIndices = &imageIndex;
     presentInfo.pResults = nullptr; // Optional
 
-    r = _presentQueue.presentKHR(presentInfo);
-    if(r == vk::Result::eSuboptimalKHR || _frameBufferResized){
+    auto r = vk::Result::eSuccess;
+    try{
+        TRACE_ZONE("present");
+        r = _presentQueue.presentKHR(presentInfo);
+    }catch(vk::OutOfDateKHRError &err){
+        _droppedFrames++;
+        r = vk::Result::eErrorOutOfDateKHR;
+    }
+    _frameTimings.presentMs = elapsedMs(presentStart, Clock::now());
+
+    if(r != vk::Result::eSuccess || _frameBufferResized){
+        // the new swapchain starts without the frame
+        _redraw = true;
         recreateSwapChain();
         _frameBufferResized = false;
-        return;
     }
-    
-    _currentFrame = (_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
 void VulkanInstance::wait(){
@@ -1,11 +1,35 @@
 #pragma once
 #include "Application.hpp"
+#include <chrono>
+#include <map>
+#include <memory_resource>
 #include <string>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
 #include "Vertext.hpp"
+#include "FrameScheduler.hpp"
+#include "CommandBufferCache.hpp"
+#include "ResourceStateTracker.hpp"
+#include "RenderGraph.hpp"
+#include "PipelineCache.hpp"
+#include "PipelineManager.hpp"
+#include "ShaderLibrary.hpp"
+#include "DescriptorAllocator.hpp"
+#include "DeletionQueue.hpp"
+#include "FramePacer.hpp"
+#include "GpuProfiler.hpp"
+#include "GpuCulling.hpp"
+#include "DynamicResolution.hpp"
+#include "ClusteredLighting.hpp"
+#include "FrameCapture.hpp"
+#include "MipGenerator.hpp"
+#include "JobSystem.hpp"
+#include "FrameArena.hpp"
+#include "Scene.hpp"
+#include "Benchmark.hpp"
+#include "RenderOptions.hpp"
 
 class VulkanInstance {
 public:
@@ -15,9 +39,25 @@ public:
     
 public:
     void destroy();
-    std::error_code initialize(GLFWwindow *window, const uint32_t width = 0, const uint32_t height = 0);
+    // Assets load on the job system while the device is set up, without one they load inline.
+    std::error_code initialize(GLFWwindow *window, const uint32_t width = 0, const uint32_t height = 0, const RenderOptions &options = {},
+        JobSystem *jobs = nullptr);
+    // Waits for a free frame slot and paces the frame start, input should be polled right after it.
+    void beginFrame();
     void draw();
+    const FrameTimings& frameTimings() const { return _frameTimings; }
+    const FramePacingStats& pacingStats() const { return _pacer.stats(); }
+    const std::map<std::string, GpuScopeStats>& gpuScopes() const { return _profiler.scopes(); }
     void wait();
+    // true once a self-terminating run like the light benchmark has nothing left to render
+    bool finished() const { return _lightBenchDone; }
+    // On-demand rendering: true while the next frame would differ from the last one submitted.
+    bool needsRedraw() const;
+    // Pipelines still compile in the background, they do not wake an event wait.
+    bool streaming() const { return _pipelines.stats().pending > 0; }
+    void invalidate() { _redraw = true; }
+    bool animating() const { return _animating; }
+    void setAnimating(const bool animating);
     
 private:
     void createInstance();
@@ -25,37 +65,68 @@ private:
     void SelectRunningDevice();
     void createLogicDevice();
     void createSurface(GLFWwindow *window);
-    void createSwapChain();
+    void createSwapChain(const vk::SwapchainKHR &oldSwapChain = nullptr);
+    void createOffscreenTargets();
     void createImageViews();
+    void createResolutionController();
+    void createCapture();
+    void createPipelineCache();
     void createGraphicsPipeline();
     void createRenderPass();
+    void createDepthRenderPass();
     void createFrameBuffers();
     void createCommandBuffer();
     void createVertexBuffer();
     void createIndexBuffer();
+    void createObjectBuffer();
+    // animated scenes: turns the layers and writes the changed world matrices into the slot's objects
+    void updateObjectTransforms(const uint32_t slot, const float time);
+    void createCuller();
+    void createLighting();
+    // switches the fragment shader variant, pipelines of every mode the run uses are enqueued up front
+    void setLightingMode(const LightingMode mode);
+    void advanceLightBenchmark();
     void createCommandPool();
+    void createMipGenerator();
     void createSyncObject();
-    void cleanSwapChain();
+    void createPresentSemaphores();
+    void cleanSwapChain(const uint64_t retireValue);
     void recreateSwapChain();
     void createUniformBuffer();
     void createDescriptorSetLayout();
     void copyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size);
     void updateUniformBuffer(const uint32_t currentImage);
     void recordCommandBuffer(const uint32_t index);
+    void beginMainRenderPass(const vk::CommandBuffer &cmdBuffer, const uint32_t imageIndex, const vk::SubpassContents contents);
+    void beginDepthRenderPass(const vk::CommandBuffer &cmdBuffer);
+    // depthOnly draws the pre-pass, otherwise the shaded scene
+    void recordSceneDraws(const vk::CommandBuffer &cmdBuffer, const uint32_t slot, const bool depthOnly = false);
+    void recordDrawGroup(const vk::CommandBuffer &cmdBuffer, const uint32_t slot, const uint32_t group, const bool depthOnly = false);
+    // frustum tests the draw groups against the slot's matrices, groups that turned visible or invisible are re-recorded
+    void updateDrawGroups(const uint32_t slot);
+    vk::CommandBuffer acquireCachedCommandBuffer(const uint32_t imageIndex);
+    // temporaries that live until the end of the frame, the frame arena unless --heap-scratch
+    std::pmr::memory_resource* frameScratch() { return _options.heapScratch ? std::pmr::new_delete_resource() : _frameArena.resource(); }
     void createDescriptorPool();
     void createDescriptorSets();
+    void benchmarkDescriptors();
+    void decodeTexture();
     void createTextureImage();
     void createTextureImageView();
     void createTextureSampler();
-    void createDepthResources();
     void loadModel();
-    void createColorResources();
+    // runs the asset loader on the job system, or right away without one
+    JobHandle loadAsset(std::function<void()> &&load);
+    void waitForAssets();
+    void buildRenderGraph();
+    void executeRenderGraph(const vk::CommandBuffer &cmdBuffer, const uint32_t imageIndex, const std::vector<vk::CommandBuffer> *secondaries);
 
 public:
     bool _frameBufferResized{false};
     
 private:
     vk::UniqueInstance _instance{};
+    uint32_t _apiVersion{};
     vk::PhysicalDevice _phyDevice{};
     vk::UniqueDevice _logicDevice{};
     vk::Queue _graphicsQueue{};
@@ -68,46 +139,146 @@ private:
     std::vector<vk::ImageView> _swapChainImageViews;
     vk::Format _swapForamt{};
     vk::Extent2D _swapExtent{};
+    vk::ImageUsageFlags _swapUsage{};
+    // scene render size, the swapchain extent unless dynamic resolution scales it down
+    vk::Extent2D _renderExtent{};
+    bool _dynamicResolution{false};
+    ResolutionController _resolution{};
+    uint64_t _resolutionSamples{};
     vk::RenderPass _renderPass{};
     vk::PipelineLayout _renderLayout{};
-    vk::Pipeline _renderPipeline{};
+    PipelineCache _pipelineCache{};
+    PipelineManager _pipelines{};
+    ShaderLibrary _shaders{};
+    PipelineDesc _scenePipeline{};
+    PipelineDesc _depthPipeline{};
+    vk::RenderPass _depthRenderPass{};
+    vk::Framebuffer _depthFramebuffer{};
+    uint64_t _pipelineGeneration{};
+    vk::UniqueShaderModule _vertModule{};
+    vk::UniqueShaderModule _fragModule{};
     std::vector<vk::Framebuffer> _framebuffers;
     vk::CommandPool _cmdPool{};
     std::vector<vk::CommandBuffer, std::allocator<vk::CommandBuffer>> _cmdBuffers{};
+    CommandBufferCache _cmdCache{};
+    ResourceStateTracker _stateTracker{};
+    double _recordCpuMs{};
+    bool _redraw{true};
+    // the scene clock only runs while animating, on-demand runs start paused
+    bool _animating{true};
+    double _animationSeconds{};
+    std::chrono::steady_clock::time_point _animationLast{};
+    // what each slot's uniforms, lights and objects were last written with, repeated frames skip the writes
+    struct WrittenUniforms{
+        glm::mat4 model{};
+        glm::mat4 view{};
+        glm::mat4 proj{};
+        float time{};
+        vk::Extent2D extent{};
+        // the light benchmark and mode switches change the lights without touching the matrices
+        LightingMode lightingMode{};
+        uint32_t lightCount{};
+        bool valid{false};
+    };
+    std::vector<WrittenUniforms> _writtenUniforms{};
+    uint64_t _skippedUniformWrites{};
+    // scratch memory of the frame being recorded, reclaimed with the frame slot
+    FrameArena _frameArena{};
+    // heap allocations of the render thread from the frame slot wait to the submit
+    uint64_t _frameHeapStart{};
+    uint64_t _heapAllocatingFrames{};
+    uint64_t _heapMaxAllocations{};
     uint32_t _width{};
     uint32_t _height{};
     std::vector<vk::Semaphore> _imageAvailableSemaphores;
     std::vector<vk::Semaphore> _renderFinishedSemaphores;
-    std::vector<vk::Fence> _inFlightFences;
+    FrameScheduler _scheduler{};
+    DeletionQueue _deletionQueue{};
+    // backing memory of the headless targets that replace the swapchain images
+    std::vector<vk::DeviceMemory> _offscreenMemory{};
+    FramePacer _pacer{};
+    GpuProfiler _profiler{};
+    GpuCuller _culler{};
+    FrameCapture _capture{};
+    JobSystem *_jobs{};
+    JobHandle _modelJob{};
+    JobHandle _textureJob{};
+    MipGenerator _mipGenerator{};
+    bool _writeWithoutFormatSupported{false};
+    ClusteredLighting _lighting{};
+    LightingMode _lightingMode{LightingMode::Unlit};
+    struct LightBenchStep{
+        uint32_t lights{};
+        LightingMode mode{};
+        double gpuMs{};
+        double binMs{};
+    };
+    std::vector<LightBenchStep> _lightBench{};
+    size_t _lightBenchStep{};
+    uint32_t _lightBenchFrames{};
+    uint32_t _lightBenchSamples{};
+    uint64_t _lightBenchGpuSamples{};
+    bool _lightBenchDone{false};
+    // multiDrawIndirect, drawIndirectFirstInstance and drawIndirectCount, all needed by the culled draws
+    bool _indirectDrawSupported{false};
+    bool _pipelineStatisticsSupported{false};
+    FrameTimings _frameTimings{};
+    vk::PresentModeKHR _presentMode{vk::PresentModeKHR::eFifo};
+    uint64_t _droppedFrames{};
+    RenderOptions _options{};
     size_t _currentFrame = 0;
     vk::Buffer _vertexBuffer{};
     vk::DeviceMemory _vertexBufferMemory{};
     vk::Buffer _indexBuffer{};
     vk::DeviceMemory _indexMemory{};
+    std::vector<SceneObject> _objects{};
+    // one secondary command buffer per group when command buffers are cached
+    std::vector<SceneDrawGroup> _drawGroups{};
+    vk::Buffer _objectBuffer{};
+    vk::DeviceMemory _objectMemory{};
+    // animated scenes keep one mapped copy of the objects per frame slot, _objectSlotSize apart
+    TransformStore _transforms{};
+    std::vector<TransformId> _sceneLayers{};
+    void *_objectData{};
+    vk::DeviceSize _objectSlotSize{};
+    // transform version each slot's copy was last written at
+    std::vector<uint64_t> _objectVersions{};
     vk::DescriptorSetLayout _descSetLayout{};
     std::vector<vk::Buffer> _mvpBuffer{};
     std::vector<vk::DeviceMemory> _mvpMemory{};
     std::vector<void*> _mvpData{};
-    vk::DescriptorPool _descriptorPool{};
+    DescriptorLayoutCache _layoutCache{};
+    DescriptorAllocator _descriptors{};
+    // transient sets, recycled in bulk once the frame slot retires
+    std::vector<DescriptorAllocator> _frameDescriptors{};
     std::vector<vk::DescriptorSet> _descriptorSets{};
     vk::DeviceMemory _imageMemory{};
     vk::Image _imageTexture{};
     vk::ImageView _textureView{};
     vk::Sampler _textureSampler;
 
-    vk::Image _depthImage;
-    vk::DeviceMemory _depthImageMemory;
-    vk::ImageView _depthImageView;
-
     std::vector<Vertex> _vertices;
     std::vector<uint32_t> _indices;
+    glm::vec3 _meshMin{};
+    glm::vec3 _meshMax{};
+    // RGBA8 pixels from stb_image, uploaded and freed by createTextureImage
+    struct DecodedTexture{
+        unsigned char *pixels{};
+        uint32_t width{};
+        uint32_t height{};
+    } _decodedTexture{};
 
     uint32_t _mipLevels;
     vk::SampleCountFlagBits _msaaSamples = vk::SampleCountFlagBits::e1;
 
-    vk::Image _colorImage;
-    vk::DeviceMemory _colorImageMemory;
-    vk::ImageView _colorImageView;
+    RenderGraph _renderGraph{};
+    RGResource _graphColor{kInvalidRGResource};
+    RGResource _graphDepth{kInvalidRGResource};
+    RGResource _graphBackbuffer{kInvalidRGResource};
+    // resolve target of the scaled scene, only with dynamic resolution
+    RGResource _graphSceneColor{kInvalidRGResource};
+    uint32_t _graphImageIndex{};
+    const std::vector<vk::CommandBuffer> *_graphSecondaries{};
 
     vk::Image _resolveImage;
     vk::DeviceMemory _resolveImageMemory;
@@ -1,6 +1,8 @@
 
 #include <iostream>
 #include <format>
+#include <algorithm>
+#include <thread>
 
 
 #include <glm/vec4.hpp>
@@ -9,22 +11,56 @@
 #include <vulkan/vulkan.h>
 
 #include "Application.hpp"
+#include "JobSystem.hpp"
 #include "Log.hpp"
+#include "RenderOptions.hpp"
+#include "Trace.hpp"
+#include "TransformStore.hpp"
 
+static constexpr const uint32_t kLogBenchmarkThreads = 8;
+static constexpr const uint32_t kLogBenchmarkMessages = 200000;
+static constexpr const uint32_t kTraceBenchmarkZones = 1 << 20;
 
 int main(int argc, char **argv){
     LOGI("Hello Vulkan");
+    RenderOptions options{};
+    if (ParseRenderOptions(argc, argv, options)) {
+        LOGE("invalid command line");
+        exit(1);
+    }
+    if (!options.logPath.empty()) {
+        LOGSETFILE(options.logPath);
+    }
+    if (options.benchLog) {
+        sys::BenchmarkLogcat(kLogBenchmarkThreads, kLogBenchmarkMessages);
+        return 0;
+    }
+    if (options.benchJobs) {
+        BenchmarkJobs(std::max(std::thread::hardware_concurrency(), 1u));
+        return 0;
+    }
+    if (options.benchTrace) {
+        trace::BenchmarkZones(std::max(std::thread::hardware_concurrency(), 1u), kTraceBenchmarkZones);
+        return 0;
+    }
+    if (options.benchTransforms) {
+        BenchmarkTransforms();
+        return 0;
+    }
+
     Application app{};
-    if (app.init()) {
+    if (app.init(options)) {
         LOGE("initialize the application failed");
         exit(1);
     }
 
+    int status = 0;
     if (app.run()) {
         LOGE("can not run the application normally");
+        status = 1;
     }
 
     app.destroy();
     LOGI("Good Bye Vulkan");
-    return 0;
+    return status;
 }
\ No newline at end of file